@@ -0,0 +1,152 @@
+/*
+   Streaming applier for delta firmware patches
+   Purpose: Rebuild the new image from the running partition and a patch made by tools/fota_delta.py
+*/
+
+#include "DeltaPatcher.h"
+
+#include <string.h>
+
+#define DELTA_OP_END 0x00
+#define DELTA_OP_COPY 0x01
+#define DELTA_OP_ADD 0x02
+#define DELTA_OP_DATA 0x03
+
+static uint32_t read_le32(const uint8_t *p) { return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24); }
+
+bool DeltaPatcher::parseHeader(const uint8_t *header, uint32_t *baseSize, uint32_t *targetSize, uint8_t *baseDigest) {
+  if (memcmp(header, "FDP2", 4) != 0) return false;
+  *baseSize   = read_le32(header + 4);
+  *targetSize = read_le32(header + 8);
+  if (baseDigest) memcpy(baseDigest, header + 12, 32);
+  return *targetSize > 0;
+}
+
+void DeltaPatcher::begin(BaseReader base, BaseCheck check) {
+  _base       = base;
+  _check      = check;
+  _state      = HEADER;
+  _bufLen     = 0;
+  _bufNeed    = DELTA_HEADER_SIZE;
+  _baseSize   = 0;
+  _targetSize = 0;
+  _written    = 0;
+  _remaining  = 0;
+  _error      = NULL;
+}
+
+bool DeltaPatcher::fail(const char *error) {
+  _state = FAILED;
+  _error = error;
+  return false;
+}
+
+bool DeltaPatcher::emit(const uint8_t *data, size_t len) {
+  if (len > _targetSize - _written) return fail("Patch writes past the target size");
+  if (!_output(data, len)) return fail("Output failed");
+  _written += len;
+  return true;
+}
+
+// Header or the operands of an opcode are complete in _buf
+bool DeltaPatcher::operandsDone() {
+  if (_state == HEADER) {
+    uint8_t digest[32];
+    if (!parseHeader(_buf, &_baseSize, &_targetSize, digest)) return fail("Invalid patch header");
+    if (_check && !_check(_baseSize, digest)) return fail("Patch is for a different base image");
+    _state = OPCODE;
+    return true;
+  }
+
+  if (_op == DELTA_OP_DATA) {
+    _remaining = read_le32(_buf);
+    _state     = _remaining > 0 ? LITERAL_DATA : OPCODE;
+    return true;
+  }
+
+  _src       = read_le32(_buf);
+  _remaining = read_le32(_buf + 4);
+  if (_src > _baseSize || _remaining > _baseSize - _src) return fail("Patch reads past the base image");
+
+  if (_op == DELTA_OP_ADD) {
+    _state = _remaining > 0 ? ADD_DATA : OPCODE;
+    return true;
+  }
+
+  // COPY needs no further patch bytes
+  while (_remaining > 0) {
+    size_t n = _remaining < sizeof(_buf) ? _remaining : sizeof(_buf);
+    if (!_base(_src, _buf, n)) return fail("Base read failed");
+    if (!emit(_buf, n)) return false;
+    _src += n;
+    _remaining -= n;
+  }
+  _state = OPCODE;
+  return true;
+}
+
+bool DeltaPatcher::write(const uint8_t *data, size_t len) {
+  size_t i = 0;
+  while (i < len) {
+    switch (_state) {
+      case HEADER:
+      case OPERANDS: {
+        size_t n = _bufNeed - _bufLen;
+        if (n > len - i) n = len - i;
+        memcpy(_buf + _bufLen, data + i, n);
+        _bufLen += n;
+        i += n;
+        if (_bufLen == _bufNeed && !operandsDone()) return false;
+        break;
+      }
+
+      case OPCODE:
+        _op     = data[i++];
+        _bufLen = 0;
+        if (_op == DELTA_OP_END) {
+          if (_written != _targetSize) return fail("Patch ended before the target size");
+          _state = DONE;
+        } else if (_op == DELTA_OP_COPY || _op == DELTA_OP_ADD) {
+          _bufNeed = 8;
+          _state   = OPERANDS;
+        } else if (_op == DELTA_OP_DATA) {
+          _bufNeed = 4;
+          _state   = OPERANDS;
+        } else {
+          return fail("Unknown patch opcode");
+        }
+        break;
+
+      case ADD_DATA: {
+        size_t n = len - i;
+        if (n > _remaining) n = _remaining;
+        if (n > sizeof(_buf)) n = sizeof(_buf);
+        if (!_base(_src, _buf, n)) return fail("Base read failed");
+        for (size_t k = 0; k < n; k++) _buf[k] += data[i + k];
+        if (!emit(_buf, n)) return false;
+        _src += n;
+        _remaining -= n;
+        i += n;
+        if (_remaining == 0) _state = OPCODE;
+        break;
+      }
+
+      case LITERAL_DATA: {
+        size_t n = len - i;
+        if (n > _remaining) n = _remaining;
+        if (!emit(data + i, n)) return false;
+        _remaining -= n;
+        i += n;
+        if (_remaining == 0) _state = OPCODE;
+        break;
+      }
+
+      case DONE:
+        return fail("Data after the end of the patch");
+
+      case FAILED:
+        return false;
+    }
+  }
+  return true;
+}
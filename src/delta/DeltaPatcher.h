@@ -0,0 +1,69 @@
+/*
+   Streaming applier for delta firmware patches
+   Purpose: Rebuild the new image from the running partition and a patch made by tools/fota_delta.py.
+            Has no Arduino dependency, base reads and output go through callbacks.
+
+   Patch format (all integers little endian):
+     header  "FDP2" | base size u32 | target size u32 | SHA-256 of the base image (32 bytes)
+     COPY    0x01 | src u32 | len u32                  target += base[src, src + len)
+     ADD     0x02 | src u32 | len u32 | len bytes      target += base[src + i] + byte[i] (mod 256)
+     DATA    0x03 | len u32 | len bytes                target += bytes
+     END     0x00
+*/
+
+#ifndef DeltaPatcher_h
+#define DeltaPatcher_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+
+#define DELTA_HEADER_SIZE 44
+#define DELTA_BLOCK_SIZE 256  // Base partition read granularity
+
+class DeltaPatcher {
+ public:
+  typedef std::function<bool(uint32_t offset, uint8_t* buf, size_t len)> BaseReader;
+  typedef std::function<bool(const uint8_t* data, size_t len)> Output;
+  // Whether the first size bytes of the base have this SHA-256. The same version built twice differs,
+  // a patch made against another build would rebuild a corrupt image.
+  typedef std::function<bool(uint32_t size, const uint8_t* sha256)> BaseCheck;
+
+  // baseDigest (32 bytes) may be NULL
+  static bool parseHeader(const uint8_t* header, uint32_t* baseSize, uint32_t* targetSize, uint8_t* baseDigest = NULL);
+
+  DeltaPatcher() { begin(NULL); }
+  // Without check the base is taken as is. A base that fails it stops the patch at its header, before any output.
+  void begin(BaseReader base, BaseCheck check = NULL);
+  void setOutput(Output output) { _output = output; }
+  // Feed the next part of the patch, split anywhere. Returns false once the patch turned out to be
+  // malformed or the base read or output failed.
+  bool write(const uint8_t* data, size_t len);
+  bool finished() const { return _state == DONE; }
+  uint32_t targetSize() const { return _targetSize; }
+  uint32_t written() const { return _written; }
+  const char* errorString() const { return _error; }
+
+ private:
+  enum State { HEADER, OPCODE, OPERANDS, ADD_DATA, LITERAL_DATA, DONE, FAILED };
+  bool fail(const char* error);
+  bool emit(const uint8_t* data, size_t len);
+  bool operandsDone();
+  BaseReader _base;
+  BaseCheck _check;
+  Output _output;
+  State _state;
+  uint8_t _op;
+  uint8_t _buf[DELTA_BLOCK_SIZE];
+  size_t _bufLen;
+  size_t _bufNeed;
+  uint32_t _src;
+  uint32_t _remaining;
+  uint32_t _baseSize;
+  uint32_t _targetSize;
+  uint32_t _written;
+  const char* _error;
+};
+
+#endif
@@ -8,33 +8,51 @@
 
 #include <Arduino.h>
 #include <FS.h>
+#include <Preferences.h>
 #include <SPIFFS.h>
 #include <Update.h>
+#include <errno.h>
+
+#include <algorithm>
 
 #include "ArduinoJson.h"
-#include "SSLClient.h"
 #include "ca_cert.h"
 #include "esp_ota_ops.h"
+#include "http/ManifestReader.h"
 #include "mbedtls/md.h"
-#include "mbedtls/md_internal.h"
 #include "mbedtls/pk.h"
 
+#define FOTA_NVS_NAMESPACE "esp32fota"
+#define FOTA_NVS_MANIFEST "esp32fota_mf"
+#define FOTA_NVS_NETWORK "esp32fota_net"                       // Last registration, apart from FOTA_NVS_NAMESPACE which verify() clears
+#define FOTA_RESUME_COMMIT_INTERVAL (16 * SPI_FLASH_SEC_SIZE)  // How much data a reboot may cost at most
+#define FOTA_MANIFEST_ENTRY_SIZE 1024                          // JSON document for a single (filtered) manifest entry
+#define FOTA_MANIFEST_ENTRY_TEXT 2048                          // Longest manifest entry as it is in the file, before the filter
+#define FOTA_INDEX_SIZE HTTP_DRAIN_MAX                         // Start of an indexed manifest fetched for its index, tools/fota_index.py keeps it within
+#define FOTA_MAX_REDIRECTS 5
+#define FOTA_RESPONSE_TIMEOUT 30000L                           // From the request to the end of the response headers
+#define FOTA_MODEM_RESPONSE_TIMEOUT 600000L                    // The same on the modem's HTTPS service, which answers once it has the whole body
+#define FOTA_STALL_TIMEOUT 30000L                              // Longest gap in the body before an attempt is given up
+#define FOTA_MIN_SEGMENT (64 * 1024)                           // Smallest part of the image worth a socket of its own
+#define FOTA_AT_TIMEOUT 1000L                                  // For an AT command the modem answers right away
+#define FOTA_COPS_TIMEOUT 60000L                               // Operator selection may take a network search
+#define FOTA_MODEM_BOOT_TIMEOUT 10000L                         // From the power key to the modem answering AT
+
 esp32FotaGsmSSL::esp32FotaGsmSSL(String firmwareType, int firmwareVersion, boolean validate, boolean allow_insecure_https) {
   _firmwareType         = firmwareType;
-  _firmwareVersion      = semver_t{firmwareVersion};
+  _firmwareVersion      = SemVer(firmwareVersion);
   _check_sig            = validate;
   _allow_insecure_https = allow_insecure_https;
   useDeviceID           = false;
 
-  char version_no[256] = {'\0'};  // If we are passed firmwareVersion as an int, we're assuming it's a major version
-  semver_render(&_firmwareVersion, version_no);
+  char version_no[SEMVER_RENDER_SIZE];  // If we are passed firmwareVersion as an int, we're assuming it's a major version
+  _firmwareVersion.render(version_no, sizeof(version_no));
   log_i("Current firmware version: %s", version_no);
 }
 
 esp32FotaGsmSSL::esp32FotaGsmSSL(String firmwareType, String firmwareSemanticVersion, boolean validate, boolean allow_insecure_https) {
-  if (semver_parse(firmwareSemanticVersion.c_str(), &_firmwareVersion)) {
+  if (!_firmwareVersion.parse(firmwareSemanticVersion.c_str())) {
     log_e("Invalid semver string %s passed to constructor. Defaulting to 0", firmwareSemanticVersion.c_str());
-    _firmwareVersion = semver_t{0};
   }
 
   _firmwareType         = firmwareType;
@@ -42,45 +60,120 @@ esp32FotaGsmSSL::esp32FotaGsmSSL(String firmwareType, String firmwareSemanticVer
   _allow_insecure_https = allow_insecure_https;
   useDeviceID           = false;
 
-  char version_no[256] = {'\0'};
-  semver_render(&_firmwareVersion, version_no);
+  char version_no[SEMVER_RENDER_SIZE];
+  _firmwareVersion.render(version_no, sizeof(version_no));
   log_i("Current firmware version: %s", version_no);
 }
 
 esp32FotaGsmSSL::~esp32FotaGsmSSL() {
-  semver_free(&_firmwareVersion);
-  semver_free(&_payloadVersion);
+  abort();
+  for (TinyGsmClient *socket : _segmentSockets) delete socket;
 }
 
-// Check file signature
-// https://techtutorialsx.com/2018/05/10/esp32-arduino-mbed-tls-using-the-sha-256-algorithm/
-// https://github.com/ARMmbed/mbedtls/blob/development/programs/pkey/rsa_verify.c
-bool esp32FotaGsmSSL::validate_sig(unsigned char *signature, uint32_t firmware_size) {
-  int ret = 1;
-  mbedtls_pk_context pk;
-  mbedtls_md_context_t rsa;
+// Feed bytes [from, to) of a partition into a running digest by reading them back from flash
+static bool hash_partition_range(const esp_partition_t *partition, uint32_t from, uint32_t to, mbedtls_md_context_t *md) {
+  uint8_t *_buffer = (uint8_t *)malloc(SPI_FLASH_SEC_SIZE);
+  if (!_buffer) {
+    log_e("malloc failed");
+    return false;
+  }
 
-  {  // Open RSA public key:
-    File public_key_file = SPIFFS.open("/rsa_key.pub");
-    if (!public_key_file) {
-      log_e("Failed to open rsa_key.pub for reading");
-      return false;
-    }
-    std::string public_key = "";
-    while (public_key_file.available()) {
-      public_key.push_back(public_key_file.read());
-    }
-    public_key_file.close();
+  uint32_t bytesread = from;
+  while (bytesread < to) {
+    uint32_t bytestoread = to - bytesread;
+    if (bytestoread > SPI_FLASH_SEC_SIZE) bytestoread = SPI_FLASH_SEC_SIZE;
 
-    mbedtls_pk_init(&pk);
-    if ((ret = mbedtls_pk_parse_public_key(&pk, (unsigned char *)public_key.c_str(), public_key.length() + 1)) != 0) {
-      log_e("Reading public key failed\n  ! mbedtls_pk_parse_public_key %d\n\n", ret);
+    if (!ESP.partitionRead(partition, bytesread, (uint32_t *)_buffer, bytestoread)) {
+      log_e("partitionRead failed!");
+      free(_buffer);
       return false;
     }
+    mbedtls_md_update(md, (uint8_t *)_buffer, bytestoread);
+    bytesread += bytestoread;
+  }
+  free(_buffer);
+  return true;
+}
+
+// Hash the first firmware_size bytes of a partition
+static bool hash_partition(const esp_partition_t *partition, uint32_t firmware_size, unsigned char *hash) {
+  mbedtls_md_context_t rsa;
+  mbedtls_md_init(&rsa);
+  mbedtls_md_setup(&rsa, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 0);
+  mbedtls_md_starts(&rsa);
+
+  bool ok = hash_partition_range(partition, 0, firmware_size, &rsa);
+  if (ok) mbedtls_md_finish(&rsa, hash);
+  mbedtls_md_free(&rsa);
+  return ok;
+}
+
+// Download state kept in NVS, so an interrupted image can be continued even after a reboot
+static String resume_target(const String &host, int port, const String &bin) { return host + ":" + String(port) + bin; }
+
+static void save_resume_state(Preferences &prefs, const String &target, const String &etag, PartitionWriter &writer, const unsigned char *signature,
+                              SignatureVerifier::Algorithm algorithm, const String &keyId) {
+  prefs.putString("target", target);
+  prefs.putString("etag", etag);
+  prefs.putUInt("size", writer.size());
+  prefs.putUChar("sigalg", algorithm);
+  prefs.putString("keyid", keyId);
+  if (algorithm != SignatureVerifier::NONE) prefs.putBytes("signature", signature, SignatureVerifier::signatureLength(algorithm));
+  prefs.putUInt("offset", 0);  // Header and offset are only valid once the first sector is on flash
+}
+
+static void save_resume_offset(Preferences &prefs, PartitionWriter &writer) {
+  prefs.putBytes("header", writer.header(), PARTITION_WRITER_HEADER_SIZE);
+  prefs.putUInt("offset", writer.committed());
+}
+
+// The partition is about to be written or erased from the start, below the offset the record vouches for.
+// A reboot after that must start over instead of resuming on top of erased sectors.
+static void drop_resume_offset(Preferences &prefs) {
+  if (prefs.getUInt("offset") > 0) prefs.putUInt("offset", 0);
+}
+
+// The key the image is checked with: the one the manifest entry names, or the only one. Without any added
+// to keys, /rsa_key.pub is loaded from SPIFFS (whatever its type, the file keeps its name), and if it is missing
+// or doesn't parse, not tried again until keys changes.
+SignatureVerifier *esp32FotaGsmSSL::signingKey() {
+  if (keys.count() == 0 && _defaultKeyTried != keys.changes()) {
+    _defaultKeyTried = keys.changes();
+    keys.addFile("", SPIFFS, "/rsa_key.pub");
   }
+  return keys.find(_keyId.c_str());
+}
 
-  if (!mbedtls_pk_can_do(&pk, MBEDTLS_PK_RSA)) {
-    log_e("Public key is not an rsa key -0x%x\n\n", -ret);
+// What an HTTPS server is checked against, NULL for plain HTTP and allow_insecure_https. Without roots or
+// pins of the application's own, root_ca from ca_cert.h is parsed into trust on first use and kept.
+TlsTrust *esp32FotaGsmSSL::serverTrust(bool https) {
+  if (!https || _allow_insecure_https) return NULL;
+  if (trust.empty()) trust.addAnchor(root_ca);
+  return &trust;
+}
+
+void esp32FotaGsmSSL::setSignatureVerifier(SignatureVerifier *verifier) {
+  keys.clear();
+  if (verifier) keys.add("", verifier);
+}
+
+// What the image is signed with, NONE if it isn't checked. Bytes of signature in front of the image and of a patch.
+SignatureVerifier::Algorithm esp32FotaGsmSSL::signatureAlgorithm() {
+  SignatureVerifier *key = _check_sig ? signingKey() : NULL;
+  return key ? key->algorithm() : SignatureVerifier::NONE;
+}
+
+size_t esp32FotaGsmSSL::signatureLength() { return SignatureVerifier::signatureLength(signatureAlgorithm()); }
+
+// Check file signature
+// The SHA-256 digest is normally computed by execOTA() while the image is downloaded. It only holds within
+// that run: called on its own (outside a run, or after one failed or was aborted) or with recheckPartition set,
+// the partition is read back.
+// signature is as long as the key's algorithm takes (SignatureVerifier::signatureLength()).
+bool esp32FotaGsmSSL::validate_sig(unsigned char *signature, uint32_t firmware_size) {
+  SignatureVerifier *key = signingKey();
+  if (!key) {
+    log_e("No key \"%s\" to check the signature with", _keyId.c_str());
     return false;
   }
 
@@ -91,206 +184,1076 @@ bool esp32FotaGsmSSL::validate_sig(unsigned char *signature, uint32_t firmware_s
     return false;
   }
 
-  const mbedtls_md_info_t *mdinfo = mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
-  mbedtls_md_init(&rsa);
-  mbedtls_md_setup(&rsa, mdinfo, 0);
-  mbedtls_md_starts(&rsa);
+  unsigned char hash[sizeof(_firmwareDigest)];
+  if (_firmwareDigestValid && _run) {
+    memcpy(hash, _firmwareDigest, sizeof(hash));
+    if (recheckPartition) {
+      unsigned char flash_hash[sizeof(hash)];
+      if (!hash_partition(partition, firmware_size, flash_hash) || memcmp(hash, flash_hash, sizeof(hash)) != 0) {
+        log_e("Partition content doesn't match the digest computed while downloading");
+        ESP.partitionEraseRange(partition, 0, SPI_FLASH_SEC_SIZE);
+        return false;
+      }
+    }
+  } else if (!hash_partition(partition, firmware_size, hash)) {
+    return false;
+  }
 
-  int bytestoread = SPI_FLASH_SEC_SIZE;
-  int bytesread   = 0;
-  int size        = firmware_size;
+  if (key->verify(hash, signature)) {
+    return true;
+  }
 
-  uint8_t *_buffer = (uint8_t *)malloc(SPI_FLASH_SEC_SIZE);
-  if (!_buffer) {
-    log_e("malloc failed");
+  // overwrite the first sector so this partition won't boot!
+  ESP.partitionEraseRange(partition, 0, SPI_FLASH_SEC_SIZE);
+
+  return false;
+}
+
+// Split http(s)://host[:port]/path into its parts
+static void split_url(const String &url, String &host, int &port, String &path) {
+  String urlRaw;
+  if (url.substring(0, 5) == "https") {
+    urlRaw = url.substring(8);
+    port   = 443;
+  } else {
+    urlRaw = url.substring(7);
+    port   = 80;
+  }
+  int slash = urlRaw.indexOf('/');
+  host      = slash < 0 ? urlRaw : urlRaw.substring(0, slash);
+  path      = slash < 0 ? String("/") : urlRaw.substring(slash);
+  int colon = host.indexOf(':');
+  if (colon >= 0) {
+    port = host.substring(colon + 1).toInt();
+    host = host.substring(0, colon);
+  }
+}
+
+struct esp32FotaGsmSSL::Run {
+  bool update;  // Go on to the image after the check, execHTTPcheck() stops after it
+  bool idle;    // The last step had nothing to do, the blocking drivers wait a bit before the next
+  Preferences prefs;
+  // Manifest check
+  String cacheKey;
+  bool cached;
+  bool indexed;  // The index of an indexed manifest was read, this response has the entries for our type
+  // Manifest body, read over the poll()s after its headers (pollManifest())
+  int manifestStatus;  // Status of the manifest response, 0 while its headers aren't in
+  bool indexing;       // Reading the index at the start of an indexed manifest into indexText
+  String indexText;
+  size_t manifestFrom;  // Body position of the entries for our type, those before it are skipped
+  ManifestReader reader;
+  unsigned long manifestAt;
+  // Image or patch
+  mbedtls_md_context_t sha;
+  unsigned char signature[SIGNATURE_MAX_LENGTH];
+  String target;
+  String etag;
+  int attempt;
+  bool delta;      // The transfer is the patch from _patchURL, not the full image
+  bool inflating;  // The body goes through inflater
+  bool fresh;      // The body starts the image (200 or a patch), it doesn't continue it (206)
+  Inflater inflater;
+  DeltaPatcher patcher;
+  DownloadPipeline *pipeline;
+  uint8_t *buffer;  // Sector buffer for a patch or compressed image inline, without pipeline; an image is read into the writer's
+  DownloadPipeline::Sink sink;
+  // Segments on extra sockets (downloadSockets), the main download stops where they start
+  SegmentFetcher *segments[FOTA_MAX_SOCKETS - 1];
+  int segmentCount;
+  size_t segmentsFrom;
+  bool waiting;  // The main download is through, the segments aren't yet
+  size_t sigLength;
+  size_t sigRead;
+  size_t length;  // Body bytes after the signature
+  size_t received;
+  size_t lastCommit;
+  unsigned long lastData;
+  // Metrics
+  unsigned long startedAt;
+  unsigned long bodyStartedAt;
+  unsigned long windowStartedAt;  // One second windows for the current and peak rate
+  uint32_t windowBytes;
+  uint32_t bytesReceived;  // TlsClient counters when the run started
+  uint32_t bytesSent;
+  uint32_t segmentBytesReceived;  // TlsClient counters of segments already dropped
+  uint32_t segmentBytesSent;
+  uint32_t freeHeap;  // ESP.getFreeHeap() and getMinFreeHeap() before the run started
+  uint32_t lowWater;
+  volatile uint32_t flashMicros;
+  uint32_t writeStallMicros;  // PartitionWriter counters when the run started
+  uint32_t eraseAheadMicros;
+  uint32_t bytesCopied;
+
+  Run()
+      : update(true),
+        idle(false),
+        cached(false),
+        indexed(false),
+        manifestStatus(0),
+        indexing(false),
+        manifestFrom(0),
+        manifestAt(0),
+        attempt(0),
+        delta(false),
+        inflating(false),
+        fresh(false),
+        pipeline(NULL),
+        buffer(NULL),
+        segmentCount(0),
+        segmentsFrom(0),
+        waiting(false),
+        sigLength(0),
+        sigRead(0),
+        length(0),
+        received(0),
+        lastCommit(0),
+        lastData(0),
+        startedAt(0),
+        bodyStartedAt(0),
+        windowStartedAt(0),
+        windowBytes(0),
+        bytesReceived(0),
+        bytesSent(0),
+        segmentBytesReceived(0),
+        segmentBytesSent(0),
+        flashMicros(0),
+        writeStallMicros(0),
+        eraseAheadMicros(0),
+        bytesCopied(0) {
+    mbedtls_md_init(&sha);
+    mbedtls_md_setup(&sha, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 0);
+    mbedtls_md_starts(&sha);
+  }
+  ~Run() {
+    if (pipeline) {
+      pipeline->finish();
+      delete pipeline;
+    }
+    if (buffer) free(buffer);
+    for (int i = 0; i < segmentCount; i++) delete segments[i];
+    mbedtls_md_free(&sha);
+    prefs.end();
+  }
+};
+
+// Start a GET request, httpPoll() then connects, sends it and reads the response headers into _response.
+// The connection is reused if the previous request went to the same host and port; whoever handles the
+// response hands it back with _connection.release() or close() once it is done with it.
+void esp32FotaGsmSSL::httpStart(const String &host, int port, const String &path, const String &headers, TlsTrust *trust) {
+  _connection.closeIfIdle(connectionLinger);
+  _connection.tls().setSession(resumeTls ? &_tlsSession : NULL);
+  _connection.tls().setMaxFragmentLength(tlsFragmentLength);
+  _request.host       = host;
+  _request.port       = port;
+  _request.path       = path;
+  _request.headers    = headers;
+  _request.trust      = trust;
+  _request.hops       = 0;
+  _request.connecting = false;
+  _request.sent       = false;
+  _request.reused     = false;
+  _metrics.requests++;
+}
+
+// Returns 0 while the request is under way, then the final status code (after 301/302/303/307/308
+// redirects), or -1 if there was no usable response
+int esp32FotaGsmSSL::httpPoll() {
+  Request &request = _request;
+  if (!request.sent) {
+    if (!request.connecting) {
+      log_i("Connecting to: %s:%d...", request.host.c_str(), request.port);
+      request.connecting = true;
+      request.connectAt  = millis();
+    }
+    bool reused;
+    int ret = _connection.connect(request.host, request.port, request.trust, reused);
+    if (ret == 0) {
+      _run->idle = true;
+      return 0;
+    }
+    request.connecting = false;
+    if (ret < 0) {
+      log_i("fail!\r\n");
+      return -1;
+    }
+    log_i("OK%s\r\n", reused ? " (kept alive)" : "");
+
+    if (_connection.onModem()) {
+      // The handshake happened on the modem, it is part of the connect time
+      _metrics.modemRequests++;
+      if (!reused) _metrics.connectMs += millis() - request.connectAt;
+    } else if (!reused) {
+      const TlsHandshake &handshake = _connection.tls().lastHandshake();
+      for (TlsStats *stats : {&_tlsStats, &_metrics.tls}) {
+        stats->handshakes++;
+        stats->resumed += handshake.resumed ? 1 : 0;
+        stats->handshakeTime += handshake.duration;
+        stats->handshakeCpuTime += handshake.cpuTime;
+        stats->last = handshake;
+      }
+      _metrics.connectMs += millis() - request.connectAt - handshake.duration;
+    }
+
+    // Make a HTTP request:
+    Client &client = _connection.client();
+    client.print(String("GET ") + request.path + " HTTP/1.1\r\n");
+    client.print(String("Host: ") + request.host + "\r\n");
+    client.print(request.headers);
+    client.print(connectionLinger > 0 ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n");
+
+    _response.begin(client);
+    request.sent   = true;
+    request.reused = reused;
+    request.sentAt = millis();
+  }
+
+  int status = _response.pollHeaders();
+  if (status == 0 && millis() - request.sentAt <= (_connection.onModem() ? FOTA_MODEM_RESPONSE_TIMEOUT : FOTA_RESPONSE_TIMEOUT)) {
+    _run->idle = true;
+    return 0;
+  }
+  if (status <= 0) {
+    if (status == 0) log_e(">>> Invalid response or client timeout!");
+    // The server may have closed a kept connection in the meantime, or the modem's HTTPS service couldn't
+    // do the request, either costs one retry on a new connection
+    bool retry = request.reused || _connection.modemFailed();
+    _connection.close();
+    request.sent = false;
+    if (!retry) return -1;
+    _metrics.reconnects++;
+    return 0;
+  }
+  _metrics.firstByteMs += millis() - request.sentAt;
+  if (!_response.response().isRedirect()) return status;
+
+  const char *location = _response.response().location();
+  if (location[0] == '\0') {
+    log_e("Redirect %d without a Location", status);
+    return status;
+  }
+  if (++request.hops > FOTA_MAX_REDIRECTS) {
+    log_e("Too many redirects");
+    return -1;
+  }
+  log_i("Redirect %d to %s", status, location);
+  _metrics.redirects++;
+  if (location[0] == '/') {
+    request.path = location;
+  } else {
+    split_url(location, request.host, request.port, request.path);
+  }
+  _connection.release(_response);
+  request.sent = false;
+  return 0;
+}
+
+bool esp32FotaGsmSSL::begin(bool check) { return start(check, true); }
+
+bool esp32FotaGsmSSL::start(bool check, bool update) {
+  if (_run) {
+    log_e("An update is already running");
     return false;
   }
-  // log_d("Reading partition (%i sectors, sec_size: %i)\r\n", size, bytestoread);
-  while (bytestoread > 0) {
-    // log_d("Left: %i (%i)               \r", size, bytestoread);
+  uint32_t freeHeap      = ESP.getFreeHeap();
+  uint32_t lowWater      = ESP.getMinFreeHeap();
+  _run                   = new Run();
+  _run->update           = update;
+  _run->freeHeap         = freeHeap;
+  _run->lowWater         = lowWater;
+  _run->startedAt        = millis();
+  _run->bytesReceived    = _connection.bytesReceived();
+  _run->bytesSent        = _connection.bytesSent();
+  _run->writeStallMicros = _writer.stallMicros();
+  _run->eraseAheadMicros = _writer.eraseAheadMicros();
+  _run->bytesCopied      = _writer.bytesCopied();
+  _signatureRejected     = false;
+  _firmwareDigestValid   = false;
+  _metrics               = {};
+  _metrics.minFreeHeap   = freeHeap;
+  _connection.setModemHttp(modemHttp && _modem ? &_modemHttp : NULL);
+  if (check) {
+    _state = FOTA_CHECKING;
+    startCheck();
+  } else {
+    startUpdate();
+  }
+  return true;
+}
 
-    if (ESP.partitionRead(partition, bytesread, (uint32_t *)_buffer, bytestoread)) {
-      // Debug output for the purpose of comparing with file
-      /*for( int i = 0; i < bytestoread; i++ ) {
-        if( ( i % 16 ) == 0 ) {
-          log_d( "\r\n0x%08x\t", i + bytesread );
-        }
-        log_d( "%02x ", (uint8_t*)_buffer[i] );
-      }*/
+void esp32FotaGsmSSL::end(State state) {
+  dropSegments();
+  sampleMetrics();
+  _metrics.result  = state;
+  _metrics.totalMs = millis() - _run->startedAt;
+  delete _run;
+  _run                 = NULL;
+  _state               = state;
+  _firmwareDigestValid = false;  // Belongs to this run's image, what is on flash may change after it
+  if (_metricsCallback) _metricsCallback(_metrics);
+}
 
-      mbedtls_md_update(&rsa, (uint8_t *)_buffer, bytestoread);
+// Brings the running totals of _metrics up to date, after every poll() step
+void esp32FotaGsmSSL::sampleMetrics() {
+  Run &run               = *_run;
+  uint32_t transfer      = _metrics.transferMs + (_state == FOTA_DOWNLOADING ? millis() - run.bodyStartedAt : 0);
+  uint32_t received      = run.segmentBytesReceived;
+  uint32_t sent          = run.segmentBytesSent;
+  for (int i = 0; i < run.segmentCount; i++) {
+    received += run.segments[i]->tls().bytesReceived();
+    sent += run.segments[i]->tls().bytesSent();
+  }
+  _metrics.bytesReceived = _connection.bytesReceived() - run.bytesReceived + received;
+  _metrics.bytesSent     = _connection.bytesSent() - run.bytesSent + sent;
+  _metrics.flashMs       = run.flashMicros / 1000;
+  _metrics.writeStallMs  = (_writer.stallMicros() - run.writeStallMicros) / 1000;
+  _metrics.eraseAheadMs  = (_writer.eraseAheadMicros() - run.eraseAheadMicros) / 1000;
+  _metrics.bytesCopied   = _writer.bytesCopied() - run.bytesCopied;
+  _metrics.averageRate   = transfer > 0 ? (uint64_t)_metrics.bodyBytes * 1000 / transfer : 0;
+  // A new low-water mark of the heap also catches what was held only within a step, like a TLS handshake
+  uint32_t freeHeap = ESP.getFreeHeap();
+  if (ESP.getMinFreeHeap() < run.lowWater) freeHeap = std::min(freeHeap, ESP.getMinFreeHeap());
+  _metrics.minFreeHeap = std::min(_metrics.minFreeHeap, freeHeap);
+  _metrics.peakHeap    = run.freeHeap - _metrics.minFreeHeap;
+}
 
-      bytesread = bytesread + bytestoread;
-      size      = size - bytestoread;
+esp32FotaGsmSSL::State esp32FotaGsmSSL::poll() {
+  if (!_run) return _state;
+  _run->idle = false;
+  switch (_state) {
+    case FOTA_CHECKING:
+      if (_run->manifestStatus != 0) {
+        pollManifest();
+      } else {
+        int status = httpPoll();
+        if (status != 0) finishCheck(status);
+      }
+      break;
+    case FOTA_CONNECTING:
+    case FOTA_REQUESTING:
+      pollRequest();
+      break;
+    case FOTA_DOWNLOADING:
+      pollBody();
+      break;
+    case FOTA_VERIFYING:
+      verify();
+      break;
+    default:
+      break;
+  }
+  if (_run && _run->segmentCount > 0) pollSegments();
+  // Nothing arrived: erase where the image goes next, unless the pipeline's writer task has the flash to itself
+  if (_run && _run->idle && !_run->pipeline && eraseAhead > 0 && (_state == FOTA_CONNECTING || _state == FOTA_REQUESTING || _state == FOTA_DOWNLOADING) &&
+      _writer.eraseAhead(eraseUntil())) {
+    _run->idle = false;
+  }
+  if (_run) sampleMetrics();
+  return _state;
+}
 
-      if (size <= SPI_FLASH_SEC_SIZE) {
-        bytestoread = size;
+// Blocking form of poll(), for execOTA() and execHTTPcheck()
+void esp32FotaGsmSSL::drive() {
+  while (_run) {
+    poll();
+    if (_run && _run->idle) delay(1);
+  }
+}
+
+void esp32FotaGsmSSL::abort() {
+  if (!_run) return;
+  _connection.close();
+  if (_state == FOTA_DOWNLOADING) {
+    // The writer has to be stopped before looking at what made it to flash
+    if (_run->pipeline) {
+      _run->pipeline->finish();
+      delete _run->pipeline;
+      _run->pipeline = NULL;
+    }
+    if (!_run->delta && !_run->inflating && _run->sigRead == _run->sigLength && _writer.isRunning()) save_resume_offset(_run->prefs, _writer);
+  }
+  _writer.abort();
+  end(FOTA_IDLE);
+}
+
+const char *esp32FotaGsmSSL::stateName(State state) {
+  switch (state) {
+    case FOTA_IDLE:
+      return "idle";
+    case FOTA_CHECKING:
+      return "checking";
+    case FOTA_CONNECTING:
+      return "connecting";
+    case FOTA_REQUESTING:
+      return "requesting";
+    case FOTA_DOWNLOADING:
+      return "downloading";
+    case FOTA_VERIFYING:
+      return "verifying";
+    case FOTA_UP_TO_DATE:
+      return "up to date";
+    case FOTA_UPDATE_AVAILABLE:
+      return "update available";
+    case FOTA_DONE:
+      return "done";
+    case FOTA_FAILED:
+      return "failed";
+  }
+  return "?";
+}
+
+void esp32FotaGsmSSL::startUpdate() {
+  Run &run = *_run;
+  memset(&_pipelineStats, 0, sizeof(_pipelineStats));
+  if (_firmwareHost.length() == 0) {
+    log_e("No firmware to update to, check the manifest first");
+    end(FOTA_FAILED);
+    return;
+  }
+  // The key tells how long the signature in front of the image is
+  if (_check_sig && !signingKey()) {
+    log_e("No key \"%s\" to check the signature with", _keyId.c_str());
+    end(FOTA_FAILED);
+    return;
+  }
+  if (_check_sig && _signatureAlgorithm != SignatureVerifier::NONE && _signatureAlgorithm != signatureAlgorithm()) {
+    log_e("Image is signed with %s, the key is %s", SignatureVerifier::algorithmName(_signatureAlgorithm), SignatureVerifier::algorithmName(signatureAlgorithm()));
+    end(FOTA_FAILED);
+    return;
+  }
+  run.target = resume_target(_firmwareHost, _firmwarePort, _firmwareBin);
+  run.prefs.begin(FOTA_NVS_NAMESPACE, false);
+
+  // Continue an image that was interrupted by a reboot or brownout
+  _writer.abort();
+  if (run.prefs.getString("target") == run.target && run.prefs.getUChar("sigalg") == signatureAlgorithm() && run.prefs.getString("keyid") == _keyId &&
+      run.prefs.getUInt("offset") > 0) {
+    uint8_t header[PARTITION_WRITER_HEADER_SIZE];
+    uint32_t offset = run.prefs.getUInt("offset");
+    run.prefs.getBytes("header", header, sizeof(header));
+    if (_check_sig) run.prefs.getBytes("signature", run.signature, signatureLength());
+    run.etag = run.prefs.getString("etag");
+
+    // The digest of the part already on flash has to be rebuilt, the header never made it to flash
+    if (_writer.begin(run.prefs.getUInt("size"), offset, header)) {
+      mbedtls_md_update(&run.sha, header, sizeof(header));
+      if (hash_partition_range(_writer.partition(), sizeof(header), offset, &run.sha)) {
+        log_i("Resuming interrupted download at %u/%u", offset, _writer.size());
+      } else {
+        _writer.abort();
+        mbedtls_md_starts(&run.sha);
       }
-    } else {
-      log_e("partitionRead failed!");
-      return false;
     }
   }
-  free(_buffer);
 
-  unsigned char *hash = (unsigned char *)malloc(mdinfo->size);
-  mbedtls_md_finish(&rsa, hash);
+  // A patch against the running firmware is much smaller than the full image, try it first and
+  // fall back to the full image if it fails
+  if (!_writer.isRunning() && _patchURL.length() > 0) {
+    startDelta();
+  } else {
+    startAttempt();
+  }
+}
 
-  ret = mbedtls_pk_verify(&pk, MBEDTLS_MD_SHA256, hash, mdinfo->size, (unsigned char *)signature, 512);
+// Download the delta patch from _patchURL and rebuild the new image from the running partition.
+// The signature in front of the patch is the one of the rebuilt image.
+void esp32FotaGsmSSL::startDelta() {
+  String host, path;
+  int port;
+  split_url(_patchURL, host, port, path);
+  drop_resume_offset(_run->prefs);
+  _run->delta = true;
+  httpStart(host, port, path, "", serverTrust(_patchURL.startsWith("https")));
+  _state = FOTA_CONNECTING;
+}
 
-  free(hash);
-  mbedtls_md_free(&rsa);
-  mbedtls_pk_free(&pk);
-  if (ret == 0) {
-    return true;
+void esp32FotaGsmSSL::startAttempt() {
+  _run->delta = false;
+  if (!_writer.isRunning()) dropSegments();
+  if (_writer.isRunning() && _writer.progress() == mainEnd()) {
+    mainDone();
+    return;
+  }
+  // A compressed image can only be restarted from the beginning
+  if (_firmwareCompression != Inflater::NONE) _writer.abort();
+  if (!_writer.isRunning()) drop_resume_offset(_run->prefs);
+
+  httpStart(_firmwareHost, _firmwarePort, _firmwareBin, "", serverTrust(true));
+  // With its size from the manifest a fresh image is split before the first request, so the main download
+  // doesn't fetch the segments' part as well. The modem's HTTPS service wouldn't gain from the segments.
+  if (!_writer.isRunning() && _firmwareCompression == Inflater::NONE && _firmwareSize > 0 && !(modemHttp && _modem)) {
+    if (_writer.begin(_firmwareSize)) startSegments();
+    if (_run->segmentCount == 0) _writer.abort();
   }
 
-  // overwrite the first few bytes so this partition won't boot!
-  ESP.partitionEraseRange(partition, 0, ENCRYPTED_BLOCK_SIZE);
+  // Ask only for the missing part if some of the image is already written, and only up to the segments
+  const size_t sigLen = signatureLength();
+  size_t rangeFrom    = _writer.isRunning() && _writer.progress() > 0 ? sigLen + _writer.progress() : 0;
+  if (rangeFrom > 0 || _run->segmentCount > 0) {
+    _request.headers = String("Range: bytes=") + String(rangeFrom) + "-" + (_run->segmentCount > 0 ? String(sigLen + mainEnd() - 1) : String("")) + "\r\n";
+    if (_run->etag.length() > 0) _request.headers += String("If-Range: ") + _run->etag + "\r\n";
+  }
+  _metrics.attempts++;
+  _state = FOTA_CONNECTING;
+}
 
-  return false;
+// Another go at the image, each one resumes where the last one stopped, until downloadRetries are used up
+void esp32FotaGsmSSL::nextAttempt() {
+  if (++_run->attempt > downloadRetries) {
+    failUpdate();
+  } else {
+    startAttempt();
+  }
 }
 
-// OTA Logic
-void esp32FotaGsmSSL::execOTA() {
-  int contentLength       = 0;
-  bool isValidContentType = false;
+void esp32FotaGsmSSL::failUpdate() {
+  Serial.println("OTA not finished!");
+  end(FOTA_FAILED);
+}
+
+void esp32FotaGsmSSL::pollRequest() {
+  int status = httpPoll();
+  if (status == 0) {
+    _state = _request.sent ? FOTA_REQUESTING : FOTA_CONNECTING;
+  } else if (_run->delta) {
+    deltaHeaders(status);
+  } else {
+    imageHeaders(status);
+  }
+}
 
-  TinyGsmClient client;
-  client.init(_modem);
-  SSLClient secure_client(&client);
-  // http.setFollowRedirects(HTTPC_STRICT_FOLLOW_REDIRECTS); // Don't have this in ssl. TODO: Add similar
+void esp32FotaGsmSSL::deltaHeaders(int status) {
+  Run &run                       = *_run;
+  const size_t sigLen            = signatureLength();
+  const esp_partition_t *running = esp_ota_get_running_partition();
+  int64_t contentLength          = _response.response().contentLength();
+  log_i("Delta patch HTTP status: %i, contentLength : %lld", status, contentLength);
+
+  run.inflating = _patchCompression != Inflater::NONE;
+  if (status != 200 || contentLength <= (int64_t)sigLen) {
+    log_e("Couldn't get a valid delta patch");
+    _connection.close();
+    _metrics.deltaFallback = true;
+    startAttempt();
+    return;
+  }
+  run.patcher.begin(
+      [running](uint32_t offset, uint8_t *buf, size_t len) {
+        return offset + len <= running->size && esp_partition_read(running, offset, buf, len) == ESP_OK;
+      },
+      [running](uint32_t size, const uint8_t *sha256) {
+        // Same version, different build: the patch would rebuild garbage, the full image is fetched instead
+        unsigned char digest[32];
+        return size <= running->size && hash_partition(running, size, digest) && memcmp(digest, sha256, sizeof(digest)) == 0;
+      });
+  if (run.inflating && !run.inflater.begin(_patchCompression, NULL)) {
+    log_e("Not enough memory to decompress the patch");
+    _connection.close();
+    _metrics.deltaFallback = true;
+    startAttempt();
+    return;
+  }
 
-  log_i("Connecting to: %s...", _firmwareHost.c_str());
+  Serial.println("Begin delta OTA with a " + String((uint32_t)contentLength) + " byte patch");
+  startBody(contentLength - sigLen, sigLen, true);
+}
 
-  // Include root_ca in SSLClient style, you need to include a ca_cert.h at the top
-  if (!_allow_insecure_https) secure_client.setCACert(root_ca);
-  if (!secure_client.connect(_firmwareHost.c_str(), _firmwarePort)) log_i("fail! Retrying...\r\n");
-  log_i("OK\r\n");
+void esp32FotaGsmSSL::imageHeaders(int status) {
+  const size_t sigLen              = signatureLength();
+  const bool compressed            = _firmwareCompression != Inflater::NONE;
+  const HttpResponseParser &parser = _response.response();
+  int64_t contentLength            = parser.contentLength();
+  size_t rangeFrom                 = _writer.isRunning() && _writer.progress() > 0 ? sigLen + _writer.progress() : 0;
+  const bool ranged                = rangeFrom > 0 || _run->segmentCount > 0;
 
-  // Make a HTTP request:
-  secure_client.print(String("GET ") + _firmwareBin + " HTTP/1.1\r\n");
-  secure_client.print(String("Host: ") + _firmwareHost + "\r\n");
-  secure_client.print("Connection: close\r\n\r\n");
+  // Check what is the contentLength
+  log_i("HTTP status: %i, contentLength : %lld", status, contentLength);
 
-  // Check timeout
-  long timeout = millis();
-  while (secure_client.available() == 0) {
-    if (millis() - timeout > 30000L) {
-      log_e(">>> Client Timeout!");
-      secure_client.stop();
+  _run->inflating = compressed;
+  if (status == 206 && ranged && parser.rangeStart() == (int64_t)rangeFrom && parser.rangeTotal() == (int64_t)(sigLen + _writer.size())) {
+    if (rangeFrom == 0) {
+      // The first part of an image split up front, signature included
+      startBody(mainEnd(), sigLen, true);
+      return;
+    }
+    log_i("Resuming at %u", rangeFrom);
+    startSegments();
+    startBody(mainEnd() - _writer.progress(), 0, false);
+  } else if (status == 200) {
+    if (rangeFrom > 0) {
+      log_w("Server sent the whole image, restarting download");
+      drop_resume_offset(_run->prefs);
+    }
+    dropSegments();
+    // If firmware is signed, the signature comes first and content-length is signatureLength() bytes more than the image.
+    // A compressed image takes its size from the manifest.
+    if (contentLength <= (int64_t)sigLen || !_writer.begin(compressed ? _firmwareSize : contentLength - sigLen) ||
+        (compressed && !_run->inflater.begin(_firmwareCompression, NULL))) {
+      Serial.println("Not enough space to begin OTA: " + String(_writer.errorString()));
+      _connection.close();
+      failUpdate();
+      return;
+    }
+    // A server that ignored the Range won't serve the segments either
+    if (!ranged) startSegments();
+    startBody(compressed ? contentLength - sigLen : mainEnd(), sigLen, true);
+  } else {
+    // Either an error or a partial reply that doesn't line up with what is on flash
+    log_e("Unexpected HTTP response %i (Content-Range %lld-%lld/%lld)", status, parser.rangeStart(), parser.rangeEnd(), parser.rangeTotal());
+    if (status == 206) _writer.abort();
+    _connection.close();
+    if (status >= 400 && status < 500) {
+      failUpdate();
+    } else {
+      nextAttempt();
     }
   }
+}
 
-  while (secure_client.available()) {
-    String line = secure_client.readStringUntil('\n');
-    line.trim();
-    // log_i("%s", line);  // Uncomment this to show response header
-    line.toLowerCase();
-    if (line.startsWith("content-length:")) {
-      contentLength = line.substring(line.lastIndexOf(':') + 1).toInt();
+// Set up copying the body into the update partition, feeding every block into the SHA-256 digest on its
+// way to flash. The committed offset is saved to NVS every FOTA_RESUME_COMMIT_INTERVAL bytes.
+// The body may be compressed (inflater) and/or a delta patch (patcher). The image is then whatever
+// comes out of those stages, and the writer is started once the patch header gives its size.
+// Such a download can't be resumed, as body and image offsets don't line up.
+void esp32FotaGsmSSL::startBody(size_t length, size_t sigLength, bool fresh) {
+  Run *run        = _run;
+  run->length     = length;
+  run->received   = 0;
+  run->sigLength  = sigLength;
+  run->sigRead    = 0;
+  run->fresh      = fresh;
+  run->lastData   = millis();
+  run->lastCommit = _writer.committed();
+
+  run->bodyStartedAt   = millis();
+  run->windowStartedAt = run->bodyStartedAt;
+  run->windowBytes     = _metrics.bodyBytes;
+
+  const bool resumable        = !run->delta && !run->inflating;
+  DownloadPipeline::Sink sink = [this, run, resumable](const uint8_t *block, size_t len) {
+    if (run->delta && !_writer.isRunning() && !_writer.begin(run->patcher.targetSize())) {
+      log_e("Delta patch doesn't fit: %s", _writer.errorString());
+      return false;
     }
-    if (line.length() == 0) {
-      break;
+    mbedtls_md_update(&run->sha, block, len);
+    unsigned long start = micros();
+    size_t written      = _writer.write(block, len);
+    run->flashMicros += micros() - start;
+    _metrics.bytesWritten += written;
+    if (written != len) {
+      log_e("Flash write failed: %s", _writer.errorString());
+      return false;
+    }
+    if (resumable && _writer.committed() - run->lastCommit >= FOTA_RESUME_COMMIT_INTERVAL) {
+      save_resume_offset(run->prefs, _writer);
+      run->lastCommit = _writer.committed();
     }
+    return true;
+  };
+  if (run->delta) {
+    run->patcher.setOutput(sink);
+    sink = [run](const uint8_t *block, size_t len) { return run->patcher.write(block, len); };
+  }
+  if (run->inflating) {
+    run->inflater.setOutput(sink);
+    sink = [run](const uint8_t *block, size_t len) { return run->inflater.write(block, len); };
   }
+  run->sink = sink;
+
+  // No activity would appear on the Serial monitor
+  // So be patient. This may take 2 - 5mins to complete
+  _state = FOTA_DOWNLOADING;
+  if (pipelineBuffers > 0) {
+    DownloadPipeline::Idle idle;
+    if (eraseAhead > 0) idle = [this]() { return _writer.eraseAhead(eraseUntil()); };
+    run->pipeline = new DownloadPipeline(pipelineBuffers);
+    if (!run->pipeline->start(sink, idle)) {
+      endBody();
+      return;
+    }
+  } else if (!resumable && !(run->buffer = (uint8_t *)malloc(SPI_FLASH_SEC_SIZE))) {
+    log_e("malloc failed");
+    endBody();
+    return;
+  }
+  if (sigLength == 0) bodyReady();
+}
 
-  // Check what is the contentLength
-  log_i("contentLength : %i", contentLength);
+// The signature (if any) is in, what follows is the image
+void esp32FotaGsmSSL::bodyReady() {
+  Run &run = *_run;
+  if (!run.fresh) return;
+  mbedtls_md_starts(&run.sha);
+  if (run.delta) return;
+  run.etag = _response.response().etag();
+  if (!run.inflating) save_resume_state(run.prefs, run.target, run.etag, _writer, run.signature, signatureAlgorithm(), _keyId);
+  Serial.println("Begin OTA. This may take 2 - 5 mins to complete. Things might be quiet for a while.. Patience!");
+}
 
-  if (_check_sig) {
-    // If firmware is signed, extract signature and decrease content-length by 512 bytes for signature
-    contentLength = contentLength - 512;
+// One read from the connection, at most a sector, and with the pipeline off also the flash write for it
+void esp32FotaGsmSSL::pollBody() {
+  Run &run = *_run;
+  if (run.waiting) {
+    run.idle = true;  // pollSegments() takes it from here
+    return;
+  }
+  const bool signature = run.sigRead < run.sigLength;
+  int bytesRead;
+  if (signature) {
+    bytesRead = _response.readBody(run.signature + run.sigRead, run.sigLength - run.sigRead);
+  } else if (run.pipeline) {
+    bytesRead = run.pipeline->pump([this](uint8_t *buf, size_t len) { return _response.readBody(buf, len); }, run.length - run.received);
+    if (bytesRead == 0 && run.pipeline->stalled()) run.lastData = millis();  // Waiting on the flash writer, not on the network
+  } else {
+    // The image itself is read into the writer's sector buffer, the sink then flashes it from there
+    size_t toRead = SPI_FLASH_SEC_SIZE;
+    uint8_t *into = run.buffer ? run.buffer : _writer.buffer(toRead);
+    if (toRead > run.length - run.received) toRead = run.length - run.received;
+    bytesRead = into ? _response.readBody(into, toRead) : -1;
+    if (bytesRead > 0 && !run.sink(into, bytesRead)) bytesRead = -1;
   }
-  if (Update.begin(contentLength)) {
-    unsigned char signature[512];
-    if (_check_sig) {
-      secure_client.readBytes(signature, 512);
-    }
-    Serial.println("Begin OTA. This may take 2 - 5 mins to complete. Things might be quiet for a while.. Patience!");
-    // No activity would appear on the Serial monitor
-    // So be patient. This may take 2 - 5mins to complete
-    size_t written = Update.writeStream(secure_client);
 
-    if (written == contentLength) {
-      Serial.println("Written : " + String(written) + " successfully");
-    } else {
-      Serial.println("Written only : " + String(written) + "/" + String(contentLength) + ". Retry?");
-      // retry??
-      // execOTA();
-    }
-    if (Update.end()) {
-      if (_check_sig) {
-        if (!validate_sig(signature, contentLength)) {
-          const esp_partition_t *partition = esp_ota_get_running_partition();
-          esp_ota_set_boot_partition(partition);
-
-          log_e("Signature check failed!");
-          secure_client.stop();
-          // _modem.gprsDisconnect();
-          ESP.restart();
-          return;
-        } else {
-          log_i("Signature OK");
-        }
-      }
-      Serial.println("OTA done!");
-      if (Update.isFinished()) {
-        Serial.println("Restart ESP device!");
-        secure_client.stop();
-        ESP.restart();
-      } else {
-        Serial.println("OTA not finished!");
-      }
+  if (bytesRead == 0 && millis() - run.lastData < FOTA_STALL_TIMEOUT) {
+    run.idle = true;
+    return;
+  }
+  if (bytesRead <= 0) {
+    endBody();
+    return;
+  }
+  run.lastData = millis();
+  _metrics.bodyBytes += bytesRead;
+  if (run.lastData - run.windowStartedAt >= 1000) {
+    _metrics.currentRate = (uint64_t)(_metrics.bodyBytes - run.windowBytes) * 1000 / (run.lastData - run.windowStartedAt);
+    _metrics.peakRate    = std::max(_metrics.peakRate, _metrics.currentRate);
+    run.windowStartedAt  = run.lastData;
+    run.windowBytes      = _metrics.bodyBytes;
+  }
+  if (signature) {
+    run.sigRead += bytesRead;
+    if (run.sigRead == run.sigLength) bodyReady();
+    return;
+  }
+  run.received += bytesRead;
+  if (run.received == run.length) endBody();
+}
+
+// The body ended, completely or not: wrap up the transfer and decide what comes next
+void esp32FotaGsmSSL::endBody() {
+  Run &run       = *_run;
+  size_t written = run.received;
+  _metrics.transferMs += millis() - run.bodyStartedAt;
+  if (run.pipeline) {
+    written = run.pipeline->finish();
+    for (PipelineStats *stats : {&_pipelineStats, &_metrics.pipeline}) {
+      stats->networkStalls += run.pipeline->stats().networkStalls;
+      stats->networkStallMs += run.pipeline->stats().networkStallMs;
+      stats->flashStalls += run.pipeline->stats().flashStalls;
+      stats->flashStallMs += run.pipeline->stats().flashStallMs;
+    }
+    delete run.pipeline;
+    run.pipeline = NULL;
+  }
+  if (run.buffer) {
+    free(run.buffer);
+    run.buffer = NULL;
+  }
+  const bool complete = _writer.isRunning() && _writer.progress() == mainEnd();
+
+  if (run.delta) {
+    _connection.release(_response);
+    if (run.sigRead < run.sigLength || !run.patcher.finished() || !complete) {
+      log_e("Delta update failed: %s", run.patcher.errorString() ? run.patcher.errorString() : "download incomplete");
+      _writer.abort();
+      run.inflater.end();
+      _metrics.deltaFallback = true;
+      startAttempt();
     } else {
-      Serial.println("Error occurred #: " + String(Update.getError()));
+      _state = FOTA_VERIFYING;
     }
+    return;
+  }
+
+  if (run.sigRead < run.sigLength) {
+    _writer.abort();
+    _connection.close();
+    nextAttempt();
+    return;
+  }
+  if (complete && (run.segmentCount == 0 || _response.response().bodyComplete())) {
+    _connection.release(_response);
   } else {
-    Serial.println("Not enough space to begin OTA");
-    secure_client.stop();
+    _connection.close();  // Stalled or cut off, the next attempt starts on a new connection
+  }
+
+  if (run.inflating && complete && !run.inflater.finished()) {
+    log_e("Compressed stream didn't end with the image");
+    _writer.abort();
+    failUpdate();
+    return;
+  }
+  if (complete) {
+    mainDone();
+    return;
+  }
+  if (run.inflating && _uncompressedURL.length() > 0) {
+    Serial.println("Written only : " + String(_writer.progress()) + "/" + String(_writer.size()) + ". Resuming with the uncompressed image...");
+    useUncompressed();
+  } else if (run.inflating) {
+    Serial.println("Written only : " + String(_writer.progress()) + "/" + String(_writer.size()) + ". Restarting compressed download...");
+  } else {
+    Serial.println("Written only : " + String(_writer.progress()) + "/" + String(_writer.size()) + " (" + String(written) + " this attempt). Resuming...");
+    save_resume_offset(run.prefs, _writer);
+  }
+  nextAttempt();
+}
+
+// The inflater can't pick up in the middle of the stream, so after a compressed download broke off the rest comes
+// from the uncompressed image. What is on flash is that image's start, it is continued with a Range request and
+// from now on resumable like any uncompressed download, after a reboot too.
+void esp32FotaGsmSSL::useUncompressed() {
+  Run &run = *_run;
+  split_url(_uncompressedURL, _firmwareHost, _firmwarePort, _firmwareBin);
+  _firmwareCompression = Inflater::NONE;
+  _uncompressedURL     = "";
+  run.inflater.end();
+  run.inflating = false;
+  run.etag      = "";  // The compressed file's, it doesn't validate a Range of the other one
+  run.target    = resume_target(_firmwareHost, _firmwarePort, _firmwareBin);
+  save_resume_state(run.prefs, run.target, run.etag, _writer, run.signature, signatureAlgorithm(), _keyId);
+  save_resume_offset(run.prefs, _writer);
+  _metrics.inflateFallback = true;
+}
+
+// Where the main download ends: the start of the first segment, or the end of the image
+size_t esp32FotaGsmSSL::mainEnd() { return _run->segmentCount > 0 ? _run->segmentsFrom : _writer.size(); }
+
+// How far erasing ahead may go: eraseAhead bytes past what is on flash, rounded up to a block so the window
+// moves a block erase at a time, but not into the image's segments or past its end. Before the writer is
+// started the image (or patch output) starts at 0 and its size may not be known.
+size_t esp32FotaGsmSSL::eraseUntil() {
+  size_t from  = _writer.isRunning() ? _writer.committed() : 0;
+  size_t until = (from + eraseAhead + PARTITION_WRITER_BLOCK_SIZE - 1) / PARTITION_WRITER_BLOCK_SIZE * PARTITION_WRITER_BLOCK_SIZE;
+  if (_writer.isRunning()) return std::min(until, mainEnd());
+  return _firmwareSize > 0 && !_run->delta ? std::min(until, (size_t)_firmwareSize) : until;
+}
+
+// The main download reached mainEnd(), the image is complete once the segments are as well
+void esp32FotaGsmSSL::mainDone() {
+  Run &run = *_run;
+  if (run.segmentCount > 0) {
+    run.waiting       = true;
+    run.bodyStartedAt = millis();
+    _state            = FOTA_DOWNLOADING;
+    return;
+  }
+  Serial.println("Written : " + String(_writer.size()) + " successfully");
+  _state = FOTA_VERIFYING;
+}
+
+// Splits what is left of a full uncompressed image into downloadSockets parts of whole sectors. The main
+// download keeps the first, each of the others goes over an extra modem socket with a Range request of its
+// own and is written straight to its place in the partition.
+void esp32FotaGsmSSL::startSegments() {
+  Run &run = *_run;
+  // The modem's HTTPS service has the whole body by the time it answers, other sockets wouldn't speed that up
+  if (run.segmentCount > 0 || downloadSockets < 2 || !_modem || run.delta || run.inflating || _connection.onModem()) return;
+  const size_t sigLen    = signatureLength();
+  const size_t from      = _writer.progress();
+  const size_t remaining = _writer.size() - from;
+  int count              = std::min<int>(std::min(downloadSockets, FOTA_MAX_SOCKETS), remaining / FOTA_MIN_SEGMENT);
+  if (count < 2) return;
+  size_t share = ((remaining + count - 1) / count + SPI_FLASH_SEC_SIZE - 1) / SPI_FLASH_SEC_SIZE * SPI_FLASH_SEC_SIZE;
+  // Before the main request is out, _response is still the manifest's
+  String etag = _request.sent && _response.response().etag()[0] ? _response.response().etag() : run.etag.c_str();
+
+  run.segmentsFrom = from + share;
+  for (int i = 1; i < count && from + i * share < _writer.size(); i++) {
+    if (!_segmentSockets[i - 1]) _segmentSockets[i - 1] = new TinyGsmClient(*_modem, i);
+    size_t offset           = from + i * share;
+    SegmentFetcher *segment = new SegmentFetcher(*_segmentSockets[i - 1]);
+    run.segments[run.segmentCount++] = segment;
+    segment->tls().setMaxFragmentLength(tlsFragmentLength);
+    if (!segment->begin(_request.host, _request.port, _request.path, _request.trust, resumeTls ? &_tlsSession : NULL, etag, sigLen + offset, offset,
+                        std::min(share, _writer.size() - offset), downloadRetries, FOTA_STALL_TIMEOUT)) {
+      dropSegments();
+      return;
+    }
+  }
+  _metrics.segments += run.segmentCount;
+  log_i("Fetching %u bytes from %u over %d sockets", remaining, from, run.segmentCount + 1);
+}
+
+// One step of every segment, after whatever the main download did in this poll(). Once the main download waits for them
+// and they are all on flash, the image is complete.
+void esp32FotaGsmSSL::pollSegments() {
+  Run &run  = *_run;
+  bool done = true;
+  for (int i = 0; i < run.segmentCount; i++) {
+    SegmentFetcher &segment = *run.segments[i];
+    size_t received         = segment.received();
+    size_t written          = segment.written();
+    int retries             = segment.retries();
+    uint32_t flashMicros    = segment.flashMicros();
+    int ret                 = segment.poll(_writer);
+    if (segment.received() != received) run.idle = false;
+    _metrics.bodyBytes += segment.received() - received;
+    _metrics.bytesWritten += segment.written() - written;
+    _metrics.segmentRetries += segment.retries() - retries;
+    run.flashMicros += segment.flashMicros() - flashMicros;
+    if (ret < 0) {
+      _connection.close();
+      failUpdate();
+      return;
+    }
+    done = done && ret == 1;
+  }
+  if (!done || !run.waiting) return;
+
+  _metrics.transferMs += millis() - run.bodyStartedAt;
+  run.waiting = false;
+  if (!_writer.skip(_writer.size() - run.segmentsFrom)) {
+    Serial.println("Error occurred: " + String(_writer.errorString()));
+    failUpdate();
+    return;
+  }
+  Serial.println("Written : " + String(_writer.size()) + " successfully over " + String(run.segmentCount + 1) + " sockets");
+  _state = FOTA_VERIFYING;
+}
+
+// Closes the segments, their handshakes and bytes stay in the metrics
+void esp32FotaGsmSSL::dropSegments() {
+  Run &run = *_run;
+  for (int i = 0; i < run.segmentCount; i++) {
+    SegmentFetcher *segment = run.segments[i];
+    run.segmentBytesReceived += segment->tls().bytesReceived();
+    run.segmentBytesSent += segment->tls().bytesSent();
+    for (TlsStats *stats : {&_tlsStats, &_metrics.tls}) {
+      stats->handshakes += segment->tlsStats().handshakes;
+      stats->resumed += segment->tlsStats().resumed;
+      stats->handshakeTime += segment->tlsStats().handshakeTime;
+      stats->handshakeCpuTime += segment->tlsStats().handshakeCpuTime;
+    }
+    delete segment;
   }
+  run.segmentCount = 0;
+  run.waiting      = false;
+}
+
+// The image is complete: check it and make it the boot partition
+void esp32FotaGsmSSL::verify() {
+  Run &run            = *_run;
+  unsigned long start = millis();
+  run.inflater.end();
+  // The segments weren't hashed on their way in, they are read back from flash
+  if (run.segmentCount > 0 && !hash_partition_range(_writer.partition(), run.segmentsFrom, _writer.size(), &run.sha)) {
+    _metrics.verifyMs = millis() - start;
+    end(FOTA_FAILED);
+    return;
+  }
+  mbedtls_md_finish(&run.sha, _firmwareDigest);
+  _firmwareDigestValid = true;
+  run.prefs.clear();
+
+  if (!_writer.end()) {
+    Serial.println("Error occurred: " + String(_writer.errorString()));
+    _metrics.verifyMs = millis() - start;
+    end(FOTA_FAILED);
+    return;
+  }
+  if (_check_sig) {
+    if (!validate_sig(run.signature, _writer.size())) {
+      const esp_partition_t *partition = esp_ota_get_running_partition();
+      esp_ota_set_boot_partition(partition);
+
+      log_e("Signature check failed!");
+      _signatureRejected = true;
+      _metrics.verifyMs  = millis() - start;
+      end(FOTA_FAILED);
+      return;
+    }
+    log_i("Signature OK");
+  }
+  Serial.println("OTA done!");
+  _metrics.verifyMs = millis() - start;
+  end(FOTA_DONE);
+}
+
+// OTA Logic, the blocking way: runs the update to its end and restarts into the new image
+void esp32FotaGsmSSL::execOTA() {
+  if (!start(false, true)) return;
+  drive();
+  if (_state == FOTA_DONE) {
+    Serial.println("Restart ESP device!");
+    ESP.restart();
+  } else if (_signatureRejected) {
+    // _modem.gprsDisconnect();
+    ESP.restart();
+  }
+}
+
+// One end of an entry's "ids" range, a decimal string or a number; missing gives fallback. false for anything
+// else, which must not widen the range to every device.
+static bool read_device_id(JsonVariant value, uint64_t fallback, uint64_t &id) {
+  if (value.isNull()) {
+    id = fallback;
+    return true;
+  }
+  if (value.is<uint64_t>()) {
+    id = value.as<uint64_t>();
+    return true;
+  }
+  const char *text = value.as<const char *>();
+  char *end        = NULL;
+  if (!text || !isdigit((unsigned char)text[0])) return false;
+  errno = 0;
+  id    = strtoull(text, &end, 10);
+  return errno == 0 && *end == '\0';
 }
 
 bool esp32FotaGsmSSL::checkJSONManifest(JsonVariant JSONDocument) {
-  if (strcmp(JSONDocument["type"].as<const char *>(), _firmwareType.c_str()) != 0) {
+  if (strcmp(JSONDocument["type"] | "", _firmwareType.c_str()) != 0) {
     log_i("Payload type in manifest %s doesn't match current firmware %s", JSONDocument["type"].as<const char *>(), _firmwareType.c_str());
     log_i("Doesn't match type: %s", _firmwareType.c_str());
     return false;  // Move to the next entry in the manifest
   }
   log_i("Payload type in manifest %s matches current firmware %s", JSONDocument["type"].as<const char *>(), _firmwareType.c_str());
 
-  semver_free(&_payloadVersion);
+  // An entry can be limited to a range of device IDs (as getDeviceID() gives them), both ends included
+  if (!JSONDocument["ids"].isNull()) {
+    uint64_t id = ESP.getEfuseMac();
+    uint64_t from, to;
+    if (!JSONDocument["ids"].is<JsonArray>() || !read_device_id(JSONDocument["ids"][0], 0, from) ||
+        !read_device_id(JSONDocument["ids"][1], UINT64_MAX, to)) {
+      log_e("Manifest entry's 'ids' isn't a range of device IDs, skipping it");
+      return false;
+    }
+    if (id < from || id > to) {
+      log_i("Device ID %s is outside the entry's range", getDeviceID().c_str());
+      return false;
+    }
+  }
+
   if (JSONDocument["version"].is<uint16_t>()) {
     log_i("JSON version: %d (int)", JSONDocument["version"].as<uint16_t>());
-    _payloadVersion = semver_t{JSONDocument["version"].as<uint16_t>()};
+    _payloadVersion = SemVer(JSONDocument["version"].as<uint16_t>());
   } else if (JSONDocument["version"].is<const char *>()) {
     log_i("JSON version: %s (semver)", JSONDocument["version"].as<const char *>());
-    if (semver_parse(JSONDocument["version"].as<const char *>(), &_payloadVersion)) {
+    if (!_payloadVersion.parse(JSONDocument["version"].as<const char *>())) {
       log_e("Invalid semver string received in manifest. Defaulting to 0");
-      _payloadVersion = semver_t{0};
     }
   } else {
     log_e("Invalid semver format received in manifest. Defaulting to 0");
-    _payloadVersion = semver_t{0};
+    _payloadVersion = SemVer();
   }
 
-  char version_no[256] = {'\0'};
-  semver_render(&_payloadVersion, version_no);
+  char version_no[SEMVER_RENDER_SIZE];
+  _payloadVersion.render(version_no, sizeof(version_no));
   log_i("Payload firmware version: %s", version_no);
 
   if (JSONDocument["url"].is<String>()) {
     // We were provided a complete URL in the JSON manifest - use it
-    String url = JSONDocument["url"].as<String>();
-    String urlRaw;
-    if (url.substring(0, 5) == "https") {
-      urlRaw        = url.substring(8);
-      _firmwarePort = 443;
-    } else {
-      urlRaw        = url.substring(7);
-      _firmwarePort = 80;
-    }
-    _firmwareHost = urlRaw.substring(0, urlRaw.indexOf('/'));
-    _firmwareBin  = urlRaw.substring(urlRaw.indexOf('/'));
+    split_url(JSONDocument["url"].as<String>(), _firmwareHost, _firmwarePort, _firmwareBin);
 
     if (JSONDocument["host"].is<String>())  // If the manifest provides both, warn the user
       log_w("Manifest provides both url and host - Using URL");
@@ -305,13 +1268,60 @@ bool esp32FotaGsmSSL::checkJSONManifest(JsonVariant JSONDocument) {
     return false;
   }
 
-  if (semver_compare(_payloadVersion, _firmwareVersion) == 1) {
+  // Compressed images need their uncompressed size up front
+  _firmwareCompression = Inflater::formatFromName(JSONDocument["compression"] | "");
+  _firmwareSize        = JSONDocument["size"] | 0;
+  if (_firmwareCompression != Inflater::NONE && _firmwareSize == 0) {
+    log_e("Manifest entry is compressed but has no 'size'");
+    return false;
+  }
+  _uncompressedURL = _firmwareCompression != Inflater::NONE ? JSONDocument["uncompressed"] | "" : "";
+
+  // An entry may name the key and the algorithm its image is signed with, one we can't check is passed over
+  // for the next
+  _keyId              = JSONDocument["key"] | "";
+  _signatureAlgorithm = SignatureVerifier::algorithmFromName(JSONDocument["signature"] | "");
+  if (_check_sig && _keyId.length() > 0 && !signingKey()) {
+    log_i("Manifest entry is signed with key %s, which we don't have", _keyId.c_str());
+    return false;
+  }
+  if (_check_sig && !JSONDocument["signature"].isNull() && signingKey() && _signatureAlgorithm != signingKey()->algorithm()) {
+    log_i("Manifest entry is signed with %s, our key is %s", JSONDocument["signature"].as<const char *>(), SignatureVerifier::algorithmName(signingKey()->algorithm()));
+    return false;
+  }
+
+  // Delta patch against the version we are running, if the manifest offers one
+  _patchURL         = "";
+  _patchCompression = Inflater::NONE;
+  for (JsonVariant patch : JSONDocument["patches"].as<JsonArray>()) {
+    SemVer base;
+    if (patch["base"].is<uint16_t>()) {
+      base = SemVer(patch["base"].as<uint16_t>());
+    } else if (!patch["base"].is<const char *>() || !base.parse(patch["base"].as<const char *>())) {
+      continue;
+    }
+    if (base.compare(_firmwareVersion) == 0 && patch["url"].is<const char *>()) {
+      _patchURL         = patch["url"].as<String>();
+      _patchCompression = Inflater::formatFromName(patch["compression"] | "");
+      log_i("Delta patch available: %s", _patchURL.c_str());
+      break;
+    }
+  }
+
+  if (_payloadVersion.compare(_firmwareVersion) == 1) {
     return true;
   }
   return false;
 }
 
 bool esp32FotaGsmSSL::execHTTPcheck() {
+  if (!start(true, false)) return false;
+  drive();
+  return _state == FOTA_UPDATE_AVAILABLE;
+}
+
+void esp32FotaGsmSSL::startCheck() {
+  Run &run = *_run;
   String useURL;
 
   if (useDeviceID) {
@@ -321,82 +1331,308 @@ bool esp32FotaGsmSSL::execHTTPcheck() {
     useURL = checkURL;
   }
 
+  // Cached result of the last manifest, only valid for the same URL and firmware type
+  run.cacheKey = useURL + "|" + _firmwareType;
+  run.prefs.begin(FOTA_NVS_MANIFEST, false);
+  run.cached = cacheManifest && run.prefs.getString("key") == run.cacheKey;
+
+  // Cache-Control: max-age lets us skip the request entirely
+  if (run.cached && _manifestFetchedAt != 0 && millis() - _manifestFetchedAt < _manifestMaxAge * 1000UL) {
+    log_i("Manifest still fresh, not polling");
+    checked(useCachedManifest(run.prefs));
+    return;
+  }
+
   log_i("Getting HTTP: %s", useURL.c_str());
   log_i("------");
 
-  TinyGsmClient client;
-  client.init(_modem);
-  SSLClient secure_client(&client);
-
-  String urlRaw;
+  // We connect to the host so we need to separate the host and the path
+  String urlHost, urlPath;
   int urlPort;
-  if (useURL.substring(0, 5) == "https") {
-    urlRaw  = useURL.substring(8);
-    urlPort = 443;
-    if (!_allow_insecure_https) secure_client.setCACert(root_ca);
+  split_url(useURL, urlHost, urlPort, urlPath);
+
+  // Conditional request, the server answers 304 if the manifest didn't change
+  String headers;
+  if (run.cached) {
+    String etag         = run.prefs.getString("etag");
+    String lastModified = run.prefs.getString("modified");
+    if (etag.length() > 0) headers += "If-None-Match: " + etag + "\r\n";
+    if (lastModified.length() > 0) headers += "If-Modified-Since: " + lastModified + "\r\n";
+  }
+  // Of an indexed manifest only the index at its start, what else is needed follows from it
+  if (indexedManifest) headers += "Range: bytes=0-" + String(FOTA_INDEX_SIZE - 1) + "\r\n";
+  httpStart(urlHost, urlPort, urlPath, headers, serverTrust(useURL.startsWith("https")));
+}
+
+// Headers of the manifest are in, pollManifest() reads its body over the next steps
+void esp32FotaGsmSSL::finishCheck(int status) {
+  Run &run    = *_run;
+  long maxAge = _response.response().maxAge();
+  if (status == 304 && run.cached) {
+    _connection.release(_response);
+    log_i("Manifest not modified");
+    _manifestFetchedAt = millis();
+    _manifestMaxAge    = maxAge > 0 ? maxAge : 0;
+    checked(useCachedManifest(run.prefs));
+    return;
+  }
+  if (status != 200 && !(status == 206 && indexedManifest)) {
+    log_e("Manifest request failed, HTTP status %d", status);
+    _connection.close();
+    end(FOTA_FAILED);
+    return;
+  }
+  // The manifest is split into its entries as it arrives and each is parsed on its own, so memory use
+  // doesn't depend on the number of entries
+  if (!run.reader.begin(FOTA_MANIFEST_ENTRY_TEXT)) {
+    log_e("malloc failed");
+    _connection.close();
+    end(FOTA_FAILED);
+    return;
+  }
+  _firmwareHost = "";  // Tells us afterwards whether there was an entry for our type at all
+  _patchURL     = "";
+  // The index at the start of the file tells where the entries for our type are. A 206 has only the
+  // index, the entries take a second Range request; a 200 (no Range support, or the file changed
+  // since the index was read) has the whole file, the entries are further down the same response.
+  run.indexing       = indexedManifest && (!run.indexed || status == 200);
+  run.indexText      = "";
+  run.manifestFrom   = 0;
+  run.manifestAt     = millis();
+  run.lastData       = run.manifestAt;
+  run.manifestStatus = status;
+}
+
+// One step of the manifest body: what has arrived of it, at most a stream buffer's worth. An entry is
+// parsed from memory once it is complete, the first one checkJSONManifest() takes ends the check.
+void esp32FotaGsmSSL::pollManifest() {
+  Run &run = *_run;
+  int c    = -1;
+  size_t n = 0;
+  for (; n < HTTP_STREAM_BUFFER && (c = _response.read()) >= 0; n++) {
+    if (run.indexing) {
+      // The buckets close the index, tools/fota_index.py keeps it within FOTA_INDEX_SIZE
+      run.indexText += (char)c;
+      if (run.indexText.length() < FOTA_INDEX_SIZE && !run.indexText.endsWith("]}")) continue;
+      if (!indexRead()) return;
+    } else if (_response.position() > run.manifestFrom && !manifestByte(c)) {
+      return;
+    }
+  }
+  if (n > 0) {
+    run.lastData = millis();
+    return;
+  }
+  if (!_response.finished()) {
+    if (millis() - run.lastData < FOTA_STALL_TIMEOUT) {
+      run.idle = true;
+      return;
+    }
+    log_e("Manifest stalled");
+  } else if (run.indexing) {
+    indexRead();  // A file shorter than FOTA_INDEX_SIZE
+    return;
   } else {
-    urlRaw  = useURL.substring(7);
-    urlPort = 80;
-  }
-  // SSLClient connect to the host so we need to separate the host and the path
-  String urlHost = urlRaw.substring(0, urlRaw.indexOf('/'));
-  String urlPath = urlRaw.substring(urlRaw.indexOf('/'));
-  if (!secure_client.connect(urlHost.c_str(), urlPort)) log_i("fail! Retrying...\r\n");
-  log_i("OK\r\n");
-
-  // Make a HTTP request:
-  secure_client.print(String("GET ") + urlPath + " HTTP/1.1\r\n");
-  secure_client.print(String("Host: ") + urlHost + "\r\n");
-  secure_client.print("Connection: close\r\n\r\n");
-
-  // TODO: Add check http code
-  while (secure_client.connected()) {
-    String line = secure_client.readStringUntil('\n');
-    if (line == "\r") {
-      break;
-    }  // if line only contain '\r', it's the end of headers
+    log_e("Parsing failed: manifest ends early");
+  }
+  finishManifest(false, false);
+}
+
+// The index of an indexed manifest is in indexText: skip to the entries for our type, or ask for them with a
+// second request. False once the check went on without this response.
+bool esp32FotaGsmSSL::indexRead() {
+  Run &run     = *_run;
+  run.indexing = false;
+  uint32_t offset, length;
+  if (!findManifestBucket(run.indexText.c_str(), offset, length)) {
+    log_e("Parsing failed: no index at the start of the indexed manifest");
+    finishManifest(false, false);
+    return false;
+  }
+  if (length == 0) {
+    log_i("Manifest index has no entries for %s", _firmwareType.c_str());
+    finishManifest(true, false);
+    return false;
+  }
+  if (offset < _response.position()) {
+    log_e("Parsing failed: manifest index points into itself");
+    finishManifest(false, false);
+    return false;
+  }
+  if (run.manifestStatus == 200) {
+    run.manifestFrom = offset;
+    return true;
   }
+  String etag = _response.response().etag();
+  _connection.release(_response);
+  _metrics.manifestMs += millis() - run.manifestAt;
+  run.reader.end();
+  run.manifestStatus = 0;
+  run.indexed        = true;
+  String host        = _request.host;
+  String path        = _request.path;
+  String headers     = "Range: bytes=" + String(offset) + "-" + String(offset + length - 1) + "\r\n";
+  if (etag.length() > 0) headers += "If-Range: " + etag + "\r\n";
+  httpStart(host, _request.port, path, headers, _request.trust);
+  return false;
+}
 
-  long timeout = millis();
-  String payload;
+// Only the keys checkJSONManifest() looks at
+static void manifest_filter(JsonDocument &filter) {
+  filter["type"]                      = true;
+  filter["ids"]                       = true;
+  filter["version"]                   = true;
+  filter["url"]                       = true;
+  filter["host"]                      = true;
+  filter["port"]                      = true;
+  filter["bin"]                       = true;
+  filter["compression"]               = true;
+  filter["size"]                      = true;
+  filter["uncompressed"]              = true;
+  filter["signature"]                 = true;
+  filter["key"]                       = true;
+  filter["patches"][0]["base"]        = true;
+  filter["patches"][0]["url"]         = true;
+  filter["patches"][0]["compression"] = true;
+}
 
-  while (secure_client.connected() && millis() - timeout < 30000L) {  // Timeout should be at least 20s for TTGO SIM7000G
-    while (secure_client.available()) {
-      char c = secure_client.read();
-      payload.concat(c);
-      timeout = millis();
+// Next byte of the manifest's entries. False once the manifest is done with, a complete entry is
+// parsed right away and the first one checkJSONManifest() takes is the match.
+bool esp32FotaGsmSSL::manifestByte(char c) {
+  Run &run                      = *_run;
+  ManifestReader::Result result = run.reader.feed(c);
+  if (result == ManifestReader::MORE) return true;
+  if (result == ManifestReader::FAILED) {
+    log_e("Parsing failed: %s", run.reader.error());
+    finishManifest(false, false);
+    return false;
+  }
+  if (result == ManifestReader::ENTRY) {
+    StaticJsonDocument<256> filter;
+    manifest_filter(filter);
+    DynamicJsonDocument JSONDocument(FOTA_MANIFEST_ENTRY_SIZE);
+    DeserializationError err = deserializeJson(JSONDocument, run.reader.entry(), run.reader.length(), DeserializationOption::Filter(filter));
+    if (err) {  // Check for errors in parsing
+      log_e("Parsing failed: %s", err.c_str());
+      finishManifest(false, false);
+      return false;
     }
+    if (checkJSONManifest(JSONDocument.as<JsonVariant>())) {
+      finishManifest(true, true);
+      return false;
+    }
+    if (!run.reader.done()) return true;
+  }
+  finishManifest(true, false);  // Through to the end without a match
+  return false;
+}
+
+// The manifest check is through: parsed tells whether the manifest was valid JSON, found whether it had
+// an entry for us. The connection stays open for the download if the server allows it.
+void esp32FotaGsmSSL::finishManifest(bool parsed, bool found) {
+  Run &run                         = *_run;
+  const HttpResponseParser &parser = _response.response();
+  String etag                      = parser.etag();
+  String lastModified              = parser.lastModified();
+  long maxAge                      = parser.maxAge();
+  run.reader.end();
+  run.indexText      = "";
+  run.manifestStatus = 0;
+  _connection.release(_response);
+  _metrics.manifestMs += millis() - run.manifestAt;
+
+  if (cacheManifest && parsed && (etag.length() > 0 || lastModified.length() > 0 || maxAge > 0)) {
+    char version_no[SEMVER_RENDER_SIZE];
+    _payloadVersion.render(version_no, sizeof(version_no));
+    run.prefs.putString("key", run.cacheKey);
+    run.prefs.putString("etag", etag);
+    run.prefs.putString("modified", lastModified);
+    run.prefs.putString("host", _firmwareHost);
+    run.prefs.putUInt("port", _firmwarePort);
+    run.prefs.putString("bin", _firmwareBin);
+    run.prefs.putUChar("compression", _firmwareCompression);
+    run.prefs.putUInt("size", _firmwareSize);
+    run.prefs.putString("uncompressed", _uncompressedURL);
+    run.prefs.putString("patch", _patchURL);
+    run.prefs.putUChar("patchcomp", _patchCompression);
+    run.prefs.putUChar("sigalg", _signatureAlgorithm);
+    run.prefs.putString("keyid", _keyId);
+    run.prefs.putString("version", version_no);
+    _manifestFetchedAt = millis();
+    _manifestMaxAge    = maxAge > 0 ? maxAge : 0;
+  } else if (parsed) {
+    run.prefs.remove("key");
   }
 
-  int str_len = payload.length() + 1;
-  char JSONMessage[str_len];
-  payload.toCharArray(JSONMessage, str_len);
+  if (!parsed) {
+    end(FOTA_FAILED);
+    return;
+  }
+  checked(found);  // Not found if we didn't get a hit against the above
+}
 
-  DynamicJsonDocument JSONResult(2048);
-  DeserializationError err = deserializeJson(JSONResult, JSONMessage);
+// FNV-1a, what tools/fota_index.py spreads the types of an indexed manifest over its buckets with
+static uint32_t index_hash(const char *key) {
+  uint32_t hash = 2166136261UL;
+  while (*key) hash = (hash ^ (uint8_t)*key++) * 16777619UL;
+  return hash;
+}
 
-  // We're done with HTTP - free the resources
-  secure_client.stop();
-  client.stop();
+// Next unsigned number in the text, skipping whatever comes before it. False if the text ends first.
+static bool read_index_number(const char *&in, uint32_t &value) {
+  while (*in && !isdigit((unsigned char)*in)) in++;
+  if (!*in) return false;
+  char *end;
+  value = strtoul(in, &end, 10);
+  in    = end;
+  return true;
+}
 
-  if (err) {  // Check for errors in parsing
-    log_e("Parsing failed");
-    return false;
+// Looks up the bucket our type hashes to in the index at the start of an indexed manifest: offset and
+// length of the array with its entries in the file. Reads the index as text instead of parsing it, so its
+// size doesn't matter for the heap. The format is described in tools/fota_index.py.
+bool esp32FotaGsmSSL::findManifestBucket(const char *index, uint32_t &offset, uint32_t &length) {
+  uint32_t count, skip;
+  const char *in = strstr(index, "\"count\":");
+  if (!in || !read_index_number(in, count) || count == 0 || !(in = strstr(in, "\"buckets\":["))) return false;
+  uint32_t bucket = index_hash(_firmwareType.c_str()) % count;
+  for (uint32_t i = 0; i < 2 * bucket; i++) {
+    if (!read_index_number(in, skip)) return false;
   }
+  return read_index_number(in, offset) && read_index_number(in, length);
+}
 
-  if (JSONResult.is<JsonArray>()) {
-    // We already received an array of multiple firmware types
-    JsonArray arr = JSONResult.as<JsonArray>();
-    for (JsonVariant JSONDocument : arr) {
-      if (checkJSONManifest(JSONDocument)) {
-        return true;
-      }
-    }
-  } else if (JSONResult.is<JsonObject>()) {
-    if (checkJSONManifest(JSONResult.as<JsonVariant>())) return true;
+// The manifest check is done, found tells whether it has a newer version for us
+void esp32FotaGsmSSL::checked(bool found) {
+  _run->prefs.end();
+  if (!found) {
+    end(FOTA_UP_TO_DATE);
+  } else if (!_run->update) {
+    end(FOTA_UPDATE_AVAILABLE);
+  } else {
+    startUpdate();
   }
+}
 
-  return false;  // We didn't get a hit against the above, return false
+// Restore the firmware target from the last manifest without parsing it again
+bool esp32FotaGsmSSL::useCachedManifest(Preferences &prefs) {
+  _firmwareHost        = prefs.getString("host");
+  _firmwarePort        = prefs.getUInt("port");
+  _firmwareBin         = prefs.getString("bin");
+  _patchURL            = prefs.getString("patch");
+  _firmwareCompression = (Inflater::Format)prefs.getUChar("compression");
+  _firmwareSize        = prefs.getUInt("size");
+  _uncompressedURL     = prefs.getString("uncompressed");
+  _patchCompression    = (Inflater::Format)prefs.getUChar("patchcomp");
+  _signatureAlgorithm  = (SignatureVerifier::Algorithm)prefs.getUChar("sigalg");
+  _keyId               = prefs.getString("keyid");
+  if (_firmwareHost.length() == 0) {
+    log_i("Cached manifest has no entry for %s", _firmwareType.c_str());
+    return false;
+  }
+
+  _payloadVersion.parse(prefs.getString("version").c_str());
+  return _payloadVersion.compare(_firmwareVersion) == 1;
 }
 
 String esp32FotaGsmSSL::getDeviceID() {
@@ -408,18 +1644,21 @@ String esp32FotaGsmSSL::getDeviceID() {
   return thisID;
 }
 
+// An image given by URL has none of what a manifest entry says about it, so nothing of the last check may stick
+void esp32FotaGsmSSL::forceImage(boolean validate) {
+  _patchURL            = "";
+  _firmwareCompression = Inflater::NONE;
+  _firmwareSize        = 0;
+  _uncompressedURL     = "";
+  _signatureAlgorithm  = SignatureVerifier::NONE;
+  _keyId               = "";
+  _check_sig           = validate;
+}
+
 // Force a firmware update regardless on current version
 void esp32FotaGsmSSL::forceUpdate(String firmwareURL, boolean validate) {
-  String urlRaw;
-  if (firmwareURL.substring(0, 5) == "https") {
-    urlRaw        = firmwareURL.substring(8);
-    _firmwarePort = 443;
-  } else {
-    urlRaw        = firmwareURL.substring(7);
-    _firmwarePort = 80;
-  }
-  _firmwareHost = urlRaw.substring(0, urlRaw.indexOf('/'));
-  _firmwareBin  = urlRaw.substring(urlRaw.indexOf('/'));
+  split_url(firmwareURL, _firmwareHost, _firmwarePort, _firmwareBin);
+  forceImage(validate);
   execOTA();
 }
 
@@ -427,7 +1666,7 @@ void esp32FotaGsmSSL::forceUpdate(String firmwareHost, uint16_t firmwarePort, St
   _firmwareHost = firmwareHost;
   _firmwareBin  = firmwarePath;
   _firmwarePort = firmwarePort;
-  _check_sig    = validate;
+  forceImage(validate);
   execOTA();
 }
 
@@ -453,9 +1692,29 @@ int esp32FotaGsmSSL::getPayloadVersion() {
   return _payloadVersion.major;
 }
 
-void esp32FotaGsmSSL::getPayloadVersion(char *version_string) { semver_render(&_payloadVersion, version_string); }
+void esp32FotaGsmSSL::getPayloadVersion(char *version_string) { _payloadVersion.render(version_string, SEMVER_RENDER_SIZE); }
+
+PipelineStats esp32FotaGsmSSL::getPipelineStats() { return _pipelineStats; }
+
+TlsStats esp32FotaGsmSSL::getTlsStats() { return _tlsStats; }
+
+uint32_t esp32FotaGsmSSL::getProgress() {
+  uint32_t progress = _writer.progress();
+  if (_run && progress < _writer.size()) {
+    for (int i = 0; i < _run->segmentCount; i++) progress += _run->segments[i]->written();
+  }
+  return progress;
+}
+
+void esp32FotaGsmSSL::closeIdleConnection() { _connection.closeIfIdle(connectionLinger); }
 
 void esp32FotaGsmSSL::setModem(TinyGsm &modem, int led, int pwr, int baud, int rx, int tx) {
+  _connection.close();
+  _socket.init(&modem);
+  _modemHttp.init(&modem);
+  for (int i = 0; i < FOTA_MAX_SOCKETS - 1; i++) {
+    if (_segmentSockets[i]) _segmentSockets[i]->init(&modem, i + 1);
+  }
   _modem     = &modem;
   _ledPin    = led;
   _pwrPin    = pwr;
@@ -465,114 +1724,156 @@ void esp32FotaGsmSSL::setModem(TinyGsm &modem, int led, int pwr, int baud, int r
 }
 
 void esp32FotaGsmSSL::turnModemOn() {
-  unsigned long current = millis();
   digitalWrite(_ledPin, LOW);
   digitalWrite(_pwrPin, LOW);
-  while (millis() - current < 1000) {
-    ;
-  }  // Datasheet Ton minutes = 1S
+  delay(1000);  // Datasheet Ton minutes = 1S
   digitalWrite(_pwrPin, HIGH);
 }
 
 void esp32FotaGsmSSL::turnModemOff() {
-  unsigned long current = millis();
   digitalWrite(_pwrPin, LOW);
-  while (millis() - current < 1500) {
-    ;
-  }  // Datasheet Ton minutes = 1.2S
+  delay(1500);  // Datasheet Ton minutes = 1.2S
   digitalWrite(_pwrPin, HIGH);
   digitalWrite(_ledPin, LOW);
 }
 
+// The waits below yield to other tasks, they don't spin. turnModemOff() already takes longer than the
+// 1s the modem needs to be off; after the power key the modem is polled with AT until it has booted,
+// instead of waiting the 5s it may take.
 void esp32FotaGsmSSL::modemRestart() {
-  unsigned long current = millis();
   turnModemOff();
-  while (millis() - current < 1000) {
-    ;
-  }
-  current = millis();
   turnModemOn();
-  while (millis() - current < 5000) {
-    ;
+  if (_modem) {
+    _modem->testAT(FOTA_MODEM_BOOT_TIMEOUT);
+  } else {
+    delay(4000);
   }
 }
 
-void esp32FotaGsmSSL::readyUpModem(TinyGsm &modem, const char *apn, const char *user, const char *pass) {
+// Nothing here waits a fixed time: the modem is polled until it answers AT and until it is registered
+// (waitForNetwork() checks every 250ms). The operator and access technology of the last registration are
+// kept in NVS and selected right away with AT+COPS=4, manual with automatic fallback, which spares the
+// modem the search over all bands an automatic selection starts with.
+bool esp32FotaGsmSSL::readyUpModem(TinyGsm &modem, const char *apn, const char *user, const char *pass) {
+  unsigned long start = millis();
+  _attachMetrics      = {};
+  auto finish         = [&](bool attached) {
+    _attachMetrics.attached = attached;
+    _attachMetrics.totalMs  = millis() - start;
+    log_i("Attach %s in %u ms (modem %u, registration %u%s, data %u)", attached ? "done" : "failed", _attachMetrics.totalMs, _attachMetrics.modemMs,
+          _attachMetrics.registerMs, _attachMetrics.cached ? " from cache" : "", _attachMetrics.dataMs);
+    return attached;
+  };
+
   Serial1.begin(_modemBaud, SERIAL_8N1, _modemRX, _modemTX);
   Serial.print("Initializing modem...");
   if (!modem.init()) {
     Serial.print(" fail... restarting modem...");
+    _attachMetrics.restarted = true;
     modemRestart();
     if (!modem.restart()) {
       Serial.println(" fail... even after restart");
-      return;
+      _attachMetrics.modemMs = millis() - start;
+      return finish(false);
     }
   }
   Serial.println(" OK");
 
-  if (!modem.testAT()) {
+  if (!modem.testAT(FOTA_AT_TIMEOUT)) {
     Serial.println("Failed to restart modem, attempting to continue without restarting");
+    _attachMetrics.restarted = true;
     modemRestart();
-    return;
+    _attachMetrics.modemMs = millis() - start;
+    return finish(false);
   }
+  _attachMetrics.modemMs = millis() - start;
 
   // General information
   Serial.println("Modem Name: " + modem.getModemName());
   Serial.println("Modem Info: " + modem.getModemInfo());
 
-  unsigned long current = millis();
-  // Set modes. Only use 2 and 13
-  modem.setNetworkMode(2);
-  while (millis() - current < 3000) {
-    ;
-  }
+  // Set modes. Only use 2 and 13. A new mode starts the registration over, so only when it changes.
+  unsigned long registering = millis();
+  if (modem.getNetworkMode() != 2) modem.setNetworkMode(2);
 
   // Choose IoT mode. Only use if the SIM provider supports
-  // current = millis()
   // _sim_modem.setPreferredMode(3);
-  // while (millis() - current < 3000) {
-  //   ;
-  // }
 
-  // Wait for network availability
-  Serial.print("Waiting for network...");
-  if (!modem.waitForNetwork()) {
-    current = millis();
-    Serial.println(" fail");
-    while (millis() - current < 10000) {
-      ;
+  Preferences prefs;
+  prefs.begin(FOTA_NVS_NETWORK, false);
+  String oper = prefs.getString("oper");
+  if (oper.length() > 0) {
+    int format = prefs.getInt("format", 2);
+    int act    = prefs.getInt("act", -1);
+    Serial.print("Selecting operator " + oper + "...");
+    if (act >= 0) {
+      modem.sendAT(GF("+COPS=4,"), format, GF(",\""), oper, GF("\","), act);
+    } else {
+      modem.sendAT(GF("+COPS=4,"), format, GF(",\""), oper, GF("\""));
     }
-    return;
+    _attachMetrics.cached = modem.waitResponse(FOTA_COPS_TIMEOUT) == 1;
+    Serial.println(_attachMetrics.cached ? " OK" : " fail");
   }
-  Serial.println(" OK");
 
-  // Connect to the GPRS network
-  Serial.print("Connecting to network...");
-  if (!modem.isNetworkConnected()) {
-    current = millis();
+  // Wait for network availability
+  Serial.print("Waiting for network...");
+  if (!modem.waitForNetwork() || !modem.isNetworkConnected()) {
     Serial.println(" fail");
-    while (millis() - current < 10000) {
-      ;
+    // Whatever was kept didn't help, the next try searches from scratch
+    if (oper.length() > 0) {
+      prefs.clear();
+      modem.sendAT(GF("+COPS=0"));
+      modem.waitResponse(FOTA_COPS_TIMEOUT);
     }
-    return;
+    prefs.end();
+    _attachMetrics.registerMs = millis() - registering;
+    return finish(false);
   }
   Serial.println(" OK");
+  _attachMetrics.registerMs = millis() - registering;
+  saveRegistration(modem, prefs);
+  prefs.end();
 
   // Connect to APN
+  unsigned long connecting = millis();
   Serial.print("Connecting to APN: ");
   Serial.print(apn);
-  if (!modem.gprsConnect(apn, user, pass)) {
+  bool connected        = modem.gprsConnect(apn, user, pass);
+  _attachMetrics.dataMs = millis() - connecting;
+  if (!connected) {
     Serial.println(" fail");
-    return;
+    return finish(false);
   }
   digitalWrite(_ledPin, HIGH);
   Serial.println(" OK");
+  finish(true);
 
-  // More info..
+  // More info.. (after the attach time was taken, these are extra AT round trips)
   Serial.println("");
   Serial.println("CCID: " + modem.getSimCCID());
   Serial.println("IMEI: " + modem.getIMEI());
   Serial.println("Operator: " + modem.getOperator());
-  Serial.println("Local IP: " + String(modem.localIP()));
+  Serial.println("Local IP: " + modem.localIP().toString());
   Serial.println("Signal quality: " + String(modem.getSignalQuality()));
+  return true;
+}
+
+// Keeps the operator and access technology the modem registered on, written only when they changed
+void esp32FotaGsmSSL::saveRegistration(TinyGsm &modem, Preferences &prefs) {
+  modem.sendAT(GF("+COPS?"));
+  if (modem.waitResponse(FOTA_AT_TIMEOUT, GF("+COPS:")) != 1) return;
+  String status = modem.stream.readStringUntil('\n');  // <mode>,<format>,"<oper>"[,<AcT>]
+  modem.waitResponse(FOTA_AT_TIMEOUT);
+  int comma = status.indexOf(',');
+  int quote = status.indexOf('"');
+  int end   = quote < 0 ? -1 : status.indexOf('"', quote + 1);
+  if (comma < 0 || quote < comma || end < 0) return;
+  int format  = status.substring(comma + 1).toInt();
+  String oper = status.substring(quote + 1, end);
+  int next    = status.indexOf(',', end);
+  int act     = next < 0 ? -1 : status.substring(next + 1).toInt();
+  if (oper == prefs.getString("oper") && format == prefs.getInt("format", 2) && act == prefs.getInt("act", -1)) return;
+  prefs.putString("oper", oper);
+  prefs.putInt("format", format);
+  prefs.putInt("act", act);
 }
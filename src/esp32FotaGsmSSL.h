@@ -10,13 +10,90 @@
 #include <Arduino.h>
 #include <ArduinoJson.h>
 
+#include <functional>
+
 #define TINY_GSM_MODEM_SIM7000
 #include <TinyGsmClient.h>
+#include <Preferences.h>
+
+#include "delta/DeltaPatcher.h"
+#include "http/HttpBodyStream.h"
+#include "http/HttpConnection.h"
+#include "http/ModemHttpClient.h"
+#include "mbedtls/md.h"
+#include "ota/DownloadPipeline.h"
+#include "ota/Inflater.h"
+#include "ota/PartitionWriter.h"
+#include "ota/SegmentFetcher.h"
+#include "semver/SemVer.h"
+#include "sig/KeyStore.h"
+#include "sig/SignatureVerifier.h"
+#include "tls/TlsClient.h"
+#include "tls/TlsTrust.h"
 
-#include "semver/semver.h"
+#define FOTA_MAX_SOCKETS 4  // Highest downloadSockets, every socket takes a TLS context and a sector buffer
 
 class esp32FotaGsmSSL {
  public:
+  // Where an update started with begin() is, as returned by poll()
+  enum State {
+    FOTA_IDLE,              // Nothing started yet, or abort()ed
+    FOTA_CHECKING,          // Fetching and parsing the manifest
+    FOTA_CONNECTING,        // Opening the connection (and TLS handshake) for the image or patch
+    FOTA_REQUESTING,        // Request sent, waiting for the response headers
+    FOTA_DOWNLOADING,       // Writing the body to flash
+    FOTA_VERIFYING,         // Digest and signature check, switching the boot partition
+    FOTA_UP_TO_DATE,        // The manifest has nothing newer
+    FOTA_UPDATE_AVAILABLE,  // Only checked (execHTTPcheck()), the manifest has a newer version
+    FOTA_DONE,              // New image is the boot partition, restart whenever it suits the application
+    FOTA_FAILED
+  };
+  // What one run took, from begin() (or execHTTPcheck()/execOTA()) to its end state. Times in ms, rates in
+  // bytes per second. Phases add up over all requests of the run; TLS handshake time is in tls.handshakeTime.
+  struct Metrics {
+    State result;
+    uint32_t totalMs;
+    uint32_t connectMs;       // Opening sockets, DNS and TCP on the modem
+    uint32_t firstByteMs;     // From sending a request to having its response headers
+    uint32_t manifestMs;      // Parsing the manifest
+    uint32_t transferMs;      // Reading image and patch bodies
+    uint32_t flashMs;         // Erasing and writing flash, overlaps transferMs when the pipeline is on
+    uint32_t writeStallMs;    // Part of flashMs the writes waited for their sector to be erased, none erased ahead
+    uint32_t eraseAheadMs;    // Erasing ahead of the writes while waiting on the network (eraseAhead)
+    uint32_t verifyMs;        // Digest, signature check and switching the boot partition
+    uint32_t bytesReceived;   // On the wire, TLS records and HTTP headers included
+    uint32_t bytesSent;
+    uint32_t bodyBytes;       // Image and patch bodies as they came, so compressed or patch size
+    uint32_t bytesWritten;    // Image bytes written to flash
+    uint32_t bytesCopied;     // Of those, copied into the flash writer's sector buffer instead of read or flashed in place
+    uint32_t averageRate;     // bodyBytes over transferMs
+    uint32_t currentRate;     // Over the last second of the transfer, updated while it runs
+    uint32_t peakRate;        // Best second of the transfer
+    uint16_t requests;
+    uint16_t attempts;        // Image downloads started, more than one means retries
+    uint16_t reconnects;      // Kept connections the server had closed, retried on a new one
+    uint16_t redirects;
+    bool deltaFallback;       // The patch failed and the full image was downloaded instead
+    bool inflateFallback;     // A compressed download broke off, the rest came from the uncompressed image
+    uint16_t segments;        // Parts of the image fetched over extra sockets (downloadSockets)
+    uint16_t segmentRetries;  // Reconnects of those
+    uint16_t modemRequests;   // Requests the modem's HTTPS service answered (modemHttp)
+    uint32_t minFreeHeap;     // Lowest free heap seen while running
+    uint32_t peakHeap;        // Most heap the run held at once, over what was in use when it started
+    TlsStats tls;
+    PipelineStats pipeline;
+  };
+  typedef std::function<void(const Metrics& metrics)> MetricsCallback;
+  // How the last readyUpModem() went. Times in ms, the phases add up to about totalMs.
+  struct AttachMetrics {
+    bool attached;        // Registered and the data connection is up
+    uint32_t totalMs;
+    uint32_t modemMs;     // Until the modem answered AT, power cycles included
+    uint32_t registerMs;  // Network registration
+    uint32_t dataMs;      // Bringing up the data connection (APN)
+    bool cached;          // Registration started with the operator and access technology kept from last time
+    bool restarted;       // The modem had to be power cycled
+  };
   esp32FotaGsmSSL(String firwmareType, int firwmareVersion, boolean validate = false, boolean allow_insecure_https = false);
   esp32FotaGsmSSL(String firwmareType, String firmwareSemanticVersion, boolean validate = false, boolean allow_insecure_https = false);
   ~esp32FotaGsmSSL();
@@ -25,30 +102,148 @@ class esp32FotaGsmSSL {
   void forceUpdate(boolean validate);
   void execOTA();
   bool execHTTPcheck();
+  // Non-blocking update: begin() starts it (with the manifest check first if check is set, otherwise with
+  // the image from the last check or forceUpdate()), then call poll() from loop() until it returns FOTA_DONE,
+  // FOTA_UP_TO_DATE or FOTA_FAILED. Each poll() does a bounded amount of work, at most a sector of the body.
+  bool begin(bool check = true);
+  State poll();
+  State state() { return _state; }
+  bool isRunning() { return _run != NULL; }
+  void abort();  // Stops a running update, a partly written image is resumed by the next one
+  uint32_t getProgress();
+  uint32_t getSize() { return _writer.size(); }
+  static const char* stateName(State state);
+  // Record of the running or the last run, and a callback that gets it whenever a run ends
+  const Metrics& getMetrics() { return _metrics; }
+  void onMetrics(MetricsCallback callback) { _metricsCallback = callback; }
+  const AttachMetrics& getAttachMetrics() { return _attachMetrics; }
   int getPayloadVersion();
-  void getPayloadVersion(char* version_string);
+  void getPayloadVersion(char* version_string);  // version_string takes SEMVER_RENDER_SIZE bytes
   bool useDeviceID;
   String checkURL;
   bool validate_sig(unsigned char* signature, uint32_t firmware_size);
+  // Checks signatures with verifier alone, which stays the caller's; NULL goes back to /rsa_key.pub
+  void setSignatureVerifier(SignatureVerifier* verifier);
+  KeyStore keys;   // Keys signatures are checked against, selected by the manifest entry's "key"; /rsa_key.pub if empty
+  TlsTrust trust;  // Roots and key pins HTTPS servers are checked against; root_ca from ca_cert.h if empty
+  bool recheckPartition          = false;   // Also re-read the written partition to confirm the digest hashed while downloading
+  int downloadRetries            = 5;       // Reconnects allowed per execOTA(), each one resumes with an HTTP Range request
+  int pipelineBuffers            = 4;       // Sector buffers between the network and the flash writer task, 0 writes inline
+  size_t eraseAhead              = 131072;  // Bytes past the write position erased while waiting on the network, 0 erases each sector as its data arrives
+  int downloadSockets            = 1;       // Modem sockets a full uncompressed image is fetched over at once, in segments (up to FOTA_MAX_SOCKETS)
+  bool modemHttp                 = false;   // HTTPS on the modem's own TLS/HTTP stack (AT+SH*), TLS on the ESP32 if that fails
+  bool cacheManifest             = true;    // Conditional manifest requests (ETag/Last-Modified, max-age) with the result kept in NVS
+  bool indexedManifest           = false;   // checkURL is an index made by tools/fota_index.py, only the entries for our type are fetched
+  bool resumeTls                 = true;    // Resume the TLS session of the previous connection to the same server
+  uint16_t tlsFragmentLength     = 0;       // Largest TLS record asked of the server (512, 1024, 2048 or 4096), 0 for full 16 KB records
+  unsigned long connectionLinger = 30000L;  // ms an idle connection is kept for the next request to the same server, 0 closes it after each
+  PipelineStats getPipelineStats();
+  TlsStats getTlsStats();
+  void closeIdleConnection();  // Call from loop() to hang up once the connection was idle for connectionLinger
   void modemRestart();
-  void readyUpModem(TinyGsm& modem, const char* apn, const char* user, const char* pass);
+  bool readyUpModem(TinyGsm& modem, const char* apn, const char* user, const char* pass);  // false if the modem isn't online
   void setModem(TinyGsm& modem, int led, int pwr, int baud, int rx, int tx);
 
  private:
   String getDeviceID();
   String _firmwareType;
-  semver_t _firmwareVersion = {0};
-  semver_t _payloadVersion  = {0};
+  SemVer _firmwareVersion;
+  SemVer _payloadVersion;
   String _firmwareHost;
   String _firmwareBin;
+  String _patchURL;
+  Inflater::Format _firmwareCompression = Inflater::NONE;
+  Inflater::Format _patchCompression    = Inflater::NONE;
+  uint32_t _firmwareSize                = 0;  // Uncompressed size of a compressed image
+  String _uncompressedURL;                    // The same image uncompressed, to continue a compressed download that broke off
   int _firmwarePort;
   boolean _check_sig;
+  SignatureVerifier::Algorithm _signatureAlgorithm = SignatureVerifier::NONE;  // As the manifest entry declared it, NONE if it didn't
+  String _keyId;                                                              // Key the manifest entry is signed with, "" for the default
+  uint32_t _defaultKeyTried = 0;                                              // keys.changes() when /rsa_key.pub was last tried, 0 for never
+  SignatureVerifier* signingKey();
+  void forceImage(boolean validate);
+  SignatureVerifier::Algorithm signatureAlgorithm();
+  size_t signatureLength();
   boolean _allow_insecure_https;
+  TlsTrust* serverTrust(bool https);
   bool checkJSONManifest(JsonVariant JSONDocument);
+  bool findManifestBucket(const char* index, uint32_t& offset, uint32_t& length);
+  bool useCachedManifest(Preferences& prefs);
+  unsigned long _manifestFetchedAt = 0;
+  unsigned long _manifestMaxAge    = 0;
+  // GET request advanced by httpPoll(), following up to FOTA_MAX_REDIRECTS redirects into _response
+  struct Request {
+    String host;
+    int port;
+    String path;
+    String headers;
+    TlsTrust* trust;
+    int hops;
+    bool connecting;
+    bool sent;
+    bool reused;
+    unsigned long connectAt;
+    unsigned long sentAt;
+  };
+  void httpStart(const String& host, int port, const String& path, const String& headers, TlsTrust* trust);
+  int httpPoll();
+  // Everything one begin() ... poll() run needs, allocated by start() and freed by end()
+  struct Run;
+  bool start(bool check, bool update);
+  void end(State state);
+  void drive();
+  void startCheck();
+  void finishCheck(int status);
+  void pollManifest();
+  bool indexRead();
+  bool manifestByte(char c);
+  void finishManifest(bool parsed, bool found);
+  void checked(bool found);
+  void startUpdate();
+  void startDelta();
+  void startAttempt();
+  void useUncompressed();
+  void nextAttempt();
+  void failUpdate();
+  void pollRequest();
+  void deltaHeaders(int status);
+  void imageHeaders(int status);
+  void startBody(size_t length, size_t sigLength, bool fresh);
+  void bodyReady();
+  void pollBody();
+  void endBody();
+  size_t mainEnd();
+  size_t eraseUntil();
+  void mainDone();
+  void startSegments();
+  void pollSegments();
+  void dropSegments();
+  void verify();
+  State _state = FOTA_IDLE;
+  Run* _run    = NULL;
+  Request _request;
+  HttpBodyStream _response;
+  bool _signatureRejected = false;
+  void sampleMetrics();
+  Metrics _metrics = {};
+  AttachMetrics _attachMetrics = {};
+  MetricsCallback _metricsCallback;
+  PartitionWriter _writer;
+  PipelineStats _pipelineStats = {0};
+  TlsSession _tlsSession;
+  TlsStats _tlsStats = {0};
+  TinyGsmClient _socket;
+  ModemHttpClient _modemHttp;
+  HttpConnection _connection{_socket};
+  TinyGsmClient* _segmentSockets[FOTA_MAX_SOCKETS - 1] = {};  // Made on first use and kept, TinyGSM remembers its sockets
+  unsigned char _firmwareDigest[32];
+  bool _firmwareDigestValid = false;
   void turnModemOn();
   void turnModemOff();
+  void saveRegistration(TinyGsm& modem, Preferences& prefs);
   int _ledPin, _pwrPin, _modemBaud, _modemRX, _modemTX;
-  TinyGsm* _modem;
+  TinyGsm* _modem = NULL;
 };
 
 #endif
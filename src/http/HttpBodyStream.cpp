@@ -0,0 +1,99 @@
+/*
+   HTTP response reader on top of an Arduino Client
+   Purpose: Reads the response headers through HttpResponseParser and exposes the decoded body,
+            either as a Stream (for ArduinoJson) or block-wise straight into a caller buffer
+*/
+
+#include "HttpBodyStream.h"
+
+void HttpBodyStream::begin(Client &client) {
+  _client = &client;
+  _parser.reset();
+  _pos      = 0;
+  _len      = 0;
+  _position = 0;
+}
+
+int HttpBodyStream::readHeaders(unsigned long timeout) {
+  unsigned long start = millis();
+  int status;
+  while ((status = pollHeaders()) == 0) {
+    if (millis() - start > timeout) {
+      log_e(">>> Invalid response or client timeout!");
+      return -1;
+    }
+    delay(10);
+  }
+  return status;
+}
+
+int HttpBodyStream::pollHeaders() {
+  while (!_parser.headersComplete()) {
+    if (_parser.failed()) {
+      log_e(">>> Invalid response or client timeout!");
+      return -1;
+    }
+    int bytesRead = _client->read(_buf, sizeof(_buf));
+    if (bytesRead <= 0) return !_client->connected() && !_client->available() ? -1 : 0;
+
+    size_t used = _parser.parseHeaders(_buf, bytesRead);
+    if (_parser.headersComplete()) {
+      // Whatever followed the headers is the start of the body
+      _pos = 0;
+      _len = _parser.decodeBody(_buf + used, bytesRead - used);
+      memmove(_buf, _buf + used, _len);
+    }
+  }
+  return _parser.status();
+}
+
+bool HttpBodyStream::fill() {
+  if (_parser.bodyComplete() || _parser.failed()) return false;
+  int bytesRead = _client->read(_buf, sizeof(_buf));
+  if (bytesRead <= 0) return false;
+  _pos = 0;
+  _len = _parser.decodeBody(_buf, bytesRead);
+  return _len > 0;
+}
+
+int HttpBodyStream::readBody(uint8_t *buf, size_t len) {
+  if (_pos < _len) {
+    size_t n = _len - _pos;
+    if (n > len) n = len;
+    memcpy(buf, _buf + _pos, n);
+    _pos += n;
+    _position += n;
+    return n;
+  }
+  if (_parser.bodyComplete() || _parser.failed()) return -1;
+
+  // Read into the caller's buffer and strip the framing there, no intermediate copy
+  int bytesRead = _client->read(buf, len);
+  if (bytesRead <= 0) {
+    return (!_client->connected() && !_client->available()) ? -1 : 0;
+  }
+  size_t n = _parser.decodeBody(buf, bytesRead);
+  _position += n;
+  return n;
+}
+
+bool HttpBodyStream::finished() {
+  if (_pos < _len) return false;
+  return _parser.bodyComplete() || _parser.failed() || (!_client->connected() && !_client->available());
+}
+
+int HttpBodyStream::available() {
+  if (_pos < _len || fill()) return _len - _pos;
+  return 0;
+}
+
+int HttpBodyStream::read() {
+  if (!available()) return -1;
+  _position++;
+  return _buf[_pos++];
+}
+
+int HttpBodyStream::peek() {
+  if (!available()) return -1;
+  return _buf[_pos];
+}
@@ -0,0 +1,49 @@
+/*
+   HTTP response reader on top of an Arduino Client
+   Purpose: Reads the response headers through HttpResponseParser and exposes the decoded body,
+            either as a Stream (for ArduinoJson) or block-wise straight into a caller buffer
+*/
+
+#ifndef HttpBodyStream_h
+#define HttpBodyStream_h
+
+#include <Arduino.h>
+#include <Client.h>
+
+#include "HttpResponseParser.h"
+
+#define HTTP_STREAM_BUFFER 512
+
+class HttpBodyStream : public Stream {
+ public:
+  HttpBodyStream() : _client(NULL), _pos(0), _len(0), _position(0) {}
+  void begin(Client& client);
+  // Wait for and parse the status line and headers. Returns the status code, or -1 on timeout,
+  // a closed connection or a malformed response.
+  int readHeaders(unsigned long timeout = 30000L);
+  // readHeaders() without the waiting: parses whatever has arrived and returns the status code once the
+  // headers are complete, 0 while they are not, or -1 on a closed connection or a malformed response.
+  int pollHeaders();
+  const HttpResponseParser& response() const { return _parser; }
+  // Decoded body bytes straight into buf, without waiting. Returns the number of bytes, 0 if
+  // nothing has arrived yet, or -1 once the body is complete or the connection is gone.
+  int readBody(uint8_t* buf, size_t len);
+  bool finished();
+  size_t position() const { return _position; }  // Body bytes read so far, through read() or readBody()
+
+  int available() override;
+  int read() override;
+  int peek() override;
+  size_t write(uint8_t) override { return 0; }
+
+ private:
+  bool fill();
+  Client* _client;
+  HttpResponseParser _parser;
+  uint8_t _buf[HTTP_STREAM_BUFFER];
+  size_t _pos;
+  size_t _len;
+  size_t _position;
+};
+
+#endif
@@ -0,0 +1,108 @@
+/*
+   Keep-alive connection to the update server
+   Purpose: Keeps the modem socket and the TLS session on it open between requests, so the manifest check and
+            the download after it (or the next poll) go over one connection when they hit the same host and port
+*/
+
+#include "HttpConnection.h"
+
+HttpConnection::HttpConnection(Client &transport)
+    : _tls(&transport), _modem(NULL), _useModem(false), _onModem(false), _port(0), _open(false), _busy(false), _connecting(false), _idleSince(0), _draining(NULL), _drained(0) {}
+
+void HttpConnection::setModemHttp(ModemHttpClient *modem) {
+  // A kept connection on the other transport would take the next request
+  if (_open && !_busy && _onModem != (modem != NULL)) close();
+  _modem    = modem;
+  _useModem = modem != NULL;
+}
+
+int HttpConnection::connect(const String &host, int port, TlsTrust *trust, bool &reused) {
+  reused = false;
+  if (!_connecting) {
+    // The rest of the last response is still due, it is worth waiting for on the same host and port
+    if (_draining && drain() == 0) {
+      if (_port == port && _host == host) return 0;
+      close();
+    }
+    if (_open && !_busy && _port == port && _host == host && client().connected()) {
+      reused = true;
+      _busy  = true;
+      return 1;
+    }
+    close();
+    _host = host;
+    _port = port;
+    if (_useModem && (!trust || trust->pem())) {
+      // The modem does the handshake within its AT+SHCONN, polled until the modem answers it
+      _modem->setCACert(trust ? trust->pem() : NULL);
+      _onModem = _modem->startConnect(host.c_str(), port);
+      if (!_onModem) modemFallback();
+    }
+    _tls.setTrust(trust);
+    if (!_onModem && !_tls.startConnect(host.c_str(), port)) return -1;
+    _connecting = true;
+  }
+
+  int ret = _onModem ? _modem->pollConnect() : _tls.pollConnect();
+  if (ret < 0 && _onModem) {
+    _onModem = false;
+    modemFallback();
+    ret = _tls.startConnect(host.c_str(), port) ? 0 : -1;
+  }
+  if (ret == 0) return 0;
+  _connecting = false;
+  if (ret < 0) return -1;
+  _open = true;
+  _busy = true;
+  return 1;
+}
+
+// Connections go over TlsClient from here on, until the next setModemHttp()
+void HttpConnection::modemFallback() {
+  log_w("Modem HTTPS failed, falling back to TLS on the ESP32");
+  _useModem = false;
+}
+
+void HttpConnection::release(HttpBodyStream &response) {
+  if (!_open) return;
+  // The rest of a manifest or the closing chunk is cheaper to read than a new connection: what has arrived
+  // is read now, the rest by the next connect()
+  _busy      = false;
+  _idleSince = millis();
+  _draining  = &response;
+  _drained   = 0;
+  drain();
+}
+
+// Reads what has arrived of the released response. Returns 1 once the connection can take the next request,
+// 0 while more of the response is due, -1 if it was closed.
+int HttpConnection::drain() {
+  HttpBodyStream &response         = *_draining;
+  const HttpResponseParser &parser = response.response();
+  uint8_t buf[64];
+  int n = 0;
+  while (parser.headersComplete() && !parser.bodyComplete() && parser.keepAlive() && _drained < HTTP_DRAIN_MAX && (n = response.readBody(buf, sizeof(buf))) > 0) {
+    _drained += n;
+  }
+  if (parser.bodyComplete() && parser.keepAlive() && client().connected()) {
+    _draining = NULL;
+    return 1;
+  }
+  if (n == 0 && parser.headersComplete() && parser.keepAlive() && _drained < HTTP_DRAIN_MAX && millis() - _idleSince < HTTP_DRAIN_TIMEOUT) return 0;
+  close();
+  return -1;
+}
+
+void HttpConnection::close() {
+  if (modemFailed()) modemFallback();
+  if (_open || _connecting) client().stop();
+  _onModem    = false;
+  _open       = false;
+  _busy       = false;
+  _connecting = false;
+  _draining   = NULL;
+}
+
+void HttpConnection::closeIfIdle(unsigned long linger) {
+  if (_open && !_busy && (linger == 0 || millis() - _idleSince >= linger || !client().connected())) close();
+}
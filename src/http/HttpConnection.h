@@ -0,0 +1,67 @@
+/*
+   Keep-alive connection to the update server
+   Purpose: Keeps the modem socket and the TLS session on it open between requests, so the manifest check and
+            the download after it (or the next poll) go over one connection when they hit the same host and port
+*/
+
+#ifndef HttpConnection_h
+#define HttpConnection_h
+
+#include <Arduino.h>
+#include <Client.h>
+
+#include "../tls/TlsClient.h"
+#include "HttpBodyStream.h"
+#include "ModemHttpClient.h"
+
+#define HTTP_DRAIN_MAX 2048      // Unread body bytes worth reading to keep the connection, instead of reconnecting
+#define HTTP_DRAIN_TIMEOUT 5000L  // How long after release() they may take to arrive
+
+class HttpConnection {
+ public:
+  explicit HttpConnection(Client& transport);
+  ~HttpConnection() { close(); }
+
+  // Connects to host:port a step at a time: 1 once the connection is usable, 0 while the TLS handshake is
+  // still going, -1 if it failed. Reuses the open connection if it goes to the same place and is still up,
+  // reused tells which. trust as for TlsClient::setTrust(), only used for a new connection; the modem gets
+  // its first PEM root and isn't used for a trust without one.
+  int connect(const String& host, int port, TlsTrust* trust, bool& reused);
+  // New connections go to the modem's HTTPS service first and over TlsClient if that fails, until the next
+  // call. NULL keeps all connections on TlsClient.
+  void setModemHttp(ModemHttpClient* modem);
+  bool onModem() const { return _onModem; }
+  // The open connection is on the modem and the service failed it, close() then falls back to TlsClient
+  bool modemFailed() const { return _onModem && _modem->failed(); }
+  // Done with a response: the connection stays open if the server allows it and the body can be read to its
+  // end, otherwise it is closed. What hasn't arrived yet is read by the next connect() to the same place, up
+  // to HTTP_DRAIN_MAX bytes within HTTP_DRAIN_TIMEOUT; response must stay around until then.
+  void release(HttpBodyStream& response);
+  void close();
+  // Closes the connection if it has been idle for longer than linger ms, 0 closes any idle connection
+  void closeIfIdle(unsigned long linger);
+  bool isOpen() { return _open && client().connected(); }
+  Client& client() { return _onModem ? (Client&)*_modem : (Client&)_tls; }
+  TlsClient& tls() { return _tls; }
+  // Both transports together, see TlsClient and ModemHttpClient for what they count
+  uint32_t bytesReceived() const { return _tls.bytesReceived() + (_modem ? _modem->bytesReceived() : 0); }
+  uint32_t bytesSent() const { return _tls.bytesSent() + (_modem ? _modem->bytesSent() : 0); }
+
+ private:
+  void modemFallback();
+  int drain();
+  TlsClient _tls;
+  ModemHttpClient* _modem;
+  bool _useModem;
+  bool _onModem;  // The open connection is _modem's
+  String _host;
+  int _port;
+  bool _open;
+  bool _busy;        // A request went out and its response wasn't released yet
+  bool _connecting;  // Handshake started by connect() and not finished yet
+  unsigned long _idleSince;
+  HttpBodyStream* _draining;  // Released response whose rest is still due, see release()
+  size_t _drained;
+};
+
+#endif
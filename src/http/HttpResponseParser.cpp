@@ -0,0 +1,227 @@
+/*
+   Incremental HTTP/1.1 response parser
+   Purpose: Status line, header and chunked transfer decoding into fixed buffers, without any
+            Arduino dependency so it can be built and fed recorded responses on a host
+*/
+
+#include "HttpResponseParser.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Case insensitive "does the header name match", returns the trimmed value or NULL
+static const char *header_value(const char *line, const char *name) {
+  size_t n = strlen(name);
+  for (size_t i = 0; i < n; i++) {
+    if (tolower((unsigned char)line[i]) != name[i]) return NULL;
+  }
+  if (line[n] != ':') return NULL;
+  line += n + 1;
+  while (*line == ' ' || *line == '\t') line++;
+  return line;
+}
+
+// Case insensitive search for a token inside a header value
+static bool contains_token(const char *value, const char *token) {
+  size_t n = strlen(token);
+  for (; *value; value++) {
+    size_t i = 0;
+    while (i < n && tolower((unsigned char)value[i]) == token[i]) i++;
+    if (i == n) return true;
+  }
+  return false;
+}
+
+static void copy_value(char *dst, size_t size, const char *value) {
+  strncpy(dst, value, size - 1);
+  dst[size - 1] = '\0';
+}
+
+void HttpResponseParser::reset() {
+  _state          = STATUS_LINE;
+  _headersDone    = false;
+  _lineLen        = 0;
+  _chunkExtension = false;
+  _status         = 0;
+  _minorVersion   = 1;
+  _contentLength  = -1;
+  _remaining      = 0;
+  _chunked        = false;
+  _keepAlive      = true;
+  _location[0]    = '\0';
+  _etag[0]        = '\0';
+  _lastModified[0] = '\0';
+  _maxAge         = -1;
+  _rangeStart     = 0;
+  _rangeEnd       = 0;
+  _rangeTotal     = -1;
+}
+
+size_t HttpResponseParser::parseHeaders(const uint8_t *data, size_t len) {
+  size_t i = 0;
+  while (i < len && !headersComplete() && _state != FAILED) {
+    char c = data[i++];
+    if (c == '\r') continue;
+    if (c != '\n') {
+      if (_lineLen < sizeof(_line) - 1) _line[_lineLen++] = c;
+      continue;
+    }
+    _line[_lineLen] = '\0';
+    headerLine();
+    _lineLen = 0;
+  }
+  return i;
+}
+
+void HttpResponseParser::headerLine() {
+  if (_state == STATUS_LINE) {
+    // HTTP/1.<minor> <status> <reason>
+    if (_lineLen == 0) return;  // Tolerate stray blank lines before the status line
+    if (strncmp(_line, "HTTP/1.", 7) != 0 || !isdigit((unsigned char)_line[7]) || _line[8] != ' ') {
+      _state = FAILED;
+      return;
+    }
+    _minorVersion = _line[7] - '0';
+    _keepAlive    = _minorVersion >= 1;
+    _status       = atoi(_line + 9);
+    _state        = _status >= 100 && _status <= 999 ? HEADERS : FAILED;
+    return;
+  }
+
+  if (_lineLen == 0) {
+    headersDone();
+    return;
+  }
+
+  const char *value;
+  if ((value = header_value(_line, "content-length"))) {
+    _contentLength = strtoll(value, NULL, 10);
+  } else if ((value = header_value(_line, "transfer-encoding"))) {
+    _chunked = contains_token(value, "chunked");
+  } else if ((value = header_value(_line, "connection"))) {
+    if (contains_token(value, "close")) _keepAlive = false;
+    if (contains_token(value, "keep-alive")) _keepAlive = true;
+  } else if ((value = header_value(_line, "location"))) {
+    copy_value(_location, sizeof(_location), value);
+  } else if ((value = header_value(_line, "etag"))) {
+    copy_value(_etag, sizeof(_etag), value);
+  } else if ((value = header_value(_line, "last-modified"))) {
+    copy_value(_lastModified, sizeof(_lastModified), value);
+  } else if ((value = header_value(_line, "cache-control"))) {
+    if (contains_token(value, "no-cache") || contains_token(value, "no-store")) {
+      _maxAge = 0;
+    } else {
+      for (const char *p = value; *p; p++) {
+        if (strncmp(p, "max-age=", 8) == 0) _maxAge = atol(p + 8);
+      }
+    }
+  } else if ((value = header_value(_line, "content-range"))) {
+    // bytes <start>-<end>/<total> or bytes */<total>
+    const char *p = strchr(value, ' ');
+    if (p && isdigit((unsigned char)p[1])) {
+      char *end;
+      _rangeStart = strtoll(p + 1, &end, 10);
+      if (*end == '-') _rangeEnd = strtoll(end + 1, NULL, 10);
+    }
+    p = strchr(value, '/');
+    if (p && isdigit((unsigned char)p[1])) _rangeTotal = strtoll(p + 1, NULL, 10);
+  }
+}
+
+void HttpResponseParser::headersDone() {
+  if (_status >= 100 && _status < 200) {
+    // Interim response (100 Continue), the real one follows
+    reset();
+    return;
+  }
+  _headersDone = true;
+  if (_status == 204 || _status == 304) {
+    _state = DONE;
+  } else if (_chunked) {
+    _state   = CHUNK_SIZE;
+    _lineLen = 0;
+  } else if (_contentLength >= 0) {
+    _remaining = _contentLength;
+    _state     = _remaining > 0 ? BODY_IDENTITY : DONE;
+  } else {
+    _state     = BODY_UNTIL_CLOSE;
+    _keepAlive = false;  // The body ends when the server closes the connection
+  }
+}
+
+size_t HttpResponseParser::decodeBody(uint8_t *data, size_t len) {
+  size_t in  = 0;
+  size_t out = 0;
+  while (in < len && _state != DONE && _state != FAILED) {
+    switch (_state) {
+      case BODY_UNTIL_CLOSE:
+      case BODY_IDENTITY:
+      case CHUNK_DATA: {
+        size_t n = len - in;
+        if (_state != BODY_UNTIL_CLOSE && n > _remaining) n = _remaining;
+        if (out != in) memmove(data + out, data + in, n);
+        in += n;
+        out += n;
+        if (_state == BODY_UNTIL_CLOSE) break;
+        _remaining -= n;
+        if (_remaining == 0) _state = _state == CHUNK_DATA ? CHUNK_DATA_END : DONE;
+        break;
+      }
+
+      case CHUNK_SIZE: {
+        // <hex size>[;extension]\r\n
+        char c = data[in++];
+        if (c == '\r') break;
+        if (c == '\n') {
+          if (_lineLen == 0) {
+            _state = FAILED;  // No size digits
+          } else {
+            _state = _remaining > 0 ? CHUNK_DATA : TRAILERS;
+          }
+          _lineLen        = 0;
+          _chunkExtension = false;
+          break;
+        }
+        if (_chunkExtension) break;
+        if (c == ';' || c == ' ' || c == '\t') {
+          _chunkExtension = true;
+        } else if (isxdigit((unsigned char)c) && _lineLen < 15) {
+          if (_lineLen == 0) _remaining = 0;
+          _remaining = (_remaining << 4) | (isdigit((unsigned char)c) ? c - '0' : (tolower((unsigned char)c) - 'a' + 10));
+          _lineLen++;
+        } else {
+          _state = FAILED;
+        }
+        break;
+      }
+
+      case CHUNK_DATA_END: {
+        char c = data[in++];
+        if (c == '\n') {
+          _state = CHUNK_SIZE;
+        } else if (c != '\r') {
+          _state = FAILED;
+        }
+        break;
+      }
+
+      case TRAILERS: {
+        // Trailer fields are ignored, the body ends at the first empty line
+        char c = data[in++];
+        if (c == '\n') {
+          if (_lineLen == 0) _state = DONE;
+          _lineLen = 0;
+        } else if (c != '\r') {
+          _lineLen++;
+        }
+        break;
+      }
+
+      default:
+        _state = FAILED;
+        break;
+    }
+  }
+  return out;
+}
@@ -0,0 +1,72 @@
+/*
+   Incremental HTTP/1.1 response parser
+   Purpose: Status line, header and chunked transfer decoding into fixed buffers, without any
+            Arduino dependency so it can be built and fed recorded responses on a host
+*/
+
+#ifndef HttpResponseParser_h
+#define HttpResponseParser_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HTTP_LINE_MAX 256      // Longer header lines are truncated
+#define HTTP_LOCATION_MAX 256  // Redirect target
+#define HTTP_ETAG_MAX 80
+#define HTTP_DATE_MAX 40
+
+class HttpResponseParser {
+ public:
+  HttpResponseParser() { reset(); }
+  void reset();
+
+  // Feed raw bytes while the header block is incomplete. Returns the number of bytes consumed,
+  // anything after the blank line that ends the headers is left for decodeBody().
+  size_t parseHeaders(const uint8_t* data, size_t len);
+  // Remove the transfer framing in place. Returns how many payload bytes are now at the start
+  // of data. Bytes past the end of the body are dropped.
+  size_t decodeBody(uint8_t* data, size_t len);
+
+  bool headersComplete() const { return _headersDone; }  // Stays set if the body fails later, a bad status line never sets it
+  bool bodyComplete() const { return _state == DONE; }
+  bool failed() const { return _state == FAILED; }
+
+  int status() const { return _status; }
+  bool isRedirect() const { return _status == 301 || _status == 302 || _status == 303 || _status == 307 || _status == 308; }
+  int64_t contentLength() const { return _contentLength; }  // -1 if not sent
+  bool chunked() const { return _chunked; }
+  bool keepAlive() const { return _keepAlive; }
+  const char* location() const { return _location; }
+  const char* etag() const { return _etag; }
+  const char* lastModified() const { return _lastModified; }
+  long maxAge() const { return _maxAge; }  // Cache-Control max-age in seconds, -1 if not sent
+  // Content-Range of a 206 reply, rangeTotal() is -1 if the reply didn't carry one
+  int64_t rangeStart() const { return _rangeStart; }
+  int64_t rangeEnd() const { return _rangeEnd; }
+  int64_t rangeTotal() const { return _rangeTotal; }
+
+ private:
+  enum State { STATUS_LINE, HEADERS, BODY_IDENTITY, BODY_UNTIL_CLOSE, CHUNK_SIZE, CHUNK_DATA, CHUNK_DATA_END, TRAILERS, DONE, FAILED };
+  void headerLine();
+  void headersDone();
+  State _state;
+  bool _headersDone;
+  char _line[HTTP_LINE_MAX];
+  size_t _lineLen;
+  bool _chunkExtension;
+  int _status;
+  int _minorVersion;
+  int64_t _contentLength;
+  uint64_t _remaining;
+  bool _chunked;
+  bool _keepAlive;
+  char _location[HTTP_LOCATION_MAX];
+  char _etag[HTTP_ETAG_MAX];
+  char _lastModified[HTTP_DATE_MAX];
+  long _maxAge;
+  int64_t _rangeStart;
+  int64_t _rangeEnd;
+  int64_t _rangeTotal;
+};
+
+#endif
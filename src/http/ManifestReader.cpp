@@ -0,0 +1,90 @@
+/*
+   Incremental manifest splitter
+   Purpose: Cuts a manifest (a single JSON object or an array of them) fed a byte at a time into its
+            entries, each kept in a fixed buffer until it is complete and can be parsed from memory
+*/
+
+#include "ManifestReader.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+
+bool ManifestReader::begin(size_t maxEntry) {
+  end();
+  _buf = (char *)malloc(maxEntry + 1);
+  if (!_buf) return false;
+  _size = maxEntry;
+  reset();
+  return true;
+}
+
+void ManifestReader::end() {
+  if (_buf) free(_buf);
+  _buf  = NULL;
+  _size = 0;
+}
+
+void ManifestReader::reset() {
+  _state  = START;
+  _array  = false;
+  _string = false;
+  _escape = false;
+  _depth  = 0;
+  _len    = 0;
+  _error  = NULL;
+}
+
+ManifestReader::Result ManifestReader::fail(const char *error) {
+  _state = FAILED_STATE;
+  _error = error;
+  return FAILED;
+}
+
+ManifestReader::Result ManifestReader::feed(char c) {
+  switch (_state) {
+    case START:
+    case BETWEEN:
+      if (isspace((unsigned char)c) || (_state == BETWEEN && c == ',')) return MORE;
+      if (_state == START && c == '[' && !_array) {
+        _array = true;
+        _state = BETWEEN;
+        return MORE;
+      }
+      if (_array && c == ']') {
+        _state = DONE;
+        return END;
+      }
+      if (c != '{') return fail(_array ? "manifest entry isn't a JSON object" : "manifest is neither a JSON object nor an array");
+      _state = ENTRY_TEXT;
+      _len   = 0;
+      _depth = 0;
+      // fall through
+    case ENTRY_TEXT:
+      if (!_buf || _len == _size) return fail("manifest entry too long");
+      _buf[_len++] = c;
+      if (_string) {
+        if (_escape) {
+          _escape = false;
+        } else if (c == '\\') {
+          _escape = true;
+        } else if (c == '"') {
+          _string = false;
+        }
+        return MORE;
+      }
+      if (c == '"') {
+        _string = true;
+      } else if (c == '{' || c == '[') {
+        _depth++;
+      } else if ((c == '}' || c == ']') && --_depth == 0) {
+        _buf[_len] = '\0';
+        _state     = _array ? BETWEEN : DONE;
+        return ENTRY;
+      }
+      return MORE;
+    case DONE:
+      return END;
+    default:
+      return FAILED;
+  }
+}
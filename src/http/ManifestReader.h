@@ -0,0 +1,47 @@
+/*
+   Incremental manifest splitter
+   Purpose: Cuts a manifest (a single JSON object or an array of them) fed a byte at a time into its
+            entries, each kept in a fixed buffer until it is complete and can be parsed from memory
+*/
+
+#ifndef ManifestReader_h
+#define ManifestReader_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+class ManifestReader {
+ public:
+  enum Result { MORE, ENTRY, END, FAILED };
+
+  ManifestReader() : _buf(NULL), _size(0) { reset(); }
+  ~ManifestReader() { end(); }
+  // Allocates room for an entry of up to maxEntry bytes, released again by end()
+  bool begin(size_t maxEntry);
+  void end();
+
+  // Next byte of the manifest. ENTRY once an entry is complete in entry(), it stays there until the next
+  // call. END after the closing bracket of an array, or for any byte after a single object (done()).
+  Result feed(char c);
+  const char* entry() const { return _buf; }
+  size_t length() const { return _len; }
+  // The manifest was a single object and that was its entry
+  bool done() const { return _state == DONE; }
+  const char* error() const { return _error; }
+
+ private:
+  enum State { START, BETWEEN, ENTRY_TEXT, DONE, FAILED_STATE };
+  void reset();
+  Result fail(const char* error);
+  State _state;
+  bool _array;
+  bool _string;
+  bool _escape;
+  int _depth;
+  char* _buf;
+  size_t _size;
+  size_t _len;
+  const char* _error;
+};
+
+#endif
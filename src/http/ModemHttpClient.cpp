@@ -0,0 +1,334 @@
+/*
+   HTTPS on the modem's own TLS/HTTP stack
+   Purpose: A Client that takes the HTTP/1.1 GET requests the library writes and runs them on the SIM7000's
+            HTTP(S) service (AT+SHCONF/SHCONN/SHREQ/SHREAD), then hands back a response HttpBodyStream can
+            read: a status line and Content-Length, Content-Range and Connection made from what the modem
+            reports, then the body over the UART. TLS runs on the modem, the ESP32 keeps no mbedtls context.
+*/
+
+#include "ModemHttpClient.h"
+
+#include <algorithm>
+
+#define MODEM_HTTP_AT_TIMEOUT 1000L        // Commands the modem answers right away
+#define MODEM_HTTP_CONNECT_TIMEOUT 30000L  // AT+SHCONN, TCP and the TLS handshake on the modem
+#define MODEM_HTTP_READ_TIMEOUT 5000L      // Longest gap in the answer to AT+SHREAD, the modem already has the data
+#define MODEM_HTTP_CA_FILE "fota_ca.pem"   // On the modem's customer file system (AT+CFSWFILE, at most 10240 bytes)
+
+ModemHttpClient::ModemHttpClient()
+    : _modem(NULL),
+      _rootCA(NULL),
+      _uploadedCA(NULL),
+      _open(false),
+      _connected(false),
+      _failed(false),
+      _step(IDLE),
+      _awaiting(false),
+      _timeout(0),
+      _sentAt(0),
+      _headPos(0),
+      _length(0),
+      _offset(0),
+      _reading(false),
+      _blockLeft(0),
+      _rangeFrom(-1),
+      _rangeOpen(false),
+      _keepAlive(true),
+      _requests(0),
+      _bytesIn(0),
+      _bytesOut(0) {}
+
+void ModemHttpClient::init(TinyGsm *modem) {
+  stop();
+  _modem      = modem;
+  _uploadedCA = NULL;
+}
+
+int ModemHttpClient::connect(const char *host, uint16_t port) {
+  if (!startConnect(host, port)) return 0;
+  int ret;
+  while ((ret = pollConnect()) == 0) delay(1);
+  return ret > 0;
+}
+
+bool ModemHttpClient::startConnect(const char *host, uint16_t port) {
+  stop();
+  _failed = true;
+  if (!_modem) return false;
+  if (_rootCA && _rootCA != _uploadedCA) {
+    if (!uploadCA()) {
+      log_e("Modem HTTPS: root certificate upload failed");
+      return false;
+    }
+    _uploadedCA = _rootCA;
+  }
+  // TLS 1.2, checking the server against _rootCA if there is one
+  queue(String("+CSSLCFG=\"sslversion\",1,3"));
+  queue(String("+SHSSL=1,\"") + (_rootCA ? MODEM_HTTP_CA_FILE : "") + "\"");
+  queue(String("+SHCONF=\"URL\",\"https://") + host + ":" + port + "\"");
+  queue(String("+SHCONF=\"BODYLEN\",1024"));
+  queue(String("+SHCONF=\"HEADERLEN\",350"));
+  queue(String("+SHCONN"));
+  _host = String(host) + ":" + port;
+  _step = CONNECTING;
+  return true;
+}
+
+int ModemHttpClient::pollConnect() {
+  if (_step != CONNECTING) return -1;
+  int ret = pollCommands();
+  if (ret == 0) return 0;
+  if (ret < 0) {
+    log_e("Modem HTTPS: no connection to %s", _host.c_str());
+    stop();
+    return -1;
+  }
+  _step      = IDLE;
+  _connected = true;
+  _failed    = false;
+  _requests  = 0;
+  return 1;
+}
+
+void ModemHttpClient::queue(const String &command) { _commands += command + "\n"; }
+
+// Sends the queued AT commands one at a time, each once the modem answered the one before. Nothing waits
+// for an answer that hasn't started to arrive. Returns 1 once all are answered with OK, 0 while some are
+// due and -1 on an ERROR or no answer in time.
+int ModemHttpClient::pollCommands() {
+  if (_awaiting) {
+    if (_modem->stream.available() <= 0) return millis() - _sentAt < _timeout ? 0 : -1;
+    if (_modem->waitResponse(MODEM_HTTP_AT_TIMEOUT) != 1) return -1;
+    _awaiting = false;
+  }
+  if (_commands.length() == 0) return 1;
+  int end        = _commands.indexOf('\n');
+  String command = _commands.substring(0, end);
+  _commands.remove(0, end + 1);
+  // AT+SHCONN is answered once the modem has the connection, TCP and the TLS handshake
+  _open    = _open || command == "+SHCONN";
+  _timeout = command == "+SHCONN" ? MODEM_HTTP_CONNECT_TIMEOUT : MODEM_HTTP_AT_TIMEOUT;
+  // Whatever is left over of an earlier answer would pass for this one's
+  while (_modem->stream.available() > 0) _modem->stream.read();
+  _modem->sendAT(command);
+  _awaiting = true;
+  _sentAt   = millis();
+  return 0;
+}
+
+bool ModemHttpClient::uploadCA() {
+  size_t length = strlen(_rootCA);
+  _modem->sendAT(GF("+CFSINIT"));
+  _modem->waitResponse(MODEM_HTTP_AT_TIMEOUT);
+  _modem->sendAT(GF("+CFSWFILE=3,\"" MODEM_HTTP_CA_FILE "\",0,"), length, GF(",10000"));
+  bool ok = _modem->waitResponse(MODEM_HTTP_AT_TIMEOUT, GF("DOWNLOAD")) == 1;
+  if (ok) {
+    _modem->stream.write((const uint8_t *)_rootCA, length);
+    ok = _modem->waitResponse(10000L) == 1;
+  }
+  _modem->sendAT(GF("+CFSTERM"));
+  _modem->waitResponse(MODEM_HTTP_AT_TIMEOUT);
+  if (!ok) return false;
+  _modem->sendAT(GF("+CSSLCFG=\"convert\",2,\"" MODEM_HTTP_CA_FILE "\""));
+  return _modem->waitResponse(MODEM_HTTP_AT_TIMEOUT) == 1;
+}
+
+size_t ModemHttpClient::write(const uint8_t *buf, size_t size) {
+  if (!_connected || _step != IDLE) return 0;
+  _request.concat((const char *)buf, size);
+  _bytesOut += size;
+  if (_request.indexOf("\r\n\r\n") >= 0 && !sendRequest()) failRequest();
+  return size;
+}
+
+// GET <path> HTTP/1.1 and its headers as AT+SHAHEAD, Host is in the URL and Connection is up to the modem.
+// The commands go out over the next available()/read() calls.
+bool ModemHttpClient::sendRequest() {
+  int lineEnd = _request.indexOf("\r\n");
+  int pathAt  = _request.indexOf(' ') + 1;
+  int pathEnd = _request.indexOf(' ', pathAt);
+  if (pathAt <= 0 || pathEnd < pathAt || pathEnd > lineEnd || !_request.startsWith("GET ")) {
+    log_e("Modem HTTPS only does GET requests");
+    return false;
+  }
+  String path = _request.substring(pathAt, pathEnd);
+
+  queue(String("+SHCHEAD"));
+  _rangeFrom = -1;
+  _rangeOpen = false;
+  _keepAlive = true;
+  for (int start = lineEnd + 2, end; (end = _request.indexOf("\r\n", start)) > start; start = end + 2) {
+    int colon = _request.indexOf(':', start);
+    if (colon < 0 || colon > end) continue;
+    String name  = _request.substring(start, colon);
+    String value = _request.substring(colon + 1, end);
+    value.trim();
+    if (name.equalsIgnoreCase("Host")) continue;
+    if (name.equalsIgnoreCase("Connection")) {
+      _keepAlive = !value.equalsIgnoreCase("close");
+      continue;
+    }
+    if (name.equalsIgnoreCase("Range") && value.startsWith("bytes=")) {
+      _rangeFrom = value.substring(6).toInt();
+      _rangeOpen = value.endsWith("-");
+    }
+    queue(String("+SHAHEAD=\"") + name + "\",\"" + value + "\"");
+  }
+  _request = "";
+
+  queue(String("+SHREQ=\"") + path + "\",1");
+  _step = SENDING;
+  return true;
+}
+
+// The request's AT commands, then on to waiting for the response
+void ModemHttpClient::pollRequest() {
+  int ret = pollCommands();
+  if (ret > 0) _step = WAITING;
+  if (ret < 0) {
+    log_e("Modem HTTPS: request not taken");
+    failRequest();
+  }
+}
+
+// The modem answers with +SHREQ: "GET",<status>,<length> once it has the whole response. Nothing waits for
+// it here, the caller's response timeout covers a request that never comes back.
+bool ModemHttpClient::pollResponse() {
+  if (_modem->stream.available() <= 0) return false;
+  if (_modem->waitResponse(MODEM_HTTP_AT_TIMEOUT, GF("+SHREQ:")) != 1) return false;
+  String result = _modem->stream.readStringUntil('\n');
+  int comma     = result.indexOf(',');
+  int next      = comma < 0 ? -1 : result.indexOf(',', comma + 1);
+  int status    = comma < 0 ? 0 : result.substring(comma + 1).toInt();
+  // 6xx are the modem's own errors: network, DNS, out of memory
+  if (next < 0 || status < 100 || status >= 600) {
+    log_e("Modem HTTPS request failed:%s", result.c_str());
+    failRequest();
+    return false;
+  }
+  _length = result.substring(next + 1).toInt();
+  _offset = 0;
+
+  _head = String("HTTP/1.1 ") + status + " \r\nContent-Length: " + _length + "\r\n";
+  if (status == 206 && _rangeFrom >= 0 && _length > 0) {
+    _head += String("Content-Range: bytes ") + _rangeFrom + "-" + (_rangeFrom + _length - 1) + "/";
+    _head += _rangeOpen ? String(_rangeFrom + _length) : String("*");
+    _head += "\r\n";
+  }
+  _head += _keepAlive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+  _headPos = 0;
+  _step    = HEAD;
+  return true;
+}
+
+// Straight into the caller's buffer: AT+SHREAD for the next block in one call, its data as it crosses the
+// UART in the following ones
+int ModemHttpClient::readBody(uint8_t *buf, size_t size) {
+  if (_blockLeft == 0 && !_reading) {
+    _modem->sendAT(GF("+SHREAD="), _offset, ',', std::min<size_t>(_length - _offset, MODEM_HTTP_BLOCK));
+    _reading = true;
+    _sentAt  = millis();
+    return 0;
+  }
+  int available = _modem->stream.available();
+  if (available <= 0) {
+    if (millis() - _sentAt < MODEM_HTTP_READ_TIMEOUT) return 0;
+    log_e("Modem HTTPS: AT+SHREAD stalled at %u", _offset);
+    failRequest();
+    return 0;
+  }
+  if (_reading) {
+    if (_modem->waitResponse(MODEM_HTTP_AT_TIMEOUT) != 1 || _modem->waitResponse(MODEM_HTTP_AT_TIMEOUT, GF("+SHREAD:")) != 1) {
+      log_e("Modem HTTPS: AT+SHREAD failed at %u", _offset);
+      failRequest();
+      return 0;
+    }
+    size_t count = _modem->stream.readStringUntil('\n').toInt();
+    if (count == 0 || count > std::min<size_t>(_length - _offset, MODEM_HTTP_BLOCK)) {
+      log_e("Modem HTTPS: short AT+SHREAD at %u", _offset);
+      failRequest();
+      return 0;
+    }
+    _reading   = false;
+    _blockLeft = count;
+    _sentAt    = millis();
+    return readBody(buf, size);
+  }
+  size_t n = _modem->stream.readBytes(buf, std::min<size_t>(std::min<size_t>(size, _blockLeft), available));
+  _blockLeft -= n;
+  _offset += n;
+  _bytesIn += n;
+  _sentAt = millis();
+  return n;
+}
+
+int ModemHttpClient::available() {
+  if (_step == SENDING) pollRequest();
+  if (_step == WAITING) pollResponse();
+  if (_step == HEAD) return _head.length() - _headPos;
+  if (_step == BODY && _blockLeft > 0) return std::min<size_t>(_blockLeft, std::max(_modem->stream.available(), 0));
+  return 0;
+}
+
+int ModemHttpClient::read(uint8_t *buf, size_t size) {
+  if (_step == SENDING) pollRequest();
+  if (_step == WAITING && !pollResponse()) return 0;
+  int n = 0;
+  if (_step == HEAD) {
+    n = std::min<size_t>(size, _head.length() - _headPos);
+    memcpy(buf, _head.c_str() + _headPos, n);
+    _headPos += n;
+    if (_headPos < _head.length()) return n;
+    _step = BODY;
+  } else if (_step == BODY) {
+    n = readBody(buf, size);
+  } else {
+    return 0;
+  }
+  if (_step == BODY && _offset == _length) {
+    // All read, the modem's connection stays for the next request unless the request asked otherwise
+    _requests++;
+    _step      = IDLE;
+    _connected = _keepAlive;
+  }
+  return n;
+}
+
+int ModemHttpClient::read() {
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+int ModemHttpClient::peek() {
+  if (_step == SENDING) pollRequest();
+  if (_step == WAITING) pollResponse();
+  return _step == HEAD ? (uint8_t)_head[_headPos] : -1;
+}
+
+void ModemHttpClient::stop() {
+  if (_open) {
+    _modem->sendAT(GF("+SHDISC"));
+    _modem->waitResponse(MODEM_HTTP_AT_TIMEOUT);
+  }
+  _open      = false;
+  _connected = false;
+  _step      = IDLE;
+  _request   = "";
+  _head      = "";
+  _commands  = "";
+  _awaiting  = false;
+  _reading   = false;
+  _blockLeft = 0;
+}
+
+// A failed first request means the service doesn't work for us, a later one that the server hung up
+void ModemHttpClient::failRequest() {
+  _failed    = _requests == 0;
+  _connected = false;
+  _step      = IDLE;
+  _request   = "";
+  _commands  = "";
+  _awaiting  = false;
+  _reading   = false;
+  _blockLeft = 0;
+}
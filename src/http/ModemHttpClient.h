@@ -0,0 +1,99 @@
+/*
+   HTTPS on the modem's own TLS/HTTP stack
+   Purpose: A Client that takes the HTTP/1.1 GET requests the library writes and runs them on the SIM7000's
+            HTTP(S) service (AT+SHCONF/SHCONN/SHREQ/SHREAD), then hands back a response HttpBodyStream can
+            read: a status line and Content-Length, Content-Range and Connection made from what the modem
+            reports, then the body over the UART. TLS runs on the modem, the ESP32 keeps no mbedtls context.
+*/
+
+#ifndef ModemHttpClient_h
+#define ModemHttpClient_h
+
+#include <Arduino.h>
+#include <Client.h>
+
+#ifndef TINY_GSM_MODEM_SIM7000
+#define TINY_GSM_MODEM_SIM7000
+#endif
+#include <TinyGsmClient.h>
+
+#define MODEM_HTTP_BLOCK 1024  // Body bytes per AT+SHREAD at most
+
+// The modem only reports status and length of a response, so there is no ETag, Last-Modified, Location or
+// Cache-Control, and the total of a Content-Range is only known for an open range (bytes=<from>-). It keeps
+// the whole response until it has been read, its firmware decides how large one may be.
+class ModemHttpClient : public Client {
+ public:
+  ModemHttpClient();
+  ~ModemHttpClient() { stop(); }
+
+  void init(TinyGsm* modem);
+  // PEM root certificate(s) the server must chain up to, uploaded to the modem's file system when it is
+  // not the one uploaded last; NULL accepts any server
+  void setCACert(const char* rootCA) { _rootCA = rootCA; }
+  // Failed to connect or to run the first request of a connection: the service itself didn't work, unlike
+  // a server that closed a kept connection
+  bool failed() const { return _failed; }
+  // Over the UART: request lines written and body bytes read, the AT framing around them not counted
+  uint32_t bytesReceived() const { return _bytesIn; }
+  uint32_t bytesSent() const { return _bytesOut; }
+
+  int connect(IPAddress ip, uint16_t port) { return connect(ip.toString().c_str(), port); }
+  int connect(const char* host, uint16_t port);
+  // connect() in two halves, like TlsClient: startConnect() sets the service up, pollConnect() sends its AT
+  // commands a step at a time and returns 1 once AT+SHCONN went through, 0 while it hasn't been answered
+  // and -1 if it failed (the client is stopped then). The root certificate upload still waits for the modem.
+  bool startConnect(const char* host, uint16_t port);
+  int pollConnect();
+  size_t write(uint8_t c) { return write(&c, 1); }
+  // Collects the request, it goes out as AT commands once its header block is complete
+  size_t write(const uint8_t* buf, size_t size);
+  int available();
+  int read();
+  int read(uint8_t* buf, size_t size);
+  int peek();
+  void flush() {}
+  void stop();
+  uint8_t connected() { return _connected; }
+  operator bool() { return connected(); }
+
+  using Print::write;
+
+ private:
+  enum Step { IDLE, CONNECTING, SENDING, WAITING, HEAD, BODY };
+  bool uploadCA();
+  void queue(const String& command);
+  int pollCommands();
+  bool sendRequest();
+  void pollRequest();
+  bool pollResponse();
+  int readBody(uint8_t* buf, size_t size);
+  void failRequest();
+  TinyGsm* _modem;
+  const char* _rootCA;
+  const char* _uploadedCA;  // On the modem's file system since the last init()
+  bool _open;               // AT+SHCONN went out, AT+SHDISC is due
+  bool _connected;
+  bool _failed;
+  Step _step;
+  String _host;      // host:port of the connection, for the log
+  String _commands;  // AT commands (without the AT) still to send for this step, one per line
+  bool _awaiting;    // The last one sent wasn't answered yet
+  unsigned long _timeout;
+  unsigned long _sentAt;  // Last command, or last body data
+  String _request;        // Request head written so far
+  String _head;           // Status line and headers handed out before the body
+  size_t _headPos;
+  uint32_t _length;   // Body length the modem reported
+  uint32_t _offset;   // Body bytes read from the modem
+  bool _reading;      // AT+SHREAD went out, its +SHREAD: line isn't in yet
+  size_t _blockLeft;  // Data of the last AT+SHREAD still to come over the UART
+  long _rangeFrom;    // Range of the request, -1 if it had none
+  bool _rangeOpen;
+  bool _keepAlive;
+  uint16_t _requests;  // Completed on this connection
+  uint32_t _bytesIn;
+  uint32_t _bytesOut;
+};
+
+#endif
@@ -0,0 +1,136 @@
+/*
+   Producer/consumer pipeline between the network and the flash writer
+   Purpose: Keep receiving from the modem while sectors are erased and written on the other core
+*/
+
+#include "DownloadPipeline.h"
+
+#define PIPELINE_WRITER_STACK 6144
+
+DownloadPipeline::DownloadPipeline(size_t depth, size_t bufferSize)
+    : _depth(depth), _bufferSize(bufferSize), _pool(NULL), _free(NULL), _full(NULL), _done(NULL), _failed(false), _consumed(0), _block{NULL, 0}, _stallSince(0) {
+  memset(&_stats, 0, sizeof(_stats));
+}
+
+DownloadPipeline::~DownloadPipeline() { release(); }
+
+void DownloadPipeline::release() {
+  if (_free) vQueueDelete(_free);
+  if (_full) vQueueDelete(_full);
+  if (_done) vSemaphoreDelete(_done);
+  if (_pool) free(_pool);
+  _free = _full = NULL;
+  _done         = NULL;
+  _pool         = NULL;
+  _block        = {NULL, 0};
+}
+
+void DownloadPipeline::writerTask(void *arg) {
+  ((DownloadPipeline *)arg)->consume();
+  vTaskDelete(NULL);
+}
+
+void DownloadPipeline::consume() {
+  Block block;
+  for (;;) {
+    if (xQueueReceive(_full, &block, 0) != pdTRUE) {
+      unsigned long start = millis();
+      _stats.flashStalls++;
+      bool received = false;
+      while (_idle && !_failed && _idle()) {
+        if ((received = xQueueReceive(_full, &block, 0) == pdTRUE)) break;
+      }
+      if (!received) xQueueReceive(_full, &block, portMAX_DELAY);
+      _stats.flashStallMs += millis() - start;
+    }
+    if (block.data == NULL) break;  // End of stream marker
+
+    if (!_failed) {
+      if (_sink(block.data, block.len)) {
+        _consumed += block.len;
+      } else {
+        _failed = true;
+      }
+    }
+    xQueueSend(_free, &block, portMAX_DELAY);
+  }
+  xSemaphoreGive(_done);
+}
+
+bool DownloadPipeline::start(Sink sink, Idle idle) {
+  release();
+  _sink       = sink;
+  _idle       = idle;
+  _failed     = false;
+  _consumed   = 0;
+  _stallSince = 0;
+  memset(&_stats, 0, sizeof(_stats));
+
+  _pool = (uint8_t *)malloc(_depth * _bufferSize);
+  _free = xQueueCreate(_depth, sizeof(Block));
+  _full = xQueueCreate(_depth + 1, sizeof(Block));  // One extra slot for the end of stream marker
+  _done = xSemaphoreCreateBinary();
+  if (!_pool || !_free || !_full || !_done) {
+    log_e("Not enough memory for a %u x %u download pipeline", _depth, _bufferSize);
+    release();
+    return false;
+  }
+  for (size_t i = 0; i < _depth; i++) {
+    Block block = {_pool + i * _bufferSize, 0};
+    xQueueSend(_free, &block, 0);
+  }
+
+  // The network side stays on the calling task (and so on the calling core), which also keeps
+  // the TLS client single threaded. Flash work moves to the other core.
+  BaseType_t writerCore = xPortGetCoreID() == 0 ? 1 : 0;
+  if (xTaskCreatePinnedToCore(writerTask, "fota_writer", PIPELINE_WRITER_STACK, this, uxTaskPriorityGet(NULL), NULL, writerCore) != pdPASS) {
+    log_e("Failed to start flash writer task");
+    release();
+    return false;
+  }
+  return true;
+}
+
+int DownloadPipeline::pump(Source source, size_t remaining) {
+  if (!_pool || _failed) return -1;
+  if (!_block.data) {
+    if (xQueueReceive(_free, &_block, 0) != pdTRUE) {
+      if (!_stallSince) {
+        _stats.networkStalls++;
+        _stallSince = millis();
+      }
+      return 0;
+    }
+    if (_stallSince) _stats.networkStallMs += millis() - _stallSince;
+    _stallSince = 0;
+    _block.len  = 0;
+  }
+
+  size_t toRead = _bufferSize - _block.len;
+  if (toRead > remaining) toRead = remaining;
+  int bytesRead = source(_block.data + _block.len, toRead);
+  if (bytesRead <= 0) return bytesRead;
+  _block.len += bytesRead;
+
+  if (_block.len == _bufferSize || (size_t)bytesRead == remaining) {
+    xQueueSend(_full, &_block, portMAX_DELAY);
+    _block.data = NULL;
+  }
+  return bytesRead;
+}
+
+size_t DownloadPipeline::finish() {
+  if (!_pool) return 0;
+  if (_block.data && _block.len > 0) {
+    xQueueSend(_full, &_block, portMAX_DELAY);  // Whatever arrived before the connection dropped
+  }
+  _block = {NULL, 0};
+
+  Block end = {NULL, 0};
+  xQueueSend(_full, &end, portMAX_DELAY);
+  xSemaphoreTake(_done, portMAX_DELAY);
+
+  log_i("Pipeline stalls: network %u (%u ms), flash %u (%u ms)", _stats.networkStalls, _stats.networkStallMs, _stats.flashStalls, _stats.flashStallMs);
+  release();
+  return _consumed;
+}
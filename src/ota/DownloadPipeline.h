@@ -0,0 +1,74 @@
+/*
+   Producer/consumer pipeline between the network and the flash writer
+   Purpose: Keep receiving from the modem while sectors are erased and written on the other core
+*/
+
+#ifndef DownloadPipeline_h
+#define DownloadPipeline_h
+
+#include <Arduino.h>
+
+#include <functional>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+struct PipelineStats {
+  uint32_t networkStalls;   // Times the network side found no free buffer (flash writer too slow)
+  uint32_t networkStallMs;  // Time spent waiting for a free buffer
+  uint32_t flashStalls;     // Times the flash writer found no filled buffer (network too slow)
+  uint32_t flashStallMs;    // Time spent waiting for data
+};
+
+class DownloadPipeline {
+ public:
+  // Runs on the calling task. Returns the number of bytes read, 0 if nothing has arrived yet
+  // or -1 once the stream has ended.
+  typedef std::function<int(uint8_t* buf, size_t len)> Source;
+  // Runs on the writer task, returning false aborts the transfer
+  typedef std::function<bool(const uint8_t* data, size_t len)> Sink;
+  // Runs on the writer task while it waits for data, one short piece of flash work per call (erasing ahead),
+  // returning false when there is nothing left to do
+  typedef std::function<bool()> Idle;
+
+  // A buffer is passed on once it is full, so with sector sized buffers every one but the last is a whole
+  // sector, which PartitionWriter::write() flashes from where it is
+  DownloadPipeline(size_t depth, size_t bufferSize = SPI_FLASH_SEC_SIZE);
+  ~DownloadPipeline();
+  // Reads from source on the calling task and passes the data to sink on a writer task pinned to the other
+  // core, a step at a time so the caller never blocks: start() sets up the buffers and the writer task,
+  // pump() reads once from source into the current buffer (at most remaining bytes, never waiting for data
+  // or a free buffer) and returns the number of bytes read, 0 if there was nothing to do, or -1 once the
+  // stream has ended or the sink failed. finish() waits for the writer and returns what the sink accepted.
+  bool start(Sink sink, Idle idle = NULL);
+  int pump(Source source, size_t remaining);
+  size_t finish();
+  bool stalled() const { return _stallSince != 0; }  // pump() is waiting for the flash writer to free a buffer
+  const PipelineStats& stats() const { return _stats; }
+
+ private:
+  struct Block {
+    uint8_t* data;
+    size_t len;
+  };
+  static void writerTask(void* arg);
+  void consume();
+  void release();
+  size_t _depth;
+  size_t _bufferSize;
+  uint8_t* _pool;
+  QueueHandle_t _free;
+  QueueHandle_t _full;
+  SemaphoreHandle_t _done;
+  Sink _sink;
+  Idle _idle;
+  volatile bool _failed;
+  volatile size_t _consumed;
+  Block _block;  // Buffer being filled by pump()
+  unsigned long _stallSince;
+  PipelineStats _stats;
+};
+
+#endif
@@ -0,0 +1,179 @@
+/*
+   Streaming gzip/zlib/deflate decompressor
+   Purpose: Decompress a firmware stream on its way to flash, using the inflater in the ESP32 ROM
+*/
+
+#include "Inflater.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if __has_include("esp32/rom/miniz.h")
+#include "esp32/rom/miniz.h"
+#else
+#include "rom/miniz.h"
+#endif
+
+// tinfl needs the whole deflate window (32 KB) as a circular output buffer
+#define INFLATE_DICT_SIZE TINFL_LZ_DICT_SIZE
+
+#define GZIP_FHCRC 0x02
+#define GZIP_FEXTRA 0x04
+#define GZIP_FNAME 0x08
+#define GZIP_FCOMMENT 0x10
+
+Inflater::Format Inflater::formatFromName(const char *name) {
+  if (!name) return NONE;
+  if (strcmp(name, "gzip") == 0) return GZIP;
+  if (strcmp(name, "zlib") == 0) return ZLIB;
+  if (strcmp(name, "deflate") == 0) return DEFLATE;
+  return NONE;
+}
+
+Inflater::Inflater() : _format(NONE), _state(DONE), _inflator(NULL), _dict(NULL), _dictPos(0), _headerLen(0), _skip(0), _totalOut(0), _trailerSize(0) {}
+
+Inflater::~Inflater() { end(); }
+
+bool Inflater::begin(Format format, Output output) {
+  end();
+  if (format == NONE) return false;
+
+  _inflator = malloc(sizeof(tinfl_decompressor));
+  _dict     = (uint8_t *)malloc(INFLATE_DICT_SIZE);
+  if (!_inflator || !_dict) {
+    end();
+    return false;
+  }
+  tinfl_init((tinfl_decompressor *)_inflator);
+
+  _format      = format;
+  _output      = output;
+  _state       = format == GZIP ? HEADER : BODY;
+  _dictPos     = 0;
+  _headerLen   = 0;
+  _skip        = 0;
+  _totalOut    = 0;
+  _trailerSize = 0;
+  return true;
+}
+
+void Inflater::end() {
+  if (_inflator) free(_inflator);
+  if (_dict) free(_dict);
+  _inflator = NULL;
+  _dict     = NULL;
+}
+
+// Skip over the variable length gzip header, returns the number of bytes used
+size_t Inflater::gzipHeader(const uint8_t *data, size_t len) {
+  size_t i = 0;
+  while (i < len && _state != BODY && _state != FAILED) {
+    switch (_state) {
+      case HEADER:
+        _header[_headerLen++] = data[i++];
+        if (_headerLen < sizeof(_header)) break;
+        // ID1 ID2 CM FLG MTIME(4) XFL OS
+        if (_header[0] != 0x1f || _header[1] != 0x8b || _header[2] != 8) {
+          _state = FAILED;
+          break;
+        }
+        _headerLen = 0;
+        _state     = HEADER_EXTRA_LEN;
+        break;
+
+      case HEADER_EXTRA_LEN:
+        if (!(_header[3] & GZIP_FEXTRA)) {
+          _state = HEADER_NAME;
+          break;
+        }
+        _skip |= (size_t)data[i++] << (8 * _headerLen++);
+        if (_headerLen == 2) _state = HEADER_EXTRA;
+        break;
+
+      case HEADER_EXTRA:
+        if (_skip > 0) {
+          size_t n = len - i < _skip ? len - i : _skip;
+          i += n;
+          _skip -= n;
+        }
+        if (_skip == 0) _state = HEADER_NAME;
+        break;
+
+      case HEADER_NAME:
+      case HEADER_COMMENT: {
+        uint8_t flag = _state == HEADER_NAME ? GZIP_FNAME : GZIP_FCOMMENT;
+        if ((_header[3] & flag) && data[i++] != '\0') break;  // Zero terminated
+        _state = _state == HEADER_NAME ? HEADER_COMMENT : HEADER_CRC;
+        _skip  = (_header[3] & GZIP_FHCRC) ? 2 : 0;
+        break;
+      }
+
+      case HEADER_CRC:
+        if (_skip > 0) {
+          i++;
+          _skip--;
+        }
+        if (_skip == 0) _state = BODY;
+        break;
+
+      default:
+        _state = FAILED;
+        break;
+    }
+  }
+  return i;
+}
+
+bool Inflater::write(const uint8_t *data, size_t len) {
+  if (_state == FAILED) return false;
+
+  if (_state < BODY) {
+    size_t used = gzipHeader(data, len);
+    data += used;
+    len -= used;
+    if (_state == FAILED) return false;
+  }
+
+  mz_uint32 flags = TINFL_FLAG_HAS_MORE_INPUT;
+  if (_format == ZLIB) flags |= TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_COMPUTE_ADLER32;
+
+  while (_state == BODY) {
+    size_t inBytes  = len;
+    size_t outBytes = INFLATE_DICT_SIZE - _dictPos;
+    tinfl_status status = tinfl_decompress((tinfl_decompressor *)_inflator, data, &inBytes, _dict, _dict + _dictPos, &outBytes, flags);
+    data += inBytes;
+    len -= inBytes;
+
+    if (outBytes > 0) {
+      if (!_output(_dict + _dictPos, outBytes)) {
+        _state = FAILED;
+        return false;
+      }
+      _dictPos = (_dictPos + outBytes) & (INFLATE_DICT_SIZE - 1);
+      _totalOut += outBytes;
+    }
+
+    if (status == TINFL_STATUS_DONE) {
+      _state = _format == GZIP ? TRAILER : DONE;
+    } else if (status < 0) {
+      _state = FAILED;
+      return false;
+    } else if (status == TINFL_STATUS_NEEDS_MORE_INPUT && len == 0) {
+      return true;
+    }
+  }
+
+  if (_state == TRAILER) {
+    // CRC32 and ISIZE. The image itself is checked by the signature and image verification,
+    // only the length is compared here.
+    while (len > 0 && _trailerSize < 8) {
+      _header[_trailerSize++] = *data++;
+      len--;
+    }
+    if (_trailerSize == 8) {
+      uint32_t isize = _header[4] | (_header[5] << 8) | (_header[6] << 16) | ((uint32_t)_header[7] << 24);
+      _state         = isize == _totalOut ? DONE : FAILED;
+    }
+  }
+  return _state != FAILED;
+}
@@ -0,0 +1,49 @@
+/*
+   Streaming gzip/zlib/deflate decompressor
+   Purpose: Decompress a firmware stream on its way to flash, using the inflater in the ESP32 ROM
+*/
+
+#ifndef Inflater_h
+#define Inflater_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+
+class Inflater {
+ public:
+  enum Format { NONE, DEFLATE, ZLIB, GZIP };
+  typedef std::function<bool(const uint8_t* data, size_t len)> Output;
+
+  // "gzip", "zlib" or "deflate" as used in the manifest, anything else is NONE
+  static Format formatFromName(const char* name);
+
+  Inflater();
+  ~Inflater();
+  // Allocates the decompressor and its 32 KB window, released again by end()
+  bool begin(Format format, Output output);
+  void setOutput(Output output) { _output = output; }
+  // Feed the next part of the compressed stream. Returns false on corrupt data or failed output.
+  bool write(const uint8_t* data, size_t len);
+  bool finished() const { return _state == DONE; }
+  size_t totalOut() const { return _totalOut; }
+  void end();
+
+ private:
+  enum State { HEADER, HEADER_EXTRA_LEN, HEADER_EXTRA, HEADER_NAME, HEADER_COMMENT, HEADER_CRC, BODY, TRAILER, DONE, FAILED };
+  size_t gzipHeader(const uint8_t* data, size_t len);
+  Format _format;
+  Output _output;
+  State _state;
+  void* _inflator;
+  uint8_t* _dict;
+  size_t _dictPos;
+  uint8_t _header[10];
+  size_t _headerLen;
+  size_t _skip;
+  uint32_t _totalOut;
+  uint32_t _trailerSize;
+};
+
+#endif
@@ -0,0 +1,230 @@
+/*
+   Sector buffered writer for the OTA update partition
+   Purpose: Replacement for Update that can continue an interrupted image at a given offset
+*/
+
+#include "PartitionWriter.h"
+
+#include <algorithm>
+
+#include "esp_image_format.h"
+#include "esp_ota_ops.h"
+
+PartitionWriter::PartitionWriter()
+    : _partition(NULL),
+      _buffer(NULL),
+      _bufferLen(0),
+      _size(0),
+      _progress(0),
+      _error(NULL),
+      _erasedIn(NULL),
+      _erasedFrom(0),
+      _erasedTo(0),
+      _stallMicros(0),
+      _eraseAheadMicros(0),
+      _copied(0) {
+  memset(_header, 0xFF, sizeof(_header));
+}
+
+PartitionWriter::~PartitionWriter() { abort(); }
+
+bool PartitionWriter::begin(size_t imageSize, size_t offset, const uint8_t *header) {
+  abort();
+  _error = NULL;
+
+  _partition = esp_ota_get_next_update_partition(NULL);
+  if (!_partition) {
+    _error = "Could not find update partition";
+    return false;
+  }
+  if (imageSize == 0 || imageSize > _partition->size) {
+    _error = "Not enough space in update partition";
+    return false;
+  }
+  if (offset % SPI_FLASH_SEC_SIZE != 0 || offset > imageSize || (offset > 0 && !header)) {
+    _error = "Invalid resume offset";
+    return false;
+  }
+
+  _buffer = (uint8_t *)malloc(SPI_FLASH_SEC_SIZE);
+  if (!_buffer) {
+    _error = "malloc failed";
+    return false;
+  }
+
+  _size      = imageSize;
+  _progress  = offset;
+  _bufferLen = 0;
+  // What was erased ahead before begin() still counts if the image starts where that did
+  if (_erasedIn != _partition || _erasedFrom != offset) {
+    _erasedIn   = _partition;
+    _erasedFrom = offset;
+    _erasedTo   = offset;
+  }
+  if (header) {
+    memcpy(_header, header, sizeof(_header));
+  } else {
+    memset(_header, 0xFF, sizeof(_header));
+  }
+  return true;
+}
+
+size_t PartitionWriter::write(const uint8_t *data, size_t len) {
+  if (!isRunning()) return 0;
+  if (len > _size - _progress) len = _size - _progress;
+
+  size_t done = 0;
+  while (done < len) {
+    const uint8_t *from = data + done;
+    size_t chunk        = SPI_FLASH_SEC_SIZE - _bufferLen;
+    if (chunk > len - done) chunk = len - done;
+    if (_bufferLen == 0 && chunk == SPI_FLASH_SEC_SIZE && from != _buffer) {
+      if (!flushSector(from, chunk)) return done;
+      _progress += chunk;
+      done += chunk;
+      continue;
+    }
+    if (from != _buffer + _bufferLen) {
+      memcpy(_buffer + _bufferLen, from, chunk);
+      _copied += chunk;
+    }
+    _bufferLen += chunk;
+    _progress += chunk;
+    done += chunk;
+
+    if (_bufferLen == SPI_FLASH_SEC_SIZE || _progress == _size) {
+      // Writes must stay 16 byte aligned for flash encryption, pad the last sector with 0xFF
+      size_t padded = (_bufferLen + 15) & ~15;
+      memset(_buffer + _bufferLen, 0xFF, padded - _bufferLen);
+      if (!flushSector(_buffer, padded)) {
+        _progress -= _bufferLen;
+        _bufferLen = 0;
+        return done - chunk;
+      }
+      _bufferLen = 0;
+    }
+  }
+  return done;
+}
+
+uint8_t *PartitionWriter::buffer(size_t &len) {
+  if (!isRunning()) return NULL;
+  len = std::min(SPI_FLASH_SEC_SIZE - _bufferLen, _size - _progress);
+  return _buffer + _bufferLen;
+}
+
+bool PartitionWriter::writeAt(size_t offset, uint8_t *sector, size_t len) {
+  if (!isRunning() || offset < SPI_FLASH_SEC_SIZE || offset % SPI_FLASH_SEC_SIZE != 0 || len > SPI_FLASH_SEC_SIZE || len > _size - offset) {
+    _error = "Invalid write offset";
+    return false;
+  }
+  if (!ESP.partitionEraseRange(_partition, offset, SPI_FLASH_SEC_SIZE)) {
+    _error = "Flash erase failed";
+    return false;
+  }
+  // No longer erased ahead, write() mustn't skip erasing it should it get there after all
+  if (offset >= _erasedFrom && offset < _erasedTo) _erasedTo = offset;
+  size_t writeLen = (len + 15) & ~15;
+  memset(sector + len, 0xFF, writeLen - len);
+  if (!ESP.partitionWrite(_partition, offset, (uint32_t *)sector, writeLen)) {
+    _error = "Flash write failed";
+    return false;
+  }
+  return true;
+}
+
+bool PartitionWriter::skip(size_t len) {
+  if (!isRunning() || _bufferLen != 0 || _progress % SPI_FLASH_SEC_SIZE != 0 || len > _size - _progress) {
+    _error = "Invalid skip";
+    return false;
+  }
+  _progress += len;
+  return true;
+}
+
+bool PartitionWriter::eraseAhead(size_t until) {
+  if (!_partition) _partition = esp_ota_get_next_update_partition(NULL);
+  if (!_partition) return false;
+  size_t from = isRunning() ? committed() : 0;
+  if (_erasedIn != _partition || _erasedFrom != from || _erasedTo < from) {
+    _erasedIn   = _partition;
+    _erasedFrom = from;
+    _erasedTo   = from;
+  }
+  size_t start = _erasedTo;
+  size_t end   = std::min((until + SPI_FLASH_SEC_SIZE - 1) / SPI_FLASH_SEC_SIZE * SPI_FLASH_SEC_SIZE, (size_t)_partition->size);
+  if (start >= end) return false;
+
+  // esp_partition_erase_range() uses the block erase command for aligned whole blocks
+  bool block          = start % PARTITION_WRITER_BLOCK_SIZE == 0 && end - start >= PARTITION_WRITER_BLOCK_SIZE;
+  size_t length       = block ? PARTITION_WRITER_BLOCK_SIZE : SPI_FLASH_SEC_SIZE;
+  unsigned long began = micros();
+  bool erased         = ESP.partitionEraseRange(_partition, start, length);
+  _eraseAheadMicros += micros() - began;
+  if (!erased) return false;
+  _erasedTo = start + length;
+  return true;
+}
+
+// Erases (unless erased ahead) and writes the sector at committed() from data, len a multiple of 16
+bool PartitionWriter::flushSector(const uint8_t *data, size_t len) {
+  size_t offset = committed();
+  size_t skip   = 0;
+
+  if (offset == 0) {
+    // Keep the image header out of flash until the whole image has been written
+    if (data[0] != ESP_IMAGE_HEADER_MAGIC) {
+      _error = "Invalid magic byte";
+      return false;
+    }
+    memcpy(_header, data, sizeof(_header));
+    skip = sizeof(_header);
+  }
+
+  if (_erasedIn == _partition && offset == _erasedFrom && offset < _erasedTo) {
+    _erasedFrom = offset + SPI_FLASH_SEC_SIZE;
+  } else {
+    unsigned long start = micros();
+    bool erased         = ESP.partitionEraseRange(_partition, offset, SPI_FLASH_SEC_SIZE);
+    _stallMicros += micros() - start;
+    if (!erased) {
+      _error = "Flash erase failed";
+      return false;
+    }
+    _erasedIn   = _partition;
+    _erasedFrom = offset + SPI_FLASH_SEC_SIZE;
+    _erasedTo   = offset + SPI_FLASH_SEC_SIZE;
+  }
+  if (len > skip && !ESP.partitionWrite(_partition, offset + skip, (uint32_t *)(data + skip), len - skip)) {
+    _error = "Flash write failed";
+    return false;
+  }
+  return true;
+}
+
+bool PartitionWriter::end() {
+  if (!isRunning()) return false;
+  if (_progress != _size) {
+    _error = "Image incomplete";
+    return false;
+  }
+  if (!ESP.partitionWrite(_partition, 0, (uint32_t *)_header, sizeof(_header))) {
+    _error = "Flash write failed";
+    return false;
+  }
+  // esp_ota_set_boot_partition() verifies the image before switching to it
+  if (esp_ota_set_boot_partition(_partition) != ESP_OK) {
+    _error = "Image verification failed";
+    ESP.partitionEraseRange(_partition, 0, SPI_FLASH_SEC_SIZE);
+    return false;
+  }
+  free(_buffer);
+  _buffer = NULL;
+  return true;
+}
+
+void PartitionWriter::abort() {
+  if (_buffer) free(_buffer);
+  _buffer    = NULL;
+  _bufferLen = 0;
+}
@@ -0,0 +1,71 @@
+/*
+   Sector buffered writer for the OTA update partition
+   Purpose: Replacement for Update that can continue an interrupted image at a given offset
+*/
+
+#ifndef PartitionWriter_h
+#define PartitionWriter_h
+
+#include <Arduino.h>
+
+#include "esp_partition.h"
+
+#define PARTITION_WRITER_HEADER_SIZE 16     // Withheld until end() so a partial image never boots
+#define PARTITION_WRITER_BLOCK_SIZE 0x10000  // Erased with one block erase instead of 16 sector erases where aligned
+
+class PartitionWriter {
+ public:
+  PartitionWriter();
+  ~PartitionWriter();
+  // Start writing an image of imageSize bytes into the next update partition. To continue an
+  // interrupted image pass the sector aligned offset already on flash and the withheld header.
+  bool begin(size_t imageSize, size_t offset = 0, const uint8_t* header = NULL);
+  // Whole sectors at a sector boundary are flashed straight from data, the rest is gathered in a sector buffer
+  size_t write(const uint8_t* data, size_t len);
+  // Where write() gathers the next bytes, len set to how many fit before the sector is full. Bytes read straight
+  // into it and then passed to write() aren't copied again. NULL if not running.
+  uint8_t* buffer(size_t& len);
+  // Writes len bytes (at most a sector) at a sector aligned offset past the first sector, outside of write(),
+  // for parts of the image that arrive on their own. sector has to hold SPI_FLASH_SEC_SIZE bytes, a short
+  // last sector is padded in it. Safe to call while write() runs on another task.
+  bool writeAt(size_t offset, uint8_t* sector, size_t len);
+  // Moves write() over len bytes that writeAt() already put on flash, from a sector boundary
+  bool skip(size_t len);
+  // Erases the next stretch of the partition past the write position, so write() finds its sectors erased
+  // instead of waiting for the erase: a whole block where one is aligned and fits before until, otherwise a
+  // sector. Meant for the time spent waiting on the network. Also works before begin(), for an image that
+  // starts at 0, which the caller must not do while a resume record still points into the partition. Not while
+  // write() runs on another task. false if there is nothing to erase before until.
+  bool eraseAhead(size_t until);
+  uint32_t stallMicros() const { return _stallMicros; }  // Time write() spent erasing sectors on the spot
+  uint32_t eraseAheadMicros() const { return _eraseAheadMicros; }
+  uint32_t bytesCopied() const { return _copied; }  // What write() had to copy into its sector buffer
+  bool end();
+  void abort();
+  bool isRunning() const { return _buffer != NULL; }
+  size_t size() const { return _size; }
+  size_t progress() const { return _progress; }
+  size_t committed() const { return _progress - _bufferLen; }  // Bytes already on flash, always sector aligned
+  const uint8_t* header() const { return _header; }
+  const esp_partition_t* partition() const { return _partition; }
+  const char* errorString() const { return _error; }
+
+ private:
+  bool flushSector(const uint8_t* data, size_t len);
+  const esp_partition_t* _partition;
+  uint8_t* _buffer;
+  size_t _bufferLen;
+  size_t _size;
+  size_t _progress;
+  uint8_t _header[PARTITION_WRITER_HEADER_SIZE];
+  const char* _error;
+  // [_erasedFrom, _erasedTo) was erased ahead and nothing was written to it since
+  const esp_partition_t* _erasedIn;
+  volatile size_t _erasedFrom;
+  volatile size_t _erasedTo;
+  uint32_t _stallMicros;
+  uint32_t _eraseAheadMicros;
+  uint32_t _copied;
+};
+
+#endif
@@ -0,0 +1,157 @@
+/*
+   One part of the image over a socket of its own
+   Purpose: Fetches a byte range of the image with an HTTP Range request on an extra modem socket and writes it
+            sector by sector at its place in the update partition, while the main download runs on another
+            socket. A connection that drops or stalls is retried from the last sector on flash.
+*/
+
+#include "SegmentFetcher.h"
+
+#include <algorithm>
+
+SegmentFetcher::SegmentFetcher(Client &transport)
+    : _connection(transport),
+      _sector(NULL),
+      _buffered(0),
+      _port(0),
+      _trust(NULL),
+      _from(0),
+      _offset(0),
+      _length(0),
+      _written(0),
+      _received(0),
+      _retries(0),
+      _attempt(0),
+      _timeout(0),
+      _since(0),
+      _flashMicros(0),
+      _step(FAILED) {
+  memset(&_tlsStats, 0, sizeof(_tlsStats));
+}
+
+SegmentFetcher::~SegmentFetcher() {
+  _connection.close();
+  if (_sector) free(_sector);
+}
+
+bool SegmentFetcher::begin(const String &host, int port, const String &path, TlsTrust *trust, TlsSession *session, const String &etag, size_t from,
+                           size_t offset, size_t length, int retries, unsigned long timeout) {
+  if (!_sector && !(_sector = (uint8_t *)malloc(SPI_FLASH_SEC_SIZE))) {
+    log_e("malloc failed");
+    return false;
+  }
+  _connection.close();
+  _connection.tls().setSession(session);
+  _host     = host;
+  _port     = port;
+  _path     = path;
+  _trust    = trust;
+  _etag     = etag;
+  _from     = from;
+  _offset   = offset;
+  _length   = length;
+  _written  = 0;
+  _received = 0;
+  _buffered = 0;
+  _retries  = retries;
+  _attempt  = 0;
+  _timeout  = timeout;
+  _step     = CONNECTING;
+  return true;
+}
+
+int SegmentFetcher::poll(PartitionWriter &writer) {
+  switch (_step) {
+    case CONNECTING: {
+      bool reused;
+      int ret = _connection.connect(_host, _port, _trust, reused);
+      if (ret == 0) return 0;
+      if (ret < 0) return retry();
+      if (!reused) {
+        const TlsHandshake &handshake = _connection.tls().lastHandshake();
+        _tlsStats.handshakes++;
+        _tlsStats.resumed += handshake.resumed ? 1 : 0;
+        _tlsStats.handshakeTime += handshake.duration;
+        _tlsStats.handshakeCpuTime += handshake.cpuTime;
+        _tlsStats.last = handshake;
+      }
+      // Only what isn't on flash yet, the segment ends where the next one starts
+      Client &client = _connection.tls();
+      client.print(String("GET ") + _path + " HTTP/1.1\r\n");
+      client.print(String("Host: ") + _host + "\r\n");
+      client.print(String("Range: bytes=") + String(_from + _written) + "-" + String(_from + _length - 1) + "\r\n");
+      if (_etag.length() > 0) client.print(String("If-Range: ") + _etag + "\r\n");
+      client.print("Connection: close\r\n\r\n");
+      _response.begin(client);
+      _step  = REQUESTING;
+      _since = millis();
+      return 0;
+    }
+
+    case REQUESTING: {
+      int status = _response.pollHeaders();
+      if (status == 0 && millis() - _since <= _timeout) return 0;
+      if (status <= 0) return retry();
+      const HttpResponseParser &parser = _response.response();
+      if (status == 206 && parser.rangeStart() == (int64_t)(_from + _written) && parser.rangeEnd() == (int64_t)(_from + _length - 1)) {
+        _step = RECEIVING;
+        return 0;
+      }
+      log_e("Segment at %u: unexpected HTTP response %i (Content-Range %lld-%lld/%lld)", _offset, status, parser.rangeStart(), parser.rangeEnd(),
+            parser.rangeTotal());
+      _connection.close();
+      // A whole file instead of the range means the If-Range didn't match, the image on the server changed
+      if (status == 200 || (status >= 400 && status < 500)) {
+        _step = FAILED;
+        return -1;
+      }
+      return retry();
+    }
+
+    case RECEIVING: {
+      size_t toRead = std::min<size_t>(SPI_FLASH_SEC_SIZE - _buffered, _length - _written - _buffered);
+      int bytesRead = _response.readBody(_sector + _buffered, toRead);
+      if (bytesRead == 0 && millis() - _since < _timeout) return 0;
+      if (bytesRead <= 0) return retry();
+      _since = millis();
+      _received += bytesRead;
+      _buffered += bytesRead;
+      if (_buffered < SPI_FLASH_SEC_SIZE && _written + _buffered < _length) return 0;
+
+      unsigned long start = micros();
+      bool ok             = writer.writeAt(_offset + _written, _sector, _buffered);
+      _flashMicros += micros() - start;
+      if (!ok) {
+        log_e("Segment at %u: %s", _offset, writer.errorString());
+        _connection.close();
+        _step = FAILED;
+        return -1;
+      }
+      _written += _buffered;
+      _buffered = 0;
+      if (_written < _length) return 0;
+      _connection.close();
+      _step = DONE;
+      return 1;
+    }
+
+    case DONE:
+      return 1;
+    default:
+      return -1;
+  }
+}
+
+// A new connection for what is missing, a partly filled sector is fetched again
+int SegmentFetcher::retry() {
+  _connection.close();
+  _buffered = 0;
+  if (++_attempt > _retries) {
+    log_e("Segment at %u failed after %d retries", _offset, _retries);
+    _step = FAILED;
+    return -1;
+  }
+  log_w("Segment at %u: retrying at %u/%u", _offset, _written, _length);
+  _step = CONNECTING;
+  return 0;
+}
@@ -0,0 +1,68 @@
+/*
+   One part of the image over a socket of its own
+   Purpose: Fetches a byte range of the image with an HTTP Range request on an extra modem socket and writes it
+            sector by sector at its place in the update partition, while the main download runs on another
+            socket. A connection that drops or stalls is retried from the last sector on flash.
+*/
+
+#ifndef SegmentFetcher_h
+#define SegmentFetcher_h
+
+#include <Arduino.h>
+#include <Client.h>
+
+#include "../http/HttpBodyStream.h"
+#include "../http/HttpConnection.h"
+#include "../tls/TlsClient.h"
+#include "PartitionWriter.h"
+
+class SegmentFetcher {
+ public:
+  explicit SegmentFetcher(Client& transport);
+  ~SegmentFetcher();
+
+  // Bytes [from, from + length) of the file at host:port path go to the image at offset, which has to be
+  // sector aligned. etag goes into If-Range, so a file that changed on the server fails the segment
+  // instead of mixing two images. timeout is for the response headers and for gaps in the body.
+  bool begin(const String& host, int port, const String& path, TlsTrust* trust, TlsSession* session, const String& etag, size_t from,
+             size_t offset, size_t length, int retries, unsigned long timeout);
+  // Connects, requests, reads and writes a step at a time: 1 once the whole segment is on flash, 0 while it
+  // is under way, -1 if it failed for good (retries used up, the file changed or flash failed)
+  int poll(PartitionWriter& writer);
+  bool done() const { return _step == DONE; }
+  size_t offset() const { return _offset; }
+  size_t length() const { return _length; }
+  size_t written() const { return _written; }    // Bytes of the segment on flash
+  size_t received() const { return _received; }  // Body bytes over all attempts, repeated ones included
+  int retries() const { return _attempt; }
+  uint32_t flashMicros() const { return _flashMicros; }
+  const TlsStats& tlsStats() const { return _tlsStats; }
+  TlsClient& tls() { return _connection.tls(); }
+
+ private:
+  enum Step { CONNECTING, REQUESTING, RECEIVING, DONE, FAILED };
+  int retry();
+  HttpConnection _connection;
+  HttpBodyStream _response;
+  uint8_t* _sector;
+  size_t _buffered;
+  String _host;
+  int _port;
+  String _path;
+  TlsTrust* _trust;
+  String _etag;
+  size_t _from;
+  size_t _offset;
+  size_t _length;
+  size_t _written;
+  size_t _received;
+  int _retries;
+  int _attempt;
+  unsigned long _timeout;
+  unsigned long _since;  // Last progress, for the timeout
+  uint32_t _flashMicros;
+  TlsStats _tlsStats;
+  Step _step;
+};
+
+#endif
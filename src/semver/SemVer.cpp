@@ -0,0 +1,135 @@
+/*
+   Semantic version without heap allocations
+   Purpose: Parses and compares versions exactly like semver.c, but keeps prerelease and metadata in a buffer
+            inside the object instead of separate heap strings, so going through a long manifest doesn't
+            churn the heap of a device that runs for months
+*/
+
+#include "SemVer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SEMVER_SLICE_SIZE 50  // Longest number semver.c parses
+#define SEMVER_VALID_CHARS "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ.-+"
+
+SemVer::SemVer(int major, int minor, int patch) : _prerelease(-1), _metadata(-1) {
+  this->major = major;
+  this->minor = minor;
+  this->patch = patch;
+  _tags[0]    = '\0';
+}
+
+bool SemVer::parse(const char *str) {
+  *this = SemVer();
+  size_t len = strlen(str);
+  if (len > SEMVER_MAX_LENGTH || strspn(str, SEMVER_VALID_CHARS) != len) return false;
+
+  // The metadata starts at the first '+', the prerelease at the first '-' before it
+  const char *end  = str + len;
+  const char *plus = strchr(str, '+');
+  const char *head = plus ? plus : end;
+  const char *dash = (const char *)memchr(str, '-', head - str);
+  if (dash) head = dash;
+
+  size_t preLength  = dash ? (plus ? plus : end) - dash - 1 : 0;
+  size_t metaLength = plus ? end - plus - 1 : 0;
+  if ((dash ? preLength + 1 : 0) + (plus ? metaLength + 1 : 0) > SEMVER_TAGS_SIZE) return false;
+
+  // Up to four numbers, the fourth is checked but not kept, anything after it is ignored as in semver.c
+  const char *slice = str;
+  for (int index = 1; slice && index <= 4; index++) {
+    const char *next = (const char *)memchr(slice, '.', head - slice);
+    size_t length    = (next ? next : head) - slice;
+    if (length > SEMVER_SLICE_SIZE) {
+      *this = SemVer();
+      return false;
+    }
+    // strtol() on a copy of the slice, so the value saturates the same way it does in semver.c
+    char number[SEMVER_SLICE_SIZE + 1];
+    memcpy(number, slice, length);
+    number[length] = '\0';
+    char *endptr;
+    int value = strtol(number, &endptr, 10);
+    if (*endptr != '\0') {
+      *this = SemVer();
+      return false;
+    }
+    if (index == 1) major = value;
+    if (index == 2) minor = value;
+    if (index == 3) patch = value;
+    slice = next ? next + 1 : NULL;
+  }
+
+  size_t used = 0;
+  if (dash) {
+    memcpy(_tags, dash + 1, preLength);
+    _tags[preLength] = '\0';
+    _prerelease      = 0;
+    used             = preLength + 1;
+  }
+  if (plus) {
+    memcpy(_tags + used, plus + 1, metaLength);
+    _tags[used + metaLength] = '\0';
+    _metadata                = used;
+  }
+  return true;
+}
+
+static int compare_number(int x, int y) { return x == y ? 0 : x > y ? 1 : -1; }
+
+int SemVer::compare(const SemVer &other) const {
+  int res;
+  if ((res = compare_number(major, other.major)) != 0) return res;
+  if ((res = compare_number(minor, other.minor)) != 0) return res;
+  if ((res = compare_number(patch, other.patch)) != 0) return res;
+  return comparePrerelease(prerelease(), other.prerelease());
+}
+
+// Dot separated identifiers one by one: numbers rank below words, numbers compare by value and words
+// byte by byte, the shorter list ranks lower when all else is equal. Taken over from semver.c as it is,
+// quirks (a leading '-' makes a number negative) included, so both agree on every manifest.
+int SemVer::comparePrerelease(const char *x, const char *y) {
+  if (x == NULL && y == NULL) return 0;
+  if (y == NULL) return -1;
+  if (x == NULL) return 1;
+
+  const char *lastx = x, *lasty = y;
+  const char *endx = x + strlen(x), *endy = y + strlen(y);
+  while (true) {
+    const char *xptr = strchr(lastx, '.');
+    const char *yptr = strchr(lasty, '.');
+    if (!xptr) xptr = endx;
+    if (!yptr) yptr = endy;
+
+    char *endptr;
+    int xnum    = strtol(lastx, &endptr, 10);
+    bool xisnum = endptr == xptr;
+    int ynum    = strtol(lasty, &endptr, 10);
+    bool yisnum = endptr == yptr;
+
+    if (xisnum && !yisnum) return -1;
+    if (!xisnum && yisnum) return 1;
+    if (xisnum) {
+      if (xnum != ynum) return xnum < ynum ? -1 : 1;
+    } else {
+      size_t xn = xptr - lastx, yn = yptr - lasty;
+      int res   = strncmp(lastx, lasty, xn < yn ? xn : yn);
+      if (res) return res < 0 ? -1 : 1;
+      if (xn != yn) return xn < yn ? -1 : 1;
+    }
+
+    if (xptr == endx && yptr == endy) return 0;
+    if (xptr == endx) return -1;
+    if (yptr == endy) return 1;
+    lastx = xptr + 1;
+    lasty = yptr + 1;
+  }
+}
+
+size_t SemVer::render(char *dest, size_t size) const {
+  const char *pre = prerelease(), *meta = metadata();
+  int n = snprintf(dest, size, "%d.%d.%d%s%s%s%s", major, minor, patch, pre ? "-" : "", pre ? pre : "", meta ? "+" : "", meta ? meta : "");
+  return n < 0 ? 0 : n;
+}
@@ -0,0 +1,47 @@
+/*
+   Semantic version without heap allocations
+   Purpose: Parses and compares versions exactly like semver.c, but keeps prerelease and metadata in a buffer
+            inside the object instead of separate heap strings, so going through a long manifest doesn't
+            churn the heap of a device that runs for months
+*/
+
+#ifndef SemVer_h
+#define SemVer_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SEMVER_MAX_LENGTH 255  // Longest version string semver.c accepts
+#define SEMVER_TAGS_SIZE 64    // Prerelease and metadata together, each with its terminator
+#define SEMVER_RENDER_SIZE (3 * 12 + SEMVER_TAGS_SIZE)  // Enough for render() of any version parse() accepts
+
+class SemVer {
+ public:
+  SemVer(int major = 0, int minor = 0, int patch = 0);
+
+  // Same rules and results as semver_parse(), except that parts missing from str are 0 rather than left as
+  // they were. Returns false and leaves 0.0.0 on invalid input, and on prerelease plus metadata longer than
+  // SEMVER_TAGS_SIZE allows (semver.c would take those onto the heap).
+  bool parse(const char* str);
+  // -1, 0 or 1 like semver_compare(): major, minor and patch, then the prerelease, metadata doesn't count
+  int compare(const SemVer& other) const;
+  // Like semver_render() but bounded by size, returns the length of the whole version as snprintf() does
+  size_t render(char* dest, size_t size) const;
+
+  // NULL when the version has none, "" when it ended in a bare '-' or '+'
+  const char* prerelease() const { return _prerelease < 0 ? NULL : _tags + _prerelease; }
+  const char* metadata() const { return _metadata < 0 ? NULL : _tags + _metadata; }
+
+  int major;
+  int minor;
+  int patch;
+
+ private:
+  static int comparePrerelease(const char* x, const char* y);
+
+  char _tags[SEMVER_TAGS_SIZE];
+  int8_t _prerelease;  // Offset into _tags, -1 without one
+  int8_t _metadata;
+};
+
+#endif
@@ -0,0 +1,86 @@
+/*
+   Trusted signing keys
+   Purpose: Holds the public keys firmware signatures are checked against, each parsed once into a
+            SignatureVerifier when it is added and kept for the lifetime of the store, so a check costs
+            neither file system access nor key parsing. Keys are told apart by an ID a manifest entry names,
+            which lets a fleet move to a new key while images signed with the old one are still around.
+*/
+
+#include "KeyStore.h"
+
+#include <Preferences.h>
+
+KeyStore::KeyStore() : _count(0), _changes(1) {}
+
+bool KeyStore::insert(const char *id, SignatureVerifier *verifier, bool owned) {
+  if (!id) id = "";
+  bool taken = false;
+  for (size_t i = 0; i < _count; i++) taken |= strcmp(_entries[i].id, id) == 0;
+  if (strlen(id) > KEY_STORE_ID_LENGTH || _count == KEY_STORE_SIZE || taken) {
+    log_e("Key \"%s\" not added: ID too long or taken, or the store is full", id);
+    if (owned) delete verifier;
+    return false;
+  }
+  Entry &entry = _entries[_count++];
+  strcpy(entry.id, id);
+  entry.verifier = verifier;
+  entry.owned    = owned;
+  _changes++;
+  return true;
+}
+
+bool KeyStore::add(const char *id, const unsigned char *key, size_t length) {
+  SignatureVerifier *verifier = SignatureVerifier::fromPublicKey(key, length);
+  return verifier && insert(id, verifier, true);
+}
+
+bool KeyStore::add(const char *id, SignatureVerifier *verifier) { return verifier && insert(id, verifier, false); }
+
+// Read whole into a buffer with a NUL behind it, so PEM parses as it is; DER starts with a SEQUENCE
+static bool add_buffer(KeyStore &store, const char *id, unsigned char *key, size_t length) {
+  key[length] = '\0';
+  return store.add(id, key, key[0] == 0x30 ? length : length + 1);
+}
+
+bool KeyStore::addFile(const char *id, fs::FS &fs, const char *path) {
+  File file = fs.open(path);
+  if (!file) {
+    log_e("Failed to open %s for reading", path);
+    return false;
+  }
+  size_t length      = file.size();
+  unsigned char *key = (unsigned char *)malloc(length + 1);
+  bool ok            = key && length > 0 && file.read(key, length) == length && add_buffer(*this, id, key, length);
+  file.close();
+  free(key);
+  return ok;
+}
+
+bool KeyStore::addNVS(const char *id, const char *nvsNamespace, const char *name) {
+  Preferences prefs;
+  if (!prefs.begin(nvsNamespace, true)) return false;
+  size_t length      = prefs.getBytesLength(name);
+  unsigned char *key = length > 0 ? (unsigned char *)malloc(length + 1) : NULL;
+  bool ok            = key && prefs.getBytes(name, key, length) == length && add_buffer(*this, id, key, length);
+  prefs.end();
+  free(key);
+  if (!ok) log_e("No usable key %s in NVS namespace %s", name, nvsNamespace);
+  return ok;
+}
+
+SignatureVerifier *KeyStore::find(const char *id) {
+  if (_count == 0) return NULL;
+  if (!id || !*id) return _entries[0].verifier;
+  for (size_t i = 0; i < _count; i++) {
+    if (strcmp(_entries[i].id, id) == 0) return _entries[i].verifier;
+  }
+  return NULL;
+}
+
+void KeyStore::clear() {
+  for (size_t i = 0; i < _count; i++) {
+    if (_entries[i].owned) delete _entries[i].verifier;
+  }
+  _count = 0;
+  _changes++;
+}
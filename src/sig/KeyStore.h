@@ -0,0 +1,54 @@
+/*
+   Trusted signing keys
+   Purpose: Holds the public keys firmware signatures are checked against, each parsed once into a
+            SignatureVerifier when it is added and kept for the lifetime of the store, so a check costs
+            neither file system access nor key parsing. Keys are told apart by an ID a manifest entry names,
+            which lets a fleet move to a new key while images signed with the old one are still around.
+*/
+
+#ifndef KeyStore_h
+#define KeyStore_h
+
+#include <Arduino.h>
+#include <FS.h>
+
+#include "SignatureVerifier.h"
+
+#define KEY_STORE_SIZE 4        // Keys a store holds at most
+#define KEY_STORE_ID_LENGTH 16  // Longest key ID, without the terminating NUL
+
+class KeyStore {
+ public:
+  KeyStore();
+  ~KeyStore() { clear(); }
+
+  // A PEM (with its terminating NUL) or DER public key, e.g. a constant compiled into the firmware. The
+  // data isn't needed after the call. false if it can't be parsed, the store is full or id is taken.
+  bool add(const char* id, const unsigned char* key, size_t length);
+  bool add(const char* id, const char* pem) { return add(id, (const unsigned char*)pem, strlen(pem) + 1); }
+  // The public key from a file, e.g. SPIFFS and /rsa_key.pub
+  bool addFile(const char* id, fs::FS& fs, const char* path);
+  // The public key as a bytes entry in NVS, PEM or DER
+  bool addNVS(const char* id, const char* nvsNamespace, const char* name);
+  // A verifier of the application's own, which stays the caller's
+  bool add(const char* id, SignatureVerifier* verifier);
+  // The key stored under id, the first one added for NULL or "". NULL if there is none.
+  SignatureVerifier* find(const char* id);
+  size_t count() const { return _count; }
+  // Goes up whenever a key is added or the store is cleared
+  uint32_t changes() const { return _changes; }
+  void clear();
+
+ private:
+  struct Entry {
+    char id[KEY_STORE_ID_LENGTH + 1];
+    SignatureVerifier* verifier;
+    bool owned;
+  };
+  bool insert(const char* id, SignatureVerifier* verifier, bool owned);
+  Entry _entries[KEY_STORE_SIZE];
+  size_t _count;
+  uint32_t _changes;
+};
+
+#endif
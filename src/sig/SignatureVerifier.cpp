@@ -0,0 +1,150 @@
+/*
+   Firmware signature check
+   Purpose: Checks the signature in front of an image against the SHA-256 digest computed while it was downloaded.
+            One implementation per key type: RSA-2048 and RSA-4096 (PKCS#1 v1.5) and ECDSA P-256 on mbedtls,
+            Ed25519 on libsodium. The key decides the algorithm and so how long the signature is.
+*/
+
+#include "SignatureVerifier.h"
+
+#include <Arduino.h>
+#include <sodium.h>
+#include <string.h>
+
+#include "mbedtls/pem.h"
+#include "mbedtls/version.h"
+
+// mbedtls 3 made the key's group private
+#if MBEDTLS_VERSION_MAJOR >= 3
+#define EC_GROUP_ID(pk) mbedtls_pk_ec(pk)->MBEDTLS_PRIVATE(grp).id
+#else
+#define EC_GROUP_ID(pk) mbedtls_pk_ec(pk)->grp.id
+#endif
+
+// SubjectPublicKeyInfo of an Ed25519 key (RFC 8410) up to the 32 key bytes, mbedtls doesn't know the algorithm
+static const unsigned char ED25519_SPKI_PREFIX[] = {0x30, 0x2a, 0x30, 0x05, 0x06, 0x03, 0x2b, 0x65, 0x70, 0x03, 0x21, 0x00};
+
+SignatureVerifier::Algorithm SignatureVerifier::algorithmFromName(const char *name) {
+  if (!name) return NONE;
+  if (strcmp(name, "rsa-2048") == 0) return RSA_2048;
+  if (strcmp(name, "rsa-4096") == 0) return RSA_4096;
+  if (strcmp(name, "ecdsa-p256") == 0) return ECDSA_P256;
+  if (strcmp(name, "ed25519") == 0) return ED25519;
+  return NONE;
+}
+
+const char *SignatureVerifier::algorithmName(Algorithm algorithm) {
+  switch (algorithm) {
+    case RSA_2048:
+      return "rsa-2048";
+    case RSA_4096:
+      return "rsa-4096";
+    case ECDSA_P256:
+      return "ecdsa-p256";
+    case ED25519:
+      return "ed25519";
+    default:
+      return "none";
+  }
+}
+
+size_t SignatureVerifier::signatureLength(Algorithm algorithm) {
+  switch (algorithm) {
+    case RSA_2048:
+      return 256;
+    case RSA_4096:
+      return 512;
+    case ECDSA_P256:
+    case ED25519:
+      return 64;
+    default:
+      return 0;
+  }
+}
+
+// The key bytes of an Ed25519 SubjectPublicKeyInfo, PEM or DER
+static bool ed25519_key(const unsigned char *key, size_t length, unsigned char *out) {
+  if (length > 0 && key[length - 1] == '\0') {
+    mbedtls_pem_context pem;
+    mbedtls_pem_init(&pem);
+    size_t used;
+    bool ok = mbedtls_pem_read_buffer(&pem, "-----BEGIN PUBLIC KEY-----", "-----END PUBLIC KEY-----", key, NULL, 0, &used) == 0 &&
+              pem.buflen == sizeof(ED25519_SPKI_PREFIX) + 32 && memcmp(pem.buf, ED25519_SPKI_PREFIX, sizeof(ED25519_SPKI_PREFIX)) == 0;
+    if (ok) memcpy(out, pem.buf + sizeof(ED25519_SPKI_PREFIX), 32);
+    mbedtls_pem_free(&pem);
+    return ok;
+  }
+  if (length != sizeof(ED25519_SPKI_PREFIX) + 32 || memcmp(key, ED25519_SPKI_PREFIX, sizeof(ED25519_SPKI_PREFIX)) != 0) return false;
+  memcpy(out, key + sizeof(ED25519_SPKI_PREFIX), 32);
+  return true;
+}
+
+SignatureVerifier *SignatureVerifier::fromPublicKey(const unsigned char *key, size_t length) {
+  unsigned char ed25519[32];
+  if (ed25519_key(key, length, ed25519)) return new Ed25519Verifier(ed25519);
+
+  mbedtls_pk_context pk;
+  mbedtls_pk_init(&pk);
+  int ret = mbedtls_pk_parse_public_key(&pk, key, length);
+  if (ret != 0) {
+    log_e("Reading public key failed: mbedtls_pk_parse_public_key -0x%x", -ret);
+    mbedtls_pk_free(&pk);
+    return NULL;
+  }
+
+  SignatureVerifier *verifier = NULL;
+  size_t bits                 = mbedtls_pk_get_bitlen(&pk);
+  if (mbedtls_pk_get_type(&pk) == MBEDTLS_PK_RSA && (bits == 2048 || bits == 4096)) {
+    verifier = new RsaVerifier(pk, bits == 2048 ? RSA_2048 : RSA_4096);
+  } else if (mbedtls_pk_get_type(&pk) == MBEDTLS_PK_ECKEY && EC_GROUP_ID(pk) == MBEDTLS_ECP_DP_SECP256R1) {
+    verifier = new EcdsaVerifier(pk, ECDSA_P256);
+  } else {
+    log_e("Public key is neither RSA-2048/4096 nor ECDSA P-256 (%u bit type %d)", bits, mbedtls_pk_get_type(&pk));
+  }
+  mbedtls_pk_free(&pk);
+  return verifier;
+}
+
+PkVerifier::PkVerifier(mbedtls_pk_context &pk, Algorithm algorithm) : _pk(pk), _algorithm(algorithm) { mbedtls_pk_init(&pk); }
+
+PkVerifier::~PkVerifier() { mbedtls_pk_free(&_pk); }
+
+bool PkVerifier::verifyDer(const unsigned char *digest, const unsigned char *signature, size_t length) {
+  int ret = mbedtls_pk_verify(&_pk, MBEDTLS_MD_SHA256, digest, 32, signature, length);
+  if (ret != 0) log_e("%s signature rejected: mbedtls_pk_verify -0x%x", algorithmName(_algorithm), -ret);
+  return ret == 0;
+}
+
+bool RsaVerifier::verify(const unsigned char *digest, const unsigned char *signature) { return verifyDer(digest, signature, signatureLength()); }
+
+// One big-endian number as a DER INTEGER: without leading zeros, but with one if the top bit is set
+static size_t der_integer(const unsigned char *number, size_t length, unsigned char *out) {
+  while (length > 1 && number[0] == 0) {
+    number++;
+    length--;
+  }
+  size_t pad = number[0] & 0x80 ? 1 : 0;
+  out[0]     = 0x02;
+  out[1]     = length + pad;
+  out[2]     = 0;
+  memcpy(out + 2 + pad, number, length);
+  return 2 + pad + length;
+}
+
+bool EcdsaVerifier::verify(const unsigned char *digest, const unsigned char *signature) {
+  // SEQUENCE { INTEGER r, INTEGER s }, at most 2 + 2 * 35 bytes
+  unsigned char der[72];
+  size_t length = der_integer(signature, 32, der + 2);
+  length += der_integer(signature + 32, 32, der + 2 + length);
+  der[0] = 0x30;
+  der[1] = length;
+  return verifyDer(digest, der, 2 + length);
+}
+
+Ed25519Verifier::Ed25519Verifier(const unsigned char *publicKey) { memcpy(_key, publicKey, sizeof(_key)); }
+
+bool Ed25519Verifier::verify(const unsigned char *digest, const unsigned char *signature) {
+  if (crypto_sign_verify_detached(signature, digest, 32, _key) == 0) return true;
+  log_e("ed25519 signature rejected");
+  return false;
+}
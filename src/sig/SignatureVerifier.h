@@ -0,0 +1,79 @@
+/*
+   Firmware signature check
+   Purpose: Checks the signature in front of an image against the SHA-256 digest computed while it was downloaded.
+            One implementation per key type: RSA-2048 and RSA-4096 (PKCS#1 v1.5) and ECDSA P-256 on mbedtls,
+            Ed25519 on libsodium. The key decides the algorithm and so how long the signature is.
+*/
+
+#ifndef SignatureVerifier_h
+#define SignatureVerifier_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mbedtls/pk.h"
+
+#define SIGNATURE_MAX_LENGTH 512  // RSA-4096, the longest signature of the supported algorithms
+
+class SignatureVerifier {
+ public:
+  enum Algorithm { NONE, RSA_2048, RSA_4096, ECDSA_P256, ED25519 };
+
+  // "rsa-2048", "rsa-4096", "ecdsa-p256" or "ed25519" as used in the manifest, anything else is NONE
+  static Algorithm algorithmFromName(const char* name);
+  static const char* algorithmName(Algorithm algorithm);
+  // Bytes the signature takes in front of the image, 0 for NONE
+  static size_t signatureLength(Algorithm algorithm);
+  // Verifier for a public key, PEM (with its terminating NUL, as mbedtls takes it) or DER SubjectPublicKeyInfo.
+  // NULL if the key can't be parsed or is of none of the supported types; the caller deletes it.
+  static SignatureVerifier* fromPublicKey(const unsigned char* key, size_t length);
+
+  virtual ~SignatureVerifier() {}
+  virtual Algorithm algorithm() const = 0;
+  size_t signatureLength() const { return signatureLength(algorithm()); }
+  // signature is signatureLength() bytes, digest the SHA-256 of the image
+  virtual bool verify(const unsigned char* digest, const unsigned char* signature) = 0;
+};
+
+// RSA and ECDSA keys as mbedtls parsed them
+class PkVerifier : public SignatureVerifier {
+ public:
+  // Takes over pk, which is left empty
+  PkVerifier(mbedtls_pk_context& pk, Algorithm algorithm);
+  ~PkVerifier();
+  Algorithm algorithm() const { return _algorithm; }
+
+ protected:
+  bool verifyDer(const unsigned char* digest, const unsigned char* signature, size_t length);
+  mbedtls_pk_context _pk;
+  Algorithm _algorithm;
+};
+
+// PKCS#1 v1.5, the signature is as long as the modulus
+class RsaVerifier : public PkVerifier {
+ public:
+  using PkVerifier::PkVerifier;
+  bool verify(const unsigned char* digest, const unsigned char* signature);
+};
+
+// The signature is r and s as two 32 byte big-endian numbers (as in JWS and COSE), not the variable length
+// DER mbedtls and openssl produce, so that it has a fixed place in front of the image
+class EcdsaVerifier : public PkVerifier {
+ public:
+  using PkVerifier::PkVerifier;
+  bool verify(const unsigned char* digest, const unsigned char* signature);
+};
+
+// Pure Ed25519 over the 32 byte SHA-256 digest rather than the image itself, so that the image can be
+// hashed as it streams to flash like for the other algorithms
+class Ed25519Verifier : public SignatureVerifier {
+ public:
+  explicit Ed25519Verifier(const unsigned char* publicKey);
+  Algorithm algorithm() const { return ED25519; }
+  bool verify(const unsigned char* digest, const unsigned char* signature);
+
+ private:
+  unsigned char _key[32];
+};
+
+#endif
@@ -0,0 +1,309 @@
+/*
+   TLS client on mbedtls
+   Purpose: TLS over the modem socket (or any other Arduino Client) that keeps the negotiated session, so the
+            next connection to the same server resumes it (session ID or ticket) instead of doing a full handshake
+*/
+
+#include "TlsClient.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define TLS_HANDSHAKE_TIMEOUT 30000L
+#define TLS_WRITE_TIMEOUT 30000L
+
+// Everything mbedtls needs for one connection, allocated by connect() and released by stop()
+struct TlsClient::State {
+  mbedtls_ssl_context ssl;
+  mbedtls_ssl_config conf;
+  mbedtls_ctr_drbg_context drbg;
+  mbedtls_entropy_context entropy;
+  uint32_t certificates;  // Server certificates seen during the handshake, none means it was resumed
+  bool established;
+  bool closed;  // The server sent close_notify or hung up
+};
+
+TlsSession::TlsSession() : _port(0), _valid(false) { mbedtls_ssl_session_init(&_session); }
+
+TlsSession::~TlsSession() { mbedtls_ssl_session_free(&_session); }
+
+bool TlsSession::matches(const char *host, uint16_t port) const { return _valid && _port == port && _host == host; }
+
+void TlsSession::clear() {
+  mbedtls_ssl_session_free(&_session);
+  mbedtls_ssl_session_init(&_session);
+  _host  = "";
+  _port  = 0;
+  _valid = false;
+}
+
+// The underlying client never blocks, mbedtls is told to come back later instead
+int TlsClient::bioSend(void *ctx, const unsigned char *buf, size_t len) {
+  TlsClient *self = (TlsClient *)ctx;
+  if (!self->_client->connected()) return MBEDTLS_ERR_SSL_CONN_EOF;
+  size_t n = self->_client->write(buf, len);
+  self->_bytesOut += n;
+  return n > 0 ? (int)n : MBEDTLS_ERR_SSL_WANT_WRITE;
+}
+
+int TlsClient::bioRecv(void *ctx, unsigned char *buf, size_t len) {
+  TlsClient *self = (TlsClient *)ctx;
+  int n           = self->_client->read(buf, len);
+  if (n > 0) {
+    self->_bytesIn += n;
+    return n;
+  }
+  return self->_client->connected() ? MBEDTLS_ERR_SSL_WANT_READ : 0;
+}
+
+TlsClient::TlsClient(Client *client)
+    : _client(client),
+      _trust(NULL),
+      _session(NULL),
+      _handshakeTimeout(TLS_HANDSHAKE_TIMEOUT),
+      _maxFragmentLength(0),
+      _state(NULL),
+      _port(0),
+      _resuming(false),
+      _handshakeStart(0),
+      _handshake{0, 0, false, false},
+      _error(0),
+      _peek(-1),
+      _bytesIn(0),
+      _bytesOut(0) {}
+
+TlsClient::~TlsClient() { stop(); }
+
+// The max_fragment_length code for a record size, the largest one that isn't above it
+static unsigned char fragment_code(uint16_t length) {
+  if (length >= 4096) return MBEDTLS_SSL_MAX_FRAG_LEN_4096;
+  if (length >= 2048) return MBEDTLS_SSL_MAX_FRAG_LEN_2048;
+  if (length >= 1024) return MBEDTLS_SSL_MAX_FRAG_LEN_1024;
+  return MBEDTLS_SSL_MAX_FRAG_LEN_512;
+}
+
+// Only counts, the chain itself is checked by mbedtls against the roots of the trust
+int TlsClient::verifyCert(void *state, mbedtls_x509_crt *crt, int depth, uint32_t *flags) {
+  if (depth == 0) ((State *)state)->certificates++;
+  return 0;
+}
+
+bool TlsClient::failed(int ret) {
+  _error = ret;
+  log_e("TLS error -0x%04x", -ret);
+  return false;
+}
+
+int TlsClient::connect(IPAddress ip, uint16_t port) { return connect(ip.toString().c_str(), port); }
+
+int TlsClient::connect(const char *host, uint16_t port) {
+  if (!startConnect(host, port)) return 0;
+  int ret;
+  while ((ret = pollConnect()) == 0) delay(1);
+  return ret > 0;
+}
+
+bool TlsClient::startConnect(const char *host, uint16_t port) {
+  stop();
+  _error             = 0;
+  _handshake.cpuTime = 0;
+  if (!_client || !_client->connect(host, port)) return false;
+  bool offer = _session && _session->matches(host, port);
+  if (!setup(host, offer)) {
+    stop();
+    return false;
+  }
+  _host           = host;
+  _port           = port;
+  _resuming       = offer && mbedtls_ssl_set_session(&_state->ssl, &_session->_session) == 0;
+  _handshakeStart = millis();
+  return true;
+}
+
+bool TlsClient::setup(const char *host, bool resuming) {
+  _state = (State *)malloc(sizeof(State));
+  if (!_state) return failed(MBEDTLS_ERR_SSL_ALLOC_FAILED);
+  mbedtls_ssl_init(&_state->ssl);
+  mbedtls_ssl_config_init(&_state->conf);
+  mbedtls_ctr_drbg_init(&_state->drbg);
+  mbedtls_entropy_init(&_state->entropy);
+  _state->certificates = 0;
+  _state->established  = false;
+  _state->closed       = false;
+
+  int ret;
+  if ((ret = mbedtls_ctr_drbg_seed(&_state->drbg, mbedtls_entropy_func, &_state->entropy, NULL, 0)) != 0 ||
+      (ret = mbedtls_ssl_config_defaults(&_state->conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT)) != 0) {
+    return failed(ret);
+  }
+  if (_trust && _trust->empty()) {
+    log_e("Nothing to check %s against, no roots or pins", host);
+    return failed(MBEDTLS_ERR_X509_CERT_VERIFY_FAILED);
+  }
+  if (_trust && _trust->pins() > 0 && !resuming) {
+    // checkPins() looks at the server's key once the handshake is done, mbedtls doesn't build the chain
+    mbedtls_ssl_conf_authmode(&_state->conf, MBEDTLS_SSL_VERIFY_NONE);
+  } else if (_trust && _trust->chain() && _trust->pins() == 0) {
+    // Parsed once by the trust, shared by every connection
+    mbedtls_ssl_conf_ca_chain(&_state->conf, _trust->chain(), NULL);
+    mbedtls_ssl_conf_authmode(&_state->conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+  } else {
+    // Without a root the chain check fails but doesn't abort; it still has to run for verifyCert(), which tells
+    // a resumed handshake from a full one. With pins, checkPins() decides after a full one.
+    mbedtls_ssl_conf_authmode(&_state->conf, MBEDTLS_SSL_VERIFY_OPTIONAL);
+  }
+  mbedtls_ssl_conf_verify(&_state->conf, verifyCert, _state);
+  mbedtls_ssl_conf_rng(&_state->conf, mbedtls_ctr_drbg_random, &_state->drbg);
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+  mbedtls_ssl_conf_session_tickets(&_state->conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+  if (_maxFragmentLength > 0 && (ret = mbedtls_ssl_conf_max_frag_len(&_state->conf, fragment_code(_maxFragmentLength))) != 0) return failed(ret);
+#endif
+  if ((ret = mbedtls_ssl_setup(&_state->ssl, &_state->conf)) != 0 || (ret = mbedtls_ssl_set_hostname(&_state->ssl, host)) != 0) return failed(ret);
+  mbedtls_ssl_set_bio(&_state->ssl, this, bioSend, bioRecv, NULL);
+  return true;
+}
+
+int TlsClient::pollConnect() {
+  if (!_state) return -1;
+  if (_state->established) return 1;
+
+  unsigned long start = micros();
+  int ret             = mbedtls_ssl_handshake(&_state->ssl);
+  _handshake.cpuTime += micros() - start;
+  if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+    if (millis() - _handshakeStart <= _handshakeTimeout) return 0;
+    ret = MBEDTLS_ERR_SSL_TIMEOUT;
+  }
+  _handshake.duration = millis() - _handshakeStart;
+  _handshake.resumed  = _resuming && _state->certificates == 0;
+  _handshake.pinned   = false;
+  if (ret == 0 && !_handshake.resumed && _trust && _trust->pins() > 0) {
+    start = micros();
+    if (!checkPins()) ret = MBEDTLS_ERR_X509_CERT_VERIFY_FAILED;
+    _handshake.cpuTime += micros() - start;
+  }
+  if (ret != 0) {
+    // A session the server chokes on is not worth offering again
+    if (_resuming) _session->clear();
+    log_e("TLS handshake with %s:%u failed", _host.c_str(), _port);
+    failed(ret);
+    stop();
+    return -1;
+  }
+
+  _state->established = true;
+  log_i("TLS handshake with %s:%u took %u ms, %u us CPU (%s)", _host.c_str(), _port, _handshake.duration, _handshake.cpuTime,
+        _handshake.resumed ? "resumed" : _handshake.pinned ? "full, pinned" : "full");
+
+  if (_session) {
+    if (mbedtls_ssl_get_session(&_state->ssl, &_session->_session) == 0) {
+      _session->_host  = _host;
+      _session->_port  = _port;
+      _session->_valid = true;
+    } else {
+      _session->clear();
+    }
+  }
+  return 1;
+}
+
+// The server's key against the pins, and its chain against the roots only if the key isn't pinned. A resumed
+// session was checked when it was made.
+bool TlsClient::checkPins() {
+  const mbedtls_x509_crt *peer = mbedtls_ssl_get_peer_cert(&_state->ssl);
+  if (_trust->pinned(peer)) {
+    _handshake.pinned = true;
+    return true;
+  }
+  uint32_t flags = _trust->verify((mbedtls_x509_crt *)peer, _host.c_str());
+  if (flags != 0) log_e("%s:%u has neither a pinned key nor a chain to the roots (flags 0x%x)", _host.c_str(), _port, flags);
+  return flags == 0;
+}
+
+size_t TlsClient::write(const uint8_t *buf, size_t size) {
+  if (!_state) return 0;
+  size_t written      = 0;
+  unsigned long start = millis();
+  while (written < size) {
+    int ret = mbedtls_ssl_write(&_state->ssl, buf + written, size - written);
+    if (ret > 0) {
+      written += ret;
+      start = millis();
+    } else if ((ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) || millis() - start > TLS_WRITE_TIMEOUT) {
+      failed(ret);
+      break;
+    } else {
+      delay(1);
+    }
+  }
+  return written;
+}
+
+int TlsClient::available() {
+  if (!_state) return 0;
+  if (mbedtls_ssl_get_bytes_avail(&_state->ssl) == 0 && !_state->closed) {
+    // Decrypts the next record if it has arrived completely, without consuming any of it
+    int ret = mbedtls_ssl_read(&_state->ssl, NULL, 0);
+    if (ret == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY || ret == MBEDTLS_ERR_SSL_CONN_EOF) {
+      _state->closed = true;
+    } else if (ret < 0 && ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+      _state->closed = true;
+      failed(ret);
+    }
+  }
+  return mbedtls_ssl_get_bytes_avail(&_state->ssl) + (_peek >= 0 ? 1 : 0);
+}
+
+int TlsClient::read() {
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+int TlsClient::read(uint8_t *buf, size_t size) {
+  if (!_state || size == 0) return -1;
+  int n = 0;
+  if (_peek >= 0) {
+    buf[n++] = _peek;
+    _peek    = -1;
+    if (--size == 0) return n;
+  }
+  if (_state->closed) return n > 0 ? n : -1;
+
+  int ret = mbedtls_ssl_read(&_state->ssl, buf + n, size);
+  if (ret > 0) return n + ret;
+  if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) return n;
+  _state->closed = true;
+  if (ret != 0 && ret != MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY && ret != MBEDTLS_ERR_SSL_CONN_EOF) failed(ret);
+  return n > 0 ? n : -1;
+}
+
+int TlsClient::peek() {
+  if (_peek < 0) {
+    uint8_t c;
+    if (read(&c, 1) == 1) _peek = c;
+  }
+  return _peek;
+}
+
+void TlsClient::stop() {
+  if (_state) {
+    if (_state->established && !_state->closed && _client->connected()) mbedtls_ssl_close_notify(&_state->ssl);
+    mbedtls_ssl_free(&_state->ssl);
+    mbedtls_ssl_config_free(&_state->conf);
+    mbedtls_ctr_drbg_free(&_state->drbg);
+    mbedtls_entropy_free(&_state->entropy);
+    free(_state);
+    _state = NULL;
+  }
+  if (_client) _client->stop();
+  _peek = -1;
+}
+
+// Data already decrypted (or peeked) can still be read after the server closed the connection
+uint8_t TlsClient::connected() {
+  if (!_state) return false;
+  if (_peek >= 0 || mbedtls_ssl_get_bytes_avail(&_state->ssl) > 0) return true;
+  return !_state->closed && _client->connected();
+}
@@ -0,0 +1,121 @@
+/*
+   TLS client on mbedtls
+   Purpose: TLS over the modem socket (or any other Arduino Client) that keeps the negotiated session, so the
+            next connection to the same server resumes it (session ID or ticket) instead of doing a full handshake
+*/
+
+#ifndef TlsClient_h
+#define TlsClient_h
+
+#include <Arduino.h>
+#include <Client.h>
+
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ssl.h"
+#include "mbedtls/x509_crt.h"
+#include "TlsTrust.h"
+
+// Session of the last handshake, only offered again to the host and port it came from
+class TlsSession {
+ public:
+  TlsSession();
+  ~TlsSession();
+  TlsSession(const TlsSession&)            = delete;
+  TlsSession& operator=(const TlsSession&) = delete;
+  bool valid() const { return _valid; }
+  bool matches(const char* host, uint16_t port) const;
+  void clear();
+
+ private:
+  friend class TlsClient;
+  mbedtls_ssl_session _session;
+  String _host;
+  uint16_t _port;
+  bool _valid;
+};
+
+struct TlsHandshake {
+  uint32_t duration;  // ms from ClientHello to the server's Finished
+  uint32_t cpuTime;   // us spent in mbedtls (and the socket calls it makes) for it, the waits for the server not counted
+  bool resumed;       // Abbreviated handshake, the server accepted the cached session
+  bool pinned;        // The server's key is one of the pins, its chain wasn't checked
+};
+
+struct TlsStats {
+  uint32_t handshakes;
+  uint32_t resumed;
+  uint32_t handshakeTime;     // ms spent in all handshakes together
+  uint32_t handshakeCpuTime;  // us of TlsHandshake::cpuTime of all of them
+  TlsHandshake last;
+};
+
+class TlsClient : public Client {
+ public:
+  explicit TlsClient(Client* client = NULL);
+  ~TlsClient();
+
+  void setClient(Client* client) { _client = client; }
+  // Roots and pins the server is checked against, NULL accepts any server and an empty trust none. Not
+  // copied, it has to outlive the connections.
+  void setTrust(TlsTrust* trust) { _trust = trust; }
+  // Offered on connect() if it matches, replaced by the session of every successful handshake
+  void setSession(TlsSession* session) { _session = session; }
+  void setHandshakeTimeout(unsigned long timeout) { _handshakeTimeout = timeout; }
+  // Asks the server for records of at most length bytes (512, 1024, 2048 or 4096; 0 for full 16 KB records)
+  // with the max_fragment_length extension. Where mbedtls sizes its record buffers by the negotiated length
+  // (MBEDTLS_SSL_VARIABLE_BUFFER_LENGTH, or the dynamic buffers of ESP-IDF), that is what they shrink to.
+  // A server that doesn't know the extension ignores it. Other values are rounded down.
+  void setMaxFragmentLength(uint16_t length) { _maxFragmentLength = length; }
+  const TlsHandshake& lastHandshake() const { return _handshake; }
+  int lastError() const { return _error; }  // mbedtls error code of the last failure
+  // Bytes through the underlying client since this TlsClient was made, handshakes and record overhead included
+  uint32_t bytesReceived() const { return _bytesIn; }
+  uint32_t bytesSent() const { return _bytesOut; }
+
+  int connect(IPAddress ip, uint16_t port);
+  int connect(const char* host, uint16_t port);
+  // connect() in two halves for callers that can't wait for the handshake: startConnect() opens the socket
+  // and sets up TLS, pollConnect() advances the handshake and returns 1 once it is done, 0 while it is
+  // still going and -1 if it failed (the client is stopped then)
+  bool startConnect(const char* host, uint16_t port);
+  int pollConnect();
+  size_t write(uint8_t c) { return write(&c, 1); }
+  size_t write(const uint8_t* buf, size_t size);
+  int available();
+  int read();
+  int read(uint8_t* buf, size_t size);
+  int peek();
+  void flush() {}
+  void stop();
+  uint8_t connected();
+  operator bool() { return connected(); }
+
+  using Print::write;
+
+ private:
+  struct State;
+  static int verifyCert(void* state, mbedtls_x509_crt* crt, int depth, uint32_t* flags);
+  static int bioSend(void* ctx, const unsigned char* buf, size_t len);
+  static int bioRecv(void* ctx, unsigned char* buf, size_t len);
+  bool setup(const char* host, bool resuming);
+  bool checkPins();
+  bool failed(int ret);
+  Client* _client;
+  TlsTrust* _trust;
+  TlsSession* _session;
+  unsigned long _handshakeTimeout;
+  uint16_t _maxFragmentLength;
+  State* _state;
+  String _host;
+  uint16_t _port;
+  bool _resuming;
+  unsigned long _handshakeStart;
+  TlsHandshake _handshake;
+  int _error;
+  int _peek;
+  uint32_t _bytesIn;
+  uint32_t _bytesOut;
+};
+
+#endif
@@ -0,0 +1,91 @@
+/*
+   What a TLS server is checked against
+   Purpose: Root certificates parsed once into an mbedtls chain that every connection shares for the lifetime of
+            the object, instead of parsing PEM on each connect, plus optional SHA-256 pins of the server's public
+            key (its SubjectPublicKeyInfo) that accept a server without building and checking its chain
+*/
+
+#include "TlsTrust.h"
+
+#include <string.h>
+
+#include "mbedtls/base64.h"
+#include "mbedtls/md.h"
+#include "mbedtls/version.h"
+
+// mbedtls 3 made the certificate's raw public key private
+#if MBEDTLS_VERSION_MAJOR >= 3
+#define CRT_PK_RAW(crt) (crt)->MBEDTLS_PRIVATE(pk_raw)
+#else
+#define CRT_PK_RAW(crt) (crt)->pk_raw
+#endif
+
+TlsTrust::TlsTrust() : _anchors(0), _pem(NULL), _pins(0) { mbedtls_x509_crt_init(&_chain); }
+
+TlsTrust::~TlsTrust() { mbedtls_x509_crt_free(&_chain); }
+
+bool TlsTrust::addAnchor(const char *pem) {
+  // Certificates of a bundle that don't parse are skipped, as long as one does
+  int ret = mbedtls_x509_crt_parse(&_chain, (const unsigned char *)pem, strlen(pem) + 1);
+  if (ret < 0) {
+    log_e("Root certificate not added: mbedtls_x509_crt_parse -0x%04x", -ret);
+    return false;
+  }
+  if (ret > 0) log_w("%d certificates of the root bundle skipped", ret);
+  if (!_pem) _pem = pem;
+  _anchors++;
+  return true;
+}
+
+bool TlsTrust::addAnchor(const unsigned char *der, size_t length) {
+  int ret = mbedtls_x509_crt_parse_der(&_chain, der, length);
+  if (ret != 0) {
+    log_e("Root certificate not added: mbedtls_x509_crt_parse_der -0x%04x", -ret);
+    return false;
+  }
+  _anchors++;
+  return true;
+}
+
+bool TlsTrust::addPin(const unsigned char *sha256) {
+  if (_pins == TLS_TRUST_MAX_PINS) {
+    log_e("Pin not added, there are %d already", TLS_TRUST_MAX_PINS);
+    return false;
+  }
+  memcpy(_pin[_pins++], sha256, 32);
+  return true;
+}
+
+bool TlsTrust::addPin(const char *base64) {
+  unsigned char sha256[33];
+  size_t length = 0;
+  if (mbedtls_base64_decode(sha256, sizeof(sha256), &length, (const unsigned char *)base64, strlen(base64)) != 0 || length != 32) {
+    log_e("Pin %s is not a base64 SHA-256", base64);
+    return false;
+  }
+  return addPin(sha256);
+}
+
+void TlsTrust::clear() {
+  mbedtls_x509_crt_free(&_chain);
+  mbedtls_x509_crt_init(&_chain);
+  _anchors = 0;
+  _pem     = NULL;
+  _pins    = 0;
+}
+
+bool TlsTrust::pinned(const mbedtls_x509_crt *crt) const {
+  if (!crt || _pins == 0) return false;
+  unsigned char sha256[32];
+  if (mbedtls_md(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), CRT_PK_RAW(crt).p, CRT_PK_RAW(crt).len, sha256) != 0) return false;
+  for (int i = 0; i < _pins; i++) {
+    if (memcmp(_pin[i], sha256, sizeof(sha256)) == 0) return true;
+  }
+  return false;
+}
+
+uint32_t TlsTrust::verify(mbedtls_x509_crt *crt, const char *host) {
+  uint32_t flags = MBEDTLS_X509_BADCERT_NOT_TRUSTED;
+  if (crt && _anchors > 0) mbedtls_x509_crt_verify(crt, &_chain, NULL, host, &flags, NULL, NULL);
+  return flags;
+}
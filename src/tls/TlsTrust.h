@@ -0,0 +1,53 @@
+/*
+   What a TLS server is checked against
+   Purpose: Root certificates parsed once into an mbedtls chain that every connection shares for the lifetime of
+            the object, instead of parsing PEM on each connect, plus optional SHA-256 pins of the server's public
+            key (its SubjectPublicKeyInfo) that accept a server without building and checking its chain
+*/
+
+#ifndef TlsTrust_h
+#define TlsTrust_h
+
+#include <Arduino.h>
+
+#include "mbedtls/x509_crt.h"
+
+#define TLS_TRUST_MAX_PINS 4
+
+class TlsTrust {
+ public:
+  TlsTrust();
+  ~TlsTrust();
+  TlsTrust(const TlsTrust&)            = delete;
+  TlsTrust& operator=(const TlsTrust&) = delete;
+
+  // One or more PEM certificates (a bundle), or a DER one, added to the roots. The first PEM text added is
+  // kept (not copied) for the modem's own TLS, which takes a PEM file.
+  bool addAnchor(const char* pem);
+  bool addAnchor(const unsigned char* der, size_t length);
+  // SHA-256 of the server's SubjectPublicKeyInfo, 32 bytes or base64 as printed by
+  // openssl x509 -pubkey -noout | openssl pkey -pubin -outform der | openssl dgst -sha256 -binary | base64
+  bool addPin(const unsigned char* sha256);
+  bool addPin(const char* base64);
+  void clear();
+  bool empty() const { return _anchors == 0 && _pins == 0; }
+  int anchors() const { return _anchors; }
+  int pins() const { return _pins; }
+  // The roots for mbedtls_ssl_conf_ca_chain(), NULL if there are none
+  mbedtls_x509_crt* chain() { return _anchors > 0 ? &_chain : NULL; }
+  const char* pem() const { return _pem; }
+  // The server's public key is one of the pins
+  bool pinned(const mbedtls_x509_crt* crt) const;
+  // Chain check of a server certificate (with the intermediates it sent) against the roots, for a server
+  // whose key isn't pinned. 0 or the mbedtls verification flags.
+  uint32_t verify(mbedtls_x509_crt* crt, const char* host);
+
+ private:
+  mbedtls_x509_crt _chain;
+  int _anchors;
+  const char* _pem;
+  unsigned char _pin[TLS_TRUST_MAX_PINS][32];
+  int _pins;
+};
+
+#endif
@@ -0,0 +1,72 @@
+/*
+   Recorded HTTP responses for the host benchmark
+   Purpose: Byte streams as servers and proxies sent them (and a few broken ones), with what HttpResponseParser
+            has to make of them. The benchmark feeds each one split at every byte boundary.
+*/
+
+#ifndef http_fixtures_h
+#define http_fixtures_h
+
+#include <stdint.h>
+
+struct HttpFixture {
+  const char* name;
+  const char* raw;
+  bool headers;   // headersComplete() at the end of the stream
+  bool complete;  // bodyComplete()
+  bool failed;
+  int status;
+  const char* body;
+  bool keepAlive;
+  int64_t contentLength;
+  const char* location;
+  const char* etag;
+  int64_t rangeStart;
+  int64_t rangeEnd;
+  int64_t rangeTotal;
+};
+
+static const HttpFixture http_fixtures[] = {
+    {"200 identity", "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Length: 11\r\nETag: \"fw-1\"\r\n\r\nhello world",
+     true, true, false, 200, "hello world", true, 11, "", "\"fw-1\"", 0, 0, -1},
+    {"200, body overrun", "HTTP/1.1 200 OK\r\nContent-Length: 3\r\n\r\nabcdef", true, true, false, 200, "abc", true, 3, "", "", 0, 0, -1},
+    {"chunked", "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhello\r\nA\r\n, chunked!\r\n0\r\n\r\n", true, true, false, 200,
+     "hello, chunked!", true, -1, "", "", 0, 0, -1},
+    {"chunked, ext+trailers",
+     "HTTP/1.1 200 OK\r\nDate: Sat, 17 Oct 2026 10:00:00 GMT\r\ntransfer-encoding: gzip, Chunked\r\nTrailer: X-Checksum\r\n\r\n"
+     "5;name=value\r\nhello\r\n7 ; ext=\"q;uoted\"\r\n, world\r\n0;last\r\nX-Checksum: 1234\r\nX-Other: a\r\n\r\n",
+     true, true, false, 200, "hello, world", true, -1, "", "", 0, 0, -1},
+    {"206 Content-Range",
+     "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes 100-109/2000\r\nContent-Length: 10\r\nETag: \"fw-1\"\r\n\r\n0123456789", true, true,
+     false, 206, "0123456789", true, 10, "", "\"fw-1\"", 100, 109, 2000},
+    {"416 Content-Range */", "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */2000\r\nContent-Length: 0\r\n\r\n", true, true, false,
+     416, "", true, 0, "", "", 0, 0, 2000},
+    {"301 absolute Location",
+     "HTTP/1.1 301 Moved Permanently\r\nLocation: https://cdn.example.com:8443/fw/firmware.bin\r\nContent-Length: 0\r\n\r\n", true, true, false,
+     301, "", true, 0, "https://cdn.example.com:8443/fw/firmware.bin", "", 0, 0, -1},
+    {"302 relative Location", "HTTP/1.1 302 Found\r\nlocation:/v2/firmware.bin\r\nContent-Length: 5\r\nConnection: close\r\n\r\nmoved", true,
+     true, false, 302, "moved", false, 5, "/v2/firmware.bin", "", 0, 0, -1},
+    {"100-continue", "HTTP/1.1 100 Continue\r\n\r\nHTTP/1.1 200 OK\r\nContent-Length: 3\r\nConnection: close\r\n\r\nabc", true, true, false, 200,
+     "abc", false, 3, "", "", 0, 0, -1},
+    {"304", "HTTP/1.1 304 Not Modified\r\nETag: \"mf-1\"\r\nCache-Control: max-age=60\r\n\r\n", true, true, false, 304, "", true, -1, "",
+     "\"mf-1\"", 0, 0, -1},
+    {"HTTP/1.0 until close", "HTTP/1.0 200 OK\r\nServer: old\r\n\r\nto the end", true, false, false, 200, "to the end", false, -1, "", "", 0, 0,
+     -1},
+    {"LF only", "HTTP/1.1 200 OK\nContent-Length: 2\n\nok", true, true, false, 200, "ok", true, 2, "", "", 0, 0, -1},
+    {"truncated status line", "HTTP/1.1 20", false, false, false, 0, "", true, -1, "", "", 0, 0, -1},
+    {"truncated headers", "HTTP/1.1 200 OK\r\nContent-Length: 10\r\n", false, false, false, 200, "", true, 10, "", "", 0, 0, -1},
+    {"truncated body", "HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\n01234", true, false, false, 200, "01234", true, 10, "", "", 0, 0, -1},
+    {"truncated chunk", "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\na\r\nhello", true, false, false, 200, "hello", true, -1, "", "", 0,
+     0, -1},
+    {"malformed status line", "HTTP/1.1200 OK\r\nContent-Length: 0\r\n\r\n", false, false, true, 0, "", true, -1, "", "", 0, 0, -1},
+    {"not HTTP", "ICY 200 OK\r\n\r\n", false, false, true, 0, "", true, -1, "", "", 0, 0, -1},
+    {"status not a number", "HTTP/1.1 OK\r\n\r\n", false, false, true, 0, "", true, -1, "", "", 0, 0, -1},
+    {"bad chunk size", "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\nhello\r\n0\r\n\r\n", true, false, true, 200, "", true, -1, "",
+     "", 0, 0, -1},
+    {"empty chunk size", "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n\r\nhello\r\n0\r\n\r\n", true, false, true, 200, "", true, -1, "",
+     "", 0, 0, -1},
+    {"chunk without CRLF", "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nabcX\r\n0\r\n\r\n", true, false, true, 200, "abc", true, -1,
+     "", "", 0, 0, -1},
+};
+
+#endif
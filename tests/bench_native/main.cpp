@@ -0,0 +1,1221 @@
+/**
+   esp32 firmware OTA - host benchmark
+
+   Purpose: Run execHTTPcheck(), execOTA() and validate_sig() unchanged on Linux against the stand-ins in
+            tests/host (mocked modem, TLS terminated in process, memory mapped partitions, in-memory NVS) and
+            report throughput, allocations and peak heap for each, so changes to the download path can be
+            measured without a board and a SIM card
+
+   Run:
+   Step 1 : pio run -e native
+   Step 2 : .pio/build/native/program [image size in KB]
+
+   The exit code is non-zero if any update over the ideal link didn't end up byte-identical in the update partition.
+*/
+
+#include <Arduino.h>
+#include <SPIFFS.h>
+#include <esp32FotaGsmSSL.h>
+#include <sodium.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "HostFlash.h"
+#include "HostHeap.h"
+#include "HostNet.h"
+#include "HostTls.h"
+#include "LinkSimulator.h"
+#include "Preferences.h"
+#include "bench_key.h"
+#include "ca_cert.h"
+#include "delta/DeltaPatcher.h"
+#include "http/HttpResponseParser.h"
+#include "http_fixtures.h"
+#include "esp_ota_ops.h"
+#include "mbedtls/md.h"
+#include "mbedtls/pem.h"
+#include "mbedtls/pk.h"
+#include "mbedtls/version.h"
+#include "ota/Inflater.h"
+#include "semver/SemVer.h"
+#include "semver/semver.h"
+#include "sig/SignatureVerifier.h"
+
+#define BENCH_HOST "fota.local"
+#define BENCH_PORT 443
+#define BENCH_CHAIN_PORT 8443  // The same server with bench_chain_cert
+#define BENCH_SIG_LEN 512
+#define FLEET_TYPES 300
+// tools/ of the checkout, for fota_delta.py. platformio.ini sets the absolute path, so the benchmark runs from
+// any directory; without it, it has to be started from the checkout.
+#ifndef FOTA_TOOLS_DIR
+#define FOTA_TOOLS_DIR "tools"
+#endif
+
+TinyGsm modem(Serial1);
+HttpFileServer server;
+HostTlsEndpoint tls;
+HostTlsEndpoint chainTls;
+
+static int failures = 0;
+
+// Downlink/uplink in bytes/s, RTT and jitter in ms, one round trip for TCP setup; the TLS handshake
+// adds its own flights (two round trips, one when resumed)
+static const LinkProfile profiles[] = {
+    {"ideal", 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {"LTE-M good", 30000, 10000, 150, 50, 1, 0, 0, 0, 1},
+    {"LTE-M congested", 8000, 2000, 400, 300, 1, 64 * 1024, 8000, 0, 2},
+    {"EDGE", 6000, 3000, 700, 300, 1, 0, 0, 0, 3},
+    {"NB-IoT", 2500, 1000, 1800, 800, 1, 0, 0, 0, 4},
+    {"drop every 300 KB", 20000, 5000, 250, 100, 1, 0, 0, 300 * 1024, 5},
+    {"45 s dead zone", 20000, 5000, 250, 100, 1, 400 * 1024, 45000, 0, 6},
+};
+
+// A cell with capacity to spare that schedules each connection at a fixed rate, where more sockets do help
+static const LinkProfile socketCapped = {"LTE-M, 6 KB/s a socket", 40000, 10000, 150, 50, 1, 0, 0, 0, 7, 6 * 1024};
+
+// Deterministic stand-in for a firmware image: header magic, then alternating stretches of code-like
+// repetition, noise and 0xff padding so it compresses roughly like a real application image
+static std::vector<uint8_t> make_image(size_t size) {
+  std::vector<uint8_t> image(size);
+  uint32_t x = 0x12345678;
+  for (size_t i = 0; i < size; i++) {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    switch ((i / 4096) % 4) {
+      case 0: image[i] = "\x36\x41\x00\x0c\x02\x1d\xf0\x00"[i % 8] ^ (uint8_t)(i / 4096); break;
+      case 1: image[i] = x; break;
+      case 2: image[i] = (x & 3) ? "entry 0x%08x\n"[i % 13] : (uint8_t)x; break;
+      default: image[i] = (i % 4096) < 3072 ? (uint8_t)(x >> 8) : 0xff; break;
+    }
+  }
+  image[0] = 0xe9;
+  return image;
+}
+
+static std::string gzip(const std::vector<uint8_t>& data) {
+  z_stream z = {};
+  deflateInit2(&z, 9, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY);
+  std::string out(deflateBound(&z, data.size()), '\0');
+  z.next_in   = (Bytef*)data.data();
+  z.avail_in  = data.size();
+  z.next_out  = (Bytef*)&out[0];
+  z.avail_out = out.size();
+  deflate(&z, Z_FINISH);
+  out.resize(z.total_out);
+  deflateEnd(&z);
+  return out;
+}
+
+static int bench_rng(void* state, unsigned char* out, size_t len) {
+  uint32_t* x = (uint32_t*)state;
+  for (size_t i = 0; i < len; i++) {
+    *x ^= *x << 13;
+    *x ^= *x >> 17;
+    *x ^= *x << 5;
+    out[i] = *x;
+  }
+  return 0;
+}
+
+// The image signed by one of the bench keys: the signature as it goes in front of the image, and the
+// public key as PEM
+struct SignedImage {
+  SignatureVerifier::Algorithm algorithm;
+  std::string signature;
+  std::string publicKey;
+};
+
+// DER SEQUENCE { INTEGER r, INTEGER s } as mbedtls signs to the r||s that EcdsaVerifier takes
+static std::string ecdsa_raw(const unsigned char* der) {
+  std::string raw(64, '\0');
+  const unsigned char* p = der + 2;
+  for (int i = 0; i < 2; p += 2 + p[1], i++) {
+    const unsigned char* number = p + 2;
+    size_t length               = p[1];
+    for (; length > 32; length--) number++;
+    memcpy(&raw[i * 32 + 32 - length], number, length);
+  }
+  return raw;
+}
+
+// Signs the SHA-256 digest of an image the way SignatureVerifier checks it for algorithm
+static SignedImage sign_digest(SignatureVerifier::Algorithm algorithm, const unsigned char* hash) {
+  SignedImage out = {algorithm};
+  if (algorithm == SignatureVerifier::ED25519) {
+    static const unsigned char spki[] = {0x30, 0x2a, 0x30, 0x05, 0x06, 0x03, 0x2b, 0x65, 0x70, 0x03, 0x21, 0x00};
+    unsigned char pk[crypto_sign_PUBLICKEYBYTES], sk[crypto_sign_SECRETKEYBYTES], sig[crypto_sign_BYTES];
+    crypto_sign_seed_keypair(pk, sk, bench_ed25519_seed);
+    crypto_sign_detached(sig, NULL, hash, 32, sk);
+    unsigned char der[sizeof(spki) + sizeof(pk)], pem[128];
+    memcpy(der, spki, sizeof(spki));
+    memcpy(der + sizeof(spki), pk, sizeof(pk));
+    size_t length;
+    mbedtls_pem_write_buffer("-----BEGIN PUBLIC KEY-----\n", "-----END PUBLIC KEY-----\n", der, sizeof(der), pem, sizeof(pem), &length);
+    out.signature.assign((const char*)sig, sizeof(sig));
+    out.publicKey = (const char*)pem;
+    return out;
+  }
+
+  const char* key = algorithm == SignatureVerifier::RSA_2048 ? bench_rsa2048_key : algorithm == SignatureVerifier::RSA_4096 ? bench_private_key : bench_p256_key;
+  mbedtls_pk_context pk;
+  mbedtls_pk_init(&pk);
+  uint32_t seed = 42;
+#if MBEDTLS_VERSION_MAJOR >= 3
+  int ret = mbedtls_pk_parse_key(&pk, (const unsigned char*)key, strlen(key) + 1, NULL, 0, bench_rng, &seed);
+#else
+  int ret = mbedtls_pk_parse_key(&pk, (const unsigned char*)key, strlen(key) + 1, NULL, 0);
+#endif
+  if (ret != 0) {
+    fprintf(stderr, "mbedtls_pk_parse_key: -0x%x\n", -ret);
+    exit(2);
+  }
+
+  unsigned char sig[MBEDTLS_PK_SIGNATURE_MAX_SIZE];
+  size_t sigLen = 0;
+#if MBEDTLS_VERSION_MAJOR >= 3
+  ret = mbedtls_pk_sign(&pk, MBEDTLS_MD_SHA256, hash, 32, sig, sizeof(sig), &sigLen, bench_rng, &seed);
+#else
+  ret = mbedtls_pk_sign(&pk, MBEDTLS_MD_SHA256, hash, 32, sig, &sigLen, bench_rng, &seed);
+#endif
+  if (ret != 0) {
+    fprintf(stderr, "mbedtls_pk_sign: -0x%x\n", -ret);
+    exit(2);
+  }
+  out.signature = algorithm == SignatureVerifier::ECDSA_P256 ? ecdsa_raw(sig) : std::string((const char*)sig, sigLen);
+
+  unsigned char pem[1024];
+  mbedtls_pk_write_pubkey_pem(&pk, pem, sizeof(pem));
+  out.publicKey = (const char*)pem;
+  mbedtls_pk_free(&pk);
+  return out;
+}
+
+static void image_digest(const std::vector<uint8_t>& image, unsigned char* hash) {
+  mbedtls_md(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), image.data(), image.size(), hash);
+}
+
+// Signs the image with the RSA-4096 bench key and publishes the public half as /rsa_key.pub
+static std::string sign(const std::vector<uint8_t>& image) {
+  unsigned char hash[32];
+  image_digest(image, hash);
+  SignedImage signedImage = sign_digest(SignatureVerifier::RSA_4096, hash);
+  if (signedImage.signature.size() != BENCH_SIG_LEN) exit(2);
+  File pub = SPIFFS.open("/rsa_key.pub", FILE_WRITE);
+  pub.write((const uint8_t*)signedImage.publicKey.data(), signedImage.publicKey.size());
+  pub.close();
+  return signedImage.signature;
+}
+
+static std::string manifest(const char* url, const char* extra = "") {
+  return std::string("{\"type\":\"bench\",\"version\":\"1.0.1\",\"url\":\"https://" BENCH_HOST) + url + "\"" + extra + "}";
+}
+
+struct ManifestEntry {
+  std::string type;
+  std::string json;
+};
+
+// Manifest of a fleet with many device types: one entry for each of count other types, ours somewhere in
+// the second half, and in front of it newer ones for a range of device IDs that doesn't include this one (as strings
+// and as numbers) and one whose range doesn't parse
+static std::vector<ManifestEntry> fleet(int count) {
+  std::vector<ManifestEntry> entries;
+  for (int i = 0; i < count; i++) {
+    std::string type = "fleet-" + std::to_string(i);
+    entries.push_back({type, "{\"type\":\"" + type + "\",\"version\":\"1." + std::to_string(i % 7) + ".0\",\"url\":\"https://" BENCH_HOST "/" + type +
+                                 ".bin\",\"patches\":[{\"base\":\"1.0.0\",\"url\":\"https://" BENCH_HOST "/" + type + ".patch\"}]}"});
+    if (i == count * 2 / 3) {
+      entries.push_back({"bench", "{\"type\":\"bench\",\"ids\":[\"0\",\"1000\"],\"version\":\"9.0.0\",\"url\":\"https://" BENCH_HOST "/none.bin\"}"});
+      entries.push_back({"bench", "{\"type\":\"bench\",\"ids\":[0,1000],\"version\":\"9.0.1\",\"url\":\"https://" BENCH_HOST "/none.bin\"}"});
+      entries.push_back({"bench", "{\"type\":\"bench\",\"ids\":[\"0\",\"1e3\"],\"version\":\"9.0.2\",\"url\":\"https://" BENCH_HOST "/none.bin\"}"});
+      entries.push_back({"bench", manifest("/firmware.bin")});
+    }
+  }
+  return entries;
+}
+
+static std::string plain_manifest(const std::vector<ManifestEntry>& entries) {
+  std::string out = "[";
+  for (const ManifestEntry& entry : entries) out += (out.size() > 1 ? "," : "") + entry.json;
+  return out + "]";
+}
+
+// The same entries as tools/fota_index.py lays them out, into buckets by the FNV-1a hash of their type
+static std::string indexed_manifest(const std::vector<ManifestEntry>& entries, size_t count) {
+  std::vector<std::string> buckets(count);
+  for (const ManifestEntry& entry : entries) {
+    uint32_t hash = 2166136261UL;
+    for (char c : entry.type) hash = (hash ^ (uint8_t)c) * 16777619UL;
+    std::string& bucket = buckets[hash % count];
+    bucket += (bucket.empty() ? "[" : ",") + entry.json;
+  }
+  for (std::string& bucket : buckets) bucket += bucket.empty() ? "[]" : "]";
+
+  // The offsets are in the index in front of them, so repeat until its length settles
+  std::vector<size_t> offsets(count, 0);
+  std::string head;
+  for (size_t length = 0; head.empty() || head.size() != length;) {
+    if (!head.empty()) {
+      length = head.size();
+      for (size_t i = 0, offset = length; i < count; offset += buckets[i++].size() + 1) offsets[i] = offset;
+    }
+    head = "{\"index\":{\"hash\":\"fnv1a\",\"count\":" + std::to_string(count) + ",\"buckets\":[";
+    for (size_t i = 0; i < count; i++) head += (i ? "," : "") + std::to_string(offsets[i]) + "," + std::to_string(buckets[i] == "[]" ? 0 : buckets[i].size());
+    head += "]},\"entries\":[";
+  }
+  for (size_t i = 0; i < count; i++) head += (i ? "," : "") + buckets[i];
+  return head + "]}";
+}
+
+static std::string payload_version(esp32FotaGsmSSL& fota) {
+  char version[SEMVER_RENDER_SIZE];
+  fota.getPayloadVersion(version);
+  return version;
+}
+
+// Runs one scenario and prints time, wire throughput, heap allocations and peak heap above the
+// level at the start of the scenario
+static void measure(const char* name, std::function<bool()> scenario) {
+  host_net_reset_stats();
+  host_flash_reset_stats();
+  host_heap_reset();
+  size_t baseline     = host_heap_stats().current;
+  unsigned long start = micros();
+
+  bool ok = scenario();
+
+  double seconds      = (micros() - start) / 1e6;
+  HostHeapStats heap  = host_heap_stats();
+  HostNetStats net    = host_net_stats();
+  HostFlashStats disk = host_flash_stats();
+  if (!ok) failures++;
+  printf("%-26s %-4s %9.1f ms %10.0f KB/s %9llu B in %6llu req %8llu allocs %8zu B peak %6llu erased\n", name, ok ? "ok" : "FAIL", seconds * 1000,
+         seconds > 0 ? net.bytesReceived / 1024.0 / seconds : 0.0, (unsigned long long)net.bytesReceived, (unsigned long long)net.requests,
+         (unsigned long long)heap.allocations, heap.peak - baseline, (unsigned long long)disk.sectorsErased);
+}
+
+// execOTA() ends in ESP.restart(), which the host turns into an exception
+static bool update(esp32FotaGsmSSL& fota, const std::vector<uint8_t>& image) {
+  const esp_partition_t* target = esp_ota_get_next_update_partition(NULL);
+  bool restarted                = false;
+  try {
+    fota.execOTA();
+  } catch (HostRestart&) {
+    restarted = true;
+  }
+  return restarted && host_flash_boot_partition() == target && memcmp(host_flash_data(target), image.data(), image.size()) == 0;
+}
+
+// The same check and update driven by begin()/poll() the way loop() would, with a 1 ms pause between the
+// calls. longest is the longest single poll() call, on the link profiles that is simulated time spent waiting;
+// opening the longest one that opened a socket, which TinyGSM's connect blocks for a round trip
+static bool polled_update(esp32FotaGsmSSL& fota, const std::vector<uint8_t>& image, unsigned long& longest, unsigned long& opening) {
+  const esp_partition_t* target = esp_ota_get_next_update_partition(NULL);
+  longest                       = 0;
+  opening                       = 0;
+  if (!fota.begin()) return false;
+  while (fota.isRunning()) {
+    uint64_t connections = host_net_stats().connections;
+    unsigned long start  = micros();
+    fota.poll();
+    unsigned long& into = host_net_stats().connections != connections ? opening : longest;
+    into                = std::max(into, micros() - start);
+    delay(1);
+  }
+  return fota.state() == esp32FotaGsmSSL::FOTA_DONE && host_flash_boot_partition() == target &&
+         memcmp(host_flash_data(target), image.data(), image.size()) == 0;
+}
+
+// The full check-and-update flow from a cold start (no NVS state, no TLS session) over every link profile.
+// Wasted is what went over the downlink on top of the least any link needed. Only the ideal link counts
+// towards the exit code, the others may legitimately not finish within downloadRetries
+static void link_matrix(const char* title, const char* checkURL, const std::vector<uint8_t>& image, std::function<void(esp32FotaGsmSSL&)> configure = NULL,
+                        bool polled = false) {
+  struct Row {
+    bool ok;
+    double seconds;
+    LinkStats link;
+    TlsStats stats;
+    unsigned long long connections;
+    unsigned long longest;
+    unsigned long opening;
+  };
+  std::vector<Row> rows;
+  uint64_t clean = UINT64_MAX;
+  for (const LinkProfile& profile : profiles) {
+    host_nvs_erase();
+    host_net_reset_stats();
+    LinkSimulator::resetStats();
+    LinkSimulator::use(&profile);
+
+    esp32FotaGsmSSL fota("bench", "1.0.0", true, true);
+    fota.setModem(modem, 12, 4, 9600, 26, 27);
+    fota.checkURL        = checkURL;
+    fota.downloadRetries = 10;
+    if (configure) configure(fota);
+    unsigned long start   = millis();
+    unsigned long longest = 0, opening = 0;
+    bool ok               = polled ? polled_update(fota, image, longest, opening) : fota.execHTTPcheck() && update(fota, image);
+    double seconds        = (millis() - start) / 1000.0;
+
+    LinkSimulator::use(NULL);
+    rows.push_back({ok, seconds, LinkSimulator::stats(), fota.getTlsStats(), (unsigned long long)host_net_stats().connections, longest, opening});
+    clean = std::min<uint64_t>(clean, rows.back().link.delivered);
+    if (!ok && &profile == &profiles[0]) failures++;
+  }
+
+  printf("\n%-20s %-4s %10s %10s %10s %5s %6s %5s %9s %7s %s\n", title, "", "time", "downlink", "wasted", "conn", "stalls", "drops", "tls", "resumed",
+         polled ? "  longest poll()  socket open" : "");
+  for (size_t i = 0; i < rows.size(); i++) {
+    const Row& row = rows[i];
+    printf("%-20s %-4s %9.1fs %8.1f KB %8.1f KB %5llu %6u %5u %7.1fs %3u/%-3u", profiles[i].name, row.ok ? "ok" : "FAIL", row.seconds, row.link.delivered / 1024.0,
+           (row.link.delivered - clean) / 1024.0, row.connections, row.link.stalls, row.link.drops, row.stats.handshakeTime / 1000.0, row.stats.resumed,
+           row.stats.handshakes);
+    if (polled) printf(" %13.1f ms %9.1f ms", row.longest / 1000.0, row.opening / 1000.0);
+    printf("\n");
+  }
+}
+
+// Where the time of the update goes per link, from the metrics record execOTA() hands to onMetrics()
+static void phase_table(const char* checkURL) {
+  printf("\n%-20s %-4s %8s %8s %8s %8s %8s %8s %8s %9s %9s %9s %9s\n", "phases", "", "connect", "tls", "ttfb", "manifest", "transfer", "flash", "verify",
+         "avg KB/s", "peak KB/s", "wire KB", "min heap");
+  for (const LinkProfile& profile : profiles) {
+    host_nvs_erase();
+    LinkSimulator::use(&profile);
+
+    esp32FotaGsmSSL fota("bench", "1.0.0", true, true);
+    fota.setModem(modem, 12, 4, 9600, 26, 27);
+    fota.checkURL        = checkURL;
+    fota.downloadRetries = 10;
+    esp32FotaGsmSSL::Metrics check, update;
+    bool checked = false;
+    fota.onMetrics([&](const esp32FotaGsmSSL::Metrics& metrics) {
+      (checked ? update : check) = metrics;
+      checked                    = true;
+    });
+    bool ok = fota.execHTTPcheck();
+    try {
+      fota.execOTA();
+    } catch (HostRestart&) {
+    }
+    ok = ok && update.result == esp32FotaGsmSSL::FOTA_DONE;
+    LinkSimulator::use(NULL);
+
+    // The check's phases count too, the download usually continues on its connection
+    printf("%-20s %-4s %7.2fs %7.2fs %7.2fs %7.2fs %7.2fs %7.2fs %7.2fs %9.1f %9.1f %9.1f %8u\n", profile.name, ok ? "ok" : "FAIL",
+           (check.connectMs + update.connectMs) / 1000.0, (check.tls.handshakeTime + update.tls.handshakeTime) / 1000.0,
+           (check.firstByteMs + update.firstByteMs) / 1000.0, check.manifestMs / 1000.0, update.transferMs / 1000.0, update.flashMs / 1000.0,
+           update.verifyMs / 1000.0, update.averageRate / 1024.0, update.peakRate / 1024.0, (check.bytesReceived + update.bytesReceived) / 1024.0,
+           std::min(check.minFreeHeap, update.minFreeHeap));
+  }
+}
+
+// Time and downlink bytes of a manifest check against the fleet manifest per link, reading it through to our
+// entry and looking it up in the index
+static void fleet_table() {
+  printf("\n%-20s %-4s %9s %9s %9s %9s %9s\n", "fleet manifest", "", "plain", "KB", "indexed", "KB", "requests");
+  for (const LinkProfile& profile : profiles) {
+    esp32FotaGsmSSL::Metrics plain = {}, indexed = {};
+    bool ok = true;
+    for (bool index : {false, true}) {
+      host_nvs_erase();
+      LinkSimulator::use(&profile);
+      esp32FotaGsmSSL fota("bench", "1.0.0", true, true);
+      fota.setModem(modem, 12, 4, 9600, 26, 27);
+      fota.checkURL        = index ? "https://" BENCH_HOST "/fleet.idx.json" : "https://" BENCH_HOST "/fleet.json";
+      fota.indexedManifest = index;
+      ok                   = fota.execHTTPcheck() && payload_version(fota) == "1.0.1" && ok;
+      (index ? indexed : plain) = fota.getMetrics();
+      LinkSimulator::use(NULL);
+    }
+    printf("%-20s %-4s %8.2fs %9.1f %8.2fs %9.1f %9u\n", profile.name, ok ? "ok" : "FAIL", plain.totalMs / 1000.0, plain.bytesReceived / 1024.0,
+           indexed.totalMs / 1000.0, indexed.bytesReceived / 1024.0, indexed.requests);
+  }
+}
+
+// The update over 1 to FOTA_MAX_SOCKETS sockets per link. On the profiles of the link matrix all connections
+// share one downlink, so more sockets mostly add handshakes; where each connection is capped they add up
+static void socket_table(const std::vector<uint8_t>& image) {
+  printf("\n%-22s %-4s", "sockets", "");
+  for (int sockets = 1; sockets <= FOTA_MAX_SOCKETS; sockets++) printf(" %8d", sockets);
+  printf(" %9s %9s\n", "wire KB", "retries");
+  std::vector<const LinkProfile*> links;
+  for (const LinkProfile& profile : profiles) links.push_back(&profile);
+  links.push_back(&socketCapped);
+  for (const LinkProfile* profile : links) {
+    bool ok = true;
+    std::vector<double> times;
+    esp32FotaGsmSSL::Metrics last = {};
+    for (int sockets = 1; sockets <= FOTA_MAX_SOCKETS; sockets++) {
+      host_nvs_erase();
+      LinkSimulator::use(profile);
+      esp32FotaGsmSSL fota("bench", "1.0.0", true, true);
+      fota.setModem(modem, 12, 4, 9600, 26, 27);
+      fota.checkURL        = "https://" BENCH_HOST "/plain.json";
+      fota.downloadRetries = 10;
+      fota.downloadSockets = sockets;
+      unsigned long start  = millis();
+      ok                   = fota.execHTTPcheck() && update(fota, image) && ok;
+      times.push_back((millis() - start) / 1000.0);
+      last = fota.getMetrics();
+      LinkSimulator::use(NULL);
+    }
+    if (!ok && profile == &profiles[0]) failures++;
+    printf("%-22s %-4s", profile->name, ok ? "ok" : "FAIL");
+    for (double seconds : times) printf(" %7.1fs", seconds);
+    printf(" %9.1f %9u\n", last.bytesReceived / 1024.0, last.segmentRetries);
+  }
+}
+
+// readyUpModem() on a modem that needs 12 s to find the network on its own and 2.5 s to attach to the
+// operator it is told, from an empty cache, the cache of the last run, a cache naming an operator that is
+// gone and without any network. The rows follow each other like boots of one device.
+static void attach_table() {
+  struct {
+    const char* name;
+    const char* cachedOperator;  // Planted in NVS, NULL keeps what the row before left
+    uint32_t searchTime;
+    uint32_t attachTime;
+    bool attached;
+  } rows[] = {
+      {"first boot", "", 12000, 2500, true},
+      {"cached registration", NULL, 12000, 2500, true},
+      {"operator gone", "99999", 12000, 2500, true},
+      {"no network", NULL, 600000, 600000, false},
+      {"after no network", NULL, 12000, 2500, true},
+  };
+  // readyUpModem() prints its progress, the table comes after it
+  std::string table;
+  char line[128];
+  host_nvs_erase();
+  for (auto& row : rows) {
+    if (row.cachedOperator) {
+      Preferences prefs;
+      prefs.begin("esp32fota_net", false);
+      prefs.clear();
+      if (*row.cachedOperator) {
+        prefs.putString("oper", row.cachedOperator);
+        prefs.putInt("format", 2);
+        prefs.putInt("act", 7);
+      }
+      prefs.end();
+    }
+    LinkSimulator::use(&profiles[0]);
+    modem.searchTime = row.searchTime;
+    modem.attachTime = row.attachTime;
+    esp32FotaGsmSSL fota("bench", "1.0.0", true, true);
+    fota.setModem(modem, 12, 4, 9600, 26, 27);
+    bool attached = fota.readyUpModem(modem, "iot", "", "");
+    LinkSimulator::use(NULL);
+    const esp32FotaGsmSSL::AttachMetrics& metrics = fota.getAttachMetrics();
+    bool ok = attached == row.attached && metrics.attached == attached;
+    if (!ok) failures++;
+    snprintf(line, sizeof(line), "%-22s %-4s %7.2fs %7.2fs %7.2fs %7.2fs %6s %6u\n", row.name, ok ? "ok" : "FAIL", metrics.totalMs / 1000.0,
+             metrics.modemMs / 1000.0, metrics.registerMs / 1000.0, metrics.dataMs / 1000.0, metrics.cached ? "yes" : "no", modem.atCommands);
+    table += line;
+  }
+  modem.searchTime = 0;
+  modem.attachTime = 0;
+  modem.init();
+  printf("\n%-22s %-4s %8s %8s %8s %8s %6s %6s\n%s", "attach", "", "total", "modem", "register", "data", "cached", "AT", table.c_str());
+}
+
+// Every signature algorithm on the same image: parsing the key, checking the signature (and that a corrupted
+// one is rejected), averaged over rounds, then a check and update against a manifest that lists the image once
+// per algorithm with its "signature", on a device that only has the key for one of them
+static void signature_table(const std::vector<uint8_t>& image, int rounds) {
+  const SignatureVerifier::Algorithm algorithms[] = {SignatureVerifier::RSA_2048, SignatureVerifier::RSA_4096, SignatureVerifier::ECDSA_P256,
+                                                     SignatureVerifier::ED25519};
+  unsigned char hash[32];
+  image_digest(image, hash);
+  HostHeapUncounted* fixtures = new HostHeapUncounted();
+  std::vector<SignedImage> signedImages;
+  std::string entries;
+  for (SignatureVerifier::Algorithm algorithm : algorithms) {
+    std::string name = SignatureVerifier::algorithmName(algorithm);
+    signedImages.push_back(sign_digest(algorithm, hash));
+    server.serve("/firmware-" + name + ".bin", signedImages.back().signature + std::string(image.begin(), image.end()), "\"fw-" + name + "\"");
+    entries += (entries.empty() ? "" : ",") + manifest(("/firmware-" + name + ".bin").c_str(), (",\"signature\":\"" + name + "\"").c_str());
+  }
+  server.serve("/signed.json", "[" + entries + "]", "\"mf-signed\"");
+  delete fixtures;
+
+  // execOTA() prints its progress, the table comes after it
+  std::string table;
+  char line[128];
+  for (const SignedImage& signedImage : signedImages) {
+    const unsigned char* key = (const unsigned char*)signedImage.publicKey.c_str();
+    std::string corrupted    = signedImage.signature;
+    corrupted[corrupted.size() / 2] ^= 0x01;
+
+    unsigned long start = micros();
+    for (int round = 0; round < rounds; round++) delete SignatureVerifier::fromPublicKey(key, signedImage.publicKey.size() + 1);
+    double parseUs              = (micros() - start) / (double)rounds;
+    SignatureVerifier* verifier = SignatureVerifier::fromPublicKey(key, signedImage.publicKey.size() + 1);
+    bool ok                     = verifier && verifier->algorithm() == signedImage.algorithm && verifier->signatureLength() == signedImage.signature.size();
+
+    host_heap_reset();
+    size_t baseline = host_heap_stats().current;
+    start           = micros();
+    for (int round = 0; ok && round < rounds; round++) ok = verifier->verify(hash, (const unsigned char*)signedImage.signature.data());
+    double verifyUs    = (micros() - start) / (double)rounds;
+    HostHeapStats heap = host_heap_stats();
+    ok                 = ok && !verifier->verify(hash, (const unsigned char*)corrupted.data());
+
+    host_nvs_erase();
+    esp32FotaGsmSSL fota("bench", "1.0.0", true, true);
+    fota.setModem(modem, 12, 4, 9600, 26, 27);
+    fota.setSignatureVerifier(verifier);
+    fota.checkURL      = "https://" BENCH_HOST "/signed.json";
+    fota.cacheManifest = false;
+    start              = millis();
+    bool updated       = ok && fota.execHTTPcheck() && update(fota, image);
+    unsigned long took = millis() - start;
+    fota.setSignatureVerifier(NULL);
+    delete verifier;
+
+    if (!ok || !updated) failures++;
+    snprintf(line, sizeof(line), "%-20s %-4s %6zu %10.1f %10.1f %8llu %8zu %7lu ms\n", SignatureVerifier::algorithmName(signedImage.algorithm),
+             ok && updated ? "ok" : "FAIL", signedImage.signature.size(), parseUs, verifyUs, (unsigned long long)(heap.allocations / rounds),
+             heap.peak - baseline, took);
+    table += line;
+  }
+  printf("\n%-20s %-4s %6s %10s %10s %8s %8s %10s\n%s", "signature", "", "bytes", "parse us", "verify us", "allocs", "peak B", "update", table.c_str());
+}
+
+// Handshakes with the server that sends leaf and intermediate, with each way of checking it and a fresh session
+// for all but the last. cpu us is TlsHandshake::cpuTime, which here includes the in-process server's share.
+// Without a root mbedtls still checks the leaf against the intermediate it got; a pin skips that too.
+static void trust_table(int rounds) {
+  unsigned char pin[32], wrongPin[32];
+  memset(wrongPin, 0x5a, sizeof(wrongPin));
+  mbedtls_x509_crt cert;
+  mbedtls_x509_crt_init(&cert);
+  bool ok = mbedtls_x509_crt_parse(&cert, (const unsigned char*)bench_server_cert, strlen(bench_server_cert) + 1) == 0 &&
+            mbedtls_md(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), cert.pk_raw.p, cert.pk_raw.len, pin) == 0;
+  mbedtls_x509_crt_free(&cert);
+
+  struct Row {
+    const char* name;
+    const char* anchors[2];
+    const unsigned char* pin;
+    bool resume;
+    bool accepted;
+  };
+  const Row rows[] = {
+      {"no check", {}, NULL, false, true},
+      {"root", {bench_root_cert}, NULL, false, true},
+      {"2 roots", {root_ca, bench_root_cert}, NULL, false, true},
+      {"wrong root", {root_ca}, NULL, false, false},
+      {"pinned", {}, pin, false, true},
+      {"wrong pin, root", {bench_root_cert}, wrongPin, false, true},
+      {"wrong pin", {}, wrongPin, false, false},
+      {"pinned, resumed", {}, pin, true, true},
+  };
+  std::string table;
+  char line[128];
+  TinyGsmClient socket(modem);
+  TlsClient client(&socket);
+  TlsSession session;
+  for (const Row& row : rows) {
+    TlsTrust trust;
+    unsigned long start = micros();
+    for (const char* anchor : row.anchors) ok = ok && (!anchor || trust.addAnchor(anchor));
+    if (row.pin) ok = ok && trust.addPin(row.pin);
+    double parseUs = micros() - start;
+    client.setTrust(trust.empty() ? NULL : &trust);
+    client.setSession(row.resume ? &session : NULL);
+    if (row.resume) ok = ok && client.connect(BENCH_HOST, BENCH_CHAIN_PORT) && !client.lastHandshake().resumed;
+    client.stop();
+
+    uint64_t wallMs = 0, cpuUs = 0;
+    bool rowOk      = ok;
+    for (int round = 0; round < rounds; round++) {
+      bool connected                = client.connect(BENCH_HOST, BENCH_CHAIN_PORT);
+      const TlsHandshake& handshake = client.lastHandshake();
+      rowOk                         = rowOk && connected == row.accepted && (!connected || (handshake.resumed == row.resume && handshake.pinned == (row.pin == pin && !row.resume)));
+      wallMs += handshake.duration;
+      cpuUs += handshake.cpuTime;
+      client.stop();
+    }
+    if (!rowOk) failures++;
+    snprintf(line, sizeof(line), "%-20s %-4s %-8s %9.0f %9.1f %10.0f\n", row.name, rowOk ? "ok" : "FAIL", row.accepted ? "accepted" : "refused",
+             parseUs, wallMs / (double)rounds, cpuUs / (double)rounds);
+    table += line;
+  }
+  printf("\n%-20s %-4s %-8s %9s %9s %10s\n%s", "TLS trust", "", "", "parse us", "wall ms", "cpu us", table.c_str());
+}
+
+// Inflater alone on the compressed image, fed 4 KB at a time like the download does, against each link's downlink:
+// how many times faster than the link the compressed bytes are consumed. On the host tinfl is zlib, the ESP32
+// ROM inflater is slower, so the margin is what counts.
+static void inflate_table(const std::string& compressed, size_t imageSize) {
+  const size_t piece = 4096;
+  int rounds         = 0;
+  bool ok            = true;
+  Inflater inflater;
+  unsigned long start = micros();
+  do {
+    size_t out = 0;
+    ok         = inflater.begin(Inflater::GZIP, [&](const uint8_t*, size_t len) {
+      out += len;
+      return true;
+    });
+    for (size_t offset = 0; ok && offset < compressed.size(); offset += piece) {
+      ok = inflater.write((const uint8_t*)compressed.data() + offset, std::min(piece, compressed.size() - offset));
+    }
+    ok = ok && inflater.finished() && out == imageSize;
+    inflater.end();
+    rounds++;
+  } while (ok && micros() - start < 200000);
+  double seconds = (micros() - start) / 1e6 / rounds;
+  double inRate  = compressed.size() / seconds;
+  if (!ok) failures++;
+
+  // The link rows give the rate the link delivers compressed and so the image rate the inflater has to keep up with
+  printf("\n%-20s %-4s %10s %10s %8s\n", "inflate", "", "in KB/s", "out KB/s", "x link");
+  printf("%-20s %-4s %10.0f %10.0f %8s\n", "Inflater", ok ? "ok" : "FAIL", inRate / 1024, imageSize / seconds / 1024, "");
+  for (const LinkProfile& profile : profiles) {
+    if (profile.downlink == 0) continue;
+    printf("%-20s %-4s %10.1f %10.1f %8.0f\n", profile.name, "", profile.downlink / 1024.0, profile.downlink * (double)imageSize / compressed.size() / 1024,
+           inRate / profile.downlink);
+  }
+}
+
+// An update with each tlsFragmentLength: peak heap as the metrics have it, what the smaller records cost on the
+// wire (bytes received over body bytes) and the rate. Only where mbedtls sizes its record buffers by the
+// negotiated length does the heap go down; the wire overhead shows whether the server agreed.
+static void fragment_table(const std::vector<uint8_t>& image) {
+  std::string table;
+  char line[128];
+  for (uint16_t length : {0, 4096, 2048, 1024, 512}) {
+    host_nvs_erase();
+    esp32FotaGsmSSL fota("bench", "1.0.0", true, true);
+    fota.setModem(modem, 12, 4, 9600, 26, 27);
+    fota.checkURL          = "https://" BENCH_HOST "/plain.json";
+    fota.tlsFragmentLength = length;
+    fota.connectionLinger  = 0;  // The update makes its own connection, so its peak heap has the TLS state in it
+    esp32FotaGsmSSL::Metrics metrics = {};
+    fota.onMetrics([&](const esp32FotaGsmSSL::Metrics& m) { metrics = m; });
+    host_heap_reset();
+    bool ok = fota.execHTTPcheck() && update(fota, image) && metrics.result == esp32FotaGsmSSL::FOTA_DONE;
+    if (!ok) failures++;
+    snprintf(line, sizeof(line), "%-20s %-4s %10u %10u %9.2f %10.1f\n", length ? std::to_string(length).c_str() : "none (16384)", ok ? "ok" : "FAIL",
+             metrics.peakHeap, metrics.minFreeHeap, metrics.bodyBytes ? 100.0 * metrics.bytesReceived / metrics.bodyBytes - 100.0 : 0.0,
+             metrics.averageRate / 1024.0);
+    table += line;
+  }
+  printf("\n%-20s %-4s %10s %10s %9s %10s\n%s", "TLS fragment", "", "peak heap", "min heap", "wire +%", "avg KB/s", table.c_str());
+}
+
+// Flash that takes datasheet time to erase and program, on the LTE-M link: each sector erased as its data
+// arrives or erased ahead while waiting on the network, written inline or by the pipeline's writer task.
+// stall is the time writes waited for an erase, ahead the erasing done while waiting.
+static const HostFlashTiming flashTiming = {45000, 150000, 700};
+
+static void erase_table(const std::vector<uint8_t>& image) {
+  std::string table;
+  char line[128];
+  host_flash_timing(&flashTiming);
+  for (int buffers : {0, 4}) {
+    for (size_t ahead : {(size_t)0, (size_t)131072}) {
+      host_nvs_erase();
+      host_flash_reset_stats();
+      LinkSimulator::use(&profiles[1]);
+      esp32FotaGsmSSL fota("bench", "1.0.0", true, true);
+      fota.setModem(modem, 12, 4, 9600, 26, 27);
+      fota.checkURL        = "https://" BENCH_HOST "/plain.json";
+      fota.pipelineBuffers = buffers;
+      fota.eraseAhead      = ahead;
+      esp32FotaGsmSSL::Metrics metrics = {};
+      fota.onMetrics([&](const esp32FotaGsmSSL::Metrics& m) { metrics = m; });
+      bool ok = fota.execHTTPcheck() && update(fota, image) && metrics.result == esp32FotaGsmSSL::FOTA_DONE && host_flash_stats().writeErrors == 0;
+      LinkSimulator::use(NULL);
+      if (!ok) failures++;
+      HostFlashStats disk = host_flash_stats();
+      std::string name    = (buffers ? "pipeline" : "inline") + std::string(ahead ? ", ahead" : ", on demand");
+      snprintf(line, sizeof(line), "%-20s %-4s %8.2fs %8.2fs %8.2fs %8.2fs %7llu %7llu\n", name.c_str(), ok ? "ok" : "FAIL", metrics.totalMs / 1000.0, metrics.flashMs / 1000.0,
+             metrics.writeStallMs / 1000.0, metrics.eraseAheadMs / 1000.0, (unsigned long long)disk.sectorsErased, (unsigned long long)disk.blocksErased);
+      table += line;
+    }
+  }
+  host_flash_timing(NULL);
+
+  // A download stopped halfway leaves a resume record. The next run asks for the rest, gets the whole image
+  // (a server that ignores Range), starts over and erases ahead from 0, and the board reboots before anything
+  // is written. The run after that must not resume on top of the erased sectors.
+  host_nvs_erase();
+  bool ok = false;
+  {
+    esp32FotaGsmSSL fota("bench", "1.0.0", true, true);
+    fota.setModem(modem, 12, 4, 9600, 26, 27);
+    fota.checkURL = "https://" BENCH_HOST "/plain.json";
+    ok            = fota.begin();
+    while (ok && fota.isRunning() && fota.getProgress() < image.size() / 2) fota.poll();
+    fota.abort();
+  }
+  LinkSimulator::use(&profiles[4]);
+  server.ranges = false;
+  {
+    esp32FotaGsmSSL fota("bench", "1.0.0", true, true);
+    fota.setModem(modem, 12, 4, 9600, 26, 27);
+    fota.checkURL   = "https://" BENCH_HOST "/plain.json";
+    fota.eraseAhead = 131072;
+    ok              = ok && fota.begin();
+    while (ok && fota.isRunning() && fota.getProgress() == 0) fota.poll();  // Checked and resumed
+    while (ok && fota.isRunning() && fota.getProgress() > 0) fota.poll();   // Got the whole image
+    host_flash_reset_stats();
+    while (ok && fota.isRunning() && host_flash_stats().sectorsErased == 0) fota.poll();
+    ok = ok && fota.getProgress() == 0 && host_flash_stats().sectorsErased > 0;
+  }
+  LinkSimulator::use(NULL);
+  server.ranges = true;
+  esp32FotaGsmSSL fota("bench", "1.0.0", true, true);
+  fota.setModem(modem, 12, 4, 9600, 26, 27);
+  fota.checkURL = "https://" BENCH_HOST "/plain.json";
+  ok            = ok && fota.execHTTPcheck() && update(fota, image);
+  if (!ok) failures++;
+  snprintf(line, sizeof(line), "%-20s %-4s\n", "reboot, erased ahead", ok ? "ok" : "FAIL");
+  table += line;
+  printf("\n%-20s %-4s %9s %9s %9s %9s %7s %7s\n%s", "flash erase", "", "time", "flash", "stall", "ahead", "sectors", "blocks", table.c_str());
+}
+
+// Copies an image byte goes through on its way to flash: out of the socket into the TLS record buffer, out of
+// that as plaintext (mbedtls_ssl_read()), and into the flash writer's sector buffer unless it landed there or
+// is flashed from where it was read. On the device the modem's UART adds its own.
+static void copy_table(const std::vector<uint8_t>& image) {
+  std::string table;
+  char line[128];
+  struct {
+    const char* name;
+    const char* manifest;
+    int buffers;
+    int sockets;
+  } rows[] = {{"inline", "/plain.json", 0, 1}, {"pipeline", "/plain.json", 4, 1}, {"3 sockets", "/plain.json", 4, 3}, {"gzip", "/gzip.json", 4, 1}};
+  for (auto& row : rows) {
+    host_nvs_erase();
+    esp32FotaGsmSSL fota("bench", "1.0.0", true, true);
+    fota.setModem(modem, 12, 4, 9600, 26, 27);
+    fota.checkURL        = std::string("https://" BENCH_HOST) + row.manifest;
+    fota.pipelineBuffers = row.buffers;
+    fota.downloadSockets = row.sockets;
+    esp32FotaGsmSSL::Metrics metrics = {};
+    fota.onMetrics([&](const esp32FotaGsmSSL::Metrics& m) { metrics = m; });
+    bool ok = fota.execHTTPcheck() && update(fota, image) && metrics.result == esp32FotaGsmSSL::FOTA_DONE;
+    if (!ok) failures++;
+    double flashed = metrics.bytesWritten ? metrics.bytesWritten : 1;
+    snprintf(line, sizeof(line), "%-20s %-4s %9.2f %9.2f %9.2f %9.2f\n", row.name, ok ? "ok" : "FAIL", metrics.bytesReceived / flashed,
+             metrics.bodyBytes / flashed, metrics.bytesCopied / flashed, (metrics.bytesReceived + metrics.bodyBytes + metrics.bytesCopied) / flashed);
+    table += line;
+  }
+  printf("\n%-20s %-4s %9s %9s %9s %9s\n%s", "copies per byte", "", "socket", "tls", "writer", "total", table.c_str());
+}
+
+// Runs tools/fota_delta.py diff on base and target, the patch it wrote or an empty string
+static std::string fota_delta(const char* dir, const std::vector<uint8_t>& base, const std::vector<uint8_t>& target) {
+  std::string tools   = FOTA_TOOLS_DIR "/fota_delta.py";
+  std::string paths[] = {std::string(dir) + "/delta-old.bin", std::string(dir) + "/delta-new.bin", std::string(dir) + "/delta.patch"};
+  for (int i = 0; i < 2; i++) {
+    FILE* file = fopen(paths[i].c_str(), "wb");
+    const std::vector<uint8_t>& data = i == 0 ? base : target;
+    if (!file || fwrite(data.data(), 1, data.size(), file) != data.size()) return "";
+    fclose(file);
+  }
+  std::string command = "python3 " + tools + " diff " + paths[0] + " " + paths[1] + " " + paths[2] + " > /dev/null";
+  std::string patch;
+  FILE* file = system(command.c_str()) == 0 ? fopen(paths[2].c_str(), "rb") : NULL;
+  if (!file) return "";
+  char buf[4096];
+  for (size_t n; (n = fread(buf, 1, sizeof(buf), file)) > 0;) patch.append(buf, n);
+  fclose(file);
+  return patch;
+}
+
+// Applies a patch over base in 1000 byte pieces, checking the base the way the device checks its running partition
+static bool apply_patch(const std::string& patch, const std::vector<uint8_t>& base, std::vector<uint8_t>& out, std::string& error) {
+  DeltaPatcher patcher;
+  patcher.begin(
+      [&](uint32_t offset, uint8_t* buf, size_t len) {
+        if (offset + len > base.size()) return false;
+        memcpy(buf, base.data() + offset, len);
+        return true;
+      },
+      [&](uint32_t size, const uint8_t* sha256) {
+        unsigned char digest[32];
+        return size <= base.size() && mbedtls_md(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), base.data(), size, digest) == 0 &&
+               memcmp(digest, sha256, sizeof(digest)) == 0;
+      });
+  patcher.setOutput([&](const uint8_t* data, size_t len) {
+    out.insert(out.end(), data, data + len);
+    return true;
+  });
+  bool ok = true;
+  for (size_t offset = 0; ok && offset < patch.size(); offset += 1000) ok = patcher.write((const uint8_t*)patch.data() + offset, std::min((size_t)1000, patch.size() - offset));
+  error = patcher.errorString() ? patcher.errorString() : "";
+  return ok && patcher.finished();
+}
+
+// A patch from tools/fota_delta.py from the running image to a changed one, applied in process and by an update,
+// over the base it was made for and over one that differs in a single byte. The update falls back to the full image.
+static void delta_table(const char* dir, const std::vector<uint8_t>& image) {
+  std::vector<uint8_t> target(image);
+  for (size_t i = image.size() / 3; i < image.size() / 3 + 2048 && i < image.size(); i++) target[i] += 1;
+  const char build[] = "built Oct 17 2026 for 1.0.1";
+  target.insert(target.begin() + image.size() / 2, build, build + sizeof(build));
+  std::vector<uint8_t> otherBase(image);
+  otherBase[image.size() - 1] ^= 1;
+
+  HostHeapUncounted* fixtures = new HostHeapUncounted();
+  std::string patch           = fota_delta(dir, image, target);
+  std::string signature       = sign(target);
+  server.serve("/delta.bin", signature + std::string(target.begin(), target.end()), "\"dl-1\"");
+  server.serve("/delta.patch", signature + patch, "\"dl-1-patch\"");
+  server.serve("/delta.json", manifest("/delta.bin", ",\"patches\":[{\"base\":\"1.0.0\",\"url\":\"https://" BENCH_HOST "/delta.patch\"}]"), "\"mf-delta\"");
+  delete fixtures;
+
+  std::string table;
+  char line[128];
+  const std::vector<uint8_t>* bases[] = {&image, &otherBase};
+  for (const std::vector<uint8_t>* base : bases) {
+    bool same = base == &image;
+    std::vector<uint8_t> out;
+    std::string error;
+    bool applied = apply_patch(patch, *base, out, error);
+    bool ok      = !patch.empty() && (same ? applied && out == target : !applied && out.empty() && error == "Patch is for a different base image");
+    if (!ok) failures++;
+    snprintf(line, sizeof(line), "%-24s %-4s %9zu %9zu %s\n", same ? "patcher, same base" : "patcher, other base", ok ? "ok" : "FAIL",
+             patch.size(), out.size(), error.c_str());
+    table += line;
+
+    // The running partition is the base
+    memcpy(host_flash_data(esp_ota_get_running_partition()), base->data(), base->size());
+    host_nvs_erase();
+    esp32FotaGsmSSL fota("bench", "1.0.0", true, true);
+    fota.setModem(modem, 12, 4, 9600, 26, 27);
+    fota.checkURL = "https://" BENCH_HOST "/delta.json";
+    esp32FotaGsmSSL::Metrics metrics = {};
+    fota.onMetrics([&](const esp32FotaGsmSSL::Metrics& m) { metrics = m; });
+    ok = !patch.empty() && fota.execHTTPcheck() && update(fota, target) && metrics.deltaFallback != same;
+    if (!ok) failures++;
+    snprintf(line, sizeof(line), "%-24s %-4s %9lu %9lu %s\n", same ? "update, same base" : "update, other base", ok ? "ok" : "FAIL", (unsigned long)metrics.bodyBytes,
+             (unsigned long)metrics.bytesWritten, metrics.deltaFallback ? "full image" : "patch");
+    table += line;
+  }
+  memset(host_flash_data(esp_ota_get_running_partition()), 0xff, image.size());
+  printf("\n%-24s %-4s %9s %9s %s\n%s", "delta", "", "body B", "out B", "result", table.c_str());
+}
+
+// Feeds raw to a fresh parser in the pieces cuts divides it into, the way HttpBodyStream does: header bytes
+// first, what follows the header block of a piece goes to decodeBody()
+static bool parse_fixture(const HttpFixture& fixture, const std::vector<size_t>& cuts) {
+  std::string raw = fixture.raw;
+  std::string body;
+  HttpResponseParser parser;
+  size_t from = 0;
+  for (size_t i = 0; i <= cuts.size(); i++) {
+    size_t to = i < cuts.size() ? cuts[i] : raw.size();
+    std::vector<uint8_t> piece(raw.begin() + from, raw.begin() + to);
+    size_t used = 0;
+    if (!parser.headersComplete() && !parser.failed()) used = parser.parseHeaders(piece.data(), piece.size());
+    if (parser.headersComplete() && used < piece.size()) body.append((const char*)piece.data() + used, parser.decodeBody(piece.data() + used, piece.size() - used));
+    from = to;
+  }
+  bool ok = parser.headersComplete() == fixture.headers && parser.bodyComplete() == fixture.complete && parser.failed() == fixture.failed &&
+            parser.status() == fixture.status && body == fixture.body && parser.keepAlive() == fixture.keepAlive &&
+            parser.contentLength() == fixture.contentLength && strcmp(parser.location(), fixture.location) == 0 && strcmp(parser.etag(), fixture.etag) == 0;
+  return ok && parser.rangeStart() == fixture.rangeStart && parser.rangeEnd() == fixture.rangeEnd && parser.rangeTotal() == fixture.rangeTotal;
+}
+
+// Every recorded response in two pieces split at each byte boundary, then a byte at a time
+static void parser_table() {
+  printf("\n%-24s %-4s %8s %8s\n", "HTTP response", "", "splits", "failed");
+  for (const HttpFixture& fixture : http_fixtures) {
+    size_t length = strlen(fixture.raw);
+    int splits = 0, failed = 0;
+    for (size_t cut = 0; cut <= length; cut++, splits++) {
+      if (!parse_fixture(fixture, {cut})) failed++;
+    }
+    std::vector<size_t> bytewise;
+    for (size_t cut = 1; cut < length; cut++) bytewise.push_back(cut);
+    if (!parse_fixture(fixture, bytewise)) failed++;
+    splits++;
+    if (failed) failures++;
+    printf("%-24s %-4s %8d %8d\n", fixture.name, failed ? "FAIL" : "ok", splits, failed);
+  }
+}
+
+// Versions as a manifest lists them, plus the odd ones semver.c has its own opinion on
+static const char* const versions[] = {
+    "1.0.0", "1.0.1", "1.2.3", "10.20.30", "2.0.0-rc.1", "2.0.0-rc.2+build.17", "2.0.0", "2.0.0+sha.5114f85",
+    "1.0.0-alpha", "1.0.0-alpha.1", "1.0.0-alpha.beta", "1.0.0-beta.2", "1.0.0-beta.11", "1.0.0-0.3.7", "1.0.0-x.7.z.92",
+    "1.0.0-rc-1", "1.0.0-", "1.0.0+", "1", "1.2", "1..3", "01.2.3", "1.2.3.4", "1.2.3.4.x", "1.2.x", "v1.2.3", "1.2.3 ", "",
+};
+
+// checkJSONManifest()'s version handling for every entry of a manifest, with semver.c and with SemVer:
+// parse the entry's version, compare it to the running one, drop it. First checks that both agree on
+// every version above, parsed, compared and rendered, then reports the cost per entry
+static void semver_table(int rounds) {
+  const size_t count = sizeof(versions) / sizeof(versions[0]);
+  bool agree         = true;
+  for (size_t i = 0; i < count; i++) {
+    semver_t a = {0};
+    SemVer x;
+    bool parsed = semver_parse(versions[i], &a) == 0;
+    if (parsed != x.parse(versions[i])) agree = false;
+    if (parsed) {
+      char theirs[256] = {'\0'}, ours[SEMVER_RENDER_SIZE];
+      semver_render(&a, theirs);
+      x.render(ours, sizeof(ours));
+      if (strcmp(theirs, ours) != 0) agree = false;
+      for (size_t j = 0; j < count; j++) {
+        semver_t b = {0};
+        SemVer y;
+        if (semver_parse(versions[j], &b) == 0 && y.parse(versions[j]) && semver_compare(a, b) != x.compare(y)) agree = false;
+        semver_free(&b);
+      }
+    }
+    semver_free(&a);
+    if (!agree) {
+      printf("semver.c and SemVer disagree on \"%s\"\n", versions[i]);
+      break;
+    }
+  }
+  if (!agree) failures++;
+
+  printf("\n%-20s %-4s %10s %10s %10s %8s\n", "semver", "", "ns/entry", "allocs", "peak B", "newer");
+  semver_t running = {0};
+  semver_parse("1.0.0", &running);
+  SemVer current(1);
+  for (bool own : {false, true}) {
+    host_heap_reset();
+    size_t baseline     = host_heap_stats().current;
+    int newer           = 0;
+    unsigned long start = micros();
+    for (int round = 0; round < rounds; round++) {
+      for (size_t i = 0; i < count; i++) {
+        if (own) {
+          SemVer payload;
+          if (payload.parse(versions[i]) && payload.compare(current) == 1) newer++;
+        } else {
+          semver_t payload = {0};
+          if (semver_parse(versions[i], &payload) == 0 && semver_compare(payload, running) == 1) newer++;
+          semver_free(&payload);
+        }
+      }
+    }
+    double ns          = (micros() - start) * 1000.0 / ((double)rounds * count);
+    HostHeapStats heap = host_heap_stats();
+    printf("%-20s %-4s %10.1f %10llu %10zu %8d\n", own ? "SemVer" : "semver.c", agree ? "ok" : "FAIL", ns, (unsigned long long)heap.allocations,
+           heap.peak - baseline, newer);
+  }
+  semver_free(&running);
+}
+
+int main(int argc, char** argv) {
+  size_t imageSize = (argc > 1 ? atoi(argv[1]) : 1024) * 1024;
+
+  char dir[] = "/tmp/fota_bench_XXXXXX";
+  if (!mkdtemp(dir) || !host_flash_begin(dir)) return 2;
+  SPIFFS.setRoot(dir);
+  if (imageSize == 0 || imageSize > host_flash_partition(1)->size) {
+    fprintf(stderr, "Image size must be between 1 and %u KB\n", host_flash_partition(1)->size / 1024);
+    return 2;
+  }
+
+  // The image, its variants and the server's copies stay out of the heap figures, ESP.getFreeHeap() included
+  HostHeapUncounted* fixtures = new HostHeapUncounted();
+  std::vector<uint8_t> image  = make_image(imageSize);
+  std::string signature       = sign(image);
+  std::string signedImage     = signature + std::string(image.begin(), image.end());
+  std::string signedGzip      = signature + gzip(image);
+
+  server.serve("/firmware.bin", (const uint8_t*)signedImage.data(), signedImage.size(), "\"fw-1\"");
+  server.serve("/firmware.bin.gz", (const uint8_t*)signedGzip.data(), signedGzip.size(), "\"fw-1-gz\"");
+  // With the size in the manifest several sockets split the image before the first request
+  server.serve("/plain.json", manifest("/firmware.bin", (",\"size\":" + std::to_string(image.size())).c_str()), "\"mf-1\"");
+  // A compressed download that breaks off continues with the uncompressed image
+  server.serve("/gzip.json",
+               manifest("/firmware.bin.gz", (",\"compression\":\"gzip\",\"size\":" + std::to_string(image.size()) +
+                                              ",\"uncompressed\":\"https://" BENCH_HOST "/firmware.bin\"").c_str()),
+               "\"mf-2\"");
+  // The image behind a relative and an absolute redirect
+  server.redirect("/moved.bin", "/firmware.bin");
+  server.redirect("/moved-abs.bin", "https://" BENCH_HOST ":443/firmware.bin", 301);
+  server.serve("/moved.json", manifest("/moved.bin"), "\"mv-1\"");
+  server.serve("/moved-abs.json", manifest("/moved-abs.bin"), "\"mv-2\"");
+  unsigned char digest[32];
+  image_digest(image, digest);
+  SignedImage rotation[] = {sign_digest(SignatureVerifier::RSA_4096, digest), sign_digest(SignatureVerifier::ED25519, digest)};
+  server.serve("/firmware-k1.bin", rotation[0].signature + std::string(image.begin(), image.end()), "\"fw-k1\"");
+  server.serve("/firmware-k2.bin", rotation[1].signature + std::string(image.begin(), image.end()), "\"fw-k2\"");
+  server.serve("/rotation.json", "[" + manifest("/firmware-k3.bin", ",\"key\":\"k3\"") + "," + manifest("/firmware-k2.bin", ",\"key\":\"k2\",\"signature\":\"ed25519\"") + "," +
+                                     manifest("/firmware-k1.bin", ",\"key\":\"k1\"") + "]");
+  std::vector<ManifestEntry> entries = fleet(FLEET_TYPES);
+  server.serve("/fleet.json", plain_manifest(entries), "\"fl-1\"");
+  server.serve("/fleet.idx.json", indexed_manifest(entries, FLEET_TYPES / 2), "\"fl-1-idx\"");
+  if (!tls.begin(bench_server_cert, bench_server_key) || !chainTls.begin(bench_chain_cert, bench_server_key)) return 2;
+  host_net_listen(BENCH_HOST, BENCH_PORT, &server, &tls);
+  host_net_listen(BENCH_HOST, BENCH_CHAIN_PORT, &server, &chainTls);
+  delete fixtures;
+
+  printf("image %zu B, gzip %zu B, signed with RSA-4096\n\n", image.size(), signedGzip.size() - BENCH_SIG_LEN);
+
+  // The bench server's certificate is self-signed, so the handshakes run without a root to check against
+  esp32FotaGsmSSL fota("bench", "1.0.0", true, true);
+  fota.setModem(modem, 12, 4, 9600, 26, 27);
+
+  TinyGsmClient socket(modem);
+  TlsClient handshake(&socket);
+  TlsSession session;
+  handshake.setSession(&session);
+  measure("TLS handshake, full", [&] {
+    session.clear();
+    bool ok = handshake.connect(BENCH_HOST, BENCH_PORT) && !handshake.lastHandshake().resumed;
+    handshake.stop();
+    return ok;
+  });
+  measure("TLS handshake, resumed", [&] {
+    bool ok = handshake.connect(BENCH_HOST, BENCH_PORT) && handshake.lastHandshake().resumed;
+    handshake.stop();
+    return ok;
+  });
+
+  fota.checkURL = "https://" BENCH_HOST "/plain.json";
+  measure("manifest", [&] { return fota.execHTTPcheck(); });
+  measure("manifest (304)", [&] { return fota.execHTTPcheck(); });
+
+  // Our entry out of a fleet manifest, read through from the start or looked up in the index
+  fota.cacheManifest = false;
+  for (const char* url : {"/fleet.json", "/fleet.idx.json", "/fleet.idx.json (no Range)"}) {
+    std::string path      = url;
+    fota.checkURL         = "https://" BENCH_HOST + path.substr(0, path.find(' '));
+    fota.indexedManifest  = path != "/fleet.json";
+    server.ranges         = path.find("no Range") == std::string::npos;
+    std::string name      = std::string(fota.indexedManifest ? "fleet, indexed" : "fleet manifest") + (server.ranges ? "" : ", no Range");
+    measure(name.c_str(), [&] { return fota.execHTTPcheck() && payload_version(fota) == "1.0.1"; });
+  }
+  server.ranges        = true;
+  fota.indexedManifest = false;
+  fota.cacheManifest   = true;
+  fota.checkURL        = "https://" BENCH_HOST "/plain.json";
+
+  for (int buffers : {0, 4}) {
+    fota.pipelineBuffers = buffers;
+    std::string name     = "update, " + std::to_string(buffers) + " buffers";
+    measure(name.c_str(), [&] { return fota.execHTTPcheck() && update(fota, image); });
+  }
+
+  fota.downloadSockets = 3;
+  measure("update, 3 sockets", [&] { return fota.execHTTPcheck() && update(fota, image); });
+  fota.downloadSockets = 1;
+
+  // TLS and HTTP on the modem's HTTP(S) service, then on a modem without it, where it falls back to mbedtls
+  fota.modemHttp = true;
+  measure("update, modem HTTPS", [&] { return fota.execHTTPcheck() && update(fota, image) && fota.getMetrics().modemRequests == fota.getMetrics().requests; });
+  modem.httpService = false;
+  measure("update, modem fallback", [&] { return fota.execHTTPcheck() && update(fota, image) && fota.getMetrics().modemRequests == 0; });
+  modem.httpService = true;
+  fota.modemHttp    = false;
+
+  fota.checkURL = "https://" BENCH_HOST "/moved.json";
+  measure("update, 302 relative", [&] { return fota.execHTTPcheck() && update(fota, image) && fota.getMetrics().redirects == 1; });
+  fota.checkURL = "https://" BENCH_HOST "/moved-abs.json";
+  measure("update, 301 absolute", [&] { return fota.execHTTPcheck() && update(fota, image) && fota.getMetrics().redirects == 1; });
+
+  fota.checkURL = "https://" BENCH_HOST "/gzip.json";
+  measure("update, gzip", [&] { return fota.execHTTPcheck() && update(fota, image); });
+
+  // The key was parsed for the first update, checking a signature doesn't touch the file system again. Outside
+  // a run the partition is hashed, the digest of the last download doesn't vouch for what is on flash now.
+  unsigned char sig[BENCH_SIG_LEN];
+  memcpy(sig, signature.data(), sizeof(sig));
+  unsigned opened = SPIFFS.opened;
+  measure("validate_sig", [&] { return fota.validate_sig(sig, image.size()) && SPIFFS.opened == opened; });
+  fota.recheckPartition = true;
+  measure("validate_sig, recheck", [&] { return fota.validate_sig(sig, image.size()) && SPIFFS.opened == opened; });
+  fota.recheckPartition = false;
+  measure("validate_sig, changed", [&] {
+    uint8_t* flash = host_flash_data(esp_ota_get_next_update_partition(NULL));
+    flash[image.size() - 1] ^= 1;
+    bool rejected = !fota.validate_sig(sig, image.size());
+    memcpy(flash, image.data(), image.size());
+    return rejected;
+  });
+
+  // Key rotation: the manifest has the image signed with k1 (RSA-4096) and with k2 (Ed25519) behind an entry
+  // for a key k3 nobody has yet; each device takes the first entry it has the key for
+  esp32FotaGsmSSL rotated("bench", "1.0.0", true, true);
+  rotated.setModem(modem, 12, 4, 9600, 26, 27);
+  rotated.checkURL      = "https://" BENCH_HOST "/rotation.json";
+  rotated.cacheManifest = false;
+  rotated.keys.add("k1", (const unsigned char*)rotation[0].publicKey.c_str(), rotation[0].publicKey.size() + 1);
+  measure("update, key k1", [&] { return rotated.execHTTPcheck() && update(rotated, image); });
+  rotated.keys.add("k2", (const unsigned char*)rotation[1].publicKey.c_str(), rotation[1].publicKey.size() + 1);
+  measure("update, keys k1 k2", [&] { return rotated.execHTTPcheck() && update(rotated, image) && rotated.getMetrics().bodyBytes == image.size() + 64; });
+  rotated.keys.clear();
+  rotated.keys.add("k4", (const unsigned char*)rotation[1].publicKey.c_str(), rotation[1].publicKey.size() + 1);
+  measure("check, unknown key", [&] { return !rotated.execHTTPcheck() && rotated.state() == esp32FotaGsmSSL::FOTA_UP_TO_DATE; });
+
+  // Without keys and without /rsa_key.pub the file is looked for once, not for every entry of every check
+  File pub           = SPIFFS.open("/rsa_key.pub");
+  std::string pubKey = pub.readString().c_str();
+  pub.close();
+  SPIFFS.remove("/rsa_key.pub");
+  esp32FotaGsmSSL keyless("bench", "1.0.0", true, true);
+  keyless.setModem(modem, 12, 4, 9600, 26, 27);
+  keyless.checkURL      = "https://" BENCH_HOST "/rotation.json";
+  keyless.cacheManifest = false;
+  opened                = SPIFFS.opened;
+  measure("check, no key file", [&] { return !keyless.execHTTPcheck() && !keyless.execHTTPcheck() && SPIFFS.opened == opened + 1; });
+  pub = SPIFFS.open("/rsa_key.pub", FILE_WRITE);
+  pub.write((const uint8_t*)pubKey.data(), pubKey.size());
+  pub.close();
+
+  // Hang up the kept connections, so their TLS state doesn't weigh on the heap figures below
+  for (esp32FotaGsmSSL* kept : {&fota, &rotated, &keyless}) {
+    kept->connectionLinger = 0;
+    kept->closeIdleConnection();
+  }
+
+  link_matrix("link, plain image", "https://" BENCH_HOST "/plain.json", image);
+  link_matrix("link, gzip image", "https://" BENCH_HOST "/gzip.json", image);
+  link_matrix("link, no keep-alive", "https://" BENCH_HOST "/plain.json", image, [](esp32FotaGsmSSL& fota) { fota.connectionLinger = 0; });
+  link_matrix("link, fresh each time", "https://" BENCH_HOST "/plain.json", image, [](esp32FotaGsmSSL& fota) {
+    fota.connectionLinger = 0;
+    fota.resumeTls        = false;
+  });
+  link_matrix("link, begin()/poll()", "https://" BENCH_HOST "/plain.json", image, NULL, true);
+  link_matrix("link, fleet, poll()", "https://" BENCH_HOST "/fleet.json", image, NULL, true);
+  link_matrix("link, 3 sockets", "https://" BENCH_HOST "/plain.json", image, [](esp32FotaGsmSSL& fota) { fota.downloadSockets = 3; });
+  // The body crosses a 115200 baud UART after the modem has all of it
+  modem.uartRate = 11520;
+  link_matrix("link, modem HTTPS", "https://" BENCH_HOST "/plain.json", image, [](esp32FotaGsmSSL& fota) { fota.modemHttp = true; });
+  // The emulated modem opens its socket within AT+SHCONN, so that round trip still shows as a socket open
+  link_matrix("link, modem poll()", "https://" BENCH_HOST "/plain.json", image, [](esp32FotaGsmSSL& fota) { fota.modemHttp = true; }, true);
+  modem.uartRate = 0;
+  phase_table("https://" BENCH_HOST "/plain.json");
+  socket_table(image);
+  attach_table();
+  signature_table(image, 20);
+  trust_table(20);
+  inflate_table(signedGzip.substr(BENCH_SIG_LEN), image.size());
+  fragment_table(image);
+  erase_table(image);
+  copy_table(image);
+  delta_table(dir, image);
+  parser_table();
+  fleet_table();
+  semver_table(10000);
+
+  host_flash_end();
+  return failures ? 1 : 0;
+}
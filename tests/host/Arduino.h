@@ -0,0 +1,51 @@
+/*
+   Host stand-in for the arduino-esp32 core
+   Purpose: Just enough of Arduino.h to build the library on Linux for benchmarking (see tests/bench_native)
+*/
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "Esp.h"
+#include "HardwareSerial.h"
+#include "IPAddress.h"
+#include "Stream.h"
+#include "WString.h"
+#include "esp32-hal-log.h"
+#include "freertos/FreeRTOS.h"
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define PROGMEM
+#define HIGH 0x1
+#define LOW 0x0
+#define INPUT 0x01
+#define OUTPUT 0x02
+#define SERIAL_8N1 0x800001c
+
+using std::max;
+using std::min;
+
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+void yield();
+
+// GPIO only drives the modem power and status pins, which have nothing attached on the host
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+
+#endif
@@ -0,0 +1,33 @@
+/*
+   Host stand-in for Esp.h
+   Purpose: The ESP object: partition access over HostFlash, heap figures from HostHeap, and restart()
+*/
+
+#ifndef HOST_ESP_H
+#define HOST_ESP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_partition.h"
+
+// ESP.restart() can't reset the host, it throws this so a harness can treat the call as "update done"
+struct HostRestart {};
+
+class EspClass {
+ public:
+  void restart();
+  uint32_t getHeapSize();
+  uint32_t getFreeHeap();
+  uint32_t getMinFreeHeap();
+  uint32_t getMaxAllocHeap();
+  uint64_t getEfuseMac();
+  uint32_t getCycleCount();
+  bool partitionEraseRange(const esp_partition_t* partition, uint32_t offset, size_t size);
+  bool partitionWrite(const esp_partition_t* partition, uint32_t offset, uint32_t* data, size_t size);
+  bool partitionRead(const esp_partition_t* partition, uint32_t offset, uint32_t* data, size_t size);
+};
+
+extern EspClass ESP;
+
+#endif
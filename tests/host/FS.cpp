@@ -0,0 +1,70 @@
+/*
+   Host stand-in for FS.h
+   Purpose: File/FS over a directory on the host, see SPIFFS.h
+*/
+
+#include "FS.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "HostHeap.h"
+#include "SPIFFS.h"
+
+using namespace fs;
+
+int File::available() {
+  if (!_f) return 0;
+  long pos = ftell(_f);
+  return pos < 0 ? 0 : (int)(size() - pos);
+}
+
+int File::read() {
+  if (!_f) return -1;
+  int c = fgetc(_f);
+  return c == EOF ? -1 : c;
+}
+
+int File::peek() {
+  if (!_f) return -1;
+  int c = fgetc(_f);
+  if (c == EOF) return -1;
+  ungetc(c, _f);
+  return c;
+}
+
+size_t File::size() const {
+  struct stat st;
+  return _f && fstat(fileno(_f), &st) == 0 ? st.st_size : 0;
+}
+
+bool FS::begin(bool formatOnFail, const char* basePath, uint8_t maxOpenFiles, const char* partitionLabel) {
+  struct stat st;
+  return stat(_root.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+std::string FS::hostPath(const char* path) const {
+  std::string root = _root;
+  if (root.empty()) root = ".";
+  return root + (path[0] == '/' ? "" : "/") + path;
+}
+
+// The stdio buffers FILE* allocates have no counterpart on SPIFFS, keep them out of the heap figures
+File FS::open(const char* path, const char* mode, const bool create) {
+  HostHeapUncounted uncounted;
+  opened++;
+  return File(fopen(hostPath(path).c_str(), mode[0] == 'r' ? "rb" : mode[0] == 'a' ? "ab" : "wb"));
+}
+
+bool FS::exists(const char* path) {
+  HostHeapUncounted uncounted;
+  struct stat st;
+  return stat(hostPath(path).c_str(), &st) == 0;
+}
+
+bool FS::remove(const char* path) {
+  HostHeapUncounted uncounted;
+  return unlink(hostPath(path).c_str()) == 0;
+}
+
+FS SPIFFS(getenv("FOTA_HOST_FS") ? getenv("FOTA_HOST_FS") : ".");
@@ -0,0 +1,82 @@
+/*
+   Host stand-in for FS.h
+   Purpose: File/FS over a directory on the host, see SPIFFS.h
+*/
+
+#ifndef HOST_FS_H
+#define HOST_FS_H
+
+#include <Arduino.h>
+#include <stdio.h>
+
+#include <string>
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+namespace fs {
+
+class File : public Stream {
+ public:
+  File(FILE* f = NULL) : _f(f) {}
+  File(const File& other) = delete;
+  File(File&& other) : _f(other._f) { other._f = NULL; }
+  File& operator=(File&& other) {
+    close();
+    _f       = other._f;
+    other._f = NULL;
+    return *this;
+  }
+  ~File() { close(); }
+
+  size_t write(uint8_t c) { return write(&c, 1); }
+  size_t write(const uint8_t* buf, size_t size) { return _f ? fwrite(buf, 1, size, _f) : 0; }
+  int available();
+  int read();
+  size_t read(uint8_t* buf, size_t size) { return _f ? fread(buf, 1, size, _f) : 0; }
+  size_t readBytes(char* buffer, size_t length) { return read((uint8_t*)buffer, length); }
+  int peek();
+  void flush() {
+    if (_f) fflush(_f);
+  }
+  bool seek(uint32_t pos) { return _f && fseek(_f, pos, SEEK_SET) == 0; }
+  size_t position() const { return _f ? ftell(_f) : 0; }
+  size_t size() const;
+  void close() {
+    if (_f) fclose(_f);
+    _f = NULL;
+  }
+  operator bool() const { return _f != NULL; }
+
+  using Print::write;
+
+ private:
+  FILE* _f;
+};
+
+class FS {
+ public:
+  FS(const char* root) : _root(root) {}
+  bool begin(bool formatOnFail = false, const char* basePath = "/spiffs", uint8_t maxOpenFiles = 10, const char* partitionLabel = NULL);
+  File open(const char* path, const char* mode = FILE_READ, const bool create = false);
+  File open(const String& path, const char* mode = FILE_READ, const bool create = false) { return open(path.c_str(), mode, create); }
+  bool exists(const char* path);
+  bool exists(const String& path) { return exists(path.c_str()); }
+  bool remove(const char* path);
+
+  // Directory on the host the file system lives in, $FOTA_HOST_FS or the working directory by default
+  void setRoot(const char* root) { _root = root; }
+  unsigned opened = 0;  // Calls to open(), for telling what touched the file system
+
+ private:
+  std::string _root;
+  std::string hostPath(const char* path) const;
+};
+
+}  // namespace fs
+
+using fs::File;
+using fs::FS;
+
+#endif
@@ -0,0 +1,34 @@
+/*
+   Host stand-in for HardwareSerial.h
+   Purpose: Serial writes to stdout; the modem UART (Serial1/Serial2) goes nowhere, TinyGsm is mocked above it
+*/
+
+#ifndef HOST_HARDWARESERIAL_H
+#define HOST_HARDWARESERIAL_H
+
+#include "Stream.h"
+
+class HardwareSerial : public Stream {
+ public:
+  HardwareSerial(int uart_nr) : _uart_nr(uart_nr) {}
+  void begin(unsigned long baud, uint32_t config = 0, int8_t rxPin = -1, int8_t txPin = -1) {}
+  void end() {}
+  int available() { return 0; }
+  int read() { return -1; }
+  int peek() { return -1; }
+  size_t write(uint8_t c) { return write(&c, 1); }
+  size_t write(const uint8_t* buffer, size_t size);
+  void flush();
+  operator bool() const { return true; }
+
+  using Print::write;
+
+ private:
+  int _uart_nr;
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+extern HardwareSerial Serial2;
+
+#endif
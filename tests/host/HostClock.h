@@ -0,0 +1,22 @@
+/*
+   Host clock
+   Purpose: millis()/micros() either follow the wall clock or a simulated one. The simulated clock only moves
+            when the code waits (delay(), link latency) plus one microsecond per reading, so a slow link
+            costs no real time and busy-wait loops still terminate
+*/
+
+#ifndef HostClock_h
+#define HostClock_h
+
+#include <stdint.h>
+
+// Switching keeps the clock monotonic
+void host_clock_simulate(bool enabled);
+bool host_clock_simulated();
+
+// Moves the simulated clock forward, a no-op on the wall clock
+void host_clock_advance(uint64_t us);
+
+uint64_t host_clock_micros();
+
+#endif
@@ -0,0 +1,106 @@
+/*
+   Host stand-in for the arduino-esp32 core
+   Purpose: Time, GPIO, logging, the Serial ports and the ESP object
+*/
+
+#include <Arduino.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "HostClock.h"
+#include "HostHeap.h"
+
+static const auto bootTime = std::chrono::steady_clock::now();
+static std::atomic<bool> simulated(false);
+static std::atomic<uint64_t> simulatedNow(0);
+static std::atomic<int64_t> wallOffset(0);  // Time the simulated clock ran ahead while it was in use
+
+static uint64_t wallMicros() { return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - bootTime).count() + wallOffset; }
+
+void host_clock_simulate(bool enabled) {
+  if (enabled == simulated) return;
+  if (enabled) {
+    simulatedNow = wallMicros();
+  } else {
+    wallOffset += simulatedNow - wallMicros();
+  }
+  simulated = enabled;
+}
+
+bool host_clock_simulated() { return simulated; }
+
+void host_clock_advance(uint64_t us) {
+  if (simulated) simulatedNow += us;
+}
+
+uint64_t host_clock_micros() { return simulated ? ++simulatedNow : wallMicros(); }
+
+unsigned long millis() { return host_clock_micros() / 1000; }
+
+unsigned long micros() { return host_clock_micros(); }
+
+void delay(uint32_t ms) {
+  if (simulated) {
+    host_clock_advance(ms * 1000ULL);
+    std::this_thread::yield();
+  } else {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+  }
+}
+
+void yield() { std::this_thread::yield(); }
+
+void pinMode(uint8_t pin, uint8_t mode) {}
+
+void digitalWrite(uint8_t pin, uint8_t val) {}
+
+int digitalRead(uint8_t pin) { return LOW; }
+
+void host_log(char level, const char* file, int line, const char* func, const char* format, ...) {
+  const char* name = strrchr(file, '/');
+  fprintf(stderr, "[%6lu][%c][%s:%d] %s(): ", millis(), level, name ? name + 1 : file, line, func);
+  va_list args;
+  va_start(args, format);
+  vfprintf(stderr, format, args);
+  va_end(args);
+  fputc('\n', stderr);
+}
+
+// Only the console has somewhere to go
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) { return _uart_nr == 0 ? fwrite(buffer, 1, size, stdout) : size; }
+
+void HardwareSerial::flush() {
+  if (_uart_nr == 0) fflush(stdout);
+}
+
+HardwareSerial Serial(0);
+HardwareSerial Serial1(1);
+HardwareSerial Serial2(2);
+
+void EspClass::restart() {
+  fflush(stdout);
+  throw HostRestart();
+}
+
+uint32_t EspClass::getHeapSize() { return HOST_HEAP_SIZE; }
+
+uint32_t EspClass::getFreeHeap() {
+  size_t used = host_heap_stats().current;
+  return used < HOST_HEAP_SIZE ? HOST_HEAP_SIZE - used : 0;
+}
+
+uint32_t EspClass::getMinFreeHeap() {
+  size_t peak = host_heap_stats().peak;
+  return peak < HOST_HEAP_SIZE ? HOST_HEAP_SIZE - peak : 0;
+}
+
+uint32_t EspClass::getMaxAllocHeap() { return getFreeHeap(); }
+
+uint64_t EspClass::getEfuseMac() { return 0x0000a4cf12345678ULL; }
+
+uint32_t EspClass::getCycleCount() { return micros() * 240; }
+
+EspClass ESP;
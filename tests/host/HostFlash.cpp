@@ -0,0 +1,183 @@
+/*
+   Host flash
+   Purpose: Back the two OTA app partitions with memory mapped files so partition writes, reads and
+            the final image can be inspected (and timed) on the host
+*/
+
+#include "HostFlash.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "Esp.h"
+#include "HostClock.h"
+#include "esp_image_format.h"
+#include "esp_ota_ops.h"
+
+static esp_partition_t partitions[2] = {
+    {NULL, ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_0, 0x10000, 0, "app0", false},
+    {NULL, ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_1, 0x150000, 0, "app1", false},
+};
+static uint8_t* mapping[2]                = {NULL, NULL};
+static const esp_partition_t* bootPartition = &partitions[0];
+
+static std::atomic<uint64_t> bytesRead, bytesWritten, sectorsErased, blocksErased, writeErrors;
+static const HostFlashTiming* timing = NULL;
+
+#define HOST_FLASH_BLOCK_SIZE 0x10000
+#define HOST_FLASH_PAGE_SIZE 256
+
+static void busy(uint64_t us) {
+  if (us == 0) return;
+  if (host_clock_simulated()) {
+    host_clock_advance(us);
+  } else {
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+  }
+}
+
+bool host_flash_begin(const char* dir, uint32_t partitionSize) {
+  host_flash_end();
+  for (int i = 0; i < 2; i++) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/ota_%d.bin", dir, i);
+
+    struct stat st;
+    bool fresh = stat(path, &st) != 0 || (uint32_t)st.st_size != partitionSize;
+    int fd     = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0 || ftruncate(fd, partitionSize) != 0) {
+      perror(path);
+      if (fd >= 0) close(fd);
+      return false;
+    }
+    void* map = mmap(NULL, partitionSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+      perror(path);
+      return false;
+    }
+    mapping[i] = (uint8_t*)map;
+    if (fresh) memset(mapping[i], 0xff, partitionSize);
+    partitions[i].size = partitionSize;
+  }
+  bootPartition = &partitions[0];
+  host_flash_reset_stats();
+  return true;
+}
+
+void host_flash_end() {
+  for (int i = 0; i < 2; i++) {
+    if (mapping[i]) munmap(mapping[i], partitions[i].size);
+    mapping[i] = NULL;
+  }
+}
+
+const esp_partition_t* host_flash_partition(int index) { return &partitions[index]; }
+
+uint8_t* host_flash_data(const esp_partition_t* partition) {
+  for (int i = 0; i < 2; i++)
+    if (partition == &partitions[i]) return mapping[i];
+  return NULL;
+}
+
+const esp_partition_t* host_flash_boot_partition() { return bootPartition; }
+
+void host_flash_timing(const HostFlashTiming* flashTiming) { timing = flashTiming; }
+
+HostFlashStats host_flash_stats() { return HostFlashStats{bytesRead, bytesWritten, sectorsErased, blocksErased, writeErrors}; }
+
+void host_flash_reset_stats() {
+  bytesRead     = 0;
+  bytesWritten  = 0;
+  sectorsErased = 0;
+  blocksErased  = 0;
+  writeErrors   = 0;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t src_offset, void* dst, size_t size) {
+  uint8_t* data = host_flash_data(partition);
+  if (!data || !dst) return ESP_ERR_INVALID_ARG;
+  if (src_offset > partition->size || size > partition->size - src_offset) return ESP_ERR_INVALID_SIZE;
+  memcpy(dst, data + src_offset, size);
+  bytesRead += size;
+  return ESP_OK;
+}
+
+// NOR flash can only clear bits, so a write ANDs into the target like the real chip would
+esp_err_t esp_partition_write(const esp_partition_t* partition, size_t dst_offset, const void* src, size_t size) {
+  uint8_t* data = host_flash_data(partition);
+  if (!data || !src) return ESP_ERR_INVALID_ARG;
+  if (dst_offset > partition->size || size > partition->size - dst_offset) return ESP_ERR_INVALID_SIZE;
+  const uint8_t* in = (const uint8_t*)src;
+  uint8_t* out      = data + dst_offset;
+  bool clobbered    = false;
+  for (size_t i = 0; i < size; i++) {
+    clobbered |= (in[i] & ~out[i]) != 0;
+    out[i] &= in[i];
+  }
+  if (clobbered) writeErrors++;
+  bytesWritten += size;
+  if (timing) busy((uint64_t)timing->pageProgram * ((size + HOST_FLASH_PAGE_SIZE - 1) / HOST_FLASH_PAGE_SIZE));
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t* partition, size_t offset, size_t size) {
+  uint8_t* data = host_flash_data(partition);
+  if (!data) return ESP_ERR_INVALID_ARG;
+  if (offset > partition->size || size > partition->size - offset) return ESP_ERR_INVALID_SIZE;
+  if (offset % SPI_FLASH_SEC_SIZE != 0 || size % SPI_FLASH_SEC_SIZE != 0) return ESP_ERR_INVALID_SIZE;
+  memset(data + offset, 0xff, size);
+  sectorsErased += size / SPI_FLASH_SEC_SIZE;
+  // Partitions are block aligned, so an aligned offset is an aligned flash address
+  uint64_t us = 0;
+  for (size_t at = offset, end = offset + size; at < end;) {
+    if (at % HOST_FLASH_BLOCK_SIZE == 0 && end - at >= HOST_FLASH_BLOCK_SIZE) {
+      blocksErased++;
+      us += timing ? timing->blockErase : 0;
+      at += HOST_FLASH_BLOCK_SIZE;
+    } else {
+      us += timing ? timing->sectorErase : 0;
+      at += SPI_FLASH_SEC_SIZE;
+    }
+  }
+  busy(us);
+  return ESP_OK;
+}
+
+const esp_partition_t* esp_ota_get_running_partition(void) { return &partitions[0]; }
+
+const esp_partition_t* esp_ota_get_next_update_partition(const esp_partition_t* start_from) {
+  if (start_from == NULL) start_from = esp_ota_get_running_partition();
+  return start_from == &partitions[0] ? &partitions[1] : &partitions[0];
+}
+
+const esp_partition_t* esp_ota_get_boot_partition(void) { return bootPartition; }
+
+// The bootloader would verify the whole image, checking the magic byte is enough to catch a missing header
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t* partition) {
+  uint8_t* data = host_flash_data(partition);
+  if (!data) return ESP_ERR_INVALID_ARG;
+  if (data[0] != ESP_IMAGE_HEADER_MAGIC) return ESP_ERR_OTA_VALIDATE_FAILED;
+  bootPartition = partition;
+  return ESP_OK;
+}
+
+bool EspClass::partitionEraseRange(const esp_partition_t* partition, uint32_t offset, size_t size) {
+  return esp_partition_erase_range(partition, offset, size) == ESP_OK;
+}
+
+bool EspClass::partitionWrite(const esp_partition_t* partition, uint32_t offset, uint32_t* data, size_t size) {
+  return esp_partition_write(partition, offset, data, size) == ESP_OK;
+}
+
+bool EspClass::partitionRead(const esp_partition_t* partition, uint32_t offset, uint32_t* data, size_t size) {
+  return esp_partition_read(partition, offset, data, size) == ESP_OK;
+}
@@ -0,0 +1,45 @@
+/*
+   Host flash
+   Purpose: Back the two OTA app partitions with memory mapped files so partition writes, reads and
+            the final image can be inspected (and timed) on the host
+*/
+
+#ifndef HostFlash_h
+#define HostFlash_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_partition.h"
+
+struct HostFlashStats {
+  uint64_t bytesRead;
+  uint64_t bytesWritten;
+  uint64_t sectorsErased;
+  uint64_t blocksErased;  // Of those, 64 KB blocks erased with one command
+  uint64_t writeErrors;  // Writes that tried to flip a 0 bit back to 1 (target not erased)
+};
+
+// Maps <dir>/ota_0.bin and <dir>/ota_1.bin of partitionSize bytes (created erased when missing),
+// partition.csv lays them out at 0x10000 and 0x150000 with 0x140000 each
+bool host_flash_begin(const char* dir, uint32_t partitionSize = 0x140000);
+void host_flash_end();
+
+const esp_partition_t* host_flash_partition(int index);
+uint8_t* host_flash_data(const esp_partition_t* partition);
+const esp_partition_t* host_flash_boot_partition();
+
+// How long flash operations take, like a real chip (datasheet typicals): erases and writes then wait that
+// long, on the simulated clock when it runs (HostClock.h) or else sleeping
+struct HostFlashTiming {
+  uint32_t sectorErase;  // us for a 4 KB sector
+  uint32_t blockErase;   // us for a 64 KB block, used for aligned whole blocks like spi_flash_erase_range() does
+  uint32_t pageProgram;  // us for a 256 byte page
+};
+// NULL, the default, makes flash operations instant
+void host_flash_timing(const HostFlashTiming* timing);
+
+HostFlashStats host_flash_stats();
+void host_flash_reset_stats();
+
+#endif
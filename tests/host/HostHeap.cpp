@@ -0,0 +1,117 @@
+/*
+   Host heap accounting
+   Purpose: Wrap malloc & co. to count allocations and track live and peak heap, which ESP.getFreeHeap()
+            and the benchmark report against a nominal ESP32 heap
+*/
+
+#include "HostHeap.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+
+// glibc's own entry points, it explicitly supports replacing malloc by defining these in the program
+extern "C" {
+void* __libc_malloc(size_t size);
+void __libc_free(void* ptr);
+}
+
+// Every block carries its base pointer and requested size right in front of the returned pointer
+struct BlockHeader {
+  void* base;
+  size_t size;
+  bool counted;
+};
+
+static std::atomic<uint64_t> allocations(0);
+static std::atomic<size_t> current(0);
+static std::atomic<size_t> peak(0);
+static thread_local int uncounted = 0;
+
+static void account(size_t size) {
+  allocations++;
+  size_t now  = current += size;
+  size_t high = peak;
+  while (now > high && !peak.compare_exchange_weak(high, now)) {
+  }
+}
+
+static BlockHeader* header(void* ptr) { return (BlockHeader*)ptr - 1; }
+
+static void* allocate(size_t alignment, size_t size) {
+  if (alignment < alignof(max_align_t)) alignment = alignof(max_align_t);
+  if (size > SIZE_MAX - sizeof(BlockHeader) - alignment) return NULL;
+  uint8_t* base = (uint8_t*)__libc_malloc(size + sizeof(BlockHeader) + alignment);
+  if (!base) return NULL;
+  uintptr_t user = ((uintptr_t)base + sizeof(BlockHeader) + alignment - 1) & ~(uintptr_t)(alignment - 1);
+  BlockHeader* h = header((void*)user);
+  h->base        = base;
+  h->size        = size;
+  h->counted     = uncounted == 0;
+  if (h->counted) account(size);
+  return (void*)user;
+}
+
+extern "C" {
+
+void* malloc(size_t size) { return allocate(0, size); }
+
+void free(void* ptr) {
+  if (!ptr) return;
+  BlockHeader* h = header(ptr);
+  if (h->counted) current -= h->size;
+  __libc_free(h->base);
+}
+
+void* calloc(size_t nmemb, size_t size) {
+  if (size && nmemb > SIZE_MAX / size) return NULL;
+  void* ptr = allocate(0, nmemb * size);
+  if (ptr) memset(ptr, 0, nmemb * size);
+  return ptr;
+}
+
+void* realloc(void* ptr, size_t size) {
+  if (!ptr) return malloc(size);
+  if (!size) {
+    free(ptr);
+    return NULL;
+  }
+  size_t old = header(ptr)->size;
+  void* next = allocate(0, size);
+  if (!next) return NULL;
+  memcpy(next, ptr, old < size ? old : size);
+  free(ptr);
+  return next;
+}
+
+void* memalign(size_t alignment, size_t size) { return allocate(alignment, size); }
+
+void* aligned_alloc(size_t alignment, size_t size) { return allocate(alignment, size); }
+
+int posix_memalign(void** memptr, size_t alignment, size_t size) {
+  if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0) return EINVAL;
+  void* ptr = allocate(alignment, size);
+  if (!ptr) return ENOMEM;
+  *memptr = ptr;
+  return 0;
+}
+
+void* valloc(size_t size) { return allocate(4096, size); }
+
+void* pvalloc(size_t size) { return allocate(4096, (size + 4095) & ~(size_t)4095); }
+
+size_t malloc_usable_size(void* ptr) { return ptr ? header(ptr)->size : 0; }
+}
+
+HostHeapStats host_heap_stats() { return HostHeapStats{allocations, current, peak}; }
+
+void host_heap_reset() {
+  allocations = 0;
+  peak        = current.load();
+}
+
+HostHeapUncounted::HostHeapUncounted() { uncounted++; }
+
+HostHeapUncounted::~HostHeapUncounted() { uncounted--; }
@@ -0,0 +1,34 @@
+/*
+   Host heap accounting
+   Purpose: Wrap malloc & co. to count allocations and track live and peak heap, which ESP.getFreeHeap()
+            and the benchmark report against a nominal ESP32 heap
+*/
+
+#ifndef HostHeap_h
+#define HostHeap_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HOST_HEAP_SIZE (320 * 1024)  // Roughly what an ESP32 sketch has free after the core started
+
+struct HostHeapStats {
+  uint64_t allocations;  // malloc/calloc/realloc/aligned calls since the last reset
+  size_t current;        // Live bytes
+  size_t peak;           // High water mark of live bytes since the last reset
+};
+
+HostHeapStats host_heap_stats();
+
+// Restarts the allocation count and the peak from the current live size
+void host_heap_reset();
+
+// Allocations made on this thread while a guard is alive aren't counted, for host-only machinery
+// (mock servers, bookkeeping) that has no counterpart on the device
+class HostHeapUncounted {
+ public:
+  HostHeapUncounted();
+  ~HostHeapUncounted();
+};
+
+#endif
@@ -0,0 +1,175 @@
+/*
+   Host network
+   Purpose: In-process servers the mocked modem connects to by host name and port, plus a small HTTP/1.1
+            file server speaking the subset the library relies on (Range/If-Range, ETag, redirects, chunked)
+*/
+
+#include "HostNet.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <algorithm>
+
+struct HostEndpoint {
+  HostServer* server;
+  HostTlsEndpoint* tls;
+};
+
+static std::map<std::string, HostEndpoint>& servers() {
+  static std::map<std::string, HostEndpoint> registry;
+  return registry;
+}
+
+static HostNetStats stats = {0};
+
+static std::string endpoint(const char* host, uint16_t port) { return std::string(host) + ":" + std::to_string(port); }
+
+void host_net_listen(const char* host, uint16_t port, HostServer* server, HostTlsEndpoint* tls) {
+  if (server)
+    servers()[endpoint(host, port)] = HostEndpoint{server, tls};
+  else
+    servers().erase(endpoint(host, port));
+}
+
+HostServer* host_net_find(const char* host, uint16_t port) {
+  auto it = servers().find(endpoint(host, port));
+  return it == servers().end() ? NULL : it->second.server;
+}
+
+HostTlsEndpoint* host_net_tls(const char* host, uint16_t port) {
+  auto it = servers().find(endpoint(host, port));
+  return it == servers().end() ? NULL : it->second.tls;
+}
+
+HostNetStats& host_net_stats() { return stats; }
+
+void host_net_reset_stats() { stats = HostNetStats{0}; }
+
+// Value of a request header, matched case-insensitively; empty when absent
+static std::string header(const std::string& request, const char* name) {
+  size_t len = strlen(name);
+  size_t pos = request.find("\r\n");
+  while (pos != std::string::npos && pos + 2 < request.size()) {
+    size_t start = pos + 2;
+    size_t end   = request.find("\r\n", start);
+    if (end == std::string::npos) break;
+    if (end - start > len && request[start + len] == ':' && strncasecmp(request.c_str() + start, name, len) == 0) {
+      size_t value = request.find_first_not_of(' ', start + len + 1);
+      return value < end ? request.substr(value, end - value) : std::string();
+    }
+    pos = end;
+  }
+  return std::string();
+}
+
+static std::string statusLine(int status) {
+  const char* reason = "OK";
+  switch (status) {
+    case 206: reason = "Partial Content"; break;
+    case 301: reason = "Moved Permanently"; break;
+    case 302: reason = "Found"; break;
+    case 304: reason = "Not Modified"; break;
+    case 307: reason = "Temporary Redirect"; break;
+    case 400: reason = "Bad Request"; break;
+    case 404: reason = "Not Found"; break;
+    case 416: reason = "Range Not Satisfiable"; break;
+  }
+  return "HTTP/1.1 " + std::to_string(status) + " " + reason + "\r\n";
+}
+
+void HttpFileServer::serve(const std::string& path, const uint8_t* data, size_t length, const std::string& etag, long maxAge) {
+  _files[path] = File{data, length, etag, std::string(), "application/octet-stream", maxAge};
+}
+
+void HttpFileServer::serve(const std::string& path, const std::string& body, const std::string& etag, long maxAge) {
+  std::string& stored = _bodies[path] = body;
+  _files[path]        = File{(const uint8_t*)stored.data(), stored.size(), etag, std::string(), "application/json", maxAge};
+}
+
+void HttpFileServer::redirect(const std::string& path, const std::string& location, int status) {
+  _redirects[path] = std::make_pair(status, location);
+}
+
+void HttpFileServer::sendBody(HostResponse& response, const uint8_t* data, size_t length) {
+  if (!chunked) {
+    response.send(data, length);
+    return;
+  }
+  // Uneven chunk sizes so the client's chunk parser sees headers straddling its reads
+  static const size_t sizes[] = {1000, 4096, 517, 8192, 33};
+  for (size_t sent = 0, i = 0; sent < length; i++) {
+    size_t n = std::min(sizes[i % 5], length - sent);
+    char size[16];
+    snprintf(size, sizeof(size), "%zx\r\n", n);
+    response.send(size);
+    response.send(data + sent, n);
+    response.send("\r\n");
+    sent += n;
+  }
+  response.send("0\r\n\r\n");
+}
+
+bool HttpFileServer::handle(const std::string& request, HostResponse& response) {
+  _requests++;
+  _lastRequest = request;
+  bool close   = !keepAlive || strcasecmp(header(request, "Connection").c_str(), "close") == 0;
+
+  char method[16], target[1024];
+  if (sscanf(request.c_str(), "%15s %1023s", method, target) != 2 || strcmp(method, "GET") != 0) {
+    response.send(statusLine(400) + "Content-Length: 0\r\nConnection: close\r\n\r\n");
+    return false;
+  }
+
+  auto redirect = _redirects.find(target);
+  if (redirect != _redirects.end()) {
+    response.send(statusLine(redirect->second.first) + "Location: " + redirect->second.second + "\r\nContent-Length: 0\r\n" + (close ? "Connection: close\r\n" : "") + "\r\n");
+    return !close;
+  }
+
+  auto it = _files.find(target);
+  if (it == _files.end()) {
+    response.send(statusLine(404) + "Content-Length: 0\r\n" + (close ? "Connection: close\r\n" : "") + "\r\n");
+    return !close;
+  }
+  const File& file = it->second;
+
+  std::string validators;
+  if (!file.etag.empty()) validators += "ETag: " + file.etag + "\r\n";
+  if (file.maxAge >= 0) validators += "Cache-Control: max-age=" + std::to_string(file.maxAge) + "\r\n";
+  std::string connection = close ? "Connection: close\r\n" : "Connection: keep-alive\r\n";
+
+  if (!file.etag.empty() && header(request, "If-None-Match") == file.etag) {
+    response.send(statusLine(304) + validators + connection + "\r\n");
+    return !close;
+  }
+
+  // Single byte ranges only, and only while an If-Range validator (if any) still matches
+  size_t first = 0, last = file.length - 1;
+  bool partial      = false;
+  std::string range = header(request, "Range");
+  std::string cond  = header(request, "If-Range");
+  if (ranges && !range.empty() && (cond.empty() || cond == file.etag)) {
+    unsigned long long a, b;
+    int fields = sscanf(range.c_str(), "bytes=%llu-%llu", &a, &b);
+    if (fields >= 1) {
+      if (a >= file.length) {
+        response.send(statusLine(416) + "Content-Range: bytes */" + std::to_string(file.length) + "\r\nContent-Length: 0\r\n" + connection + "\r\n");
+        return !close;
+      }
+      first   = a;
+      last    = fields == 2 && b < file.length ? b : file.length - 1;
+      partial = true;
+    }
+  }
+
+  size_t length    = file.length ? last - first + 1 : 0;
+  std::string head = statusLine(partial ? 206 : 200) + "Content-Type: " + file.contentType + "\r\n" + validators + connection;
+  if (partial) head += "Content-Range: bytes " + std::to_string(first) + "-" + std::to_string(last) + "/" + std::to_string(file.length) + "\r\n";
+  head += chunked ? "Transfer-Encoding: chunked\r\n" : "Content-Length: " + std::to_string(length) + "\r\n";
+  response.send(head + "\r\n");
+  sendBody(response, file.data + first, length);
+  return !close;
+}
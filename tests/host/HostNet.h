@@ -0,0 +1,88 @@
+/*
+   Host network
+   Purpose: In-process servers the mocked modem connects to by host name and port, plus a small HTTP/1.1
+            file server speaking the subset the library relies on (Range/If-Range, ETag, redirects, chunked)
+*/
+
+#ifndef HostNet_h
+#define HostNet_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Bytes queued towards the client: owned text (status line, headers, chunk framing) or a view into
+// data the server keeps alive, so serving a firmware image doesn't copy it onto the heap being measured
+struct HostSegment {
+  std::string text;
+  const uint8_t* data;
+  size_t length;
+};
+
+class HostResponse {
+ public:
+  void send(const std::string& text) { segments.push_back(HostSegment{text, NULL, 0}); }
+  void send(const uint8_t* data, size_t length) { segments.push_back(HostSegment{std::string(), data, length}); }
+  std::vector<HostSegment> segments;
+};
+
+class HostServer {
+ public:
+  virtual ~HostServer() {}
+  // Called with each complete request head (up to and including the empty line), returns false to
+  // close the connection once the response has been read
+  virtual bool handle(const std::string& request, HostResponse& response) = 0;
+};
+
+struct HostNetStats {
+  uint64_t connections;
+  uint64_t requests;
+  uint64_t bytesSent;      // Client to server
+  uint64_t bytesReceived;  // Server to client
+};
+
+class HostTlsEndpoint;
+
+// With a TLS endpoint the server only sees the decrypted requests, see HostTls.h
+void host_net_listen(const char* host, uint16_t port, HostServer* server, HostTlsEndpoint* tls = NULL);
+HostServer* host_net_find(const char* host, uint16_t port);
+HostTlsEndpoint* host_net_tls(const char* host, uint16_t port);
+HostNetStats& host_net_stats();
+void host_net_reset_stats();
+
+class HttpFileServer : public HostServer {
+ public:
+  struct File {
+    const uint8_t* data;
+    size_t length;
+    std::string etag;
+    std::string lastModified;
+    std::string contentType;
+    long maxAge;  // Cache-Control max-age, < 0 leaves the header out
+  };
+
+  bool chunked   = false;  // Send bodies with Transfer-Encoding: chunked instead of Content-Length
+  bool keepAlive = true;   // Honour keep-alive unless the request asks for Connection: close
+  bool ranges    = true;   // Honour Range requests, otherwise they get the whole file
+
+  void serve(const std::string& path, const uint8_t* data, size_t length, const std::string& etag = "", long maxAge = -1);
+  void serve(const std::string& path, const std::string& body, const std::string& etag = "", long maxAge = -1);
+  void redirect(const std::string& path, const std::string& location, int status = 302);
+  bool handle(const std::string& request, HostResponse& response);
+
+  uint64_t requests() const { return _requests; }
+  const std::string& lastRequest() const { return _lastRequest; }
+
+ private:
+  std::map<std::string, File> _files;
+  std::map<std::string, std::string> _bodies;  // Storage for serve(path, std::string)
+  std::map<std::string, std::pair<int, std::string> > _redirects;
+  uint64_t _requests = 0;
+  std::string _lastRequest;
+  void sendBody(HostResponse& response, const uint8_t* data, size_t length);
+};
+
+#endif
@@ -0,0 +1,136 @@
+/*
+   Host TLS termination
+   Purpose: Server side of TLS 1.2 for the in-process servers, with a session cache and session tickets,
+            so the library's handshakes (full and resumed) cost real CPU and real round trips on the
+            simulated link. Everything here runs outside the heap accounting
+*/
+
+#include "HostTls.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "HostHeap.h"
+#include "mbedtls/version.h"
+
+#define HOST_TLS_TICKET_LIFETIME 86400
+
+HostTlsEndpoint::HostTlsEndpoint() {
+  HostHeapUncounted uncounted;
+  mbedtls_ssl_config_init(&_conf);
+  mbedtls_x509_crt_init(&_cert);
+  mbedtls_pk_init(&_key);
+  mbedtls_entropy_init(&_entropy);
+  mbedtls_ctr_drbg_init(&_drbg);
+  mbedtls_ssl_cache_init(&_cache);
+  mbedtls_ssl_ticket_init(&_ticket);
+}
+
+HostTlsEndpoint::~HostTlsEndpoint() {
+  HostHeapUncounted uncounted;
+  mbedtls_ssl_ticket_free(&_ticket);
+  mbedtls_ssl_cache_free(&_cache);
+  mbedtls_ctr_drbg_free(&_drbg);
+  mbedtls_entropy_free(&_entropy);
+  mbedtls_pk_free(&_key);
+  mbedtls_x509_crt_free(&_cert);
+  mbedtls_ssl_config_free(&_conf);
+}
+
+bool HostTlsEndpoint::begin(const char* certificate, const char* key) {
+  HostHeapUncounted uncounted;
+  int ret;
+  if ((ret = mbedtls_ctr_drbg_seed(&_drbg, mbedtls_entropy_func, &_entropy, NULL, 0)) != 0 ||
+      (ret = mbedtls_x509_crt_parse(&_cert, (const unsigned char*)certificate, strlen(certificate) + 1)) != 0 ||
+#if MBEDTLS_VERSION_MAJOR >= 3
+      (ret = mbedtls_pk_parse_key(&_key, (const unsigned char*)key, strlen(key) + 1, NULL, 0, mbedtls_ctr_drbg_random, &_drbg)) != 0 ||
+#else
+      (ret = mbedtls_pk_parse_key(&_key, (const unsigned char*)key, strlen(key) + 1, NULL, 0)) != 0 ||
+#endif
+      (ret = mbedtls_ssl_config_defaults(&_conf, MBEDTLS_SSL_IS_SERVER, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT)) != 0 ||
+      (ret = mbedtls_ssl_conf_own_cert(&_conf, &_cert, &_key)) != 0) {
+    fprintf(stderr, "HostTlsEndpoint: mbedtls error -0x%04x\n", -ret);
+    return false;
+  }
+  mbedtls_ssl_conf_rng(&_conf, mbedtls_ctr_drbg_random, &_drbg);
+
+  // Both ways of resuming: session IDs looked up in the cache and tickets the client brings back
+  ret = mbedtls_ssl_ticket_setup(&_ticket, mbedtls_ctr_drbg_random, &_drbg, MBEDTLS_CIPHER_AES_256_GCM, HOST_TLS_TICKET_LIFETIME);
+  if (ret != 0) {
+    fprintf(stderr, "HostTlsEndpoint: mbedtls_ssl_ticket_setup -0x%04x\n", -ret);
+    return false;
+  }
+  mbedtls_ssl_conf_session_cache(&_conf, &_cache, mbedtls_ssl_cache_get, mbedtls_ssl_cache_set);
+  mbedtls_ssl_conf_session_tickets_cb(&_conf, mbedtls_ssl_ticket_write, mbedtls_ssl_ticket_parse, &_ticket);
+  return true;
+}
+
+HostTlsConnection::HostTlsConnection(HostTlsEndpoint& endpoint) {
+  HostHeapUncounted uncounted;
+  mbedtls_ssl_init(&_ssl);
+  mbedtls_ssl_setup(&_ssl, &endpoint._conf);
+  mbedtls_ssl_set_bio(&_ssl, this, bioSend, bioRecv, NULL);
+}
+
+HostTlsConnection::~HostTlsConnection() {
+  HostHeapUncounted uncounted;
+  mbedtls_ssl_free(&_ssl);
+}
+
+int HostTlsConnection::bioSend(void* connection, const unsigned char* buf, size_t len) {
+  HostTlsConnection* self = (HostTlsConnection*)connection;
+  if (!self->_out) return MBEDTLS_ERR_SSL_WANT_WRITE;
+  self->_out->append((const char*)buf, len);
+  return len;
+}
+
+int HostTlsConnection::bioRecv(void* connection, unsigned char* buf, size_t len) {
+  HostTlsConnection* self = (HostTlsConnection*)connection;
+  size_t n                = std::min(len, self->_in.size() - self->_inOffset);
+  if (n == 0) return MBEDTLS_ERR_SSL_WANT_READ;
+  memcpy(buf, self->_in.data() + self->_inOffset, n);
+  self->_inOffset += n;
+  if (self->_inOffset == self->_in.size()) {
+    self->_in.clear();
+    self->_inOffset = 0;
+  }
+  return n;
+}
+
+bool HostTlsConnection::receive(const uint8_t* data, size_t length, std::string& out, std::string& plain) {
+  HostHeapUncounted uncounted;
+  _in.append((const char*)data, length);
+  _out = &out;
+
+  int ret = 0;
+  if (!_established) {
+    ret = mbedtls_ssl_handshake(&_ssl);
+    if (ret == 0) _established = true;
+  }
+  unsigned char buf[4096];
+  while (_established && (ret = mbedtls_ssl_read(&_ssl, buf, sizeof(buf))) > 0) plain.append((const char*)buf, ret);
+
+  _out = NULL;
+  return ret == 0 || ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE;
+}
+
+void HostTlsConnection::send(const uint8_t* data, size_t length, std::string& out) {
+  HostHeapUncounted uncounted;
+  _out = &out;
+  while (length > 0) {
+    int ret = mbedtls_ssl_write(&_ssl, data, length);
+    if (ret <= 0) break;
+    data += ret;
+    length -= ret;
+  }
+  _out = NULL;
+}
+
+void HostTlsConnection::close(std::string& out) {
+  HostHeapUncounted uncounted;
+  _out = &out;
+  mbedtls_ssl_close_notify(&_ssl);
+  _out = NULL;
+}
@@ -0,0 +1,66 @@
+/*
+   Host TLS termination
+   Purpose: Server side of TLS 1.2 for the in-process servers, with a session cache and session tickets,
+            so the library's handshakes (full and resumed) cost real CPU and real round trips on the
+            simulated link. Everything here runs outside the heap accounting
+*/
+
+#ifndef HostTls_h
+#define HostTls_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/pk.h"
+#include "mbedtls/ssl.h"
+#include "mbedtls/ssl_cache.h"
+#include "mbedtls/ssl_ticket.h"
+#include "mbedtls/x509_crt.h"
+
+// Certificate, key and resumption state shared by all connections to one endpoint
+class HostTlsEndpoint {
+ public:
+  HostTlsEndpoint();
+  ~HostTlsEndpoint();
+  // PEM certificate (chain) and private key, returns false if mbedtls rejects them
+  bool begin(const char* certificate, const char* key);
+
+ private:
+  friend class HostTlsConnection;
+  mbedtls_ssl_config _conf;
+  mbedtls_x509_crt _cert;
+  mbedtls_pk_context _key;
+  mbedtls_entropy_context _entropy;
+  mbedtls_ctr_drbg_context _drbg;
+  mbedtls_ssl_cache_context _cache;
+  mbedtls_ssl_ticket_context _ticket;
+};
+
+// One accepted connection. Bytes from the client go in through receive(), which hands back what the
+// server sends in turn (handshake flights, alerts) and the decrypted application data
+class HostTlsConnection {
+ public:
+  explicit HostTlsConnection(HostTlsEndpoint& endpoint);
+  ~HostTlsConnection();
+  // False once the connection is unusable: failed handshake, alert or close_notify from the client
+  bool receive(const uint8_t* data, size_t length, std::string& out, std::string& plain);
+  // Encrypts application data into records
+  void send(const uint8_t* data, size_t length, std::string& out);
+  void close(std::string& out);
+  bool established() const { return _established; }
+
+ private:
+  static int bioSend(void* connection, const unsigned char* buf, size_t len);
+  static int bioRecv(void* connection, unsigned char* buf, size_t len);
+  mbedtls_ssl_context _ssl;
+  std::string _in;
+  size_t _inOffset = 0;
+  std::string* _out = NULL;
+  bool _established = false;
+};
+
+#endif
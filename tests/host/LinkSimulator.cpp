@@ -0,0 +1,123 @@
+/*
+   Cellular link simulator
+   Purpose: Shapes what the mocked modem sockets deliver to match a scripted link: bandwidth caps both ways,
+            round trip time with jitter, connection setup cost, periodic stalls and mid-stream drop-outs.
+            Time is simulated (see HostClock.h), so a 20 minute NB-IoT download runs in seconds and
+            every run of a profile is identical
+*/
+
+#include "LinkSimulator.h"
+
+#include <algorithm>
+
+#include "HostClock.h"
+
+static const LinkProfile* active = NULL;
+static uint64_t downlinkTotal    = 0;  // Position in the stall/drop pattern
+static uint32_t jitterState      = 1;
+static LinkStats totals          = {0};
+static int busyLinks             = 0;  // Connections with response data on the way
+static uint64_t stallUntil       = 0;  // A stall holds up every connection, like the radio outage it stands for
+
+void LinkSimulator::use(const LinkProfile* profile) {
+  active        = profile;
+  downlinkTotal = 0;
+  stallUntil    = 0;
+  jitterState   = profile && profile->seed ? profile->seed : 1;
+  host_clock_simulate(profile != NULL);
+}
+
+const LinkProfile* LinkSimulator::profile() { return active; }
+
+LinkStats LinkSimulator::stats() { return totals; }
+
+void LinkSimulator::resetStats() { totals = LinkStats{0}; }
+
+uint64_t LinkSimulator::roundTrip() {
+  uint64_t us = active->rtt * 1000ULL;
+  if (active->jitter) {
+    jitterState ^= jitterState << 13;
+    jitterState ^= jitterState >> 17;
+    jitterState ^= jitterState << 5;
+    us += jitterState % (active->jitter * 1000ULL);
+  }
+  return us;
+}
+
+void LinkSimulator::setBusy(bool busy) {
+  if (busy != _busy) busyLinks += busy ? 1 : -1;
+  _busy = busy;
+}
+
+void LinkSimulator::connect() {
+  _ready   = 0;
+  _credit  = 0;
+  _dropped = false;
+  if (!active) return;
+  for (int i = 0; i < active->connectRtts; i++) host_clock_advance(roundTrip());
+  _clock = _resumeAt = host_clock_micros();
+}
+
+void LinkSimulator::request(size_t length) {
+  if (!active) return;
+  uint64_t now = host_clock_micros();
+  uint64_t up  = active->uplink ? length * 1000000ULL / active->uplink : 0;
+  _resumeAt    = std::max(_resumeAt, now + up + roundTrip());
+  _clock       = _resumeAt;
+  _credit      = 0;
+}
+
+size_t LinkSimulator::ready(size_t queued) {
+  if (!active) return queued;
+  if (_dropped) {
+    setBusy(false);
+    return _ready;
+  }
+
+  uint64_t now      = host_clock_micros();
+  uint64_t resumeAt = std::max(_resumeAt, stallUntil);
+  if (queued <= _ready || now <= resumeAt) {
+    // The link idles until the server has something to send, bandwidth doesn't accumulate meanwhile
+    if (queued <= _ready) _credit = 0;
+    _clock = std::max(now, resumeAt);
+    setBusy(false);
+    return _ready;
+  }
+
+  setBusy(true);
+  double rate = active->downlink ? (double)active->downlink / busyLinks : 0;
+  if (active->perConnection && (rate == 0 || rate > active->perConnection)) rate = active->perConnection;
+  uint64_t from = std::max(_clock, resumeAt);
+  _credit += rate ? (now - from) * rate / 1000000.0 : (double)(queued - _ready);
+  _clock = now;
+
+  size_t n = std::min<double>(queued - _ready, _credit);
+  if (active->stallEvery) n = std::min<uint64_t>(n, active->stallEvery - downlinkTotal % active->stallEvery);
+  if (active->dropEvery) n = std::min<uint64_t>(n, active->dropEvery - downlinkTotal % active->dropEvery);
+  if (n == 0) return _ready;
+
+  _ready += n;
+  _credit = queued > _ready ? _credit - n : 0;
+  downlinkTotal += n;
+  totals.delivered += n;
+
+  if (active->stallEvery && downlinkTotal % active->stallEvery == 0) {
+    stallUntil = now + active->stallTime * 1000ULL;
+    _credit    = 0;
+    totals.stalls++;
+  }
+  if (active->dropEvery && downlinkTotal % active->dropEvery == 0) {
+    // The bytes up to the cut still make it, everything after is gone
+    totals.drops++;
+    _dropped = true;
+  }
+  return _ready;
+}
+
+void LinkSimulator::consumed(size_t length) { _ready -= std::min(length, _ready); }
+
+void LinkSimulator::close() {
+  setBusy(false);
+  _ready   = 0;
+  _dropped = false;
+}
@@ -0,0 +1,66 @@
+/*
+   Cellular link simulator
+   Purpose: Shapes what the mocked modem sockets deliver to match a scripted link: bandwidth caps both ways,
+            round trip time with jitter, connection setup cost, periodic stalls and mid-stream drop-outs.
+            Time is simulated (see HostClock.h), so a 20 minute NB-IoT download runs in seconds and
+            every run of a profile is identical
+*/
+
+#ifndef LinkSimulator_h
+#define LinkSimulator_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct LinkProfile {
+  const char* name;
+  uint32_t downlink;       // Bytes/s towards the device, shared by all connections, 0 = unlimited
+  uint32_t uplink;         // Bytes/s from the device, 0 = unlimited
+  uint32_t rtt;            // Round trip time in ms
+  uint32_t jitter;         // Up to this many ms added to every round trip
+  uint8_t connectRtts;     // Round trips before a new connection is usable (TCP, plus TLS if modelled)
+  uint32_t stallEvery;     // Downlink bytes between stalls, 0 = never
+  uint32_t stallTime;      // Length of a stall in ms
+  uint32_t dropEvery;      // Downlink bytes after which the connection carrying them is cut, 0 = never
+  uint32_t seed;           // Jitter sequence
+  uint32_t perConnection;  // Bytes/s one connection gets at most (the cell's scheduler, not the link), 0 = no limit
+};
+
+struct LinkStats {
+  uint64_t delivered;  // Bytes that made it over the downlink
+  uint32_t stalls;
+  uint32_t drops;
+};
+
+// State of one socket's downlink. Stall and drop positions count the bytes of all connections together,
+// so a download that reconnects after a drop keeps moving towards the next one. A stall holds up all
+// connections, a drop cuts the one that carried the byte. Connections receiving at the same time split
+// the downlink evenly.
+class LinkSimulator {
+ public:
+  // NULL (the default) is an ideal link on the wall clock, anything else switches to simulated time
+  static void use(const LinkProfile* profile);
+  static const LinkProfile* profile();
+  static LinkStats stats();
+  static void resetStats();
+
+  void connect();                     // Takes the connection setup time
+  void request(size_t length);        // A request of length bytes went out, the answer starts a round trip later
+  size_t ready(size_t queued);        // How many of the queued response bytes have arrived by now
+  void consumed(size_t length);       // The device read length of the ready bytes
+  void close();
+  bool dropped() const { return _dropped; }
+  ~LinkSimulator() { setBusy(false); }
+
+ private:
+  uint64_t _clock    = 0;  // Delivery accounted up to here (us)
+  uint64_t _resumeAt = 0;  // Nothing arrives before this (us): first byte of a response
+  double _credit     = 0;  // Bytes the bandwidth allowed but the server hadn't queued yet
+  size_t _ready      = 0;
+  bool _dropped      = false;
+  bool _busy         = false;  // Counted among the connections sharing the downlink
+  uint64_t roundTrip();
+  void setBusy(bool busy);
+};
+
+#endif
@@ -0,0 +1,100 @@
+/*
+   Host stand-in for Preferences
+   Purpose: NVS as a process-wide in-memory map, so state survives between Preferences instances (and
+            simulated reboots) the way it does on the device
+*/
+
+#include "Preferences.h"
+
+#include <map>
+
+#include "HostHeap.h"
+
+// NVS caps keys at 15 characters; the library has to live with that on the device, so does the host
+#define NVS_KEY_NAME_MAX_SIZE 16
+
+typedef std::map<std::string, std::string> Namespace;
+
+static std::map<std::string, Namespace>& nvs() {
+  static std::map<std::string, Namespace> storage;
+  return storage;
+}
+
+void host_nvs_erase() {
+  HostHeapUncounted uncounted;
+  nvs().clear();
+}
+
+bool Preferences::begin(const char* name, bool readOnly, const char* partition_label) {
+  if (_started || !name || strlen(name) >= NVS_KEY_NAME_MAX_SIZE) return false;
+  HostHeapUncounted uncounted;
+  _namespace = name;
+  _readOnly  = readOnly;
+  _started   = true;
+  return true;
+}
+
+void Preferences::end() { _started = false; }
+
+bool Preferences::clear() {
+  if (!_started || _readOnly) return false;
+  HostHeapUncounted uncounted;
+  nvs().erase(_namespace);
+  return true;
+}
+
+bool Preferences::remove(const char* key) {
+  if (!_started || _readOnly || !key) return false;
+  HostHeapUncounted uncounted;
+  auto ns = nvs().find(_namespace);
+  return ns != nvs().end() && ns->second.erase(key) > 0;
+}
+
+bool Preferences::isKey(const char* key) { return find(key) != NULL; }
+
+size_t Preferences::put(const char* key, const void* value, size_t len) {
+  if (!_started || _readOnly || !key || strlen(key) >= NVS_KEY_NAME_MAX_SIZE) return 0;
+  HostHeapUncounted uncounted;
+  nvs()[_namespace][key] = std::string((const char*)value, len);
+  return len;
+}
+
+const std::string* Preferences::find(const char* key) {
+  if (!_started || !key) return NULL;
+  HostHeapUncounted uncounted;
+  auto ns = nvs().find(_namespace);
+  if (ns == nvs().end()) return NULL;
+  auto it = ns->second.find(key);
+  return it == ns->second.end() ? NULL : &it->second;
+}
+
+// Strings are stored with their terminator, like nvs_set_str()
+size_t Preferences::putString(const char* key, const char* value) {
+  if (!value) return 0;
+  return put(key, value, strlen(value) + 1) ? strlen(value) : 0;
+}
+
+size_t Preferences::getString(const char* key, char* value, size_t maxLen) {
+  const std::string* blob = find(key);
+  if (!blob || !value || blob->size() > maxLen) return 0;
+  memcpy(value, blob->data(), blob->size());
+  return blob->size();
+}
+
+String Preferences::getString(const char* key, String defaultValue) {
+  const std::string* blob = find(key);
+  if (!blob || blob->empty()) return defaultValue;
+  return String(blob->c_str());
+}
+
+size_t Preferences::getBytesLength(const char* key) {
+  const std::string* blob = find(key);
+  return blob ? blob->size() : 0;
+}
+
+size_t Preferences::getBytes(const char* key, void* buf, size_t maxLen) {
+  const std::string* blob = find(key);
+  if (!blob || !buf || blob->size() > maxLen) return 0;
+  memcpy(buf, blob->data(), blob->size());
+  return blob->size();
+}
@@ -0,0 +1,12 @@
+/*
+   Host stand-in for SPIFFS.h
+*/
+
+#ifndef HOST_SPIFFS_H
+#define HOST_SPIFFS_H
+
+#include "FS.h"
+
+extern fs::FS SPIFFS;
+
+#endif
@@ -0,0 +1,114 @@
+/*
+   Host stand-in for Stream.cpp and Print.cpp
+   Purpose: The non-inline half of the host Print/Stream
+*/
+
+#include "Stream.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "Arduino.h"
+
+size_t Print::write(const uint8_t* buffer, size_t size) {
+  size_t n = 0;
+  while (size--) {
+    if (!write(*buffer++)) break;
+    n++;
+  }
+  return n;
+}
+
+size_t Print::printf(const char* format, ...) {
+  char small[128];
+  va_list arg;
+  va_start(arg, format);
+  int len = vsnprintf(small, sizeof(small), format, arg);
+  va_end(arg);
+  if (len < 0) return 0;
+  if ((size_t)len < sizeof(small)) return write((const uint8_t*)small, len);
+
+  char* big = (char*)malloc(len + 1);
+  if (!big) return 0;
+  va_start(arg, format);
+  vsnprintf(big, len + 1, format, arg);
+  va_end(arg);
+  size_t n = write((const uint8_t*)big, len);
+  free(big);
+  return n;
+}
+
+int Stream::timedRead() {
+  unsigned long start = millis();
+  do {
+    int c = read();
+    if (c >= 0) return c;
+    yield();
+  } while (millis() - start < _timeout);
+  return -1;
+}
+
+int Stream::timedPeek() {
+  unsigned long start = millis();
+  do {
+    int c = peek();
+    if (c >= 0) return c;
+    yield();
+  } while (millis() - start < _timeout);
+  return -1;
+}
+
+// Same single-target matcher as the core: partial matches restart from the current character
+bool Stream::findUntil(const char* target, const char* terminator) {
+  size_t targetLen = strlen(target);
+  size_t termLen   = terminator ? strlen(terminator) : 0;
+  size_t index = 0, termIndex = 0;
+  if (targetLen == 0) return true;
+
+  int c;
+  while ((c = timedRead()) >= 0) {
+    if (c != target[index]) index = 0;
+    if (c == target[index] && ++index >= targetLen) return true;
+    if (termLen) {
+      if (c != terminator[termIndex]) termIndex = 0;
+      if (c == terminator[termIndex] && ++termIndex >= termLen) return false;
+    }
+  }
+  return false;
+}
+
+size_t Stream::readBytes(char* buffer, size_t length) {
+  size_t count = 0;
+  while (count < length) {
+    int c = timedRead();
+    if (c < 0) break;
+    *buffer++ = (char)c;
+    count++;
+  }
+  return count;
+}
+
+size_t Stream::readBytesUntil(char terminator, char* buffer, size_t length) {
+  size_t index = 0;
+  while (index < length) {
+    int c = timedRead();
+    if (c < 0 || c == terminator) break;
+    *buffer++ = (char)c;
+    index++;
+  }
+  return index;
+}
+
+String Stream::readString() {
+  String ret;
+  int c;
+  while ((c = timedRead()) >= 0) ret += (char)c;
+  return ret;
+}
+
+String Stream::readStringUntil(char terminator) {
+  String ret;
+  int c;
+  while ((c = timedRead()) >= 0 && c != terminator) ret += (char)c;
+  return ret;
+}
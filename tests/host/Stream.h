@@ -0,0 +1,39 @@
+/*
+   Host stand-in for Stream.h
+   Purpose: Arduino Stream with the same timed read/find semantics as the core
+*/
+
+#ifndef HOST_STREAM_H
+#define HOST_STREAM_H
+
+#include "Print.h"
+
+class Stream : public Print {
+ public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+
+  void setTimeout(unsigned long timeout) { _timeout = timeout; }
+  unsigned long getTimeout() const { return _timeout; }
+
+  bool find(const char* target) { return findUntil(target, NULL); }
+  bool find(char target) {
+    char t[2] = {target, 0};
+    return find(t);
+  }
+  bool findUntil(const char* target, const char* terminator);
+
+  virtual size_t readBytes(char* buffer, size_t length);
+  virtual size_t readBytes(uint8_t* buffer, size_t length) { return readBytes((char*)buffer, length); }
+  size_t readBytesUntil(char terminator, char* buffer, size_t length);
+  String readString();
+  String readStringUntil(char terminator);
+
+ protected:
+  unsigned long _timeout = 1000;
+  int timedRead();
+  int timedPeek();
+};
+
+#endif
@@ -0,0 +1,401 @@
+/*
+   Host stand-in for TinyGSM
+   Purpose: A SIM7000 that registers after a scripted time and stays attached; its sockets connect to the
+            in-process servers registered with host_net_listen() instead of going over AT commands, through
+            the link profile selected with LinkSimulator::use(), and through TLS if the endpoint has it.
+            Its HTTP(S) service is an AT command emulator (AT+SH*, with AT+CFSWFILE and AT+CSSLCFG for the root
+            certificate) that fetches over a socket of its own with mbedtls standing in for the modem's TLS.
+*/
+
+#include "TinyGsmClient.h"
+
+#include <stdlib.h>
+
+#include <algorithm>
+
+#include "HostClock.h"
+#include "HostHeap.h"
+#include "http/HttpBodyStream.h"
+#include "tls/TlsClient.h"
+
+#define HTTP_SERVICE_MUX 7  // Socket of the HTTP(S) service, clear of the ones the library opens
+
+struct TinyGsmSim7000::HttpService {
+  explicit HttpService(TinyGsmSim7000& modem) : socket(modem, HTTP_SERVICE_MUX), tls(&socket) {}
+  GsmClientSim7000 socket;
+  TlsClient tls;
+  TlsTrust trust;  // Parsed from the file of AT+SHSSL on AT+SHCONN
+  HttpBodyStream response;
+  std::string host;
+  uint16_t port = 0;
+  std::string ca;  // File of AT+SHSSL, empty checks nothing
+  std::vector<std::pair<std::string, std::string>> headers;
+  bool connecting = false;  // AT+SHCONN is answered once the handshake is done
+  bool connected  = false;
+  bool fetching   = false;
+  std::string body;
+};
+
+TinyGsmSim7000::~TinyGsmSim7000() {
+  HostHeapUncounted uncounted;
+  delete _http;
+}
+
+// The modem keeps connecting and fetching while the library polls the UART. Paced bytes come in at uartRate.
+int TinyGsmSim7000::AtStream::available() {
+  _modem.pump();
+  size_t ready = _rx.size();
+  if (_modem.uartRate && _pacedFrom < ready) {
+    ready = std::min<uint64_t>(ready, _pacedFrom + (host_clock_micros() - _pacedAt) * _modem.uartRate / 1000000);
+  }
+  return ready > _pos ? ready - _pos : 0;
+}
+
+size_t TinyGsmSim7000::AtStream::write(uint8_t c) {
+  _modem.upload(c);
+  return 1;
+}
+
+void TinyGsmSim7000::AtStream::respond(const std::string& text, size_t paced) {
+  HostHeapUncounted uncounted;
+  _rx.erase(0, _pos);
+  _pacedFrom = _pacedFrom > _pos ? _pacedFrom - _pos : 0;
+  _pos       = 0;
+  if (paced > 0) {
+    _pacedFrom = _rx.size() + text.size() - paced;
+    _pacedAt   = host_clock_micros();
+  }
+  _rx += text;
+}
+
+// Arguments of an AT command after the '=', quotes removed
+static std::vector<std::string> at_arguments(const std::string& line) {
+  std::vector<std::string> arguments(1);
+  bool quoted = false;
+  for (size_t i = line.find('=') + 1; i > 0 && i < line.size(); i++) {
+    if (line[i] == '"') {
+      quoted = !quoted;
+    } else if (line[i] == ',' && !quoted) {
+      arguments.emplace_back();
+    } else {
+      arguments.back() += line[i];
+    }
+  }
+  return arguments;
+}
+
+bool TinyGsmSim7000::init(const char* pin) {
+  atCommands    = 0;
+  modeChanges   = 0;
+  _selection    = 0;
+  _registeredAt = millis() + searchTime;
+  return true;
+}
+
+bool TinyGsmSim7000::setNetworkMode(uint8_t mode) {
+  atCommands++;
+  if (mode != _networkMode) {
+    // A new mode starts the registration over
+    modeChanges++;
+    _networkMode  = mode;
+    _registeredAt = millis() + searchTime;
+  }
+  return true;
+}
+
+// Polls the registration like TinyGSM does
+bool TinyGsmSim7000::waitForNetwork(uint32_t timeout_ms, bool check_signal) {
+  for (unsigned long start = millis(); millis() - start < timeout_ms;) {
+    atCommands++;
+    if (isNetworkConnected()) return true;
+    delay(250);
+  }
+  return false;
+}
+
+void TinyGsmSim7000::command(const std::string& line) {
+  HostHeapUncounted uncounted;
+  atCommands++;
+  if (line == "AT+COPS?") {
+    std::string status = "+COPS: " + std::to_string(_selection);
+    if (isNetworkConnected()) status += ",2,\"" + std::string(OPERATOR_NUMERIC) + "\"," + std::to_string(OPERATOR_ACT);
+    _at.respond("\r\n" + status + "\r\n\r\nOK\r\n");
+  } else if (line.compare(0, 5, "AT+SH") == 0 || line.compare(0, 6, "AT+CFS") == 0 || line.compare(0, 10, "AT+CSSLCFG") == 0) {
+    httpCommand(line);
+  } else if (line.compare(0, 8, "AT+COPS=") == 0) {
+    _selection       = atoi(line.c_str() + 8);
+    size_t quote     = line.find('"');
+    size_t end       = quote == std::string::npos ? quote : line.find('"', quote + 1);
+    std::string oper = end == std::string::npos ? "" : line.substr(quote + 1, end - quote - 1);
+    int act          = end != std::string::npos && line[end + 1] == ',' ? atoi(line.c_str() + end + 2) : OPERATOR_ACT;
+    bool known       = (oper == OPERATOR_NUMERIC || oper == OPERATOR_NAME) && act == OPERATOR_ACT;
+    if (_selection == 1 && !known) {
+      _at.respond("\r\n+CME ERROR: 30\r\n");  // No network service
+      return;
+    }
+    _registeredAt = millis() + (_selection != 0 && known ? attachTime : searchTime);
+    _at.respond("\r\nOK\r\n");
+  } else {
+    _at.respond("\r\nERROR\r\n");
+  }
+}
+
+// Runs under the caller's HostHeapUncounted, what the modem allocates isn't on the ESP32's heap
+void TinyGsmSim7000::httpCommand(const std::string& line) {
+  std::vector<std::string> arguments = at_arguments(line);
+  if (line == "AT+CFSINIT" || line == "AT+CFSTERM") {
+    _at.respond("\r\nOK\r\n");
+  } else if (line.compare(0, 11, "AT+CFSWFILE") == 0 && arguments.size() >= 4) {
+    // The file content follows the DOWNLOAD prompt, OK comes after its last byte
+    _uploading         = arguments[1];
+    _uploadLeft        = atoi(arguments[3].c_str());
+    _files[_uploading] = "";
+    _at.respond(_uploadLeft > 0 ? "\r\nDOWNLOAD\r\n" : "\r\nERROR\r\n");
+  } else if (line.compare(0, 10, "AT+CSSLCFG") == 0) {
+    bool known = arguments[0] != "convert" || (arguments.size() >= 3 && _files.count(arguments[2]));
+    _at.respond(known ? "\r\nOK\r\n" : "\r\nERROR\r\n");
+  } else if (!httpService) {
+    _at.respond("\r\nERROR\r\n");
+  } else {
+    if (!_http) _http = new HttpService(*this);
+    HttpService& http = *_http;
+    bool ok           = true;
+    if (line.compare(0, 9, "AT+SHSSL=") == 0) {
+      http.ca = arguments.size() >= 2 ? arguments[1] : "";
+      ok      = http.ca.empty() || _files.count(http.ca);
+    } else if (line.compare(0, 9, "AT+SHCONF") == 0 && arguments[0] == "URL" && arguments.size() >= 2) {
+      // https://<host>:<port>
+      std::string url = arguments[1];
+      size_t at       = url.find("://");
+      size_t colon    = url.rfind(':');
+      ok              = at != std::string::npos && colon > at;
+      if (ok) {
+        http.host = url.substr(at + 3, colon - at - 3);
+        http.port = atoi(url.c_str() + colon + 1);
+      }
+    } else if (line == "AT+SHCONN") {
+      http.trust.clear();
+      if (!http.ca.empty()) http.trust.addAnchor(_files[http.ca].c_str());
+      http.tls.setTrust(http.ca.empty() ? NULL : &http.trust);
+      http.connected  = false;
+      http.connecting = http.tls.startConnect(http.host.c_str(), http.port);
+      if (http.connecting) return;  // pump() answers
+      ok = false;
+    } else if (line == "AT+SHSTATE?") {
+      _at.respond(std::string("\r\n+SHSTATE: ") + (http.connected && http.tls.connected() ? "1" : "0") + "\r\n\r\nOK\r\n");
+      return;
+    } else if (line == "AT+SHCHEAD") {
+      http.headers.clear();
+    } else if (line.compare(0, 10, "AT+SHAHEAD") == 0 && arguments.size() >= 2) {
+      http.headers.emplace_back(arguments[0], arguments[1]);
+    } else if (line.compare(0, 8, "AT+SHREQ") == 0 && arguments.size() >= 2) {
+      ok = http.connected && !http.fetching && arguments[1] == "1";
+      if (ok) {
+        std::string request = "GET " + arguments[0] + " HTTP/1.1\r\nHost: " + http.host + "\r\n";
+        for (auto& header : http.headers) request += header.first + ": " + header.second + "\r\n";
+        request += "Connection: keep-alive\r\n\r\n";
+        http.body.clear();
+        http.fetching = true;
+        if (http.tls.connected()) {
+          http.tls.write((const uint8_t*)request.data(), request.size());
+          http.response.begin(http.tls);
+        }
+      }
+    } else if (line.compare(0, 9, "AT+SHREAD") == 0 && arguments.size() >= 2) {
+      size_t from   = atoi(arguments[0].c_str());
+      size_t length = atoi(arguments[1].c_str());
+      if (http.fetching || length == 0 || from + length > http.body.size()) {
+        _at.respond("\r\nERROR\r\n");
+        return;
+      }
+      // The data crosses the UART at uartRate
+      _at.respond("\r\nOK\r\n\r\n+SHREAD: " + std::to_string(length) + "\r\n" + http.body.substr(from, length) + "\r\n", length + 2);
+      return;
+    } else if (line == "AT+SHDISC") {
+      http.tls.stop();
+      http.connecting = false;
+      http.connected  = false;
+      http.fetching   = false;
+    }
+    _at.respond(ok ? "\r\nOK\r\n" : "\r\nERROR\r\n");
+  }
+}
+
+// Bytes written to the UART are the content of the file AT+CFSWFILE is taking
+void TinyGsmSim7000::upload(uint8_t c) {
+  if (_uploadLeft == 0) return;
+  HostHeapUncounted uncounted;
+  _files[_uploading] += (char)c;
+  if (--_uploadLeft == 0) _at.respond("\r\nOK\r\n");
+}
+
+// Reads the response of AT+SHREQ in the background and reports +SHREQ: "GET",<status>,<length> once the
+// body is complete, 601 (network error) if the connection broke
+void TinyGsmSim7000::pump() {
+  if (!_http || !(_http->fetching || _http->connecting)) return;
+  HostHeapUncounted uncounted;
+  HttpService& http = *_http;
+  if (http.connecting) {
+    int ret = http.tls.pollConnect();
+    if (ret == 0) return;
+    http.connecting = false;
+    http.connected  = ret > 0;
+    _at.respond(http.connected ? "\r\nOK\r\n" : "\r\nERROR\r\n");
+    return;
+  }
+  int status        = http.tls.connected() || http.tls.available() ? http.response.pollHeaders() : -1;
+  if (status == 0) return;
+  if (status > 0) {
+    uint8_t buf[1460];
+    int n;
+    while ((n = http.response.readBody(buf, sizeof(buf))) > 0) http.body.append((const char*)buf, n);
+    if (n == 0) return;
+    if (!http.response.response().bodyComplete()) status = -1;
+  }
+  http.fetching = false;
+  if (status < 0) {
+    http.body.clear();
+    http.tls.stop();
+    http.connected = false;
+  }
+  _at.respond("\r\n+SHREQ: \"GET\"," + std::to_string(status < 0 ? 601 : status) + "," + std::to_string(http.body.size()) + "\r\n");
+}
+
+int8_t TinyGsmSim7000::waitResponse(uint32_t timeout_ms, const char* r1, const char* r2) {
+  // Commands are answered right away and the HTTP(S) service reports on a later poll of the stream, so
+  // whatever isn't there now isn't waited for
+  std::string seen;
+  for (int c; (c = _at.read()) >= 0;) {
+    seen += (char)c;
+    if (r1 && seen.size() >= strlen(r1) && seen.compare(seen.size() - strlen(r1), std::string::npos, r1) == 0) return 1;
+    if (r2 && seen.size() >= strlen(r2) && seen.compare(seen.size() - strlen(r2), std::string::npos, r2) == 0) return 2;
+  }
+  return 0;
+}
+
+bool TinyGsmSim7000::GsmClientSim7000::init(TinyGsmSim7000* modem, uint8_t mux) {
+  _modem = modem;
+  return true;
+}
+
+int TinyGsmSim7000::GsmClientSim7000::connect(const char* host, uint16_t port, int timeout_s) {
+  stop();
+  _server = host_net_find(host, port);
+  if (!_server) return 0;
+  _open    = true;
+  _closing = false;
+  if (HostTlsEndpoint* tls = host_net_tls(host, port)) {
+    HostHeapUncounted uncounted;
+    _tls = new HostTlsConnection(*tls);
+  }
+  _link.connect();
+  host_net_stats().connections++;
+  return 1;
+}
+
+size_t TinyGsmSim7000::GsmClientSim7000::write(const uint8_t* buf, size_t size) {
+  if (!_open || _closing || _link.dropped()) return 0;
+  HostHeapUncounted uncounted;
+  host_net_stats().bytesSent += size;
+  if (_tls) {
+    // A handshake flight the server answers arrives a round trip later, like a response
+    std::string flight;
+    if (!_tls->receive(buf, size, flight, _request)) _closing = true;
+    if (!flight.empty()) {
+      _link.request(size);
+      queue(HostSegment{flight, NULL, 0}, false);
+    }
+  } else {
+    _request.append((const char*)buf, size);
+  }
+
+  // Hand every complete request head to the server, pipelined requests included
+  size_t end;
+  while (!_closing && (end = _request.find("\r\n\r\n")) != std::string::npos) {
+    HostResponse response;
+    bool keep = _server->handle(_request.substr(0, end + 4), response);
+    _link.request(end + 4);
+    _request.erase(0, end + 4);
+    host_net_stats().requests++;
+    for (HostSegment& segment : response.segments) queue(segment);
+    if (!keep) {
+      if (_tls) {
+        std::string alert;
+        _tls->close(alert);
+        queue(HostSegment{alert, NULL, 0}, false);
+      }
+      _closing = true;
+    }
+  }
+  return size;
+}
+
+// Bytes towards the device; response data goes out as records if the connection is encrypted
+void TinyGsmSim7000::GsmClientSim7000::queue(HostSegment segment, bool encrypt) {
+  if (_tls && encrypt) {
+    std::string records;
+    _tls->send(segment.data ? segment.data : (const uint8_t*)segment.text.data(), segment.data ? segment.length : segment.text.size(), records);
+    segment = HostSegment{records, NULL, 0};
+  }
+  _rxQueued += segment.data ? segment.length : segment.text.size();
+  _rx.push_back(segment);
+}
+
+// The SIM7000 hands out at most 1460 bytes per CARECV, the library never sees more than that either
+int TinyGsmSim7000::GsmClientSim7000::available() { return std::min<size_t>(_link.ready(_rxQueued), 1460); }
+
+int TinyGsmSim7000::GsmClientSim7000::read(uint8_t* buf, size_t size) {
+  size_t total = 0;
+  size         = std::min(size, _link.ready(_rxQueued));
+  while (total < size && !_rx.empty()) {
+    HostSegment& segment = _rx.front();
+    const uint8_t* data  = segment.data ? segment.data : (const uint8_t*)segment.text.data();
+    size_t length        = segment.data ? segment.length : segment.text.size();
+    size_t n             = std::min(size - total, length - _rxOffset);
+    memcpy(buf + total, data + _rxOffset, n);
+    total += n;
+    _rxOffset += n;
+    if (_rxOffset == length) {
+      HostHeapUncounted uncounted;
+      _rx.pop_front();
+      _rxOffset = 0;
+    }
+  }
+  _rxQueued -= total;
+  _link.consumed(total);
+  host_net_stats().bytesReceived += total;
+  return total;
+}
+
+int TinyGsmSim7000::GsmClientSim7000::read() {
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+int TinyGsmSim7000::GsmClientSim7000::peek() {
+  if (_rx.empty() || _link.ready(_rxQueued) == 0) return -1;
+  const HostSegment& segment = _rx.front();
+  return segment.data ? segment.data[_rxOffset] : (uint8_t)segment.text[_rxOffset];
+}
+
+void TinyGsmSim7000::GsmClientSim7000::stop() {
+  HostHeapUncounted uncounted;
+  _open    = false;
+  _closing = false;
+  _server  = NULL;
+  _request.clear();
+  _rx.clear();
+  _rxOffset = 0;
+  _rxQueued = 0;
+  delete _tls;
+  _tls = NULL;
+  _link.close();
+}
+
+// A dropped connection still hands out what arrived before the cut
+uint8_t TinyGsmSim7000::GsmClientSim7000::connected() {
+  if (!_open) return false;
+  size_t ready = _link.ready(_rxQueued);
+  if (_link.dropped()) return ready > 0;
+  return !_closing || _rxQueued > 0;
+}
@@ -0,0 +1,167 @@
+/*
+   Host stand-in for TinyGSM
+   Purpose: A SIM7000 that registers after a scripted time and stays attached; its sockets connect to the
+            in-process servers registered with host_net_listen() instead of going over AT commands, through
+            the link profile selected with LinkSimulator::use(), and through TLS if the endpoint has it.
+            Its HTTP(S) service is an AT command emulator (AT+SH*, with AT+CFSWFILE and AT+CSSLCFG for the root
+            certificate) that fetches over a socket of its own with mbedtls standing in for the modem's TLS.
+*/
+
+#ifndef HOST_TINYGSMCLIENT_H
+#define HOST_TINYGSMCLIENT_H
+
+#include <Arduino.h>
+#include <Client.h>
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "HostHeap.h"
+#include "HostNet.h"
+#include "HostTls.h"
+#include "LinkSimulator.h"
+
+#define GF(x) x
+
+class TinyGsmSim7000 {
+ public:
+  class GsmClientSim7000 : public Client {
+   public:
+    GsmClientSim7000() {}
+    explicit GsmClientSim7000(TinyGsmSim7000& modem, uint8_t mux = 0) { init(&modem, mux); }
+    ~GsmClientSim7000() { stop(); }
+    bool init(TinyGsmSim7000* modem, uint8_t mux = 0);
+
+    int connect(const char* host, uint16_t port, int timeout_s);
+    int connect(const char* host, uint16_t port) { return connect(host, port, 75); }
+    int connect(IPAddress ip, uint16_t port) { return connect(ip.toString().c_str(), port); }
+    size_t write(const uint8_t* buf, size_t size);
+    size_t write(uint8_t c) { return write(&c, 1); }
+    int available();
+    int read(uint8_t* buf, size_t size);
+    int read();
+    int peek();
+    void flush() {}
+    void stop();
+    uint8_t connected();
+    operator bool() { return connected(); }
+
+    using Print::write;
+
+   private:
+    void queue(HostSegment segment, bool encrypt = true);
+    TinyGsmSim7000* _modem = NULL;
+    HostServer* _server    = NULL;
+    bool _open             = false;
+    bool _closing          = false;  // Server hangs up once the queued response is drained
+    std::string _request;
+    std::deque<HostSegment> _rx;
+    size_t _rxOffset = 0;
+    size_t _rxQueued = 0;  // Response bytes the server produced that weren't read yet
+    LinkSimulator _link;
+    HostTlsConnection* _tls = NULL;  // Set when the endpoint speaks TLS
+  };
+
+  // Responses to sendAT(), read through waitResponse() and stream like the UART of the real thing
+  class AtStream : public Stream {
+   public:
+    explicit AtStream(TinyGsmSim7000& modem) : _modem(modem) {}
+    int available();
+    int read() { return available() > 0 ? (uint8_t)_rx[_pos++] : -1; }
+    int peek() { return available() > 0 ? (uint8_t)_rx[_pos] : -1; }
+    size_t write(uint8_t c);
+    // The last paced bytes of text come in at the modem's uartRate
+    void respond(const std::string& text, size_t paced = 0);
+
+    using Print::write;
+
+   private:
+    TinyGsmSim7000& _modem;
+    std::string _rx;
+    size_t _pos       = 0;
+    size_t _pacedFrom = 0;  // Bytes of _rx from here on are paced, since _pacedAt
+    uint64_t _pacedAt = 0;
+  };
+
+  explicit TinyGsmSim7000(Stream& uart) : stream(_at) {}
+  ~TinyGsmSim7000();
+
+  bool begin(const char* pin = NULL) { return init(pin); }
+  bool init(const char* pin = NULL);
+  bool restart(const char* pin = NULL) { return init(pin); }
+  bool poweroff() { return true; }
+  bool testAT(uint32_t timeout_ms = 10000L) { return true; }
+  bool factoryDefault() { return true; }
+  String getModemName() { return "SIMCOM SIM7000G (host)"; }
+  String getModemInfo() { return "SIM7000G R1529 (host)"; }
+  bool setNetworkMode(uint8_t mode);
+  int16_t getNetworkMode() { return _networkMode; }
+  bool setPreferredMode(uint8_t mode) { return true; }
+  bool waitForNetwork(uint32_t timeout_ms = 60000L, bool check_signal = false);
+  bool isNetworkConnected() { return millis() >= _registeredAt; }
+  bool gprsConnect(const char* apn, const char* user = NULL, const char* pwd = NULL) { return isNetworkConnected(); }
+  bool gprsDisconnect() { return true; }
+  bool isGprsConnected() { return isNetworkConnected(); }
+  String getSimCCID() { return "8988228066600000000"; }
+  String getIMEI() { return "860000000000000"; }
+  String getOperator() { return OPERATOR_NAME; }
+  IPAddress localIP() { return IPAddress(10, 0, 0, 2); }
+  int16_t getSignalQuality() { return 20; }
+
+  // AT commands the host modem knows: AT+COPS? and AT+COPS=<mode>[,<format>,"<oper>"[,<AcT>]], and those of
+  // the HTTP(S) service and the file upload for its root certificate
+  template <typename... Args>
+  void sendAT(Args... cmd) {
+    HostHeapUncounted uncounted;  // The real one streams the pieces to the UART
+    std::string line = "AT";
+    append(line, cmd...);
+    command(line);
+  }
+  int8_t waitResponse(uint32_t timeout_ms = 1000L, const char* r1 = "OK", const char* r2 = "ERROR");
+  int8_t waitResponse(const char* r1) { return waitResponse(1000L, r1); }
+
+  // Registration on the simulated clock: automatic operator selection scans the bands for searchTime ms,
+  // a manual selection (AT+COPS=1 or 4) of the operator and access technology the modem ends up on only
+  // takes attachTime ms. Any other manual selection falls back to the search.
+  uint32_t searchTime = 0;
+  uint32_t attachTime = 0;
+  uint32_t atCommands = 0;    // Sent since the last init(), setNetworkMode() included
+  uint32_t modeChanges = 0;   // setNetworkMode() calls that changed the mode
+
+  bool httpService  = true;  // Has AT+SH*, false answers ERROR like firmware without the HTTP(S) service
+  uint32_t uartRate = 0;     // Bytes/s AT+SHREAD data crosses the UART at, 0 = unlimited
+
+  Stream& stream;
+
+ private:
+  static constexpr const char* OPERATOR_NAME    = "host";
+  static constexpr const char* OPERATOR_NUMERIC = "00101";
+  static constexpr int OPERATOR_ACT             = 7;  // LTE Cat-M1
+  static void append(std::string& line) {}
+  template <typename T, typename... Args>
+  static void append(std::string& line, T first, Args... rest) {
+    line += String(first).c_str();
+    append(line, rest...);
+  }
+  void command(const std::string& line);
+  // HTTP(S) service: a socket of its own with a TlsClient on it, the response is kept whole until AT+SHREAD
+  struct HttpService;
+  void httpCommand(const std::string& line);
+  void pump();
+  void upload(uint8_t c);
+  AtStream _at{*this};
+  HttpService* _http = NULL;
+  std::map<std::string, std::string> _files;  // AT+CFSWFILE
+  std::string _uploading;                     // File AT+CFSWFILE takes bytes for
+  size_t _uploadLeft = 0;
+  unsigned long _registeredAt = 0;
+  int _networkMode            = 2;
+  int _selection              = 0;  // <mode> of the last AT+COPS=
+};
+
+typedef TinyGsmSim7000 TinyGsm;
+typedef TinyGsmSim7000::GsmClientSim7000 TinyGsmClient;
+
+#endif
@@ -0,0 +1,11 @@
+/*
+   Host stand-in for Update.h
+   Purpose: Only the constants; the library writes partitions through PartitionWriter, not the Update class
+*/
+
+#ifndef HOST_UPDATE_H
+#define HOST_UPDATE_H
+
+#define ENCRYPTED_BLOCK_SIZE 16
+
+#endif
@@ -0,0 +1,95 @@
+/*
+   Host stand-in for WString.cpp
+   Purpose: The non-inline half of the host String
+*/
+
+#include "WString.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+std::string String::toBase(unsigned long long value, unsigned char base) {
+  if (base < 2 || base > 36) base = 10;
+  char buf[66];
+  char* p = buf + sizeof(buf) - 1;
+  *p      = '\0';
+  do {
+    int digit = value % base;
+    *--p      = digit < 10 ? '0' + digit : 'a' + digit - 10;
+    value /= base;
+  } while (value);
+  return p;
+}
+
+String::String(int value, unsigned char base) : String((long long)value, base) {}
+String::String(long value, unsigned char base) : String((long long)value, base) {}
+String::String(long long value, unsigned char base) {
+  _s = value < 0 ? "-" + toBase(0ULL - (unsigned long long)value, base) : toBase(value, base);
+}
+
+String::String(float value, unsigned int decimalPlaces) : String((double)value, decimalPlaces) {}
+
+String::String(double value, unsigned int decimalPlaces) {
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%.*f", (int)decimalPlaces, value);
+  _s = buf;
+}
+
+bool String::equalsIgnoreCase(const String& s) const {
+  return _s.size() == s._s.size() && strcasecmp(_s.c_str(), s._s.c_str()) == 0;
+}
+
+bool String::endsWith(const String& suffix) const {
+  return _s.size() >= suffix._s.size() && _s.compare(_s.size() - suffix._s.size(), suffix._s.size(), suffix._s) == 0;
+}
+
+void String::getBytes(unsigned char* buf, unsigned int bufsize, unsigned int index) const {
+  if (!bufsize || !buf) return;
+  if (index >= _s.size()) {
+    buf[0] = 0;
+    return;
+  }
+  unsigned int n = _s.size() - index;
+  if (n > bufsize - 1) n = bufsize - 1;
+  memcpy(buf, _s.data() + index, n);
+  buf[n] = 0;
+}
+
+String String::substring(unsigned int left, unsigned int right) const {
+  if (left > right) std::swap(left, right);
+  if (left >= _s.size()) return String();
+  if (right > _s.size()) right = _s.size();
+  return String(_s.substr(left, right - left));
+}
+
+void String::replace(const String& find, const String& replace) {
+  if (find._s.empty()) return;
+  size_t pos = 0;
+  while ((pos = _s.find(find._s, pos)) != std::string::npos) {
+    _s.replace(pos, find._s.size(), replace._s);
+    pos += replace._s.size();
+  }
+}
+
+void String::remove(unsigned int index, unsigned int count) {
+  if (index >= _s.size()) return;
+  _s.erase(index, count);
+}
+
+void String::toLowerCase() {
+  for (char& c : _s) c = tolower((unsigned char)c);
+}
+
+void String::toUpperCase() {
+  for (char& c : _s) c = toupper((unsigned char)c);
+}
+
+void String::trim() {
+  size_t first = 0, last = _s.size();
+  while (first < last && isspace((unsigned char)_s[first])) first++;
+  while (last > first && isspace((unsigned char)_s[last - 1])) last--;
+  _s = _s.substr(first, last - first);
+}
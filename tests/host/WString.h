@@ -0,0 +1,138 @@
+/*
+   Host stand-in for WString.h
+   Purpose: Arduino String on top of std::string, with the subset of the API the library and its sketches use
+*/
+
+#ifndef HOST_WSTRING_H
+#define HOST_WSTRING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+class String {
+  // Same safe-bool as the core: any constructed String tests true, even an empty one
+  typedef void (String::*StringIfHelperType)() const;
+  void StringIfHelper() const {}
+
+ public:
+  String(const char* cstr = "") : _s(cstr ? cstr : "") {}
+  String(const char* cstr, unsigned int length) : _s(cstr, length) {}
+  String(const std::string& s) : _s(s) {}
+  explicit String(char c) : _s(1, c) {}
+  explicit String(unsigned char value, unsigned char base = 10) : _s(toBase(value, base)) {}
+  explicit String(int value, unsigned char base = 10);
+  explicit String(unsigned int value, unsigned char base = 10) : _s(toBase(value, base)) {}
+  explicit String(long value, unsigned char base = 10);
+  explicit String(unsigned long value, unsigned char base = 10) : _s(toBase(value, base)) {}
+  explicit String(long long value, unsigned char base = 10);
+  explicit String(unsigned long long value, unsigned char base = 10) : _s(toBase(value, base)) {}
+  explicit String(float value, unsigned int decimalPlaces = 2);
+  explicit String(double value, unsigned int decimalPlaces = 2);
+
+  bool reserve(unsigned int size) {
+    _s.reserve(size);
+    return true;
+  }
+  unsigned int length() const { return _s.size(); }
+  bool isEmpty() const { return _s.empty(); }
+  const char* c_str() const { return _s.c_str(); }
+  char* begin() { return &_s[0]; }
+  char* end() { return &_s[0] + _s.size(); }
+
+  bool concat(const String& s) {
+    _s += s._s;
+    return true;
+  }
+  bool concat(const char* cstr) {
+    if (cstr) _s += cstr;
+    return true;
+  }
+  bool concat(const char* cstr, unsigned int length) {
+    _s.append(cstr, length);
+    return true;
+  }
+  bool concat(char c) {
+    _s += c;
+    return true;
+  }
+  template <typename T>
+  bool concat(T value) {
+    return concat(String(value));
+  }
+  template <typename T>
+  String& operator+=(const T& rhs) {
+    concat(rhs);
+    return *this;
+  }
+
+  int compareTo(const String& s) const { return _s.compare(s._s); }
+  bool equals(const String& s) const { return _s == s._s; }
+  bool equals(const char* cstr) const { return _s == (cstr ? cstr : ""); }
+  bool equalsIgnoreCase(const String& s) const;
+  bool startsWith(const String& prefix) const { return _s.compare(0, prefix._s.size(), prefix._s) == 0; }
+  bool endsWith(const String& suffix) const;
+  bool operator==(const String& rhs) const { return equals(rhs); }
+  bool operator==(const char* cstr) const { return equals(cstr); }
+  bool operator!=(const String& rhs) const { return !equals(rhs); }
+  bool operator!=(const char* cstr) const { return !equals(cstr); }
+  bool operator<(const String& rhs) const { return _s < rhs._s; }
+  operator StringIfHelperType() const { return &String::StringIfHelper; }
+
+  char charAt(unsigned int index) const { return index < _s.size() ? _s[index] : 0; }
+  void setCharAt(unsigned int index, char c) {
+    if (index < _s.size()) _s[index] = c;
+  }
+  char operator[](unsigned int index) const { return charAt(index); }
+  char& operator[](unsigned int index) { return _s[index]; }
+  void getBytes(unsigned char* buf, unsigned int bufsize, unsigned int index = 0) const;
+  void toCharArray(char* buf, unsigned int bufsize, unsigned int index = 0) const { getBytes((unsigned char*)buf, bufsize, index); }
+
+  int indexOf(char ch, unsigned int fromIndex = 0) const { return find(_s.find(ch, fromIndex)); }
+  int indexOf(const String& s, unsigned int fromIndex = 0) const { return find(_s.find(s._s, fromIndex)); }
+  int lastIndexOf(char ch) const { return find(_s.rfind(ch)); }
+  int lastIndexOf(const String& s) const { return find(_s.rfind(s._s)); }
+  String substring(unsigned int beginIndex) const { return substring(beginIndex, _s.size()); }
+  String substring(unsigned int beginIndex, unsigned int endIndex) const;
+
+  void replace(const String& find, const String& replace);
+  void remove(unsigned int index) { remove(index, (unsigned int)-1); }
+  void remove(unsigned int index, unsigned int count);
+  void toLowerCase();
+  void toUpperCase();
+  void trim();
+
+  long toInt() const { return strtol(_s.c_str(), NULL, 10); }
+  float toFloat() const { return strtof(_s.c_str(), NULL); }
+  double toDouble() const { return strtod(_s.c_str(), NULL); }
+
+ private:
+  std::string _s;
+  static int find(size_t pos) { return pos == std::string::npos ? -1 : (int)pos; }
+  static std::string toBase(unsigned long long value, unsigned char base);
+};
+
+inline String operator+(const String& lhs, const String& rhs) {
+  String s(lhs);
+  s += rhs;
+  return s;
+}
+inline String operator+(const String& lhs, const char* rhs) {
+  String s(lhs);
+  s += rhs;
+  return s;
+}
+inline String operator+(const char* lhs, const String& rhs) {
+  String s(lhs);
+  s += rhs;
+  return s;
+}
+template <typename T>
+String operator+(const String& lhs, T rhs) {
+  String s(lhs);
+  s += rhs;
+  return s;
+}
+
+#endif
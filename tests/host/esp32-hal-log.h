@@ -0,0 +1,34 @@
+/*
+   Host stand-in for esp32-hal-log.h
+   Purpose: Route log_x() to stderr, filtered by CORE_DEBUG_LEVEL like the core does
+*/
+
+#ifndef HOST_ESP32_HAL_LOG_H
+#define HOST_ESP32_HAL_LOG_H
+
+#define ARDUHAL_LOG_LEVEL_NONE (0)
+#define ARDUHAL_LOG_LEVEL_ERROR (1)
+#define ARDUHAL_LOG_LEVEL_WARN (2)
+#define ARDUHAL_LOG_LEVEL_INFO (3)
+#define ARDUHAL_LOG_LEVEL_DEBUG (4)
+#define ARDUHAL_LOG_LEVEL_VERBOSE (5)
+
+#ifndef CORE_DEBUG_LEVEL
+#define CORE_DEBUG_LEVEL ARDUHAL_LOG_LEVEL_NONE
+#endif
+
+// Not printf-checked: the library formats int64_t with %lld, which is right on the ESP32 but long on LP64 hosts
+void host_log(char level, const char* file, int line, const char* func, const char* format, ...);
+
+#define HOST_LOG(lvl, c, ...)                                           \
+  do {                                                                  \
+    if (CORE_DEBUG_LEVEL >= lvl) host_log(c, __FILE__, __LINE__, __func__, __VA_ARGS__); \
+  } while (0)
+
+#define log_e(...) HOST_LOG(ARDUHAL_LOG_LEVEL_ERROR, 'E', __VA_ARGS__)
+#define log_w(...) HOST_LOG(ARDUHAL_LOG_LEVEL_WARN, 'W', __VA_ARGS__)
+#define log_i(...) HOST_LOG(ARDUHAL_LOG_LEVEL_INFO, 'I', __VA_ARGS__)
+#define log_d(...) HOST_LOG(ARDUHAL_LOG_LEVEL_DEBUG, 'D', __VA_ARGS__)
+#define log_v(...) HOST_LOG(ARDUHAL_LOG_LEVEL_VERBOSE, 'V', __VA_ARGS__)
+
+#endif
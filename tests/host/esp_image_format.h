@@ -0,0 +1,10 @@
+/*
+   Host stand-in for esp_image_format.h
+*/
+
+#ifndef HOST_ESP_IMAGE_FORMAT_H
+#define HOST_ESP_IMAGE_FORMAT_H
+
+#define ESP_IMAGE_HEADER_MAGIC 0xE9
+
+#endif
@@ -0,0 +1,16 @@
+/*
+   Host stand-in for esp_ota_ops.h
+   Purpose: ota_0 is always the running partition, ota_1 the update target
+*/
+
+#ifndef HOST_ESP_OTA_OPS_H
+#define HOST_ESP_OTA_OPS_H
+
+#include "esp_partition.h"
+
+const esp_partition_t* esp_ota_get_running_partition(void);
+const esp_partition_t* esp_ota_get_next_update_partition(const esp_partition_t* start_from);
+const esp_partition_t* esp_ota_get_boot_partition(void);
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t* partition);
+
+#endif
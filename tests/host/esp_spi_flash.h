@@ -0,0 +1,11 @@
+/*
+   Host stand-in for esp_spi_flash.h
+*/
+
+#ifndef HOST_ESP_SPI_FLASH_H
+#define HOST_ESP_SPI_FLASH_H
+
+#define SPI_FLASH_SEC_SIZE 4096
+#define SPI_FLASH_BLOCK_SIZE 65536
+
+#endif
@@ -0,0 +1,109 @@
+/*
+   Host stand-in for FreeRTOS
+   Purpose: Tasks, queues and semaphores on std::thread for the few primitives the library uses
+*/
+
+#include "freertos/FreeRTOS.h"
+
+#include <Arduino.h>
+#include <string.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+// Ring buffer allocated up front, like the storage xQueueCreate() takes from the heap on the device
+struct HostQueue {
+  std::mutex lock;
+  std::condition_variable changed;
+  std::vector<uint8_t> storage;
+  size_t length;
+  size_t itemSize;
+  size_t head  = 0;
+  size_t count = 0;
+};
+
+static thread_local BaseType_t coreID = 1;
+
+BaseType_t xPortGetCoreID(void) { return coreID; }
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t pvTaskCode, const char* const pcName, const uint32_t usStackDepth, void* const pvParameters, UBaseType_t uxPriority, TaskHandle_t* const pvCreatedTask, const BaseType_t xCoreID) {
+  BaseType_t core = xCoreID == tskNO_AFFINITY ? 0 : xCoreID;
+  std::thread([=]() {
+    coreID = core;
+    pvTaskCode(pvParameters);
+  }).detach();
+  if (pvCreatedTask) *pvCreatedTask = NULL;
+  return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t pvTaskCode, const char* const pcName, const uint32_t usStackDepth, void* const pvParameters, UBaseType_t uxPriority, TaskHandle_t* const pvCreatedTask) {
+  return xTaskCreatePinnedToCore(pvTaskCode, pcName, usStackDepth, pvParameters, uxPriority, pvCreatedTask, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t xTaskToDelete) {}
+
+void vTaskDelay(const TickType_t xTicksToDelay) { delay(xTicksToDelay * portTICK_PERIOD_MS); }
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t xTask) { return 1; }
+
+TickType_t xTaskGetTickCount(void) { return millis() / portTICK_PERIOD_MS; }
+
+QueueHandle_t xQueueCreate(UBaseType_t uxQueueLength, UBaseType_t uxItemSize) {
+  HostQueue* queue = new HostQueue;
+  queue->length    = uxQueueLength;
+  queue->itemSize  = uxItemSize;
+  queue->storage.resize(uxQueueLength * uxItemSize);
+  return queue;
+}
+
+void vQueueDelete(QueueHandle_t xQueue) { delete xQueue; }
+
+// portMAX_DELAY waits forever, anything else is a timeout in milliseconds (1 tick = 1 ms here)
+template <typename Predicate>
+static bool wait(HostQueue* queue, std::unique_lock<std::mutex>& guard, TickType_t ticks, Predicate ready) {
+  if (ticks == portMAX_DELAY) {
+    queue->changed.wait(guard, ready);
+    return true;
+  }
+  return queue->changed.wait_for(guard, std::chrono::milliseconds(ticks), ready);
+}
+
+BaseType_t xQueueSend(QueueHandle_t xQueue, const void* pvItemToQueue, TickType_t xTicksToWait) {
+  std::unique_lock<std::mutex> guard(xQueue->lock);
+  if (!wait(xQueue, guard, xTicksToWait, [xQueue] { return xQueue->count < xQueue->length; })) return pdFALSE;
+  size_t tail = (xQueue->head + xQueue->count) % xQueue->length;
+  if (pvItemToQueue) memcpy(&xQueue->storage[tail * xQueue->itemSize], pvItemToQueue, xQueue->itemSize);
+  xQueue->count++;
+  xQueue->changed.notify_all();
+  return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t xQueue, void* pvBuffer, TickType_t xTicksToWait) {
+  std::unique_lock<std::mutex> guard(xQueue->lock);
+  if (!wait(xQueue, guard, xTicksToWait, [xQueue] { return xQueue->count > 0; })) return pdFALSE;
+  if (pvBuffer) memcpy(pvBuffer, &xQueue->storage[xQueue->head * xQueue->itemSize], xQueue->itemSize);
+  xQueue->head = (xQueue->head + 1) % xQueue->length;
+  xQueue->count--;
+  xQueue->changed.notify_all();
+  return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t xQueue) {
+  std::lock_guard<std::mutex> guard(xQueue->lock);
+  return xQueue->count;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) { return xQueueCreate(1, 0); }
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+  SemaphoreHandle_t mutex = xQueueCreate(1, 0);
+  xSemaphoreGive(mutex);
+  return mutex;
+}
@@ -0,0 +1,65 @@
+/*
+   Host stand-in for the ESP32 ROM's tinfl
+   Purpose: The tinfl_decompress() interface Inflater uses, implemented with zlib
+*/
+
+#include "rom/miniz.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "HostHeap.h"
+
+// zlib's state and window are host-only, the ROM inflater has neither
+static voidpf zalloc(voidpf opaque, uInt items, uInt size) {
+  HostHeapUncounted uncounted;
+  return calloc(items, size);
+}
+
+static void zfree(voidpf opaque, voidpf address) { free(address); }
+
+static void release(tinfl_decompressor* r) {
+  z_stream* z = (z_stream*)r->m_zstream;
+  if (!z) return;
+  inflateEnd(z);
+  free(z);
+  r->m_zstream = NULL;
+}
+
+tinfl_status tinfl_decompress(tinfl_decompressor* r, const mz_uint8* pIn_buf_next, size_t* pIn_buf_size, mz_uint8* pOut_buf_start, mz_uint8* pOut_buf_next, size_t* pOut_buf_size, const mz_uint32 decomp_flags) {
+  z_stream* z = (z_stream*)r->m_zstream;
+  if (!z) {
+    {
+      HostHeapUncounted uncounted;
+      z = (z_stream*)calloc(1, sizeof(z_stream));
+    }
+    if (!z) return TINFL_STATUS_FAILED;
+    z->zalloc = zalloc;
+    z->zfree  = zfree;
+    if (inflateInit2(z, (decomp_flags & TINFL_FLAG_PARSE_ZLIB_HEADER) ? 15 : -15) != Z_OK) {
+      free(z);
+      return TINFL_STATUS_FAILED;
+    }
+    r->m_zstream = z;
+  }
+
+  z->next_in   = (Bytef*)pIn_buf_next;
+  z->avail_in  = *pIn_buf_size;
+  z->next_out  = pOut_buf_next;
+  z->avail_out = *pOut_buf_size;
+  int rc       = inflate(z, Z_NO_FLUSH);
+  *pIn_buf_size -= z->avail_in;
+  *pOut_buf_size -= z->avail_out;
+
+  if (rc == Z_STREAM_END) {
+    release(r);
+    return TINFL_STATUS_DONE;
+  }
+  if (rc != Z_OK && rc != Z_BUF_ERROR) {
+    int status = rc == Z_DATA_ERROR && z->msg && strstr(z->msg, "check") ? TINFL_STATUS_ADLER32_MISMATCH : TINFL_STATUS_FAILED;
+    release(r);
+    return (tinfl_status)status;
+  }
+  return z->avail_out == 0 ? TINFL_STATUS_HAS_MORE_OUTPUT : TINFL_STATUS_NEEDS_MORE_INPUT;
+}
@@ -0,0 +1,47 @@
+/*
+   Host stand-in for the ESP32 ROM's tinfl
+   Purpose: The tinfl_decompress() interface Inflater uses, implemented with zlib
+*/
+
+#ifndef HOST_ROM_MINIZ_H
+#define HOST_ROM_MINIZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef unsigned char mz_uint8;
+typedef uint32_t mz_uint32;
+
+#define TINFL_LZ_DICT_SIZE 32768
+
+enum {
+  TINFL_FLAG_PARSE_ZLIB_HEADER             = 1,
+  TINFL_FLAG_HAS_MORE_INPUT                = 2,
+  TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF = 4,
+  TINFL_FLAG_COMPUTE_ADLER32               = 8
+};
+
+typedef enum {
+  TINFL_STATUS_BAD_PARAM        = -3,
+  TINFL_STATUS_ADLER32_MISMATCH = -2,
+  TINFL_STATUS_FAILED           = -1,
+  TINFL_STATUS_DONE             = 0,
+  TINFL_STATUS_NEEDS_MORE_INPUT = 1,
+  TINFL_STATUS_HAS_MORE_OUTPUT  = 2
+} tinfl_status;
+
+// Same footprint as the ROM's decompressor (three Huffman tables, about 11 KB) so heap figures line up;
+// zlib keeps its own state and window outside of it
+typedef struct {
+  void* m_zstream;
+  mz_uint8 m_padding[10992 - sizeof(void*)];
+} tinfl_decompressor;
+
+#define tinfl_init(r)        \
+  do {                       \
+    (r)->m_zstream = NULL;   \
+  } while (0)
+
+tinfl_status tinfl_decompress(tinfl_decompressor* r, const mz_uint8* pIn_buf_next, size_t* pIn_buf_size, mz_uint8* pOut_buf_start, mz_uint8* pOut_buf_next, size_t* pOut_buf_size, const mz_uint32 decomp_flags);
+
+#endif
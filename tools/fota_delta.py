@@ -0,0 +1,169 @@
+#!/usr/bin/env python3
+"""Create delta patches for esp32FotaGsmSSL.
+
+The patch rebuilds the new firmware from the firmware currently running on the device. See
+src/delta/DeltaPatcher.h for the format. If the update is signed, sign the *new* image as usual
+and put the signature in front of the patch, exactly as for a full image:
+
+    fota_delta.py diff old.bin new.bin new.patch
+    cat new.sig new.patch > new.patch.signed
+
+Every generated patch is applied again before it is written, so a patch that doesn't rebuild
+new.bin byte for byte is never produced.
+"""
+
+import argparse
+import hashlib
+import struct
+import sys
+
+MAGIC = b"FDP2"
+HEADER = 44  # MAGIC, base size, target size, SHA-256 of the base
+OP_END, OP_COPY, OP_ADD, OP_DATA = 0, 1, 2, 3
+SEED = 16  # Exact match length needed to start a COPY/ADD run
+WINDOW = 16  # An ADD run continues while at least half of the last WINDOW bytes match
+MIN_COPY = 12  # Shorter exact stretches inside an ADD run aren't worth a COPY of their own
+
+
+def build_index(base):
+    index = {}
+    for i in range(0, len(base) - SEED + 1):
+        index.setdefault(base[i:i + SEED], i)
+    return index
+
+
+def extend(base, target, src, pos):
+    """Length of the ADD run starting at base[src] / target[pos]"""
+    length, last_match, recent = 0, 0, []
+    while src + length < len(base) and pos + length < len(target):
+        match = base[src + length] == target[pos + length]
+        recent.append(match)
+        if len(recent) > WINDOW:
+            recent.pop(0)
+        if match:
+            last_match = length + 1
+        elif len(recent) == WINDOW and sum(recent) < WINDOW // 2:
+            break
+        length += 1
+    return last_match
+
+
+def split_run(src, data):
+    """Turn an ADD run into COPY for the long exact stretches and short ADDs in between"""
+    ops, start, i = [], 0, 0
+    while i < len(data):
+        if data[i]:
+            i += 1
+            continue
+        zeros = i
+        while i < len(data) and not data[i]:
+            i += 1
+        if i - zeros >= MIN_COPY or i == len(data) or zeros == 0:
+            if start < zeros:
+                ops.append((OP_ADD, src + start, data[start:zeros]))
+            ops.append((OP_COPY, src + zeros, data[zeros:i]))
+            start = i
+    if start < len(data):
+        ops.append((OP_ADD, src + start, data[start:]))
+    return ops
+
+
+def diff(base, target):
+    index = build_index(base)
+    ops = []
+    pos, literal, delta = 0, 0, None
+    while pos < len(target):
+        src = index.get(target[pos:pos + SEED])
+        length = extend(base, target, src, pos) if src is not None else 0
+        if length < SEED and delta is not None and 0 <= pos + delta < len(base):
+            # Keep following the previous alignment, code moved by a constant offset
+            length = extend(base, target, pos + delta, pos)
+            src = pos + delta if length >= SEED else None
+        if src is None or length < SEED:
+            pos += 1
+            continue
+        if literal < pos:
+            ops.append((OP_DATA, bytes(target[literal:pos])))
+        ops += split_run(src, bytes((target[pos + i] - base[src + i]) & 0xFF for i in range(length)))
+        delta = src - pos
+        pos += length
+        literal = pos
+    if literal < len(target):
+        ops.append((OP_DATA, bytes(target[literal:])))
+    return ops
+
+
+def encode(base, target, ops):
+    out = bytearray(MAGIC + struct.pack("<II", len(base), len(target)) + hashlib.sha256(base).digest())
+    for op in ops:
+        if op[0] == OP_DATA:
+            out += struct.pack("<BI", OP_DATA, len(op[1])) + op[1]
+        elif op[0] == OP_COPY:
+            out += struct.pack("<BII", OP_COPY, op[1], len(op[2]))
+        else:
+            out += struct.pack("<BII", OP_ADD, op[1], len(op[2])) + op[2]
+    out.append(OP_END)
+    return bytes(out)
+
+
+def apply(base, patch):
+    """Reference implementation of DeltaPatcher"""
+    if patch[:4] != MAGIC:
+        raise ValueError("invalid patch header")
+    base_size, target_size = struct.unpack_from("<II", patch, 4)
+    if base_size > len(base):
+        raise ValueError("base image too small")
+    if hashlib.sha256(base[:base_size]).digest() != patch[12:HEADER]:
+        raise ValueError("patch is for a different base image")
+    out, p = bytearray(), HEADER
+    while True:
+        op = patch[p]
+        p += 1
+        if op == OP_END:
+            break
+        if op == OP_DATA:
+            (length,) = struct.unpack_from("<I", patch, p)
+            out += patch[p + 4:p + 4 + length]
+            p += 4 + length
+            continue
+        src, length = struct.unpack_from("<II", patch, p)
+        p += 8
+        if op == OP_COPY:
+            out += base[src:src + length]
+        elif op == OP_ADD:
+            out += bytes((base[src + i] + patch[p + i]) & 0xFF for i in range(length))
+            p += length
+        else:
+            raise ValueError("unknown opcode %d" % op)
+    if len(out) != target_size:
+        raise ValueError("patch produced %d bytes, expected %d" % (len(out), target_size))
+    return bytes(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="command", required=True)
+    d = sub.add_parser("diff", help="create a patch from old.bin to new.bin")
+    d.add_argument("old")
+    d.add_argument("new")
+    d.add_argument("patch")
+    a = sub.add_parser("apply", help="apply a patch to old.bin")
+    a.add_argument("old")
+    a.add_argument("patch")
+    a.add_argument("new")
+    args = parser.parse_args()
+
+    if args.command == "diff":
+        base, target = open(args.old, "rb").read(), open(args.new, "rb").read()
+        patch = encode(base, target, diff(base, target))
+        if apply(base, patch) != target:
+            sys.exit("internal error: patch doesn't rebuild %s" % args.new)
+        open(args.patch, "wb").write(patch)
+        print("%s: %d bytes (%.1f%% of %d)" % (args.patch, len(patch), 100.0 * len(patch) / len(target), len(target)))
+    else:
+        base, patch = open(args.old, "rb").read(), open(args.patch, "rb").read()
+        open(args.new, "wb").write(apply(base, patch))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+"""Create indexed manifests for esp32FotaGsmSSL.
+
+An indexed manifest holds the same entries as an ordinary one (a JSON array), but grouped by type
+behind a small index at the start of the file. With indexedManifest set, the device fetches only
+the index with an HTTP Range request, then only the entries for its own type with a second one,
+instead of reading and parsing the whole manifest:
+
+    fota_index.py build manifest.json manifest.idx.json
+    fota_index.py lookup manifest.idx.json esp32-fota-http
+
+The result is still plain JSON, and the server only has to support Range requests:
+
+    {"index":{"hash":"fnv1a","count":N,"buckets":[offset0,length0,offset1,length1,...]},
+     "entries":[[entries of bucket 0],[entries of bucket 1],...]}
+
+A type belongs to bucket fnv1a32(type) % count. offset and length are the byte position of that
+bucket's array in the file, length 0 for an empty bucket. "count" has to come before "buckets",
+and the whole index has to fit in the first INDEX_SIZE bytes (FOTA_INDEX_SIZE on the device).
+Entries keep their order within a bucket, the device takes the first one that is newer for it.
+Entries may carry "ids": ["from", "to"], a range of device IDs (decimal, as getDeviceID() gives
+them) the entry is limited to; that is checked on the device, not here.
+"""
+
+import argparse
+import json
+import sys
+
+INDEX_SIZE = 2048
+MAX_BUCKETS = 256
+
+
+def fnv1a(key):
+    h = 2166136261
+    for b in key.encode("utf-8"):
+        h = ((h ^ b) * 16777619) & 0xFFFFFFFF
+    return h
+
+
+def render(buckets):
+    """The file for entries already split into buckets"""
+    parts = [json.dumps(bucket, separators=(",", ":")) for bucket in buckets]
+    positions = [0] * (2 * len(buckets))
+    while True:
+        head = '{"index":{"hash":"fnv1a","count":%d,"buckets":[%s]},"entries":[' % (
+            len(buckets), ",".join(str(p) for p in positions))
+        offset, layout = len(head.encode("utf-8")), []
+        for bucket, part in zip(buckets, parts):
+            size = len(part.encode("utf-8"))
+            layout += [offset, size] if bucket else [offset, 0]
+            offset += size + 1
+        # The offsets are in the index in front of them, so repeat until its length settles
+        if layout == positions:
+            return head + ",".join(parts) + "]}", len(head.encode("utf-8"))
+        positions = layout
+
+
+def build(entries, count=None):
+    types = []
+    for entry in entries:
+        if "type" not in entry:
+            sys.exit("manifest entry without a type: %s" % json.dumps(entry))
+        if entry["type"] not in types:
+            types.append(entry["type"])
+    # About two types per bucket, as many buckets as the index has room for
+    counts = [count] if count else [n for n in range(min(MAX_BUCKETS, max(1, len(types) // 2)), 0, -1)]
+    for n in counts:
+        buckets = [[] for _ in range(n)]
+        for entry in entries:
+            buckets[fnv1a(entry["type"]) % n].append(entry)
+        text, index_size = render(buckets)
+        if index_size <= INDEX_SIZE:
+            return text, n
+    sys.exit("the index doesn't fit in %d bytes" % INDEX_SIZE)
+
+
+def lookup(text, type_):
+    """What the device does: the bucket from the index, then its entries from the file"""
+    data = text.encode("utf-8")
+    index = json.loads(data[:data.index(b',"entries":')] + b"}")["index"]
+    bucket = fnv1a(type_) % index["count"]
+    offset, length = index["buckets"][2 * bucket], index["buckets"][2 * bucket + 1]
+    if length == 0:
+        return []
+    return [entry for entry in json.loads(data[offset:offset + length]) if entry.get("type") == type_]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="command", required=True)
+    b = sub.add_parser("build", help="create an indexed manifest from a manifest")
+    b.add_argument("manifest")
+    b.add_argument("indexed")
+    b.add_argument("--buckets", type=int, help="number of buckets, picked to fill the index by default")
+    l = sub.add_parser("lookup", help="show the entries a device of the given type gets")
+    l.add_argument("indexed")
+    l.add_argument("type")
+    args = parser.parse_args()
+
+    if args.command == "build":
+        entries = json.load(open(args.manifest))
+        if isinstance(entries, dict):
+            entries = [entries]
+        text, count = build(entries, args.buckets)
+        for type_ in set(entry["type"] for entry in entries):
+            if lookup(text, type_) != [entry for entry in entries if entry["type"] == type_]:
+                sys.exit("internal error: index doesn't lead to the entries of %s" % type_)
+        open(args.indexed, "w").write(text)
+        print("%s: %d entries in %d buckets, %d bytes" % (args.indexed, len(entries), count, len(text.encode("utf-8"))))
+    else:
+        print(json.dumps(lookup(open(args.indexed).read(), args.type), indent=4))
+
+
+if __name__ == "__main__":
+    main()
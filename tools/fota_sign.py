@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+"""Sign firmware images for esp32FotaGsmSSL.
+
+The device checks the signature in front of an image against the SHA-256 digest of the image, with
+the algorithm of the public key in /rsa_key.pub. The key decides the length of the signature:
+
+    RSA-2048     256 bytes, PKCS#1 v1.5 (openssl dgst -sha256 -sign)
+    RSA-4096     512 bytes, the same
+    ECDSA P-256  64 bytes, r and s as two 32 byte big-endian numbers instead of openssl's DER
+    Ed25519      64 bytes, over the 32 byte digest rather than the image itself
+
+This runs openssl for the signature and writes it in front of the image, or of a payload made from
+it (a compressed image, a delta patch), and prints the "signature" the manifest entry can declare:
+
+    fota_sign.py sign key.pem firmware.bin firmware.signed.bin
+    fota_sign.py sign key.pem firmware.bin firmware.patch.signed --payload firmware.patch
+    fota_sign.py pubkey key.pem rsa_key.pub
+
+Keys are made the usual way, e.g. openssl genpkey -algorithm ed25519 -out key.pem, or with
+-algorithm EC -pkeyopt ec_paramgen_curve:P-256 or -algorithm RSA -pkeyopt rsa_keygen_bits:2048.
+"""
+
+import argparse
+import hashlib
+import os
+import subprocess
+import sys
+import tempfile
+
+
+def openssl(*args, data=None):
+    result = subprocess.run(["openssl"] + list(args), input=data, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    if result.returncode != 0:
+        sys.exit("openssl %s: %s" % (args[0], result.stderr.decode().strip()))
+    return result.stdout
+
+
+def algorithm(key):
+    """The algorithm name as in the manifest, from what openssl says about the key"""
+    text = openssl("pkey", "-in", key, "-noout", "-text").decode()
+    first = text.splitlines()[0]
+    if first.startswith("ED25519"):
+        return "ed25519"
+    if "NIST CURVE: P-256" in text or "prime256v1" in text:
+        return "ecdsa-p256"
+    if "modulus" in text.lower() and "(2048 bit" in first:
+        return "rsa-2048"
+    if "modulus" in text.lower() and "(4096 bit" in first:
+        return "rsa-4096"
+    sys.exit("%s is neither RSA-2048/4096, ECDSA P-256 nor Ed25519" % key)
+
+
+def der_to_raw(der):
+    """DER SEQUENCE { INTEGER r, INTEGER s } to r||s"""
+    pos, raw = 2, b""
+    for _ in range(2):
+        length = der[pos + 1]
+        number = der[pos + 2:pos + 2 + length].lstrip(b"\0")
+        raw += number.rjust(32, b"\0")
+        pos += 2 + length
+    return raw
+
+
+def sign(key, image):
+    alg = algorithm(key)
+    digest = hashlib.sha256(image).digest()
+    with tempfile.TemporaryDirectory() as tmp:
+        path = os.path.join(tmp, "data")
+        if alg == "ed25519":
+            open(path, "wb").write(digest)
+            signature = openssl("pkeyutl", "-sign", "-inkey", key, "-rawin", "-in", path)
+        else:
+            open(path, "wb").write(image)
+            signature = openssl("dgst", "-sha256", "-sign", key, path)
+            if alg == "ecdsa-p256":
+                signature = der_to_raw(signature)
+    return alg, signature
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="command", required=True)
+    s = sub.add_parser("sign", help="write the signature of an image in front of it or of a payload")
+    s.add_argument("key", help="private key, PEM")
+    s.add_argument("image")
+    s.add_argument("signed")
+    s.add_argument("--payload", help="file to put behind the signature instead of the image")
+    p = sub.add_parser("pubkey", help="write the public key the device checks with")
+    p.add_argument("key")
+    p.add_argument("pubkey")
+    args = parser.parse_args()
+
+    if args.command == "sign":
+        image = open(args.image, "rb").read()
+        alg, signature = sign(args.key, image)
+        payload = open(args.payload, "rb").read() if args.payload else image
+        open(args.signed, "wb").write(signature + payload)
+        print("%s: %d byte %s signature, \"signature\":\"%s\"" % (args.signed, len(signature), alg, alg))
+    else:
+        algorithm(args.key)
+        open(args.pubkey, "wb").write(openssl("pkey", "-in", args.key, "-pubout"))
+
+
+if __name__ == "__main__":
+    main()